@@ -74,7 +74,7 @@ const startEmu = () => {
             a[b] = e[b];
             return a;
         }, {});
-        window.worker.postMessage({ command: 'key', data: event });
+        window.devmgr.postInput({ command: 'key', data: event });
     }
     term.addEventListener('keydown', e => {
         if (e.metaKey) return;
@@ -104,6 +104,7 @@ const startSecond = () => {
 
     const worker = new Worker('lib/worker.js');
     window.worker = worker;
+    window.vga.attachWorker(worker);
     window.vga.showProgress(0.25);
 
     worker.onmessage = message => {
@@ -119,6 +120,8 @@ const startSecond = () => {
                             gen: parseInt($('#selCpuGen').value),
                             mem: parseInt($('#selMemory').value),
                             br_mbr: $('#optionDebugMBR').checked,
+                            snapshot: window.devmgr.snapshot,
+                            checkpoints: window.devmgr.checkpoints,
                         };
                         if (window.attach) {
                             window.worker.postMessage({ command: 'attach', blob: window.attach });
@@ -162,6 +165,36 @@ class DeviceManager {
         this.onCommand('outb', data => {
             this.outb(data.port, data.data)
         });
+        this.onCommand('idle_wake', data => {
+            this.wake = data;
+        });
+        this.checkpoints = [];
+        this.onCommand('snapshot', data => {
+            this.snapshot = data;
+            this.checkpoints = [];
+        });
+        this.onCommand('checkpoint', data => {
+            this.checkpoints.push(data);
+        });
+    }
+    saveSnapshot() {
+        window.worker.postMessage({ command: 'save_snapshot' });
+    }
+    saveCheckpoint() {
+        window.worker.postMessage({ command: 'save_checkpoint' });
+    }
+    // rewind to the snapshot followed by the first count checkpoints
+    loadSnapshot(count = this.checkpoints.length) {
+        this.checkpoints.length = Math.min(count, this.checkpoints.length);
+        window.worker.postMessage({ command: 'load_snapshot', blob: this.snapshot, checkpoints: this.checkpoints });
+    }
+    postInput(message) {
+        window.worker.postMessage(message);
+        // the worker may be blocked in Atomics.wait while the guest idles
+        if (this.wake) {
+            Atomics.store(this.wake, 0, 1);
+            Atomics.notify(this.wake, 0);
+        }
     }
     on(port, callback) {
         this.ioMap[port & 0xFFFF] = callback;
@@ -420,7 +453,7 @@ class VirtualMidiDevice {
 
 // Virtual Video Device
 class VideoDevice {
-    constructor(devmgr, dom, scale) {
+    constructor(devmgr, dom, offscreenDom, scale) {
         this.BLACK = 0xFF000000;
         this.WHITE = 0xFFFFFFFF;
         this.scale = scale;
@@ -433,7 +466,11 @@ class VideoDevice {
         this.font = "15px/16px 'TerminalWebFont', 'Menlo', 'Monaco', 'Consolas', 'Courier New', 'Courier', monospace";
         this.cursor = 0xFFFF;
         this.pal = new Uint32Array(256);
+        this.vram = new Uint8Array(0);
         this.canvas = dom;
+        // graphics modes are painted by the worker on this one if it supports OffscreenCanvas
+        this.offscreenCanvas = offscreenDom;
+        this.offscreen = false;
         this.ctx = this.canvas.getContext('2d');
         this.ctx.scale(scale, scale);
         this.res = [0, 0, 0, 0];
@@ -445,27 +482,27 @@ class VideoDevice {
         }
 
         devmgr.onCommand('pal', e => {
-            this.pal[e[0]] = 0xFF000000 | e[1];
+            this.setPalette(e);
             this.setNeedsRedraw();
+            if (!this.shared && this.grapihicsMode && this.bpp == 8 && this.vram.length) {
+                this.render(this.vram);
+            }
         });
         devmgr.onCommand('vga_mode', e => {
             console.log('vga_mode', e);
             this.setMode(e);
         });
         devmgr.onCommand('vga', e => {
-            if (this.grapihicsMode) {
-                if (this.bpp == 1) {
-                    if (this.grapihicsMode == 1) {
-                        this.renderMode11(e);
-                    } else {
-                        this.renderModeCGA(e);
-                    }
-                } else {
-                    this.renderMode13(e);
-                }
-            } else {
-                this.renderMode03(e);
+            if (this.offscreen) return;
+            // only the dirty spans are sent, the rest is kept from the previous frames
+            if (this.vram.length != e.size) {
+                this.vram = new Uint8Array(e.size);
+            }
+            if (e.pal) {
+                this.setPalette(e.pal);
             }
+            e.spans.forEach(([offset, data]) => this.vram.set(data, offset));
+            this.render(this.vram);
         });
         devmgr.onCommand('vga_cursor', e => {
             this.updateCursor(e);
@@ -474,6 +511,44 @@ class VideoDevice {
         this.setMode({ dim: [640 * scale, 400 * scale], vdim: [640, 400], bpp: 8, mode: 1 });
         this.showProgress(0);
     }
+    setPalette(e) {
+        const { index, colors } = e;
+        for (let i = 0; i < colors.length; i++) {
+            this.pal[index + i] = 0xFF000000 | colors[i];
+        }
+    }
+    render(vram) {
+        if (this.grapihicsMode) {
+            if (this.bpp == 1) {
+                if (this.grapihicsMode == 1) {
+                    this.renderMode11(vram);
+                } else {
+                    this.renderModeCGA(vram);
+                }
+            } else {
+                this.renderMode13(vram);
+            }
+        } else {
+            this.renderMode03(vram);
+        }
+    }
+    renderShared(shared) {
+        if (this.shared !== shared) return;
+        const { frame } = shared;
+        const generation = Atomics.load(frame, 1);
+        if (generation !== this.generation || this.needs_redraw) {
+            // frame[0] is odd while the worker is running the CPU
+            const seq = Atomics.load(frame, 0);
+            if ((seq & 1) == 0) {
+                this.render(this.vram);
+                if (Atomics.load(frame, 0) === seq) {
+                    this.generation = generation;
+                    this.needs_redraw = 0;
+                }
+            }
+        }
+        requestAnimationFrame(() => this.renderShared(shared));
+    }
     setMode(e) {
         const { ctx, fontWidth, fontHeight, scale } = this;
         const TOOLBAR_HEIGHT = 32;
@@ -482,7 +557,13 @@ class VideoDevice {
         this.dim = { width: e.dim[0], height: e.dim[1] };
         this.vdim = { width: e.vdim[0], height: e.vdim[1] };
         const { width, height } = this.dim;
-        if (this.grapihicsMode) {
+        this.offscreen = !!e.offscreen;
+        this.canvas.classList.toggle('hidden', this.offscreen);
+        this.offscreenCanvas.classList.toggle('hidden', !this.offscreen);
+        if (this.offscreen) {
+            this.offscreenCanvas.style.width = `${this.vdim.width}px`;
+            this.offscreenCanvas.style.height = `${this.vdim.height}px`;
+        } else if (this.grapihicsMode) {
             this.gvram = ctx.createImageData(width, height);
             this.canvas.width = width;
             this.canvas.height = height;
@@ -502,6 +583,21 @@ class VideoDevice {
         if (window.innerHeight < this.vdim.height + TOOLBAR_HEIGHT) {
             window.resizeBy(0, this.vdim.height + TOOLBAR_HEIGHT - window.innerHeight);
         }
+        // with a shared memory VRAM is mapped directly and redrawn at display refresh rate
+        this.shared = e.shared;
+        if (e.shared) {
+            this.vram = new Uint8Array(e.shared.buffer, e.shared.offset, e.shared.size);
+            this.generation = -1;
+            requestAnimationFrame(() => this.renderShared(e.shared));
+        } else {
+            this.vram = new Uint8Array(0);
+        }
+    }
+    attachWorker(worker) {
+        if (this.offscreenCanvas.transferControlToOffscreen) {
+            const canvas = this.offscreenCanvas.transferControlToOffscreen();
+            worker.postMessage({ command: 'vga_canvas', canvas: canvas }, [canvas]);
+        }
     }
     showProgress(value) {
         const { ctx, scale } = this;
@@ -525,10 +621,11 @@ class VideoDevice {
         ctx.strokeRect(px, py, pw, ph);
     }
     updateCursor(newCursor) {
-        if (this.grapihicsMode == 0) {
-            this.drawText(this.cursor, 0);
+        if (this.grapihicsMode == 0 && this.cursor !== newCursor) {
+            const oldCursor = this.cursor;
             this.cursor = newCursor;
-            this.drawText(this.cursor, 1);
+            this.drawText(oldCursor);
+            this.drawText(newCursor);
         }
     }
     updateFont() {
@@ -554,6 +651,7 @@ class VideoDevice {
             0x2261, 0x00B1, 0x2265, 0x2264, 0x2320, 0x2321, 0x00F7, 0x2248, 0x00B0, 0x2219, 0x00B7, 0x221A, 0x207F, 0x00B2, 0x25A0, 0x00A0,
         ];
 
+        this.glyphAtlases = [];
         this.canvasBG = document.createElement('canvas');
         do {
             this.canvasBG.width = fontWidth * 16 * scale;
@@ -589,50 +687,48 @@ class VideoDevice {
     setNeedsRedraw() {
         this.needs_redraw = 1;
     }
-    drawText(at, cursor) {
-        const wchar = this.tvram[at];
-        const char = wchar & 0xFF;
-        const attr = wchar >> 8;
-        const { ctx, fontWidth, fontHeight, lineHeight, scale, cols, rows } = this;
-        const x = at % cols;
-        const y = (at / cols) | 0;
-        const cx = x * fontWidth;
-        const cy = y * fontHeight;
-        const bgColor = attr >> 4;
-        const fgColor = attr & 0xF;
-        if (cursor) {
-            ctx.drawImage(this.canvasBG, fgColor * fontWidth * scale, 0, fontWidth * scale, fontHeight * scale, cx * scale, cy * scale, fontWidth * scale, fontHeight * scale);
-            ctx.drawImage(this.canvasFont, char * fontWidth * scale, bgColor * lineHeight * scale, fontWidth * scale, fontHeight * scale, cx * scale, cy * scale, fontWidth * scale, fontHeight * scale);
-        } else {
-            ctx.drawImage(this.canvasBG, bgColor * fontWidth * scale, 0, fontWidth * scale, fontHeight * scale, cx * scale, cy * scale, fontWidth * scale, fontHeight * scale);
-            ctx.drawImage(this.canvasFont, char * fontWidth * scale, fgColor * lineHeight * scale, fontWidth * scale, fontHeight * scale, cx * scale, cy * scale, fontWidth * scale, fontHeight * scale);
+    glyphAtlas(attr) {
+        // one strip of 256 glyphs per attribute, built on first use
+        let atlas = this.glyphAtlases[attr];
+        if (!atlas) {
+            const { fontWidth, fontHeight, lineHeight, scale } = this;
+            const fontWS = fontWidth * scale;
+            const fontHS = fontHeight * scale;
+            atlas = document.createElement('canvas');
+            atlas.width = fontWS * 256;
+            atlas.height = fontHS;
+            const ctx = atlas.getContext('2d');
+            ctx.drawImage(this.canvasBG, (attr >> 4) * fontWS, 0, fontWS, fontHS, 0, 0, atlas.width, fontHS);
+            ctx.drawImage(this.canvasFont, 0, (attr & 0xF) * lineHeight * scale, atlas.width, fontHS, 0, 0, atlas.width, fontHS);
+            this.glyphAtlases[attr] = atlas;
         }
+        return atlas;
     }
-    renderMode03(src) {
-        const { ctx, fontWidth, fontHeight, lineHeight, scale, cols, rows } = this;
+    drawCell(at, wchar) {
+        const { ctx, fontWidth, fontHeight, scale, cols } = this;
         const fontWS = fontWidth * scale;
         const fontHS = fontHeight * scale;
-        const lineHS = lineHeight * scale;
-        let p = 0, q = 0;
-        for (let i = 0; i < rows; i++) {
-            for (let j = 0; j < cols; j++, q++, p += 2) {
-                const char = src[p];
-                const attr = src[p + 1];
-                const wchar = char | (attr << 8);
-                if (this.tvram[q] != wchar) {
-                    this.tvram[q] = wchar;
-                    const cx = j * fontWS;
-                    const cy = i * fontHS;
-                    const bgColor = attr >> 4;
-                    const fgColor = attr & 0xF;
-                    if (q === this.cursor) {
-                        ctx.drawImage(this.canvasBG, fgColor * fontWS, 0, fontWS, fontHS, cx, cy, fontWS, fontHS);
-                        ctx.drawImage(this.canvasFont, char * fontWS, bgColor * lineHS, fontWS, fontHS, cx, cy, fontWS, fontHS);
-                    } else {
-                        ctx.drawImage(this.canvasBG, bgColor * fontWS, 0, fontWS, fontHS, cx, cy, fontWS, fontHS);
-                        ctx.drawImage(this.canvasFont, char * fontWS, fgColor * lineHS, fontWS, fontHS, cx, cy, fontWS, fontHS);
-                    }
-                }
+        let attr = wchar >> 8;
+        if (at === this.cursor) {
+            attr = ((attr & 0xF) << 4) | (attr >> 4);
+        }
+        const cx = (at % cols) * fontWS;
+        const cy = ((at / cols) | 0) * fontHS;
+        ctx.drawImage(this.glyphAtlas(attr), (wchar & 0xFF) * fontWS, 0, fontWS, fontHS, cx, cy, fontWS, fontHS);
+    }
+    drawText(at) {
+        if (at < this.tvram.length) {
+            this.drawCell(at, this.tvram[at]);
+        }
+    }
+    renderMode03(src) {
+        const { tvram } = this;
+        const size = this.cols * this.rows;
+        for (let q = 0, p = 0; q < size; q++, p += 2) {
+            const wchar = src[p] | (src[p + 1] << 8);
+            if (tvram[q] != wchar) {
+                tvram[q] = wchar;
+                this.drawCell(q, wchar);
             }
         }
     }
@@ -695,7 +791,7 @@ class VideoDevice {
 window.addEventListener('DOMContentLoaded', () => {
     window.beep = new i8254Sound(window.devmgr);
     window.midi = new VirtualMidiDevice(window.devmgr, $('#cpMidi'));
-    window.vga = new VideoDevice(window.devmgr, $('#canvasVGA'), Math.ceil(window.devicePixelRatio) | 1);
+    window.vga = new VideoDevice(window.devmgr, $('#canvasVGA'), $('#canvasOffscreen'), Math.ceil(window.devicePixelRatio) | 1);
     window.vpad = new VirtualTrackPad(window.devmgr, $('#screen_container'), $('#vPadBtnL'), $('#vPadBtnR'), $('#terminal'), $('#virtualTrackpad'), $('#mouseFocusButton'));
 
     $('#click_to_start').addEventListener('click', e => {
@@ -796,8 +892,10 @@ window.addEventListener('DOMContentLoaded', () => {
     $('#optionNNI').addEventListener('change', e => {
         if (e.target.checked) {
             $('#canvasVGA').classList.add('nearest_neighbor');
+            $('#canvasOffscreen').classList.add('nearest_neighbor');
         } else {
             $('#canvasVGA').classList.remove('nearest_neighbor');
+            $('#canvasOffscreen').classList.remove('nearest_neighbor');
         }
     });
 
@@ -939,12 +1037,12 @@ class VirtualTrackPad {
     }
     sendPointerChanged(array) {
         if (window.worker && (array[0] || array[1])) {
-            worker.postMessage({ command: 'pointer', move: array });
+            window.devmgr.postInput({ command: 'pointer', move: array });
         }
     }
     sendButtonStateChanged(button, pressed) {
         if (window.worker && button) {
-            worker.postMessage({ command: 'pointer', button: button, pressed: pressed });
+            window.devmgr.postInput({ command: 'pointer', button: button, pressed: pressed });
         }
     }
     getPointerMovements(e) {
@@ -117,40 +117,6 @@ const char *reg_names_AX[] = {"AX", "CX", "DX", "BX", "SP", "BP", "SI", "DI"};
 const char *reg_names_EAX[] = {"EAX", "ECX", "EDX", "EBX", "ESP", "EBP", "ESI", "EDI"};
 const char *reg_names_sreg[] = {"ES", "CS", "SS", "DS", "FS", "GS", "???", "???"};
 
-enum
-{
-    index_AX = 0,
-    index_CX,
-    index_DX,
-    index_BX,
-    index_SP,
-    index_BP,
-    index_SI,
-    index_DI,
-    index_EAX = 0,
-    index_ECX,
-    index_EDX,
-    index_EBX,
-    index_ESP,
-    index_EBP,
-    index_ESI,
-    index_EDI,
-    index_AL = 0,
-    index_CL,
-    index_DL,
-    index_BL,
-    index_AH,
-    index_CH,
-    index_DH,
-    index_BH,
-    index_ES = 0,
-    index_CS,
-    index_SS,
-    index_DS,
-    index_FS,
-    index_GS,
-};
-
 typedef struct opmap_t
 {
     const char *name;
@@ -160,8 +126,14 @@ typedef struct opmap_t
     int n_operands;
     const char *operands1;
     const char *operands2;
+    // first CPU generation and handler of the opcode, plus the 16-bit and 32-bit copies if specialized (see cpu_init_dispatch)
+    unsigned cpu_gen;
+    cpu_op_t handler, handler16, handler32;
 } opmap_t;
 
+#define OP_EXEC(gen, op) .cpu_gen = gen, .handler = op
+#define OP_EXEC_SIZED(gen, op) .cpu_gen = gen, .handler = op, .handler16 = op##_16, .handler32 = op##_32
+
 static opmap_t opcode_80[8] = {
     {"ADD", NULL, optype_EbIb},
     {"OR", NULL, optype_EbIb},
@@ -297,285 +269,287 @@ static opmap_t opcode_0FBA[8] = {
 const char *shift_names[8] = {"ROL", "ROR", "RCL", "RCR", "SHL", "SHR", NULL, "SAR"};
 
 opmap_t opcode1[256] = {
-    {"ADD", NULL, optype_EbGb},
-    {"ADD", NULL, optype_EvGv},
-    {"ADD", NULL, optype_GbEb},
-    {"ADD", NULL, optype_GvEv},
-    {"ADD", NULL, optype_ALIb},
-    {"ADD", NULL, optype_AXIz},
-    {"PUSH", NULL, optype_implied, NULL, 1, "ES"},
-    {"POP", NULL, optype_implied, NULL, 1, "ES"},
-    {"OR", NULL, optype_EbGb},
-    {"OR", NULL, optype_EvGv},
-    {"OR", NULL, optype_GbEb},
-    {"OR", NULL, optype_GvEv},
-    {"OR", NULL, optype_ALIb},
-    {"OR", NULL, optype_AXIz},
-    {"PUSH", NULL, optype_implied, NULL, 1, "CS"},
+    {"ADD", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"ADD", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"ADD", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"ADD", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"ADD", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"ADD", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_00)},
+    {"PUSH", NULL, optype_implied, NULL, 1, "ES", OP_EXEC(cpu_gen_8086, cpu_op_06)},
+    {"POP", NULL, optype_implied, NULL, 1, "ES", OP_EXEC(cpu_gen_8086, cpu_op_07)},
+    {"OR", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"OR", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"OR", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"OR", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"OR", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"OR", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_08)},
+    {"PUSH", NULL, optype_implied, NULL, 1, "CS", OP_EXEC(cpu_gen_8086, cpu_op_0E)},
     {NULL, NULL, optype_extend_0F},
-    {"ADC", NULL, optype_EbGb},
-    {"ADC", NULL, optype_EvGv},
-    {"ADC", NULL, optype_GbEb},
-    {"ADC", NULL, optype_GvEv},
-    {"ADC", NULL, optype_ALIb},
-    {"ADC", NULL, optype_AXIz},
-    {"PUSH", NULL, optype_implied, NULL, 1, "SS"},
-    {"POP", NULL, optype_implied, NULL, 1, "SS"},
-    {"SBB", NULL, optype_EbGb},
-    {"SBB", NULL, optype_EvGv},
-    {"SBB", NULL, optype_GbEb},
-    {"SBB", NULL, optype_GvEv},
-    {"SBB", NULL, optype_ALIb},
-    {"SBB", NULL, optype_AXIz},
-    {"PUSH", NULL, optype_implied, NULL, 1, "DS"},
-    {"POP", NULL, optype_implied, NULL, 1, "DS"},
-    {"AND", NULL, optype_EbGb},
-    {"AND", NULL, optype_EvGv},
-    {"AND", NULL, optype_GbEb},
-    {"AND", NULL, optype_GvEv},
-    {"AND", NULL, optype_ALIb},
-    {"AND", NULL, optype_AXIz},
+    {"ADC", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"ADC", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"ADC", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"ADC", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"ADC", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"ADC", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_10)},
+    {"PUSH", NULL, optype_implied, NULL, 1, "SS", OP_EXEC(cpu_gen_8086, cpu_op_16)},
+    {"POP", NULL, optype_implied, NULL, 1, "SS", OP_EXEC(cpu_gen_8086, cpu_op_17)},
+    {"SBB", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"SBB", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"SBB", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"SBB", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"SBB", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"SBB", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_18)},
+    {"PUSH", NULL, optype_implied, NULL, 1, "DS", OP_EXEC(cpu_gen_8086, cpu_op_1E)},
+    {"POP", NULL, optype_implied, NULL, 1, "DS", OP_EXEC(cpu_gen_8086, cpu_op_1F)},
+    {"AND", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
+    {"AND", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
+    {"AND", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
+    {"AND", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
+    {"AND", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
+    {"AND", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_20)},
     {"ES:", NULL, optype_prefix},
-    {"DAA", NULL, optype_implied},
-    {"SUB", NULL, optype_EbGb},
-    {"SUB", NULL, optype_EvGv},
-    {"SUB", NULL, optype_GbEb},
-    {"SUB", NULL, optype_GvEv},
-    {"SUB", NULL, optype_ALIb},
-    {"SUB", NULL, optype_AXIz},
+    {"DAA", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_27)},
+    {"SUB", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
+    {"SUB", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
+    {"SUB", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
+    {"SUB", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
+    {"SUB", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
+    {"SUB", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_28)},
     {"CS:", NULL, optype_prefix},
-    {"DAS", NULL, optype_implied},
-    {"XOR", NULL, optype_EbGb},
-    {"XOR", NULL, optype_EvGv},
-    {"XOR", NULL, optype_GbEb},
-    {"XOR", NULL, optype_GvEv},
-    {"XOR", NULL, optype_ALIb},
-    {"XOR", NULL, optype_AXIz},
+    {"DAS", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_2F)},
+    {"XOR", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
+    {"XOR", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
+    {"XOR", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
+    {"XOR", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
+    {"XOR", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
+    {"XOR", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_30)},
     {"SS:", NULL, optype_prefix},
-    {"AAA", NULL, optype_implied},
-    {"CMP", NULL, optype_EbGb},
-    {"CMP", NULL, optype_EvGv},
-    {"CMP", NULL, optype_GbEb},
-    {"CMP", NULL, optype_GvEv},
-    {"CMP", NULL, optype_ALIb},
-    {"CMP", NULL, optype_AXIz},
+    {"AAA", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_37)},
+    {"CMP", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
+    {"CMP", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
+    {"CMP", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
+    {"CMP", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
+    {"CMP", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
+    {"CMP", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_38)},
     {"DS:", NULL, optype_prefix},
-    {"AAS", NULL, optype_implied},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"INC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"DEC", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"PUSH", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"POP", NULL, optype_Zv},
-    {"PUSHA", "PUSHAD", optype_implied},
-    {"POPA", "POPAD", optype_implied},
+    {"AAS", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_3F)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"INC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_40)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"DEC", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_48)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_54)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"PUSH", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_50)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"POP", NULL, optype_Zv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_58)},
+    {"PUSHA", "PUSHAD", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_60)},
+    {"POPA", "POPAD", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_61)},
     {"BOUNDS", NULL, optype_GvM},
     {"ARPL", NULL, optype_EwGw},
     {"FS:", NULL, optype_prefix},
     {"GS:", NULL, optype_prefix},
     {NULL, NULL, optype_prefix66},
     {NULL, NULL, optype_prefix67},
-    {"PUSH", NULL, optype_Iz},
-    {"IMUL", NULL, optype_GvEvIz},
-    {"PUSH", NULL, optype_Ib},
-    {"IMUL", NULL, optype_GvEvIb},
-    {"INSB", NULL, optype_string},
-    {"INSW", "INSD", optype_string},
-    {"OUTSB", NULL, optype_string},
-    {"OUTSW", "OUTSD", optype_string},
-    {"JO", NULL, optype_Jb},
-    {"JNO", NULL, optype_Jb},
-    {"JB", NULL, optype_Jb},
-    {"JNB", NULL, optype_Jb},
-    {"JZ", NULL, optype_Jb},
-    {"JNZ", NULL, optype_Jb},
-    {"JNA", NULL, optype_Jb},
-    {"JA", NULL, optype_Jb},
-    {"JS", NULL, optype_Jb},
-    {"JNS", NULL, optype_Jb},
-    {"JP", NULL, optype_Jb},
-    {"JNP", NULL, optype_Jb},
-    {"JL", NULL, optype_Jb},
-    {"JNL", NULL, optype_Jb},
-    {"JNG", NULL, optype_Jb},
-    {"JG", NULL, optype_Jb},
-    {NULL, NULL, optype_group, opcode_80},
-    {NULL, NULL, optype_group, opcode_81},
-    {NULL, NULL, optype_group, opcode_80},
-    {NULL, NULL, optype_group, opcode_83},
-    {"TEST", NULL, optype_GbEb},
-    {"TEST", NULL, optype_GvEv},
-    {"XCHG", NULL, optype_GbEb},
-    {"XCHG", NULL, optype_GvEv},
-    {"MOV", NULL, optype_EbGb},
-    {"MOV", NULL, optype_EvGv},
-    {"MOV", NULL, optype_GbEb},
-    {"MOV", NULL, optype_GvEv},
-    {"MOV", NULL, optype_EwSw},
-    {"LEA", NULL, optype_GvM},
-    {"MOV", NULL, optype_SwEw},
-    {NULL, NULL, optype_group, opcode_8F},
-    {"NOP", NULL, optype_nop},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"XCHG", NULL, optype_Zv, NULL, 1, "AX"},
-    {"CBW", "CWDE", optype_implied},
-    {"CWD", "CDQ", optype_implied},
-    {"CALL", NULL, optype_Ap},
-    {"FWAIT", NULL, optype_implied},
-    {"PUSHF", "PUSHFD", optype_implied},
-    {"POPF", "POPFD", optype_implied},
-    {"SAHF", NULL, optype_implied},
-    {"LAHF", NULL, optype_implied},
-    {"MOV", NULL, optype_ALOb},
-    {"MOV", NULL, optype_AXOv},
-    {"MOV", NULL, optype_ObAL},
-    {"MOV", NULL, optype_OvAX},
-    {"MOVSB", NULL, optype_string},
-    {"MOVSW", "MOVSD", optype_string},
-    {"CMPSB", NULL, optype_string},
-    {"CMPSW", "CMPSD", optype_string},
-    {"TEST", NULL, optype_ALIb},
-    {"TEST", NULL, optype_AXIz},
-    {"STOSB", NULL, optype_string},
-    {"STOSW", "STOSD", optype_string},
-    {"LODSB", NULL, optype_string},
-    {"LODSW", "LODSD", optype_string},
-    {"SCASB", NULL, optype_string},
-    {"SCASW", "SCASD", optype_string},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZbIb},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
-    {"MOV", NULL, optype_ZvIv},
+    {"PUSH", NULL, optype_Iz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_68)},
+    {"IMUL", NULL, optype_GvEvIz, OP_EXEC(cpu_gen_8086, cpu_op_69)},
+    {"PUSH", NULL, optype_Ib, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_6A)},
+    {"IMUL", NULL, optype_GvEvIb, OP_EXEC(cpu_gen_8086, cpu_op_6B)},
+    {"INSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_6C)},
+    {"INSW", "INSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_6D)},
+    {"OUTSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_6E)},
+    {"OUTSW", "OUTSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_6F)},
+    {"JO", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNO", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JB", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNB", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JZ", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNZ", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNA", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JA", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JS", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNS", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JP", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNP", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JL", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNL", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JNG", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {"JG", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_70)},
+    {NULL, NULL, optype_group, opcode_80, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_80)},
+    {NULL, NULL, optype_group, opcode_81, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_80)},
+    {NULL, NULL, optype_group, opcode_80, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_80)},
+    {NULL, NULL, optype_group, opcode_83, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_80)},
+    {"TEST", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_84)},
+    {"TEST", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_84)},
+    {"XCHG", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_86)},
+    {"XCHG", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_86)},
+    {"MOV", NULL, optype_EbGb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_88)},
+    {"MOV", NULL, optype_EvGv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_89)},
+    {"MOV", NULL, optype_GbEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_8A)},
+    {"MOV", NULL, optype_GvEv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_8B)},
+    {"MOV", NULL, optype_EwSw, OP_EXEC(cpu_gen_8086, cpu_op_8C)},
+    {"LEA", NULL, optype_GvM, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_8D)},
+    {"MOV", NULL, optype_SwEw, OP_EXEC(cpu_gen_8086, cpu_op_8E)},
+    {NULL, NULL, optype_group, opcode_8F, OP_EXEC(cpu_gen_8086, cpu_op_8F)},
+    {"NOP", NULL, optype_nop, OP_EXEC(cpu_gen_8086, cpu_op_90)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"XCHG", NULL, optype_Zv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_91)},
+    {"CBW", "CWDE", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_98)},
+    {"CWD", "CDQ", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_99)},
+    {"CALL", NULL, optype_Ap, OP_EXEC(cpu_gen_8086, cpu_op_9A)},
+    {"FWAIT", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_9B)},
+    {"PUSHF", "PUSHFD", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_9C)},
+    {"POPF", "POPFD", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_9D)},
+    {"SAHF", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_9E)},
+    {"LAHF", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_9F)},
+    {"MOV", NULL, optype_ALOb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A0)},
+    {"MOV", NULL, optype_AXOv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A1)},
+    {"MOV", NULL, optype_ObAL, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A2)},
+    {"MOV", NULL, optype_OvAX, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A3)},
+    {"MOVSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_A4)},
+    {"MOVSW", "MOVSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_A5)},
+    {"CMPSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_A6)},
+    {"CMPSW", "CMPSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_A7)},
+    {"TEST", NULL, optype_ALIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A8)},
+    {"TEST", NULL, optype_AXIz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_A8)},
+    {"STOSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AA)},
+    {"STOSW", "STOSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AB)},
+    {"LODSB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AC)},
+    {"LODSW", "LODSD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AD)},
+    {"SCASB", NULL, optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AE)},
+    {"SCASW", "SCASD", optype_string, OP_EXEC(cpu_gen_8086, cpu_op_AF)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B0)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B1)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B2)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B3)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B4)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B5)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B6)},
+    {"MOV", NULL, optype_ZbIb, OP_EXEC(cpu_gen_8086, cpu_op_B7)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
+    {"MOV", NULL, optype_ZvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_B8)},
     {
         NULL,
         NULL,
         optype_shEbIb,
+        OP_EXEC(cpu_gen_8086, cpu_op_C0),
     },
     {
         NULL,
         NULL,
         optype_shEvIb,
+        OP_EXEC(cpu_gen_8086, cpu_op_C0),
     },
-    {"RET", NULL, optype_Iw},
-    {"RET", NULL, optype_implied},
-    {"LES", NULL, optype_GvM},
-    {"LDS", NULL, optype_GvM},
-    {"MOV", NULL, optype_EbIb},
-    {"MOV", NULL, optype_EvIv},
-    {"ENTER", NULL, optype_IwIb},
-    {"LEAVE", NULL, optype_implied},
-    {"RETF", NULL, optype_Iw},
-    {"RETF", NULL, optype_implied},
-    {"INT3", NULL, optype_implied},
-    {"INT", NULL, optype_Ib},
-    {"INTO", NULL, optype_implied},
-    {"IRET", "IRETD", optype_implied},
-    {NULL, NULL, optype_shEb, NULL, 2, NULL, "1"},
-    {NULL, NULL, optype_shEv, NULL, 2, NULL, "1"},
-    {NULL, NULL, optype_shEb, NULL, 2, NULL, "CL"},
-    {NULL, NULL, optype_shEv, NULL, 2, NULL, "CL"},
-    {"AAM", NULL, optype_Ib},
-    {"AAD", NULL, optype_Ib},
+    {"RET", NULL, optype_Iw, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_C2)},
+    {"RET", NULL, optype_implied, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_C3)},
+    {"LES", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_C4)},
+    {"LDS", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_C5)},
+    {"MOV", NULL, optype_EbIb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_C6)},
+    {"MOV", NULL, optype_EvIv, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_C6)},
+    {"ENTER", NULL, optype_IwIb, OP_EXEC(cpu_gen_8086, cpu_op_C8)},
+    {"LEAVE", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_C9)},
+    {"RETF", NULL, optype_Iw, OP_EXEC(cpu_gen_8086, cpu_op_CA)},
+    {"RETF", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_CB)},
+    {"INT3", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_CC)},
+    {"INT", NULL, optype_Ib, OP_EXEC(cpu_gen_8086, cpu_op_CD)},
+    {"INTO", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_CE)},
+    {"IRET", "IRETD", optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_CF)},
+    {NULL, NULL, optype_shEb, NULL, 2, NULL, "1", OP_EXEC(cpu_gen_8086, cpu_op_D0)},
+    {NULL, NULL, optype_shEv, NULL, 2, NULL, "1", OP_EXEC(cpu_gen_8086, cpu_op_D0)},
+    {NULL, NULL, optype_shEb, NULL, 2, NULL, "CL", OP_EXEC(cpu_gen_8086, cpu_op_D2)},
+    {NULL, NULL, optype_shEv, NULL, 2, NULL, "CL", OP_EXEC(cpu_gen_8086, cpu_op_D2)},
+    {"AAM", NULL, optype_Ib, OP_EXEC(cpu_gen_8086, cpu_op_D4)},
+    {"AAD", NULL, optype_Ib, OP_EXEC(cpu_gen_8086, cpu_op_D5)},
     {"SALC", NULL, optype_implied},
-    {"XLAT", NULL, optype_implied},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {NULL, NULL, optype_fpu},
-    {"LOOPNZ", NULL, optype_Jb},
-    {"LOOPZ", NULL, optype_Jb},
-    {"LOOP", NULL, optype_Jb},
-    {"JCXZ", "JECXZ", optype_Jb},
-    {"IN", NULL, optype_ALIb},
-    {"IN", NULL, optype_AXIb},
-    {"OUT", NULL, optype_IbAL},
-    {"OUT", NULL, optype_IbAX},
-    {"CALL", NULL, optype_Jz},
-    {"JMP", NULL, optype_Jz},
-    {"JMP", NULL, optype_Ap},
-    {"JMP", NULL, optype_Jb},
-    {"IN", NULL, optype_implied, NULL, 3, "AL", "DX"},
-    {"IN", NULL, optype_implied, NULL, 3, "AX", "DX"},
-    {"OUT", NULL, optype_implied, NULL, 3, "DX", "AL"},
-    {"OUT", NULL, optype_implied, NULL, 3, "DX", "AX"},
+    {"XLAT", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_D7)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {NULL, NULL, optype_fpu, OP_EXEC(cpu_gen_8086, cpu_op_D8)},
+    {"LOOPNZ", NULL, optype_Jb, OP_EXEC(cpu_gen_8086, cpu_op_E0)},
+    {"LOOPZ", NULL, optype_Jb, OP_EXEC(cpu_gen_8086, cpu_op_E1)},
+    {"LOOP", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_E2)},
+    {"JCXZ", "JECXZ", optype_Jb, OP_EXEC(cpu_gen_8086, cpu_op_E3)},
+    {"IN", NULL, optype_ALIb, OP_EXEC(cpu_gen_8086, cpu_op_E4)},
+    {"IN", NULL, optype_AXIb, OP_EXEC(cpu_gen_8086, cpu_op_E5)},
+    {"OUT", NULL, optype_IbAL, OP_EXEC(cpu_gen_8086, cpu_op_E6)},
+    {"OUT", NULL, optype_IbAX, OP_EXEC(cpu_gen_8086, cpu_op_E7)},
+    {"CALL", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_E8)},
+    {"JMP", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_E9)},
+    {"JMP", NULL, optype_Ap, OP_EXEC(cpu_gen_8086, cpu_op_EA)},
+    {"JMP", NULL, optype_Jb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_EB)},
+    {"IN", NULL, optype_implied, NULL, 3, "AL", "DX", OP_EXEC(cpu_gen_8086, cpu_op_EC)},
+    {"IN", NULL, optype_implied, NULL, 3, "AX", "DX", OP_EXEC(cpu_gen_8086, cpu_op_ED)},
+    {"OUT", NULL, optype_implied, NULL, 3, "DX", "AL", OP_EXEC(cpu_gen_8086, cpu_op_EE)},
+    {"OUT", NULL, optype_implied, NULL, 3, "DX", "AX", OP_EXEC(cpu_gen_8086, cpu_op_EF)},
     {"LOCK", NULL, optype_prefix},
-    {"ICEBP", NULL, optype_implied},
+    {"ICEBP", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_F1)},
     {"REPZ", NULL, optype_prefix},
     {"REPNZ", NULL, optype_prefix},
-    {"HLT", NULL, optype_implied},
-    {"CMC", NULL, optype_implied},
-    {NULL, NULL, optype_group, opcode_F6},
-    {NULL, NULL, optype_group, opcode_F7},
-    {"CLC", NULL, optype_implied},
-    {"STC", NULL, optype_implied},
-    {"CLI", NULL, optype_implied},
-    {"STI", NULL, optype_implied},
-    {"CLD", NULL, optype_implied},
-    {"STD", NULL, optype_implied},
-    {NULL, NULL, optype_group, opcode_FE},
-    {NULL, NULL, optype_group, opcode_FF},
+    {"HLT", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_F4)},
+    {"CMC", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_F5)},
+    {NULL, NULL, optype_group, opcode_F6, OP_EXEC(cpu_gen_8086, cpu_op_F6)},
+    {NULL, NULL, optype_group, opcode_F7, OP_EXEC(cpu_gen_8086, cpu_op_F7)},
+    {"CLC", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_F8)},
+    {"STC", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_F9)},
+    {"CLI", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_FA)},
+    {"STI", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_FB)},
+    {"CLD", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_FC)},
+    {"STD", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_FD)},
+    {NULL, NULL, optype_group, opcode_FE, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_FE)},
+    {NULL, NULL, optype_group, opcode_FF, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_FF)},
 };
 
 opmap_t opcode2[256] = {
-    {NULL, NULL, optype_group, opcode_0F00},
-    {NULL, NULL, optype_group, opcode_0F01},
-    {"LAR", NULL, optype_GvM},
-    {"LSL", NULL, optype_GvM},
+    {NULL, NULL, optype_group, opcode_0F00, OP_EXEC(cpu_gen_80386, cpu_op_0F00)},
+    {NULL, NULL, optype_group, opcode_0F01, OP_EXEC(cpu_gen_80386, cpu_op_0F01)},
+    {"LAR", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_0F02)},
+    {"LSL", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_0F03)},
     {NULL, NULL, optype_undefined},
     {"LOADALL286", NULL, optype_implied},
-    {"CLTS", NULL, optype_implied},
+    {"CLTS", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F06)},
     {"LOADALL386", NULL, optype_implied},
-    {"INVD", NULL, optype_implied},
-    {"WBINVD", NULL, optype_implied},
+    {"INVD", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F08)},
+    {"WBINVD", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F08)},
     {NULL, NULL, optype_undefined},
-    {"UD2", NULL, optype_undefined},
+    {"UD2", NULL, optype_undefined, OP_EXEC(cpu_gen_8086, cpu_op_0F0B)},
     {NULL, NULL, optype_undefined},
     {"NOP", NULL, optype_Ev},
     {NULL, NULL, optype_undefined},
@@ -597,12 +571,12 @@ opmap_t opcode2[256] = {
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
-    {NULL, NULL, optype_simd},
+    {NULL, NULL, optype_simd, OP_EXEC(cpu_gen_8086, cpu_op_0F1F)},
 
-    {"MOV", NULL, optype_RdCd},
-    {"MOV", NULL, optype_RdDd},
-    {"MOV", NULL, optype_CdRd},
-    {"MOV", NULL, optype_DdRd},
+    {"MOV", NULL, optype_RdCd, OP_EXEC(cpu_gen_80386, cpu_op_0F20)},
+    {"MOV", NULL, optype_RdDd, OP_EXEC(cpu_gen_80386, cpu_op_0F21)},
+    {"MOV", NULL, optype_CdRd, OP_EXEC(cpu_gen_80386, cpu_op_0F20)},
+    {"MOV", NULL, optype_DdRd, OP_EXEC(cpu_gen_80386, cpu_op_0F21)},
     {NULL, NULL, optype_undefined},
     {NULL, NULL, optype_undefined},
     {NULL, NULL, optype_undefined},
@@ -617,9 +591,9 @@ opmap_t opcode2[256] = {
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
 
-    {"WRMSR", NULL, optype_implied},
-    {"RDTSC", NULL, optype_implied},
-    {"RDMSR", NULL, optype_implied},
+    {"WRMSR", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F30)},
+    {"RDTSC", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F31)},
+    {"RDMSR", NULL, optype_implied, OP_EXEC(cpu_gen_8086, cpu_op_0F30)},
     {"RDPMC", NULL, optype_implied},
     {"SYSENTER", NULL, optype_implied},
     {"SYSEXIT", NULL, optype_implied},
@@ -635,22 +609,22 @@ opmap_t opcode2[256] = {
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
 
-    {"CMOVO", NULL, optype_GvEv},
-    {"CMOVNO", NULL, optype_GvEv},
-    {"CMOVC", NULL, optype_GvEv},
-    {"CMOVNC", NULL, optype_GvEv},
-    {"CMOVZ", NULL, optype_GvEv},
-    {"CMOVNZ", NULL, optype_GvEv},
-    {"CMOVNA", NULL, optype_GvEv},
-    {"CMOVA", NULL, optype_GvEv},
-    {"CMOVS", NULL, optype_GvEv},
-    {"CMOVNS", NULL, optype_GvEv},
-    {"CMOVPE", NULL, optype_GvEv},
-    {"CMOVPO", NULL, optype_GvEv},
-    {"CMOVL", NULL, optype_GvEv},
-    {"CMOVNL", NULL, optype_GvEv},
-    {"CMOVNG", NULL, optype_GvEv},
-    {"CMOVG", NULL, optype_GvEv},
+    {"CMOVO", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNO", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVC", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNC", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVZ", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNZ", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNA", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVA", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVS", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNS", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVPE", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVPO", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVL", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNL", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVNG", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
+    {"CMOVG", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0F40)},
 
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
@@ -703,78 +677,78 @@ opmap_t opcode2[256] = {
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
 
-    {"JO", NULL, optype_Jz},
-    {"JNO", NULL, optype_Jz},
-    {"JB", NULL, optype_Jz},
-    {"JNB", NULL, optype_Jz},
-    {"JZ", NULL, optype_Jz},
-    {"JNZ", NULL, optype_Jz},
-    {"JNA", NULL, optype_Jz},
-    {"JA", NULL, optype_Jz},
-    {"JS", NULL, optype_Jz},
-    {"JNS", NULL, optype_Jz},
-    {"JP", NULL, optype_Jz},
-    {"JNP", NULL, optype_Jz},
-    {"JL", NULL, optype_Jz},
-    {"JNL", NULL, optype_Jz},
-    {"JNG", NULL, optype_Jz},
-    {"JG", NULL, optype_Jz},
+    {"JO", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNO", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JB", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNB", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JZ", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNZ", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNA", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JA", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JS", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNS", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JP", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNP", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JL", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNL", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JNG", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
+    {"JG", NULL, optype_Jz, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0F80)},
 
-    {"SETO", NULL, optype_Eb},
-    {"SETNO", NULL, optype_Eb},
-    {"SETB", NULL, optype_Eb},
-    {"SETNB", NULL, optype_Eb},
-    {"SETZ", NULL, optype_Eb},
-    {"SETNZ", NULL, optype_Eb},
-    {"SETNA", NULL, optype_Eb},
-    {"SETA", NULL, optype_Eb},
-    {"SETS", NULL, optype_Eb},
-    {"SETNS", NULL, optype_Eb},
-    {"SETP", NULL, optype_Eb},
-    {"SETNP", NULL, optype_Eb},
-    {"SETL", NULL, optype_Eb},
-    {"SETNL", NULL, optype_Eb},
-    {"SETNG", NULL, optype_Eb},
-    {"SETG", NULL, optype_Eb},
+    {"SETO", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNO", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETB", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNB", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETZ", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNZ", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNA", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETA", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETS", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNS", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETP", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNP", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETL", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNL", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETNG", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
+    {"SETG", NULL, optype_Eb, OP_EXEC(cpu_gen_8086, cpu_op_0F90)},
 
-    {"PUSH", NULL, optype_implied, NULL, 1, "FS"},
-    {"POP", NULL, optype_implied, NULL, 1, "FS"},
-    {"CPUID", NULL, optype_implied},
-    {"BT", NULL, optype_EvGv},
-    {"SHLD", NULL, optype_EvGvIb},
-    {"SHLD", NULL, optype_EvGv, NULL, 2, "CL"},
+    {"PUSH", NULL, optype_implied, NULL, 1, "FS", OP_EXEC(cpu_gen_8086, cpu_op_0FA0)},
+    {"POP", NULL, optype_implied, NULL, 1, "FS", OP_EXEC(cpu_gen_8086, cpu_op_0FA1)},
+    {"CPUID", NULL, optype_implied, OP_EXEC(cpu_gen_80386, cpu_op_0FA2)},
+    {"BT", NULL, optype_EvGv, OP_EXEC(cpu_gen_8086, cpu_op_0FA3)},
+    {"SHLD", NULL, optype_EvGvIb, OP_EXEC(cpu_gen_8086, cpu_op_0FA4)},
+    {"SHLD", NULL, optype_EvGv, NULL, 2, "CL", OP_EXEC(cpu_gen_8086, cpu_op_0FA5)},
     {NULL, NULL, optype_undefined},
     {NULL, NULL, optype_undefined},
 
-    {"PUSH", NULL, optype_implied, NULL, 1, "GS"},
-    {"POP", NULL, optype_implied, NULL, 1, "GS"},
+    {"PUSH", NULL, optype_implied, NULL, 1, "GS", OP_EXEC(cpu_gen_8086, cpu_op_0FA8)},
+    {"POP", NULL, optype_implied, NULL, 1, "GS", OP_EXEC(cpu_gen_8086, cpu_op_0FA9)},
     {"RSM", NULL, optype_implied},
-    {"BTS", NULL, optype_EvGv},
-    {"SHRD", NULL, optype_EvGvIb},
-    {"SHRD", NULL, optype_EvGv, NULL, 1, "CL"},
+    {"BTS", NULL, optype_EvGv, OP_EXEC(cpu_gen_8086, cpu_op_0FAB)},
+    {"SHRD", NULL, optype_EvGvIb, OP_EXEC(cpu_gen_8086, cpu_op_0FAC)},
+    {"SHRD", NULL, optype_EvGv, NULL, 1, "CL", OP_EXEC(cpu_gen_8086, cpu_op_0FAD)},
     {NULL, NULL, optype_group, opcode_0FAE},
-    {"IMUL", NULL, optype_GvEv},
+    {"IMUL", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0FAF)},
 
-    {"CMPXCHG", NULL, optype_EbGb, NULL, 1, "AL"},
-    {"CMPXCHG", NULL, optype_EvGv, NULL, 1, "AX"},
-    {"LSS", NULL, optype_GvM},
-    {"BTR", NULL, optype_EvGv},
-    {"LFS", NULL, optype_GvM},
-    {"LGS", NULL, optype_GvM},
-    {"MOVZX", NULL, optype_GvEb},
-    {"MOVZX", NULL, optype_GvEw},
+    {"CMPXCHG", NULL, optype_EbGb, NULL, 1, "AL", OP_EXEC(cpu_gen_8086, cpu_op_0FB0)},
+    {"CMPXCHG", NULL, optype_EvGv, NULL, 1, "AX", OP_EXEC(cpu_gen_8086, cpu_op_0FB0)},
+    {"LSS", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_0FB2)},
+    {"BTR", NULL, optype_EvGv, OP_EXEC(cpu_gen_8086, cpu_op_0FB3)},
+    {"LFS", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_0FB4)},
+    {"LGS", NULL, optype_GvM, OP_EXEC(cpu_gen_8086, cpu_op_0FB5)},
+    {"MOVZX", NULL, optype_GvEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0FB6)},
+    {"MOVZX", NULL, optype_GvEw, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0FB6)},
 
     {NULL, NULL, optype_undefined},
     {NULL, NULL, optype_undefined},
-    {NULL, NULL, optype_group, opcode_0FBA},
-    {"BTC", NULL, optype_EvGv},
-    {"BSF", NULL, optype_GvEv},
-    {"BSR", NULL, optype_GvEv},
-    {"MOVSX", NULL, optype_GvEb},
-    {"MOVSX", NULL, optype_GvEw},
+    {NULL, NULL, optype_group, opcode_0FBA, OP_EXEC(cpu_gen_8086, cpu_op_0FBA)},
+    {"BTC", NULL, optype_EvGv, OP_EXEC(cpu_gen_8086, cpu_op_0FBB)},
+    {"BSF", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0FBC)},
+    {"BSR", NULL, optype_GvEv, OP_EXEC(cpu_gen_8086, cpu_op_0FBD)},
+    {"MOVSX", NULL, optype_GvEb, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0FBE)},
+    {"MOVSX", NULL, optype_GvEw, OP_EXEC_SIZED(cpu_gen_8086, cpu_op_0FBE)},
 
-    {"XADD", NULL, optype_EbGb},
-    {"XADD", NULL, optype_EvGv},
+    {"XADD", NULL, optype_EbGb, OP_EXEC(cpu_gen_8086, cpu_op_0FC0)},
+    {"XADD", NULL, optype_EvGv, OP_EXEC(cpu_gen_8086, cpu_op_0FC0)},
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
@@ -782,13 +756,13 @@ opmap_t opcode2[256] = {
     {NULL, NULL, optype_simd},
     {NULL, NULL, optype_simd},
 
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
-    {"BSWAP", NULL, optype_Zv},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
+    {"BSWAP", NULL, optype_Zv, OP_EXEC(cpu_gen_8086, cpu_op_0FC8)},
 
 };
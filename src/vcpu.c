@@ -2,11 +2,15 @@
 // Copyright (c) 2019 Nerry
 
 #include <stdint.h>
+#ifdef __wasm_simd128__
+#include <wasm_simd128.h>
+#endif
 
 #define NULL 0
 typedef uintptr_t size_t;
 
 #define WASM_EXPORT __attribute__((visibility("default")))
+#define ALWAYS_INLINE inline __attribute__((always_inline))
 #define WASM_IMPORT extern
 #define WASM_PAGESIZE 0x10000
 
@@ -17,12 +21,9 @@ WASM_IMPORT void vpc_outw(int port, int value);
 WASM_IMPORT int vpc_inw(int port);
 WASM_IMPORT void vpc_outd(int port, uint32_t value);
 WASM_IMPORT uint32_t vpc_ind(int port);
-WASM_IMPORT int vpc_irq();
 WASM_IMPORT _Noreturn void TRAP_NORETURN();
 WASM_IMPORT int vpc_grow(int n);
 
-#include "disasm.h"
-
 void *memset(void *p, int v, size_t n)
 {
     uint8_t *_p = p;
@@ -46,11 +47,47 @@ void *memcpy(void *p, const void *q, size_t n)
 
 typedef struct cpu_state cpu_state;
 typedef struct sreg_t sreg_t;
+typedef int (*cpu_op_t)(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg);
 WASM_EXPORT void cpu_reset(cpu_state *cpu, int gen);
 WASM_EXPORT void cpu_show_regs(cpu_state *cpu);
+static inline void machine_enter(cpu_state *cpu);
 static inline char *disasm_main(char *p, uint16_t sel, uint32_t eip, uint32_t rip, int _use32, int *length);
 int get_inst_len(cpu_state *cpu);
 
+enum
+{
+    index_AX = 0,
+    index_CX,
+    index_DX,
+    index_BX,
+    index_SP,
+    index_BP,
+    index_SI,
+    index_DI,
+    index_EAX = 0,
+    index_ECX,
+    index_EDX,
+    index_EBX,
+    index_ESP,
+    index_EBP,
+    index_ESI,
+    index_EDI,
+    index_AL = 0,
+    index_CL,
+    index_DL,
+    index_BL,
+    index_AH,
+    index_CH,
+    index_DH,
+    index_BH,
+    index_ES = 0,
+    index_CS,
+    index_SS,
+    index_DS,
+    index_FS,
+    index_GS,
+};
+
 enum
 {
     cpu_gen_8086 = 0,
@@ -71,6 +108,8 @@ typedef enum cpu_status_t
     cpu_status_inta,
     cpu_status_icebp,
     cpu_status_tsc,
+    cpu_status_fused, // internal: two instructions were executed in one step
+    cpu_status_timer, // internal: an IN/OUT to the PIT waits for time_stamp_counter
     cpu_status_halt = 0x1000,
     cpu_status_exception = 0x10000,
     cpu_status_exit,
@@ -124,6 +163,10 @@ typedef struct sreg_t
             uint8_t attr_G : 1;
         };
     };
+    // Window cached by sreg_refresh: offsets below the span can be accessed
+    // as a dword without limit or memory checks
+    uint8_t *host;
+    uint32_t read_span, write_span;
 } desc_t;
 
 typedef desc_t sreg_t;
@@ -203,6 +246,7 @@ enum
 
     CPU_CTX_DATA32 = 0x00000001,
     CPU_CTX_ADDR32 = 0x00000002,
+    CPU_CTX_SIZE_MASK = CPU_CTX_DATA32 | CPU_CTX_ADDR32,
     SEG_CTX_DEFAULT_DATA32 = 0x00000010,
     SEG_CTX_DEFAULT_ADDR32 = 0x00000020,
 };
@@ -212,10 +256,10 @@ typedef enum
     type_bitmap_TSS32 = 0x00000200,
     type_bitmap_LDT = 0x00000004,
     type_bitmap_INT_GATE = 0x0000C000,
-    type_bitmap_SEG_ALL = 0xFF0F0000,
+    type_bitmap_SEG_ALL = 0xFFFF0000,
     type_bitmap_SEG_EXEC = 0xFF000000,
-    type_bitmap_SEG_READ = 0xCC0F0000,
-    type_bitmap_SEG_WRITE = 0x000C0000,
+    type_bitmap_SEG_READ = 0xCCFF0000,
+    type_bitmap_SEG_WRITE = 0x00CC0000,
 } desc_type_bitmap_t;
 
 // Control Register 0
@@ -299,6 +343,48 @@ typedef struct
 
 typedef uint8_t *cpu_rip_t;
 #define MAX_BREAKPOINTS 1
+#define MAX_INST_LENGTH 15
+
+// Paging
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define TLB_SIZE 256
+
+// Page table entry bits, also used for the access kind and the #PF error code
+#define PTE_P 0x001
+#define PTE_W 0x002
+#define PTE_U 0x004
+#define PTE_A 0x020
+#define PTE_D 0x040
+
+// Software TLB entry, tag[access >> 1] is the linear page if that access kind is allowed
+typedef struct
+{
+    uint32_t tag[4];
+    paddr_t frame;
+} cpu_tlb_entry_t;
+
+// Copy of a memory operand that crosses a page boundary or lives in a write protected page
+typedef struct
+{
+    uint8_t data[8], orig[8];
+    uint32_t linear;
+    paddr_t phys[2];
+    uint8_t size, split, writable, active;
+} cpu_operand_copy_t;
+
+#define MODRM_NO_REG 8
+
+// ModRM operand of a cached instruction: disp + gpr[base] + (gpr[index] << scale) (see MODRM_CTX)
+typedef struct
+{
+    int32_t disp;
+    uint8_t modrm;
+    // bytes of the ModRM, SIB and displacement, 0 until the instruction was decoded once
+    uint8_t length;
+    uint8_t base, index, scale, use_ss;
+} cpu_modrm_form_t;
 
 typedef struct cpu_state
 {
@@ -435,24 +521,217 @@ typedef struct cpu_state
     cpu_rip_t last_known_rip;
     uint32_t shadow_eip;
 
+    // pending arithmetic flags (see cpu_materialize_flags)
+    uint32_t lazy_op, lazy_size;
+    int lazy_dst, lazy_src, lazy_value, lazy_aux;
+
+    uint64_t decodes_saved;
+    // operand form of the cached instruction being executed, recorded by its first decode
+    cpu_modrm_form_t *modrm_form;
+    // CMP/TEST/DEC + Jcc pairs executed as one step during the last run
+    uint32_t fused_count;
+
+    // pending #PF, or #GP/#SS of a segment limit, of the current instruction
+    uint32_t pending_fault;
+    // a REP string instruction stopped by the fault left its registers at the faulting element
+    uint32_t fault_resume;
+    // paging: the code page mapping (see cpu_map_code) and the TLB
+    uintptr_t code_base;
+    cpu_rip_t code_lo, code_hi;
+    uint8_t fetch_buf[MAX_INST_LENGTH + 1];
+    cpu_operand_copy_t opr_copy;
+    uint64_t tlb_hits, tlb_misses;
+    cpu_tlb_entry_t tlb[TLB_SIZE];
+
+    // opcode handlers for the current generation by size context, 0F xx at 0x100 (see cpu_init_dispatch)
+    cpu_op_t ops[4][512];
+
 } cpu_state;
 
 #define VOID_MEMORY_VALUE 0xDEADBEEF
+// guest memory of the selected machine (see machine_t)
 size_t max_mem = 0;
 intptr_t null_ptr;
 uint8_t *mem = NULL;
 
+#define BLOCK_CACHE_SIZE 1024
+#define BLOCK_MAX_UOPS 16
+#define CODE_LINE_SHIFT 7
+#define CODE_PAGE_SHIFT 12
+#define CODE_GUARD 3
+
+// uop opcode flag: CMP/TEST/DEC followed by a Jcc in the same block (see cpu_exec_fused)
+#define UOP_FUSED 0x8000
+
+typedef struct
+{
+    cpu_op_t handler;
+    uint16_t offset;
+    uint8_t length;
+    uint8_t seg;
+    uint16_t opcode;
+    uint8_t prefix;
+    uint8_t context;
+    cpu_modrm_form_t form;
+} cpu_uop_t;
+
+typedef struct
+{
+    uint32_t linear;
+    uint32_t cs_base;
+    uint32_t context;
+    uint16_t n_uops;
+    uint16_t span;
+    cpu_uop_t uops[BLOCK_MAX_UOPS];
+} cpu_block_t;
+
+typedef struct
+{
+    cpu_block_t *current;
+    uint32_t index;
+    int recording;
+    cpu_rip_t next_rip;
+    cpu_block_t blocks[BLOCK_CACHE_SIZE];
+} block_cache_t;
+
+// Decoded block cache and a bitmap of 128 byte lines that hold cached code (32 lines per page)
+block_cache_t *block_cache = NULL;
+uint32_t *code_map = NULL;
+
+typedef enum
+{
+    io_type_none = 0, // nothing attached, reads return all ones
+    io_type_host,     // registered by the host
+    io_type_shadow,   // byte reads return shadow[port] that the host keeps up to date, the rest goes to the host
+    io_type_pic,
+    io_type_pit,
+    io_type_vga_status,
+} io_type_t;
+
+#define IO_TYPE_IS_CORE(type) ((type) > io_type_shadow)
+
+// Port I/O dispatch table shared with the host
+typedef struct
+{
+    uint8_t type[0x10000];
+    uint8_t shadow[0x10000];
+    uint32_t count[0x10000];
+} io_map_t;
+
+io_map_t *io_map = NULL;
+
+#define MEM_PAGE_SHIFT 12
+
+// Bitmap of 4KB guest pages written since the host took the last checkpoint
+static uint32_t *page_dirty = NULL;
+
+static inline size_t page_dirty_size(const size_t size)
+{
+    // one spare word for the last bytes of a 4 byte write at the top of the memory
+    return ((size >> MEM_PAGE_SHIFT >> 5) + 1) * sizeof(uint32_t);
+}
+
+static void *alloc_pages(size_t size)
+{
+    return (void *)(vpc_grow((size + WASM_PAGESIZE - 1) / WASM_PAGESIZE) * WASM_PAGESIZE);
+}
+
+static void block_cache_flush(void)
+{
+    memset(block_cache, 0, sizeof(block_cache_t));
+    memset(code_map, 0, ((max_mem >> CODE_PAGE_SHIFT) + 1) * sizeof(uint32_t));
+}
+
 /**
- * Initialize internal structures.
- * 
- * THIS FUNCTION MUST BE CALLED BEFORE ALL OTHER FUNCTIONS.
+ * Drop all cached blocks that overlap the line containing linear
  */
-WASM_EXPORT void *_init(uint32_t mb)
+static void block_cache_invalidate_line(const uint32_t linear)
 {
-    max_mem = mb * 1024 * 1024;
-    mem = (void *)(vpc_grow(max_mem / WASM_PAGESIZE + 1) * WASM_PAGESIZE);
-    null_ptr = 0 - (intptr_t)mem;
-    return mem;
+    const uint32_t line = linear & ~((1 << CODE_LINE_SHIFT) - 1);
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++)
+    {
+        cpu_block_t *block = &block_cache->blocks[i];
+        if (block->span && block->linear + block->span > line && block->linear < line + (1 << CODE_LINE_SHIFT) + CODE_GUARD)
+        {
+            block->n_uops = 0;
+            block->span = 0;
+            if (block_cache->current == block)
+            {
+                block_cache->current = NULL;
+                block_cache->recording = 0;
+            }
+        }
+    }
+    code_map[linear >> CODE_PAGE_SHIFT] &= ~(1 << ((linear >> CODE_LINE_SHIFT) & 31));
+}
+
+static inline int is_code_line(const uint32_t linear)
+{
+    return code_map[linear >> CODE_PAGE_SHIFT] & (1 << ((linear >> CODE_LINE_SHIFT) & 31));
+}
+
+static inline void mark_code_line(const uint32_t linear)
+{
+    code_map[linear >> CODE_PAGE_SHIFT] |= 1 << ((linear >> CODE_LINE_SHIFT) & 31);
+}
+
+static inline void block_cache_notify_write(const uint32_t linear)
+{
+    if (is_code_line(linear))
+    {
+        block_cache_invalidate_line(linear);
+    }
+}
+
+// VRAM window tracked for the host; it also covers the linear SVGA frames that run past BFFFFh
+#define VRAM_BASE 0xA0000
+#define VRAM_SIZE 0x60000
+#define VRAM_SPAN_SHIFT 8
+
+#define VRAM_DIRTY_WORDS (VRAM_SIZE >> VRAM_SPAN_SHIFT >> 5)
+
+// Bitmap of 256 byte spans in the VRAM window written since the host last cleared it
+static uint32_t *vram_dirty = NULL;
+
+static inline void vram_mark_span(const uint32_t offset)
+{
+    const uint32_t span = offset >> VRAM_SPAN_SHIFT;
+    vram_dirty[span >> 5] |= 1 << (span & 31);
+}
+
+/**
+ * Notify a memory write of up to 4 bytes starting at linear
+ */
+static inline void memory_notify_write(const uint32_t linear)
+{
+    const uint32_t last = linear + 3;
+    page_dirty[linear >> MEM_PAGE_SHIFT >> 5] |= 1 << ((linear >> MEM_PAGE_SHIFT) & 31);
+    page_dirty[last >> MEM_PAGE_SHIFT >> 5] |= 1 << ((last >> MEM_PAGE_SHIFT) & 31);
+    const uint32_t offset = linear - VRAM_BASE;
+    if (offset < VRAM_SIZE)
+    {
+        vram_mark_span(offset);
+        if (offset + 3 < VRAM_SIZE)
+            vram_mark_span(offset + 3);
+    }
+    block_cache_notify_write(linear);
+}
+
+/**
+ * Notify a memory write of size bytes starting at linear
+ */
+static void memory_notify_range(const uint32_t linear, const uint32_t size)
+{
+    if (linear >= max_mem)
+        return;
+    uint32_t end = linear + size;
+    if (end > max_mem || end < linear)
+        end = max_mem;
+    // every 256 byte span in the range starts a 128 byte line, so the lines mark all of them
+    for (uint32_t p = linear & ~((1 << CODE_LINE_SHIFT) - 1); p < end; p += 1 << CODE_LINE_SHIFT)
+    {
+        memory_notify_write(p);
+    }
 }
 
 static inline void set_flag_to(uint32_t *word, const uint32_t mask, const int value)
@@ -521,11 +800,11 @@ char *dump_dec(char *p, const uint32_t value)
     char buff[16];
     size_t l = 0;
     uint32_t v = value;
-    for (; v; l++)
+    do
     {
-        buff[l] = (v % 10) + '0';
+        buff[l++] = (v % 10) + '0';
         v /= 10;
-    }
+    } while (v);
     for (int i = 0; i < l; i++)
     {
         *p++ = buff[l - i - 1];
@@ -594,121 +873,610 @@ static inline void WRITE_LE32(void *la, const uint32_t value)
     *p = value;
 }
 
-static inline uint8_t READ_MEM8(sreg_t *sreg, const uint32_t offset)
+/**
+ * Recompute the cached access window after the base, limit or attributes of a segment change
+ */
+static inline void sreg_refresh(cpu_state *cpu, sreg_t *sreg)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
-    {
-        return mem[linear];
-    }
-    else
-    {
-        return UINT8_MAX;
-    }
+    sreg->host = mem + sreg->base;
+    sreg->read_span = 0;
+    sreg->write_span = 0;
+    // With paging every access goes through the TLB
+    if (sreg->base >= max_mem || cpu->CR0.PG)
+        return;
+    // Expand-down segments are left to the slow path
+    const int code = sreg->attr_type & 8;
+    if (!code && (sreg->attr_type & 4))
+        return;
+    uint64_t end = (uint64_t)sreg->limit + 1;
+    if (end > max_mem - sreg->base)
+        end = max_mem - sreg->base;
+    const uint32_t span = end > 3 ? (uint32_t)end - 3 : 0;
+    if (!code || (sreg->attr_type & 2))
+        sreg->read_span = span;
+    if (!code && (sreg->attr_type & 2))
+        sreg->write_span = span;
 }
 
-static inline uint16_t READ_MEM16(sreg_t *sreg, const uint32_t offset)
+static inline void cpu_tlb_flush(cpu_state *cpu)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
-    {
-        return READ_LE16(mem + linear);
-    }
-    else
-    {
-        return UINT16_MAX;
-    }
+    memset(cpu->tlb, UINT8_MAX, sizeof(cpu->tlb));
 }
 
-static inline uint32_t READ_MEM32(sreg_t *sreg, const uint32_t offset)
+static inline void cpu_tlb_flush_page(cpu_state *cpu, const uint32_t linear)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
-    {
-        return READ_LE32(mem + linear);
-    }
-    else
-    {
-        return VOID_MEMORY_VALUE;
-    }
+    memset(&cpu->tlb[(linear >> PAGE_SHIFT) & (TLB_SIZE - 1)], UINT8_MAX, sizeof(cpu_tlb_entry_t));
 }
 
-static inline void WRITE_MEM8(sreg_t *sreg, const uint32_t offset, const uint8_t value)
+/**
+ * Access kind of an access from the current privilege level
+ */
+static inline unsigned cpu_page_access(cpu_state *cpu, const unsigned write)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
-    {
-        mem[linear] = value;
-    }
+    return (cpu->CPL == 3 ? PTE_U : 0) | write;
+}
+
+/**
+ * Walk the page directory and the page table for linear and fill its TLB entry
+ *
+ * @param access PTE_W for writes, PTE_U for user mode accesses
+ * @return 0 or #PF status (CR2 is not touched, see cpu_page_fault)
+ */
+static int cpu_page_walk(cpu_state *cpu, const uint32_t linear, const unsigned access, paddr_t *phys)
+{
+    const paddr_t pde_addr = (cpu->CR3 & ~PAGE_MASK) | ((linear >> 22) << 2);
+    uint32_t pde = pde_addr < max_mem ? READ_LE32(mem + pde_addr) : 0;
+    if (!(pde & PTE_P))
+        return cpu_status_page | access;
+    const paddr_t pte_addr = (pde & ~PAGE_MASK) | ((linear >> 10) & 0xFFC);
+    uint32_t pte = pte_addr < max_mem ? READ_LE32(mem + pte_addr) : 0;
+    if (!(pte & PTE_P))
+        return cpu_status_page | access;
+
+    // U/S and R/W of both levels are combined, supervisor writes ignore R/W unless CR0.WP is set
+    const uint32_t flags = pde & pte;
+    const int user = flags & PTE_U;
+    const int writable = (flags & PTE_W) || !cpu->CR0.WP;
+    const int user_writable = user && (flags & PTE_W);
+    if ((access & PTE_U) && !(user && (!(access & PTE_W) || user_writable)))
+        return cpu_status_page | PTE_P | access;
+    if ((access & PTE_W) && !writable)
+        return cpu_status_page | PTE_P | access;
+
+    if (!(pde & PTE_A))
+    {
+        WRITE_LE32(mem + pde_addr, pde | PTE_A);
+        memory_notify_write(pde_addr);
+    }
+    const uint32_t new_pte = pte | PTE_A | (access & PTE_W ? PTE_D : 0);
+    if (new_pte != pte)
+    {
+        pte = new_pte;
+        WRITE_LE32(mem + pte_addr, pte);
+        memory_notify_write(pte_addr);
+    }
+
+    // Writes are cached only once the page is dirty
+    const uint32_t page = linear & ~PAGE_MASK;
+    const int dirty = pte & PTE_D;
+    cpu_tlb_entry_t *entry = &cpu->tlb[(linear >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    entry->frame = pte & ~PAGE_MASK;
+    entry->tag[0] = page;
+    entry->tag[1] = writable && dirty ? page : UINT32_MAX;
+    entry->tag[2] = user ? page : UINT32_MAX;
+    entry->tag[3] = user_writable && dirty ? page : UINT32_MAX;
+    *phys = entry->frame | (linear & PAGE_MASK);
+    return 0;
 }
 
-static inline void WRITE_MEM16(sreg_t *sreg, const uint32_t offset, const uint16_t value)
+/**
+ * Translate a linear address to a physical address
+ *
+ * @param access PTE_W for writes, PTE_U for user mode accesses
+ * @return 0 or #PF status (CR2 is not touched, see cpu_page_fault)
+ */
+static inline int cpu_translate(cpu_state *cpu, const uint32_t linear, const unsigned access, paddr_t *phys)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
+    const cpu_tlb_entry_t *entry = &cpu->tlb[(linear >> PAGE_SHIFT) & (TLB_SIZE - 1)];
+    if (entry->tag[access >> 1] == (linear & ~PAGE_MASK))
     {
-        WRITE_LE16(mem + linear, value);
+        cpu->tlb_hits++;
+        *phys = entry->frame | (linear & PAGE_MASK);
+        return 0;
     }
+    cpu->tlb_misses++;
+    return cpu_page_walk(cpu, linear, access, phys);
 }
 
-static inline void WRITE_MEM32(sreg_t *sreg, const uint32_t offset, const uint32_t value)
+/**
+ * Raise a #PF returned by cpu_translate
+ */
+static inline int cpu_page_fault(cpu_state *cpu, const int status, const uint32_t linear)
 {
-    uint32_t linear = sreg->base + offset;
-    if (linear < max_mem)
-    {
-        WRITE_LE32(mem + linear, value);
-    }
+    cpu->CR2 = linear;
+    return status;
 }
 
-static inline int MOVSXB(const uint8_t b)
+/**
+ * Leave a #PF pending for the current instruction; the first one wins
+ */
+static inline void cpu_page_fault_pending(cpu_state *cpu, const int status, const uint32_t linear)
 {
-    return (int)(int8_t)b;
+    if (!cpu->pending_fault)
+        cpu->pending_fault = cpu_page_fault(cpu, status, linear);
 }
 
-static inline int MOVSXW(const uint16_t w)
+/**
+ * Let a string instruction stopped by a pending fault keep its registers, so that it resumes from the element that faulted
+ */
+static inline void cpu_string_resume(cpu_state *cpu)
 {
-    return (int)(int16_t)w;
+    if (cpu->pending_fault)
+        cpu->fault_resume = 1;
 }
 
-static inline int64_t MOVSXD(const uint32_t d)
+/**
+ * Host pointer to a system structure (descriptor table, TSS) at linear, accessed with supervisor rights
+ *
+ * @return 0 or #PF status
+ */
+static int SYSTEM_PTR(cpu_state *cpu, const uint32_t linear, const unsigned write, void **result)
 {
-    return (int64_t)(int32_t)d;
+    paddr_t phys = linear;
+    if (cpu->CR0.PG)
+    {
+        const int status = cpu_translate(cpu, linear, write, &phys);
+        if (status)
+            return cpu_page_fault(cpu, status, linear);
+    }
+    *result = mem + phys;
+    return 0;
 }
 
-static inline cpu_rip_t make_rip(const uint32_t base, const uint32_t index)
+static uint32_t READ_PAGED(cpu_state *cpu, const uint32_t linear, const int size)
 {
-    return mem + base + index;
+    const unsigned access = cpu_page_access(cpu, 0);
+    paddr_t phys;
+    int status;
+    if ((linear & PAGE_MASK) <= PAGE_SIZE - size)
+    {
+        status = cpu_translate(cpu, linear, access, &phys);
+        if (status)
+        {
+            cpu_page_fault_pending(cpu, status, linear);
+            return UINT32_MAX;
+        }
+        if (phys >= max_mem)
+            return size == 4 ? VOID_MEMORY_VALUE : UINT32_MAX;
+        switch (size)
+        {
+        case 1:
+            return mem[phys];
+        case 2:
+            return READ_LE16(mem + phys);
+        default:
+            return READ_LE32(mem + phys);
+        }
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < size; i++)
+    {
+        status = cpu_translate(cpu, linear + i, access, &phys);
+        if (status)
+        {
+            cpu_page_fault_pending(cpu, status, linear + i);
+            return UINT32_MAX;
+        }
+        value |= (phys < max_mem ? mem[phys] : UINT8_MAX) << (i * 8);
+    }
+    return value;
 }
 
-static inline cpu_rip_t make_rip_from_eip(cpu_state *cpu)
+static void WRITE_PAGED(cpu_state *cpu, const uint32_t linear, const int size, const uint32_t value)
 {
-    return make_rip(cpu->CS.base, cpu->shadow_eip);
+    const unsigned access = cpu_page_access(cpu, PTE_W);
+    paddr_t phys, last;
+    int status = cpu_translate(cpu, linear, access, &phys);
+    if (status)
+    {
+        cpu_page_fault_pending(cpu, status, linear);
+        return;
+    }
+    if ((linear & PAGE_MASK) <= PAGE_SIZE - size)
+    {
+        if (phys >= max_mem)
+            return;
+        switch (size)
+        {
+        case 1:
+            mem[phys] = value;
+            break;
+        case 2:
+            WRITE_LE16(mem + phys, value);
+            break;
+        default:
+            WRITE_LE32(mem + phys, value);
+        }
+        memory_notify_write(phys);
+        return;
+    }
+    // Both pages must be writable before anything is stored
+    status = cpu_translate(cpu, linear + size - 1, access, &last);
+    if (status)
+    {
+        cpu_page_fault_pending(cpu, status, linear + size - 1);
+        return;
+    }
+    for (int i = 0; i < size; i++)
+    {
+        cpu_translate(cpu, linear + i, access, &phys);
+        if (phys < max_mem)
+        {
+            mem[phys] = value >> (i * 8);
+            memory_notify_write(phys);
+        }
+    }
 }
 
-static inline uint32_t cpu_reflect_rip_to_eip(cpu_state *cpu)
+/**
+ * Host pointer to a memory operand of size bytes at linear with paging enabled.
+ * The operand is accessed through cpu->opr_copy if it crosses a page boundary
+ * or if a write to it would fault; the copy is written back by cpu_operand_writeback.
+ */
+static void *PAGED_OPERAND(cpu_state *cpu, const uint32_t linear, const int size, const int write)
 {
-    uintptr_t cs_base = (uintptr_t)mem + cpu->CS.base;
-    return (uintptr_t)cpu->rip - cs_base;
+    cpu_operand_copy_t *copy = &cpu->opr_copy;
+    const unsigned access = cpu_page_access(cpu, 0);
+    copy->linear = linear;
+    const uint32_t head = PAGE_SIZE - (linear & PAGE_MASK);
+    paddr_t phys, phys2 = 0;
+    uint32_t fault = linear;
+    int status = cpu_translate(cpu, linear, access, &phys);
+    if (status == 0 && head < size)
+    {
+        fault = linear + head;
+        status = cpu_translate(cpu, fault, access, &phys2);
+    }
+    if (status)
+    {
+        cpu_page_fault_pending(cpu, status, fault);
+        memset(copy->data, UINT8_MAX, sizeof(copy->data));
+        return copy->data;
+    }
+    int writable = 1;
+    if (write)
+    {
+        writable = cpu_translate(cpu, linear, access | PTE_W, &phys) == 0 &&
+                   (head >= size || cpu_translate(cpu, linear + head, access | PTE_W, &phys2) == 0);
+    }
+    if (head >= size && writable)
+    {
+        if (phys >= max_mem)
+            return NULL;
+        if (write)
+            memory_notify_write(phys);
+        return mem + phys;
+    }
+    copy->phys[0] = phys;
+    copy->phys[1] = phys2;
+    copy->size = size;
+    copy->split = head < size ? head : size;
+    copy->writable = writable;
+    copy->active = 1;
+    for (int i = 0; i < sizeof(copy->data); i++)
+    {
+        paddr_t p = UINT32_MAX;
+        if (i < head)
+            p = phys + i;
+        else if (head < size)
+            p = phys2 + i - head;
+        copy->data[i] = p < max_mem ? mem[p] : UINT8_MAX;
+    }
+    memcpy(copy->orig, copy->data, sizeof(copy->data));
+    return copy->data;
 }
 
-static inline void cpu_last_known_eip(cpu_state *cpu)
+/**
+ * Store a copied memory operand (see PAGED_OPERAND) if the instruction modified it.
+ * The write access is checked for every instruction that writes the operand.
+ *
+ * @return 0 or #PF status
+ */
+static int cpu_operand_writeback(cpu_state *cpu)
 {
-    cpu->last_known_rip = cpu->rip;
+    cpu_operand_copy_t *copy = &cpu->opr_copy;
+    copy->active = 0;
+    int modified = 0;
+    for (int i = 0; i < copy->size; i++)
+    {
+        modified |= copy->data[i] ^ copy->orig[i];
+    }
+    if (!copy->writable)
+    {
+        // a write faults (and sets the dirty bits) even if it stores the same value
+        const unsigned access = cpu_page_access(cpu, PTE_W);
+        paddr_t phys;
+        int status = cpu_translate(cpu, copy->linear, access, &phys);
+        if (status)
+            return cpu_page_fault(cpu, status, copy->linear);
+        status = cpu_translate(cpu, copy->linear + copy->split, access, &phys);
+        if (status)
+            return cpu_page_fault(cpu, status, copy->linear + copy->split);
+    }
+    if (!modified)
+        return 0;
+    for (int i = 0; i < copy->size; i++)
+    {
+        const paddr_t p = i < copy->split ? copy->phys[0] + i : copy->phys[1] + i - copy->split;
+        if (p < max_mem)
+        {
+            mem[p] = copy->data[i];
+            memory_notify_write(p);
+        }
+    }
+    return 0;
 }
 
-static inline void cpu_reflect_rip(cpu_state *cpu)
+/**
+ * Host pointer to a memory operand at linear; with paging enabled it may point to cpu->opr_copy
+ */
+static inline void *MEMORY_OPERAND(cpu_state *cpu, const uint32_t linear, const int size, const int write)
 {
-    cpu->rip = make_rip_from_eip(cpu);
+    if (cpu->CR0.PG)
+        return PAGED_OPERAND(cpu, linear, size, write);
+    if (write && linear < max_mem)
+        memory_notify_write(linear);
+    return mem + linear;
 }
 
-static inline uint32_t cpu_update_eip(cpu_state *cpu)
+/**
+ * Check an access that missed the window of a segment against its limit and type in protected mode,
+ * leaving a #SS for the stack segment or a #GP for the others pending
+ *
+ * @return nonzero if the access may proceed
+ */
+static inline int SEGMENT_CHECK(cpu_state *cpu, sreg_t *sreg, const uint32_t offset, const int size, const int write)
 {
-    uint32_t new_eip = cpu_reflect_rip_to_eip(cpu);
-    cpu->shadow_eip = new_eip;
-    return new_eip;
+    if (!cpu->CR0.PE || cpu->VM)
+        return 1;
+    const uint32_t last = offset + size - 1;
+    int valid = last >= offset;
+    if (sreg->attr_type & 8)
+    {
+        // Code segments can only be read, and only if readable
+        valid = valid && !write && (sreg->attr_type & 2) && last <= sreg->limit;
+    }
+    else if (write && !(sreg->attr_type & 2))
+    {
+        valid = 0;
+    }
+    else if (sreg->attr_type & 4)
+    {
+        // Expand-down: the valid offsets are above the limit
+        valid = valid && offset > sreg->limit && last <= (sreg->attr_D ? UINT32_MAX : UINT16_MAX);
+    }
+    else
+    {
+        valid = valid && last <= sreg->limit;
+    }
+    if (valid)
+        return 1;
+    if (!cpu->pending_fault)
+        cpu->pending_fault = (sreg == &cpu->SS) ? RAISE_STACK_FAULT(0) : RAISE_GPF(0);
+    return 0;
 }
 
-static inline void cpu_recover_eip(cpu_state *cpu)
+static inline uint8_t READ_MEM8(cpu_state *cpu, sreg_t *sreg, const uint32_t offset)
+{
+    if (offset < sreg->read_span)
+        return sreg->host[offset];
+    if (!SEGMENT_CHECK(cpu, sreg, offset, 1, 0))
+        return UINT8_MAX;
+    uint32_t linear = sreg->base + offset;
+    if (cpu->CR0.PG)
+        return READ_PAGED(cpu, linear, 1);
+    if (linear < max_mem)
+    {
+        return mem[linear];
+    }
+    else
+    {
+        return UINT8_MAX;
+    }
+}
+
+static inline uint16_t READ_MEM16(cpu_state *cpu, sreg_t *sreg, const uint32_t offset)
+{
+    if (offset < sreg->read_span)
+        return *(uint16_t *)(sreg->host + offset);
+    if (!SEGMENT_CHECK(cpu, sreg, offset, 2, 0))
+        return UINT16_MAX;
+    uint32_t linear = sreg->base + offset;
+    if (cpu->CR0.PG)
+        return READ_PAGED(cpu, linear, 2);
+    if (linear < max_mem)
+    {
+        return READ_LE16(mem + linear);
+    }
+    else
+    {
+        return UINT16_MAX;
+    }
+}
+
+static inline uint32_t READ_MEM32(cpu_state *cpu, sreg_t *sreg, const uint32_t offset)
+{
+    if (offset < sreg->read_span)
+        return *(uint32_t *)(sreg->host + offset);
+    if (!SEGMENT_CHECK(cpu, sreg, offset, 4, 0))
+        return VOID_MEMORY_VALUE;
+    uint32_t linear = sreg->base + offset;
+    if (cpu->CR0.PG)
+        return READ_PAGED(cpu, linear, 4);
+    if (linear < max_mem)
+    {
+        return READ_LE32(mem + linear);
+    }
+    else
+    {
+        return VOID_MEMORY_VALUE;
+    }
+}
+
+static inline void WRITE_MEM8(cpu_state *cpu, sreg_t *sreg, const uint32_t offset, const uint8_t value)
+{
+    uint32_t linear = sreg->base + offset;
+    if (offset < sreg->write_span)
+    {
+        sreg->host[offset] = value;
+        memory_notify_write(linear);
+    }
+    else if (!SEGMENT_CHECK(cpu, sreg, offset, 1, 1))
+    {
+        return;
+    }
+    else if (cpu->CR0.PG)
+    {
+        WRITE_PAGED(cpu, linear, 1, value);
+    }
+    else if (linear < max_mem)
+    {
+        mem[linear] = value;
+        memory_notify_write(linear);
+    }
+}
+
+static inline void WRITE_MEM16(cpu_state *cpu, sreg_t *sreg, const uint32_t offset, const uint16_t value)
+{
+    uint32_t linear = sreg->base + offset;
+    if (offset < sreg->write_span)
+    {
+        *(uint16_t *)(sreg->host + offset) = value;
+        memory_notify_write(linear);
+    }
+    else if (!SEGMENT_CHECK(cpu, sreg, offset, 2, 1))
+    {
+        return;
+    }
+    else if (cpu->CR0.PG)
+    {
+        WRITE_PAGED(cpu, linear, 2, value);
+    }
+    else if (linear < max_mem)
+    {
+        WRITE_LE16(mem + linear, value);
+        memory_notify_write(linear);
+    }
+}
+
+static inline void WRITE_MEM32(cpu_state *cpu, sreg_t *sreg, const uint32_t offset, const uint32_t value)
+{
+    uint32_t linear = sreg->base + offset;
+    if (offset < sreg->write_span)
+    {
+        *(uint32_t *)(sreg->host + offset) = value;
+        memory_notify_write(linear);
+    }
+    else if (!SEGMENT_CHECK(cpu, sreg, offset, 4, 1))
+    {
+        return;
+    }
+    else if (cpu->CR0.PG)
+    {
+        WRITE_PAGED(cpu, linear, 4, value);
+    }
+    else if (linear < max_mem)
+    {
+        WRITE_LE32(mem + linear, value);
+        memory_notify_write(linear);
+    }
+}
+
+/**
+ * Linear address of count elements of (1 << size) bytes starting at offset,
+ * or UINT32_MAX if the range wraps around the segment or leaves the window given by span (see sreg_refresh)
+ */
+static inline uint32_t LINEAR_RANGE(sreg_t *sreg, const uint32_t span, const uint32_t offset, const uint32_t count, const int size, const uint32_t index_mask)
+{
+    if (count == 0 || count > (max_mem >> size))
+        return UINT32_MAX;
+    const uint32_t bytes = count << size;
+    if (bytes - 1 > index_mask - offset)
+        return UINT32_MAX;
+    // the window holds a dword at each offset below the span, so its last byte is at span + 2
+    if (offset >= span || bytes - 1 > span + 2 - offset)
+        return UINT32_MAX;
+    return sreg->base + offset;
+}
+
+static inline int MOVSXB(const uint8_t b)
+{
+    return (int)(int8_t)b;
+}
+
+static inline int MOVSXW(const uint16_t w)
+{
+    return (int)(int16_t)w;
+}
+
+static inline int64_t MOVSXD(const uint32_t d)
+{
+    return (int64_t)(int32_t)d;
+}
+
+static inline cpu_rip_t make_rip(const uint32_t base, const uint32_t index)
+{
+    return mem + base + index;
+}
+
+/**
+ * rip - EIP; with paging it follows the code page mapping (see cpu_map_code)
+ */
+static inline uintptr_t cpu_code_base(cpu_state *cpu)
+{
+    if (cpu->CR0.PG)
+        return cpu->code_base;
+    return (uintptr_t)mem + cpu->CS.base;
+}
+
+/**
+ * Forget the code page mapping, the next instruction fetch translates CS:EIP again
+ */
+static inline void cpu_rebase_code(cpu_state *cpu)
+{
+    cpu->code_base = (uintptr_t)mem + cpu->CS.base;
+    cpu->code_lo = (cpu_rip_t)UINTPTR_MAX;
+    cpu->code_hi = NULL;
+}
+
+static inline cpu_rip_t make_rip_from_eip(cpu_state *cpu)
+{
+    return (cpu_rip_t)(cpu_code_base(cpu) + cpu->shadow_eip);
+}
+
+static inline uint32_t cpu_reflect_rip_to_eip(cpu_state *cpu)
+{
+    return (uintptr_t)cpu->rip - cpu_code_base(cpu);
+}
+
+static inline void cpu_last_known_eip(cpu_state *cpu)
+{
+    cpu->last_known_rip = cpu->rip;
+}
+
+static inline void cpu_reflect_rip(cpu_state *cpu)
+{
+    cpu->rip = make_rip_from_eip(cpu);
+}
+
+static inline uint32_t cpu_update_eip(cpu_state *cpu)
+{
+    uint32_t new_eip = cpu_reflect_rip_to_eip(cpu);
+    cpu->shadow_eip = new_eip;
+    return new_eip;
+}
+
+static inline void cpu_recover_eip(cpu_state *cpu)
 {
     cpu->rip = cpu->last_known_rip;
     cpu_update_eip(cpu);
@@ -720,11 +1488,14 @@ static inline void cpu_set_eip(cpu_state *cpu, const uint32_t new_eip)
     cpu_reflect_rip(cpu);
 }
 
-// TODO: DEPRECATED
-static inline int CS_LIMIT_CHECK(cpu_state *cpu, const int default_value)
+/**
+ * Check a branch target against the limit of the code segment it runs in, before CS:EIP is committed
+ */
+static inline int CS_LIMIT_CHECK(cpu_state *cpu, const sreg_t *cs, const uint32_t new_eip)
 {
-    // if (cpu->rip > cpu->cs_limit_rip) return RAISE_GPF(0);
-    return default_value;
+    if (cpu->CR0.PE && !cpu->VM && new_eip > cs->limit)
+        return RAISE_GPF(0);
+    return 0;
 }
 
 static inline uint8_t FETCH8(cpu_state *cpu)
@@ -753,9 +1524,14 @@ static inline uint32_t FETCH32(cpu_state *cpu)
     return result;
 }
 
-static inline uint32_t FETCHW(cpu_state *cpu)
+/*
+ * Helpers with a _CTX suffix take the operand and address size context as a parameter.
+ * The mode-specialized opcode handlers pass a constant there (see CPU_OP_SPECIALIZE),
+ * the plain versions read it from cpu->cpu_context.
+ */
+static inline uint32_t FETCHW_CTX(cpu_state *cpu, const unsigned ctx)
 {
-    if (cpu->cpu_context & CPU_CTX_DATA32)
+    if (ctx & CPU_CTX_DATA32)
     {
         return FETCH32(cpu);
     }
@@ -765,9 +1541,14 @@ static inline uint32_t FETCHW(cpu_state *cpu)
     }
 }
 
-static inline int FETCHSW(cpu_state *cpu)
+static inline uint32_t FETCHW(cpu_state *cpu)
 {
-    if (cpu->cpu_context & CPU_CTX_DATA32)
+    return FETCHW_CTX(cpu, cpu->cpu_context);
+}
+
+static inline int FETCHSW_CTX(cpu_state *cpu, const unsigned ctx)
+{
+    if (ctx & CPU_CTX_DATA32)
     {
         return FETCH32(cpu);
     }
@@ -777,10 +1558,15 @@ static inline int FETCHSW(cpu_state *cpu)
     }
 }
 
-static uint32_t POPW(cpu_state *cpu)
+static inline int FETCHSW(cpu_state *cpu)
 {
-    const int addr32 = (cpu->cpu_context & CPU_CTX_ADDR32);
-    const int data32 = (cpu->cpu_context & CPU_CTX_DATA32);
+    return FETCHSW_CTX(cpu, cpu->cpu_context);
+}
+
+static inline uint32_t POPW_CTX(cpu_state *cpu, const unsigned ctx)
+{
+    const int addr32 = (ctx & CPU_CTX_ADDR32);
+    const int data32 = (ctx & CPU_CTX_DATA32);
     uint32_t result;
     uint32_t esp = cpu->ESP;
     if (!addr32)
@@ -789,12 +1575,12 @@ static uint32_t POPW(cpu_state *cpu)
     }
     if (data32)
     {
-        result = READ_MEM32(&cpu->SS, esp);
+        result = READ_MEM32(cpu, &cpu->SS, esp);
         esp += 4;
     }
     else
     {
-        result = READ_MEM16(&cpu->SS, esp);
+        result = READ_MEM16(cpu, &cpu->SS, esp);
         esp += 2;
     }
     if (addr32)
@@ -808,10 +1594,15 @@ static uint32_t POPW(cpu_state *cpu)
     return result;
 }
 
-static int _PUSHW(cpu_state *cpu, uint32_t value)
+static uint32_t POPW(cpu_state *cpu)
+{
+    return POPW_CTX(cpu, cpu->cpu_context);
+}
+
+static inline int _PUSHW_CTX(cpu_state *cpu, uint32_t value, const unsigned ctx)
 {
-    const int addr32 = (cpu->cpu_context & CPU_CTX_ADDR32);
-    const int data32 = (cpu->cpu_context & CPU_CTX_DATA32);
+    const int addr32 = (ctx & CPU_CTX_ADDR32);
+    const int data32 = (ctx & CPU_CTX_DATA32);
     uint32_t esp = cpu->ESP;
     if (!addr32)
     {
@@ -824,14 +1615,14 @@ static int _PUSHW(cpu_state *cpu, uint32_t value)
         if (esp < 4)
             return cpu_status_stack;
         esp -= 4;
-        WRITE_MEM32(&cpu->SS, esp, value);
+        WRITE_MEM32(cpu, &cpu->SS, esp, value);
     }
     else
     {
         if (esp < 2)
             return cpu_status_stack;
         esp -= 2;
-        WRITE_MEM16(&cpu->SS, esp, value);
+        WRITE_MEM16(cpu, &cpu->SS, esp, value);
     }
     if (addr32)
     {
@@ -843,6 +1634,11 @@ static int _PUSHW(cpu_state *cpu, uint32_t value)
     }
     return 0;
 }
+
+static int _PUSHW(cpu_state *cpu, uint32_t value)
+{
+    return _PUSHW_CTX(cpu, value, cpu->cpu_context);
+}
 #define PUSHW(cpu, v)                \
     do                               \
     {                                \
@@ -850,9 +1646,181 @@ static int _PUSHW(cpu_state *cpu, uint32_t value)
         if (status)                  \
             return status;           \
     } while (0)
+#define PUSHW_CTX(cpu, v, ctx)                \
+    do                                        \
+    {                                         \
+        int status = _PUSHW_CTX(cpu, v, ctx); \
+        if (status)                           \
+            return status;                    \
+    } while (0)
+
+typedef enum
+{
+    lazy_none,
+    lazy_add,
+    lazy_adc,
+    lazy_sub,
+    lazy_sbb,
+    lazy_inc,
+    lazy_dec,
+    lazy_logic,
+} lazy_op_t;
+
+/*
+ * Arithmetic flags (CF PF AF ZF SF OF) of the ALU instructions are evaluated lazily.
+ * They keep the operands, the result and the kind of the last operation, and eflags is brought
+ * up to date by cpu_materialize_flags before anything else reads or writes these flags.
+ * lazy_aux holds the carry in for ADC/SBB, the preserved CF for INC/DEC and the preserved AF for logical operations.
+ */
+static inline void SET_LAZY_FLAGS(cpu_state *cpu, const lazy_op_t op, const int size, const int dst, const int src, const int value, const int aux)
+{
+    cpu->lazy_op = op;
+    cpu->lazy_size = size;
+    cpu->lazy_dst = dst;
+    cpu->lazy_src = src;
+    cpu->lazy_value = value;
+    cpu->lazy_aux = aux;
+}
+
+static inline int LAZY_CF(cpu_state *cpu)
+{
+    const int dst = cpu->lazy_dst;
+    const int src = cpu->lazy_src;
+    const int value = cpu->lazy_value;
+    const int c = cpu->lazy_aux;
+    switch (cpu->lazy_op)
+    {
+    case lazy_add:
+        switch (cpu->lazy_size)
+        {
+        case 0:
+            return (uint8_t)dst > (uint8_t)value;
+        case 1:
+            return (uint16_t)dst > (uint16_t)value;
+        default:
+            return (uint32_t)dst > (uint32_t)value;
+        }
+    case lazy_adc:
+        switch (cpu->lazy_size)
+        {
+        case 0:
+            return (uint8_t)dst > (uint8_t)value || (c && !(src + 1));
+        case 1:
+            return (uint16_t)dst > (uint16_t)value || (c && !(src + 1));
+        default:
+            return (uint32_t)dst > (uint32_t)value || (c && !(src + 1));
+        }
+    case lazy_sub:
+        switch (cpu->lazy_size)
+        {
+        case 0:
+            return (uint8_t)dst < (uint8_t)src;
+        case 1:
+            return (uint16_t)dst < (uint16_t)src;
+        default:
+            return (uint32_t)dst < (uint32_t)src;
+        }
+    case lazy_sbb:
+        switch (cpu->lazy_size)
+        {
+        case 0:
+            return (uint8_t)dst < (uint8_t)src + c || (c && !(src + 1));
+        case 1:
+            return (uint16_t)dst < (uint16_t)src + c || (c && !(src + 1));
+        default:
+            return (uint32_t)dst < (uint32_t)src + c || (c && !(src + 1));
+        }
+    case lazy_inc:
+    case lazy_dec:
+        return c;
+    case lazy_logic:
+        return 0;
+    default:
+        return cpu->CF;
+    }
+}
+
+static inline int LAZY_AF(cpu_state *cpu)
+{
+    const int dst = cpu->lazy_dst & 15;
+    const int src = cpu->lazy_src & 15;
+    switch (cpu->lazy_op)
+    {
+    case lazy_add:
+    case lazy_inc:
+        return dst + src > 15;
+    case lazy_adc:
+        return dst + src + cpu->lazy_aux > 15;
+    case lazy_sub:
+    case lazy_dec:
+        return dst - src < 0;
+    case lazy_sbb:
+        return dst - src - cpu->lazy_aux < 0;
+    case lazy_logic:
+        return cpu->lazy_aux;
+    default:
+        return cpu->AF;
+    }
+}
+
+static inline int LAZY_SIZED_VALUE(cpu_state *cpu)
+{
+    switch (cpu->lazy_size)
+    {
+    case 0:
+        return (int8_t)cpu->lazy_value;
+    case 1:
+        return (int16_t)cpu->lazy_value;
+    default:
+        return cpu->lazy_value;
+    }
+}
+
+static inline int LAZY_ZF(cpu_state *cpu)
+{
+    return LAZY_SIZED_VALUE(cpu) == 0;
+}
+
+static inline int LAZY_SF(cpu_state *cpu)
+{
+    return LAZY_SIZED_VALUE(cpu) < 0;
+}
+
+static inline int LAZY_OF(cpu_state *cpu)
+{
+    if (cpu->lazy_op == lazy_logic || cpu->lazy_size == 2)
+        return 0;
+    return LAZY_SIZED_VALUE(cpu) != cpu->lazy_value;
+}
+
+static inline int LAZY_PF(cpu_state *cpu)
+{
+    if (cpu->lazy_size == 0)
+        return 1 & ~__builtin_popcount(cpu->lazy_value);
+    return 1 & ~__builtin_popcount(cpu->lazy_value & UINT8_MAX);
+}
+
+static void cpu_materialize_flags_slow(cpu_state *cpu)
+{
+    cpu->CF = LAZY_CF(cpu);
+    cpu->PF = LAZY_PF(cpu);
+    cpu->AF = LAZY_AF(cpu);
+    cpu->ZF = LAZY_ZF(cpu);
+    cpu->SF = LAZY_SF(cpu);
+    cpu->OF = LAZY_OF(cpu);
+    cpu->lazy_op = lazy_none;
+}
+
+// Write pending arithmetic flags back to eflags
+static inline void cpu_materialize_flags(cpu_state *cpu)
+{
+    if (cpu->lazy_op)
+        cpu_materialize_flags_slow(cpu);
+}
 
 static inline void LOAD_FLAGS(cpu_state *cpu, const int value, const uint32_t preserve_mask)
 {
+    cpu_materialize_flags(cpu);
     cpu->eflags = (cpu->eflags & preserve_mask) |
                   (((value & cpu->flags_mask) | cpu->flags_mask1) & ~preserve_mask);
 }
@@ -864,19 +1832,27 @@ static inline int is_kernel(cpu_state *cpu)
 
 static inline int LOAD_SEL8086(cpu_state *cpu, sreg_t *sreg, const uint16_t value)
 {
+    // the selector may come from a faulting memory read
+    if (cpu->pending_fault)
+        return cpu->pending_fault;
     sreg->sel = value;
     sreg->base = value << 4;
     sreg->limit = UINT16_MAX;
     sreg->attrs = 0x0093;
+    sreg_refresh(cpu, sreg);
     if (sreg == &cpu->CS)
     {
         cpu->default_context = 0;
+        cpu_rebase_code(cpu);
     }
     return 0;
 }
 
 static int LOAD_DESCRIPTOR(cpu_state *cpu, desc_t *target, const uint16_t selector, const desc_type_bitmap_t type_bitmap, const int allow_null, seg_desc_t *table)
 {
+    // the selector may come from a faulting memory read
+    if (cpu->pending_fault)
+        return cpu->pending_fault;
     if (!cpu->CR0.PE || cpu->VM)
     {
         // Real mode or Virtual Mode
@@ -922,8 +1898,11 @@ static int LOAD_DESCRIPTOR(cpu_state *cpu, desc_t *target, const uint16_t select
             return RAISE_GPF(errcode);
         }
 
-        seg_desc_t *xdt = (seg_desc_t *)(mem + desc_table.base);
-        seg_desc_t new_desc = xdt[index];
+        seg_desc_t *desc;
+        int status = SYSTEM_PTR(cpu, desc_table.base + index * sizeof(seg_desc_t), 0, (void **)&desc);
+        if (status)
+            return status;
+        seg_desc_t new_desc = *desc;
 
         // Type and Presence Check
         if (type_bitmap)
@@ -937,7 +1916,8 @@ static int LOAD_DESCRIPTOR(cpu_state *cpu, desc_t *target, const uint16_t select
         // Accessed (Segment)
         if (new_desc.attr_S)
         {
-            xdt[index].attr_1 |= 1;
+            desc->attr_1 |= 1;
+            memory_notify_range((uint8_t *)desc - mem, sizeof(seg_desc_t));
         }
 
         // Load
@@ -951,8 +1931,10 @@ static int LOAD_DESCRIPTOR(cpu_state *cpu, desc_t *target, const uint16_t select
         target->limit = limit;
         target->sel = selector;
     }
+    sreg_refresh(cpu, target);
     if (target == &cpu->CS)
     {
+        cpu_rebase_code(cpu);
         if (cpu->VM)
         {
             cpu->CPL = 3;
@@ -991,8 +1973,14 @@ static int POP_SEG(cpu_state *cpu, desc_t *desc, const desc_type_bitmap_t bitmap
 
 static int TSS_switch_context(cpu_state *cpu, desc_t *new_tss, const int link)
 {
-    tss32_t *current = (tss32_t *)(mem + cpu->TSS.base);
-    tss32_t *next = (tss32_t *)(mem + new_tss->base);
+    cpu_materialize_flags(cpu);
+    tss32_t *current, *next;
+    int status = SYSTEM_PTR(cpu, cpu->TSS.base, PTE_W, (void **)&current);
+    if (status)
+        return status;
+    status = SYSTEM_PTR(cpu, new_tss->base, PTE_W, (void **)&next);
+    if (status)
+        return status;
 
     // cpu->time_stamp_counter += 500;
 
@@ -1014,12 +2002,19 @@ static int TSS_switch_context(cpu_state *cpu, desc_t *new_tss, const int link)
     current->FS = cpu->FS.sel;
     current->GS = cpu->GS.sel;
     current->LDT = cpu->LDT.sel;
+    memory_notify_range((uint8_t *)current - mem, sizeof(tss32_t));
 
     if (link)
     {
         next->link = cpu->TSS.sel;
+        memory_notify_range((uint8_t *)next - mem, sizeof(tss32_t));
     }
     cpu->TSS = *new_tss;
+    if (cpu->CR0.PG && cpu->CR3 != next->CR3)
+    {
+        cpu->CR3 = next->CR3;
+        cpu_tlb_flush(cpu);
+    }
 
     cpu->eflags = next->eflags;
     cpu->EAX = next->EAX;
@@ -1058,6 +2053,9 @@ static int FAR_CALL(cpu_state *cpu, const uint16_t new_csel, const uint32_t new_
     const uint32_t old_eip = cpu_reflect_rip_to_eip(cpu);
     sreg_t new_cs;
     int status = LOAD_DESCRIPTOR(cpu, &new_cs, new_csel, type_bitmap_SEG_EXEC, 0, NULL);
+    if (status)
+        return status;
+    status = CS_LIMIT_CHECK(cpu, &new_cs, new_eip);
     if (status)
         return status;
 
@@ -1066,18 +2064,23 @@ static int FAR_CALL(cpu_state *cpu, const uint16_t new_csel, const uint32_t new_
     PUSHW(cpu, old_csel);
     PUSHW(cpu, old_eip);
 
-    return CS_LIMIT_CHECK(cpu, 0);
+    return 0;
 }
 
 static int FAR_JUMP(cpu_state *cpu, const uint16_t new_sel, const uint32_t new_eip)
 {
     if (new_sel == 0 && new_eip == 0)
         return cpu_status_gpf;
-    int status = LOAD_DESCRIPTOR(cpu, &cpu->CS, new_sel, type_bitmap_SEG_EXEC, 0, NULL);
+    sreg_t new_cs;
+    int status = LOAD_DESCRIPTOR(cpu, &new_cs, new_sel, type_bitmap_SEG_EXEC, 0, NULL);
     if (status == 0)
     {
+        status = CS_LIMIT_CHECK(cpu, &new_cs, new_eip);
+        if (status)
+            return status;
+        LOAD_DESCRIPTOR(cpu, &cpu->CS, new_sel, 0, 0, NULL);
         cpu_set_eip(cpu, new_eip);
-        return CS_LIMIT_CHECK(cpu, 0);
+        return 0;
     }
     else
     { // TSS
@@ -1119,8 +2122,11 @@ static inline int INVOKE_INT_MAIN(cpu_state *cpu, const int n, const int_cause_t
     uint32_t chk_limit = (n << 3) | 7;
     if (chk_limit > cpu->IDT.limit)
         return RAISE_GPF(errcode);
-    gate_desc_t *idt = (gate_desc_t *)(mem + cpu->IDT.base);
-    gate_desc_t gate = idt[n];
+    gate_desc_t *idt;
+    int status = SYSTEM_PTR(cpu, cpu->IDT.base + n * sizeof(gate_desc_t), 0, (void **)&idt);
+    if (status)
+        return status;
+    gate_desc_t gate = *idt;
     if (!gate.attr_P)
         return RAISE_NOT_PRESENT(errcode);
     switch (gate.attr_type)
@@ -1145,14 +2151,22 @@ static inline int INVOKE_INT_MAIN(cpu_state *cpu, const int n, const int_cause_t
 
     if (new_csel == 0 && new_eip == 0)
         return RAISE_GPF(errcode | 1);
-    int status = LOAD_DESCRIPTOR(cpu, &cpu->CS, new_csel, type_bitmap_SEG_EXEC, 0, NULL);
+    sreg_t new_cs;
+    status = LOAD_DESCRIPTOR(cpu, &new_cs, new_csel, type_bitmap_SEG_EXEC, 0, NULL);
+    if (status)
+        return status | ext;
+    status = CS_LIMIT_CHECK(cpu, &new_cs, new_eip);
     if (status)
         return status | ext;
+    LOAD_DESCRIPTOR(cpu, &cpu->CS, new_csel, 0, 0, NULL);
     cpu_set_eip(cpu, new_eip);
 
     if (has_to_switch_esp)
     {
-        tss32_t *tss = (tss32_t *)(mem + cpu->TSS.base);
+        tss32_t *tss;
+        status = SYSTEM_PTR(cpu, cpu->TSS.base, 0, (void **)&tss);
+        if (status)
+            return status;
         new_esp = tss->stacks[new_rpl].ESP;
         new_ssel = tss->stacks[new_rpl].SS;
         status = LOAD_DESCRIPTOR(cpu, &cpu->SS, new_ssel, type_bitmap_SEG_WRITE, 0, NULL);
@@ -1193,6 +2207,7 @@ static inline int INVOKE_INT_MAIN(cpu_state *cpu, const int n, const int_cause_t
 
 static int INVOKE_INT(cpu_state *cpu, int n, int_cause_t cause)
 {
+    cpu_materialize_flags(cpu);
     cpu->cpu_context = cpu->default_context;
     const uint32_t old_eip = cpu_reflect_rip_to_eip(cpu);
     if (!cpu->CR0.PE)
@@ -1211,13 +2226,18 @@ static int INVOKE_INT(cpu_state *cpu, int n, int_cause_t cause)
         cpu_set_eip(cpu, new_eip);
         cpu->eflags &= cpu->flags_mask_intrm;
 
-        return CS_LIMIT_CHECK(cpu, 0);
+        return 0;
     }
     else
     {
         const uint16_t old_csel = cpu->CS.sel, old_ssel = cpu->SS.sel;
         const uint32_t old_esp = cpu->ESP, old_eflags = cpu->eflags;
         int status = INVOKE_INT_MAIN(cpu, n, cause, old_eip);
+        if (cpu->pending_fault)
+        {
+            status = cpu->pending_fault;
+            cpu->pending_fault = 0;
+        }
         if (status >= cpu_status_exception)
         {
             int status2;
@@ -1232,7 +2252,7 @@ static int INVOKE_INT(cpu_state *cpu, int n, int_cause_t cause)
             cpu->eflags = old_eflags;
             return status;
         }
-        return CS_LIMIT_CHECK(cpu, status);
+        return status;
     }
 }
 
@@ -1312,6 +2332,8 @@ static int FAR_RETURN(cpu_state *cpu, const uint16_t n, const int is_iret)
 
         sreg_t temp;
         int status = LOAD_DESCRIPTOR(cpu, &temp, new_csel, type_bitmap_SEG_EXEC, 0, NULL);
+        if (!status)
+            status = CS_LIMIT_CHECK(cpu, &temp, new_eip);
         if (status)
         {
             cpu->ESP = old_esp;
@@ -1355,8 +2377,7 @@ static int FAR_RETURN(cpu_state *cpu, const uint16_t n, const int is_iret)
 last_check:
     if (new_csel == 0 && new_eip == 0)
         return RAISE_GPF(0);
-    int inta = (cpu->IF || cpu->TF) ? cpu_status_inta : 0;
-    return CS_LIMIT_CHECK(cpu, inta);
+    return (cpu->IF || cpu->TF) ? cpu_status_inta : 0;
 }
 
 static inline int RETF(cpu_state *cpu, const uint16_t n)
@@ -1432,6 +2453,7 @@ typedef struct
 {
     uint32_t linear;
     uint32_t offset;
+    sreg_t *seg;
     struct
     {
         uint32_t disp;
@@ -1496,7 +2518,35 @@ typedef struct
     int32_t opr2;
 } operand_set;
 
-static inline int MODRM(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result)
+static inline int MODRM_OFFSET(cpu_state *cpu, sreg_t *seg_ovr, const int use_ss, const uint32_t offset, modrm_t *result)
+{
+    sreg_t *seg;
+    if (seg_ovr)
+    {
+        seg = seg_ovr;
+    }
+    else
+    {
+        if (use_ss)
+        {
+            seg = &cpu->SS;
+        }
+        else
+        {
+            seg = &cpu->DS;
+        }
+    }
+
+    result->seg = seg;
+    result->offset = offset;
+    result->linear = seg->base + offset;
+    if (result->linear > max_mem && !cpu->CR0.PG)
+        result->linear = null_ptr;
+
+    return 0;
+}
+
+static inline int MODRM_DECODE(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result, const unsigned ctx)
 {
     modrm_t modrm;
     modrm.modrm = FETCH8(cpu);
@@ -1509,7 +2559,7 @@ static inline int MODRM(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result)
     int skip = 1, use_ss = 0;
     uint32_t offset = 0;
     int mod = modrm.mod;
-    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    if (ctx & CPU_CTX_ADDR32)
     {
         if (modrm.rm != 4)
         {
@@ -1624,38 +2674,149 @@ static inline int MODRM(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result)
         offset &= UINT16_MAX;
     }
 
-    sreg_t *seg;
-    if (seg_ovr)
+    result->modrm = modrm.modrm;
+    return MODRM_OFFSET(cpu, seg_ovr, use_ss, offset, result);
+}
+
+/**
+ * Decode the ModRM bytes of a cached instruction for the first time and record their operand form
+ */
+static int MODRM_RECORD(cpu_state *cpu, cpu_modrm_form_t *form, sreg_t *seg_ovr, modrm_t *result, const unsigned ctx)
+{
+    static const uint8_t base16[8] = {index_EBX, index_EBX, index_EBP, index_EBP, index_ESI, index_EDI, index_EBP, index_EBX};
+    static const uint8_t index16[8] = {index_ESI, index_EDI, index_ESI, index_EDI, MODRM_NO_REG, MODRM_NO_REG, MODRM_NO_REG, MODRM_NO_REG};
+    const cpu_rip_t p = cpu->rip;
+    const int status = MODRM_DECODE(cpu, seg_ovr, result, ctx);
+    modrm_t modrm;
+    modrm.modrm = p[0];
+    uint8_t *disp = p + 1;
+    form->modrm = modrm.modrm;
+    form->base = MODRM_NO_REG;
+    form->index = MODRM_NO_REG;
+    form->scale = 0;
+    form->use_ss = 0;
+    form->disp = 0;
+    form->length = cpu->rip - p;
+    if (status)
+        return status;
+    if (ctx & CPU_CTX_ADDR32)
     {
-        seg = seg_ovr;
+        int base = modrm.rm;
+        if (modrm.rm == 4)
+        {
+            modrm.sib = *disp++;
+            base = modrm.base;
+            if (modrm.index != 4)
+            {
+                form->index = modrm.index;
+                form->scale = modrm.scale;
+            }
+        }
+        if (base != index_EBP || modrm.mod != 0)
+        {
+            form->base = base;
+            form->use_ss = (base == index_EBP || base == index_ESP);
+        }
+        if (modrm.mod == 1)
+            form->disp = (int8_t)disp[0];
+        else if (modrm.mod == 2 || base == index_EBP)
+            form->disp = READ_LE32(disp);
     }
     else
     {
-        if (use_ss)
-        {
-            seg = &cpu->SS;
-        }
-        else
+        if (modrm.rm != 6 || modrm.mod != 0)
         {
-            seg = &cpu->DS;
+            form->base = base16[modrm.rm];
+            form->index = index16[modrm.rm];
+            form->use_ss = (modrm.rm == 2 || modrm.rm == 3 || modrm.rm == 6);
         }
+        if (modrm.mod == 1)
+            form->disp = (int8_t)disp[0];
+        else if (modrm.mod == 2 || modrm.rm == 6)
+            form->disp = MOVSXW(READ_LE16(disp));
     }
+    return 0;
+}
 
-    result->modrm = modrm.modrm;
-    result->offset = offset;
-    result->linear = seg->base + offset;
-    if (result->linear > max_mem)
-        result->linear = null_ptr;
+static inline int MODRM_CTX(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result, const unsigned ctx)
+{
+    cpu_modrm_form_t *form = cpu->modrm_form;
+    if (!form)
+        return MODRM_DECODE(cpu, seg_ovr, result, ctx);
+    // only the first ModRM of an instruction is cached
+    cpu->modrm_form = NULL;
+    if (!form->length)
+        return MODRM_RECORD(cpu, form, seg_ovr, result, ctx);
+    cpu->rip += form->length;
+    result->modrm = form->modrm;
+    if (form->modrm >= 0xC0)
+        return 3;
+    uint32_t offset = form->disp;
+    if (form->base != MODRM_NO_REG)
+        offset += cpu->gpr[form->base];
+    if (form->index != MODRM_NO_REG)
+        offset += cpu->gpr[form->index] << form->scale;
+    if (!(ctx & CPU_CTX_ADDR32))
+        offset &= UINT16_MAX;
+    return MODRM_OFFSET(cpu, seg_ovr, form->use_ss, offset, result);
+}
 
-    return 0;
+static inline int MODRM(cpu_state *cpu, sreg_t *seg_ovr, modrm_t *result)
+{
+    return MODRM_CTX(cpu, seg_ovr, result, cpu->cpu_context);
+}
+
+/**
+ * Reg field of the ModRM byte that the next MODRM call decodes
+ */
+static inline int MODRM_PEEK_REG(cpu_state *cpu)
+{
+    return (*cpu->rip >> 3) & 7;
+}
+
+/**
+ * Host pointer to the memory operand of a ModRM instruction.
+ * An offset outside the window of its segment is checked against the limit and type,
+ * a violation leaves a fault pending and the operand reads as all ones.
+ */
+static inline void *MODRM_OPERAND(cpu_state *cpu, const modrm_t *modrm, const int size, const int write)
+{
+    sreg_t *seg = modrm->seg;
+    const uint32_t span = write ? seg->write_span : seg->read_span;
+    if (modrm->offset >= span && !SEGMENT_CHECK(cpu, seg, modrm->offset, size, write))
+    {
+        memset(cpu->opr_copy.data, UINT8_MAX, sizeof(cpu->opr_copy.data));
+        return cpu->opr_copy.data;
+    }
+    return MEMORY_OPERAND(cpu, modrm->linear, size, write);
 }
 
-static inline void MODRM_W_D(cpu_state *cpu, sreg_t *seg, const int w, const int d, operand_set *set)
+/**
+ * Decode the operands of a ModRM instruction
+ *
+ * @param write nonzero if the instruction stores its memory operand (only then a write access is checked)
+ */
+static inline void MODRM_W_D_CTX(cpu_state *cpu, sreg_t *seg, const int w, const int d, const int write, operand_set *set, const unsigned ctx)
 {
     modrm_t modrm;
     void *opr1;
     void *opr2;
-    if (MODRM(cpu, seg, &modrm))
+    if (w)
+    {
+        if (ctx & CPU_CTX_DATA32)
+        {
+            set->size = 2;
+        }
+        else
+        {
+            set->size = 1;
+        }
+    }
+    else
+    {
+        set->size = 0;
+    }
+    if (MODRM_CTX(cpu, seg, &modrm, ctx))
     {
         if (w)
         {
@@ -1668,7 +2829,7 @@ static inline void MODRM_W_D(cpu_state *cpu, sreg_t *seg, const int w, const int
     }
     else
     {
-        opr1 = mem + modrm.linear;
+        opr1 = MODRM_OPERAND(cpu, &modrm, 1 << set->size, write);
     }
     if (w)
     {
@@ -1684,21 +2845,6 @@ static inline void MODRM_W_D(cpu_state *cpu, sreg_t *seg, const int w, const int
         opr1 = opr2;
         opr2 = temp;
     }
-    if (w)
-    {
-        if (cpu->cpu_context & CPU_CTX_DATA32)
-        {
-            set->size = 2;
-        }
-        else
-        {
-            set->size = 1;
-        }
-    }
-    else
-    {
-        set->size = 0;
-    }
     set->opr1 = opr1;
 
     switch (set->size)
@@ -1714,53 +2860,68 @@ static inline void MODRM_W_D(cpu_state *cpu, sreg_t *seg, const int w, const int
     }
 }
 
-static inline int MODRM_W(cpu_state *cpu, sreg_t *seg, const int w, operand_set *set)
+static inline void MODRM_W_D(cpu_state *cpu, sreg_t *seg, const int w, const int d, const int write, operand_set *set)
+{
+    MODRM_W_D_CTX(cpu, seg, w, d, write, set, cpu->cpu_context);
+}
+
+/**
+ * Decode the r/m operand of a ModRM instruction, the reg field is left in set->opr2
+ *
+ * @param write nonzero if the instruction stores its memory operand (only then a write access is checked)
+ */
+static inline int MODRM_W_CTX(cpu_state *cpu, sreg_t *seg, const int w, const int write, operand_set *set, const unsigned ctx)
 {
     int result = 0;
     modrm_t modrm;
-    if (MODRM(cpu, seg, &modrm))
+    if (w)
     {
-        if (w)
+        if (ctx & CPU_CTX_DATA32)
         {
-            set->opr1 = &cpu->gpr[modrm.rm];
+            set->size = 2;
         }
         else
         {
-            set->opr1 = LEA_REG8(cpu, modrm.rm);
+            set->size = 1;
         }
-        result = 3;
     }
     else
     {
-        set->opr1 = mem + modrm.linear;
+        set->size = 0;
     }
-    if (w)
+    if (MODRM_CTX(cpu, seg, &modrm, ctx))
     {
-        if (cpu->cpu_context & CPU_CTX_DATA32)
+        if (w)
         {
-            set->size = 2;
+            set->opr1 = &cpu->gpr[modrm.rm];
         }
         else
         {
-            set->size = 1;
+            set->opr1 = LEA_REG8(cpu, modrm.rm);
         }
+        result = 3;
     }
     else
     {
-        set->size = 0;
+        set->opr1 = MODRM_OPERAND(cpu, &modrm, 1 << set->size, write);
     }
     set->opr2 = modrm.reg;
     return result;
 }
 
-static inline void OPR(cpu_state *cpu, sreg_t *seg, const uint8_t opcode, operand_set *set)
+static inline int MODRM_W(cpu_state *cpu, sreg_t *seg, const int w, const int write, operand_set *set)
+{
+    return MODRM_W_CTX(cpu, seg, w, write, set, cpu->cpu_context);
+}
+
+static inline void OPR_CTX(cpu_state *cpu, sreg_t *seg, const uint8_t opcode, operand_set *set, const unsigned ctx)
 {
     const int w = opcode & 1;
     if (opcode & 4)
     {
         if (w)
         {
-            if (cpu->cpu_context & CPU_CTX_DATA32)
+            if (ctx & CPU_CTX_DATA32)
             {
                 set->size = 2;
             }
@@ -1789,18 +2950,13 @@ static inline void OPR(cpu_state *cpu, sreg_t *seg, const uint8_t opcode, operan
     }
     else
     {
-        MODRM_W_D(cpu, seg, w, opcode & 2, set);
+        MODRM_W_D_CTX(cpu, seg, w, opcode & 2, !(opcode & 2) && (opcode & 0x38) != 0x38, set, ctx);
     }
 }
 
-static inline void ADD8(cpu_state *cpu, operand_set *set)
+static inline void OPR(cpu_state *cpu, sreg_t *seg, const uint8_t opcode, operand_set *set)
 {
-    const int src = set->opr2;
-    const int dst = *(int8_t *)set->opr1;
-    const int value = dst + src;
-    cpu->AF = (dst & 15) + (src & 15) > 15;
-    cpu->CF = (uint8_t)dst > (uint8_t)value;
-    *set->opr1b = SETFA8(cpu, value);
+    OPR_CTX(cpu, seg, opcode, set, cpu->cpu_context);
 }
 
 static inline void ADD(cpu_state *cpu, operand_set *set)
@@ -1812,9 +2968,8 @@ static inline void ADD(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = *(int8_t *)set->opr1;
         const int value = dst + src;
-        cpu->AF = (dst & 15) + (src & 15) > 15;
-        cpu->CF = (uint8_t)dst > (uint8_t)value;
-        *set->opr1b = SETFA8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_add, 0, dst, src, value, 0);
+        *set->opr1b = value;
         break;
     }
     case 1:
@@ -1822,9 +2977,8 @@ static inline void ADD(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = MOVSXW(READ_LE16(set->opr1));
         const int value = dst + src;
-        cpu->AF = (dst & 15) + (src & 15) > 15;
-        cpu->CF = (uint16_t)dst > (uint16_t)value;
-        WRITE_LE16(set->opr1, SETFA16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_add, 1, dst, src, value, 0);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
@@ -1832,9 +2986,8 @@ static inline void ADD(cpu_state *cpu, operand_set *set)
         const int src = MOVSXD(set->opr2);
         const int dst = MOVSXD(READ_LE32(set->opr1));
         const int value = dst + src;
-        cpu->AF = (dst & 15) + (src & 15) > 15;
-        cpu->CF = (uint32_t)dst > (uint32_t)value;
-        WRITE_LE32(set->opr1, SETFA32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_add, 2, dst, src, value, 0);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
@@ -1842,7 +2995,7 @@ static inline void ADD(cpu_state *cpu, operand_set *set)
 
 static inline void ADC(cpu_state *cpu, operand_set *set)
 {
-    const int c = cpu->CF;
+    const int c = LAZY_CF(cpu);
     switch (set->size)
     {
     case 0:
@@ -1850,9 +3003,8 @@ static inline void ADC(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = *(int8_t *)set->opr1;
         const int value = dst + src + c;
-        cpu->AF = ((dst & 15) + (src & 15) + c) > 15;
-        cpu->CF = (uint8_t)dst > (uint8_t)value || (c && !(src + 1));
-        *set->opr1b = SETFA8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_adc, 0, dst, src, value, c);
+        *set->opr1b = value;
         break;
     }
     case 1:
@@ -1860,9 +3012,8 @@ static inline void ADC(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = MOVSXW(READ_LE16(set->opr1));
         const int value = dst + src + c;
-        cpu->AF = ((dst & 15) + (src & 15) + c) > 15;
-        cpu->CF = (uint16_t)dst > (uint16_t)value || (c && !(src + 1));
-        WRITE_LE16(set->opr1, SETFA16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_adc, 1, dst, src, value, c);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
@@ -1870,9 +3021,8 @@ static inline void ADC(cpu_state *cpu, operand_set *set)
         const int src = MOVSXD(set->opr2);
         const int dst = MOVSXD(READ_LE32(set->opr1));
         const int value = dst + src + c;
-        cpu->AF = ((dst & 15) + (src & 15) + c) > 15;
-        cpu->CF = (uint32_t)dst > (uint32_t)value || (c && !(src + 1));
-        WRITE_LE32(set->opr1, SETFA32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_adc, 2, dst, src, value, c);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
@@ -1880,20 +3030,11 @@ static inline void ADC(cpu_state *cpu, operand_set *set)
 
 static inline void INC(cpu_state *cpu, operand_set *set)
 {
-    int saved_cf = cpu->CF;
+    const int saved_cf = LAZY_CF(cpu);
     set->opr2 = 1;
     ADD(cpu, set);
-    cpu->CF = saved_cf;
-}
-
-static inline void SUB8(cpu_state *cpu, operand_set *set)
-{
-    const int src = set->opr2;
-    const int dst = *(int8_t *)set->opr1;
-    const int value = dst - src;
-    cpu->AF = ((dst & 15) - (src & 15)) < 0;
-    cpu->CF = (uint8_t)dst < (uint8_t)src;
-    *set->opr1b = SETFA8(cpu, value);
+    cpu->lazy_op = lazy_inc;
+    cpu->lazy_aux = saved_cf;
 }
 
 static inline void SUB(cpu_state *cpu, operand_set *set)
@@ -1905,9 +3046,8 @@ static inline void SUB(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = *(int8_t *)set->opr1;
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint8_t)dst < (uint8_t)src;
-        *set->opr1b = SETFA8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_sub, 0, dst, src, value, 0);
+        *set->opr1b = value;
         break;
     }
     case 1:
@@ -1915,9 +3055,8 @@ static inline void SUB(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = MOVSXW(READ_LE16(set->opr1));
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint16_t)dst < (uint16_t)src;
-        WRITE_LE16(set->opr1, SETFA16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_sub, 1, dst, src, value, 0);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
@@ -1925,9 +3064,8 @@ static inline void SUB(cpu_state *cpu, operand_set *set)
         const int src = MOVSXD(set->opr2);
         const int dst = MOVSXD(READ_LE32(set->opr1));
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint32_t)dst < (uint32_t)src;
-        WRITE_LE32(set->opr1, SETFA32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_sub, 2, dst, src, value, 0);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
@@ -1935,7 +3073,7 @@ static inline void SUB(cpu_state *cpu, operand_set *set)
 
 static inline void SBC(cpu_state *cpu, operand_set *set)
 {
-    const int c = cpu->CF;
+    const int c = LAZY_CF(cpu);
     switch (set->size)
     {
     case 0:
@@ -1943,9 +3081,8 @@ static inline void SBC(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = *(int8_t *)set->opr1;
         const int value = dst - src - c;
-        cpu->AF = (dst & 15) - (src & 15) - c < 0;
-        cpu->CF = (uint8_t)dst < (uint8_t)src + c || (c && !(src + 1));
-        *set->opr1b = SETFA8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_sbb, 0, dst, src, value, c);
+        *set->opr1b = value;
         break;
     }
     case 1:
@@ -1953,9 +3090,8 @@ static inline void SBC(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = MOVSXW(READ_LE16(set->opr1));
         const int value = dst - src - c;
-        cpu->AF = (dst & 15) - (src & 15) - c < 0;
-        cpu->CF = (uint16_t)dst < (uint16_t)src + c || (c && !(src + 1));
-        WRITE_LE16(set->opr1, SETFA16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_sbb, 1, dst, src, value, c);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
@@ -1963,24 +3099,13 @@ static inline void SBC(cpu_state *cpu, operand_set *set)
         const int src = MOVSXD(set->opr2);
         const int dst = MOVSXD(READ_LE32(set->opr1));
         const int value = dst - src - c;
-        cpu->AF = (dst & 15) - (src & 15) - c < 0;
-        cpu->CF = (uint32_t)dst < (uint32_t)src + c || (c && !(src + 1));
-        WRITE_LE32(set->opr1, SETFA32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_sbb, 2, dst, src, value, c);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
 }
 
-static inline void CMP8(cpu_state *cpu, operand_set *set)
-{
-    const int src = set->opr2;
-    const int dst = *(int8_t *)set->opr1;
-    const int value = dst - src;
-    cpu->AF = ((dst & 15) - (src & 15)) < 0;
-    cpu->CF = (uint8_t)dst < (uint8_t)src;
-    SETFA8(cpu, value);
-}
-
 static inline void CMP(cpu_state *cpu, operand_set *set)
 {
     switch (set->size)
@@ -1990,9 +3115,7 @@ static inline void CMP(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = *(int8_t *)set->opr1;
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint8_t)dst < (uint8_t)src;
-        SETFA8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_sub, 0, dst, src, value, 0);
         break;
     }
     case 1:
@@ -2000,9 +3123,7 @@ static inline void CMP(cpu_state *cpu, operand_set *set)
         const int src = set->opr2;
         const int dst = MOVSXW(READ_LE16(set->opr1));
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint16_t)dst < (uint16_t)src;
-        SETFA16(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_sub, 1, dst, src, value, 0);
         break;
     }
     case 2:
@@ -2010,9 +3131,7 @@ static inline void CMP(cpu_state *cpu, operand_set *set)
         const int src = MOVSXD(set->opr2);
         const int dst = MOVSXD(READ_LE32(set->opr1));
         const int value = dst - src;
-        cpu->AF = ((dst & 15) - (src & 15)) < 0;
-        cpu->CF = (uint32_t)dst < (uint32_t)src;
-        SETFA32(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_sub, 2, dst, src, value, 0);
         break;
     }
     }
@@ -2020,47 +3139,51 @@ static inline void CMP(cpu_state *cpu, operand_set *set)
 
 static inline void DEC(cpu_state *cpu, operand_set *set)
 {
-    int saved_cf = cpu->CF;
+    const int saved_cf = LAZY_CF(cpu);
     set->opr2 = 1;
     SUB(cpu, set);
-    cpu->CF = saved_cf;
+    cpu->lazy_op = lazy_dec;
+    cpu->lazy_aux = saved_cf;
 }
 
 static inline void OR(cpu_state *cpu, operand_set *set)
 {
+    const int af = LAZY_AF(cpu);
     switch (set->size)
     {
     case 0:
     {
         const int value = *set->opr1b | set->opr2;
-        *set->opr1b = SETFL8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_logic, 0, 0, 0, value, af);
+        *set->opr1b = value;
         break;
     }
     case 1:
     {
         const int value = READ_LE16(set->opr1) | set->opr2;
-        WRITE_LE16(set->opr1, SETFL16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_logic, 1, 0, 0, value, af);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
     {
         const int value = READ_LE32(set->opr1) | set->opr2;
-        WRITE_LE32(set->opr1, SETFL32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_logic, 2, 0, 0, value, af);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
-    cpu->CF = 0;
-    cpu->OF = 0;
 }
 
 static inline void AND(cpu_state *cpu, operand_set *set, int test)
 {
+    const int af = LAZY_AF(cpu);
     switch (set->size)
     {
     case 0:
     {
         const int value = *set->opr1b & set->opr2;
-        SETFL8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_logic, 0, 0, 0, value, af);
         if (!test)
             *set->opr1b = value;
         break;
@@ -2068,7 +3191,7 @@ static inline void AND(cpu_state *cpu, operand_set *set, int test)
     case 1:
     {
         const int value = READ_LE16(set->opr1) & set->opr2;
-        SETFL16(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_logic, 1, 0, 0, value, af);
         if (!test)
             WRITE_LE16(set->opr1, value);
         break;
@@ -2076,48 +3199,47 @@ static inline void AND(cpu_state *cpu, operand_set *set, int test)
     case 2:
     {
         const int value = READ_LE32(set->opr1) & set->opr2;
-        SETFL32(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_logic, 2, 0, 0, value, af);
         if (!test)
             WRITE_LE32(set->opr1, value);
         break;
     }
     }
-    cpu->CF = 0;
-    cpu->OF = 0;
 }
 
 static inline void XOR(cpu_state *cpu, operand_set *set)
 {
+    const int af = LAZY_AF(cpu);
     switch (set->size)
     {
     case 0:
     {
         const int value = *set->opr1b ^ set->opr2;
-        *set->opr1b = SETFL8(cpu, value);
+        SET_LAZY_FLAGS(cpu, lazy_logic, 0, 0, 0, value, af);
+        *set->opr1b = value;
         break;
     }
     case 1:
     {
         const int value = READ_LE16(set->opr1) ^ set->opr2;
-        WRITE_LE16(set->opr1, SETFL16(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_logic, 1, 0, 0, value, af);
+        WRITE_LE16(set->opr1, value);
         break;
     }
     case 2:
     {
         const int value = READ_LE32(set->opr1) ^ set->opr2;
-        WRITE_LE32(set->opr1, SETFL32(cpu, value));
+        SET_LAZY_FLAGS(cpu, lazy_logic, 2, 0, 0, value, af);
+        WRITE_LE32(set->opr1, value);
         break;
     }
     }
-    cpu->CF = 0;
-    cpu->OF = 0;
 }
-
-static inline int JUMP_IF(cpu_state *cpu, const int disp, const int cc)
+static inline int JUMP_IF_CTX(cpu_state *cpu, const int disp, const int cc, const unsigned ctx)
 {
     if (cc)
     {
-        if (cpu->cpu_context & CPU_CTX_DATA32)
+        if (ctx & CPU_CTX_DATA32)
         {
             cpu->rip += disp;
         }
@@ -2131,9 +3253,50 @@ static inline int JUMP_IF(cpu_state *cpu, const int disp, const int cc)
     return 0;
 }
 
+static inline int JUMP_IF(cpu_state *cpu, const int disp, const int cc)
+{
+    return JUMP_IF_CTX(cpu, disp, cc, cpu->cpu_context);
+}
+
+// Evaluate Conditions from pending flags without writing them back
+static int EVAL_CC_LAZY(cpu_state *cpu, const int cc)
+{
+    int result;
+    switch ((cc >> 1) & 7)
+    {
+    case 0: // xO
+        result = LAZY_OF(cpu);
+        break;
+    case 1: // xC
+        result = LAZY_CF(cpu);
+        break;
+    case 2: // xZ
+        result = LAZY_ZF(cpu);
+        break;
+    case 3: // xBE
+        result = LAZY_CF(cpu) || LAZY_ZF(cpu);
+        break;
+    case 4: // xS
+        result = LAZY_SF(cpu);
+        break;
+    case 5: // xP
+        result = LAZY_PF(cpu);
+        break;
+    case 6: // xL
+        result = LAZY_SF(cpu) != LAZY_OF(cpu);
+        break;
+    default: // xLE
+        result = LAZY_ZF(cpu) || (LAZY_SF(cpu) != LAZY_OF(cpu));
+        break;
+    }
+    return result ^ (cc & 1);
+}
+
 // Evaluate Conditions for Jcc, SETcc, CMOVcc
 static inline int EVAL_CC(cpu_state *cpu, const int cc)
 {
+    if (cpu->lazy_op)
+        return EVAL_CC_LAZY(cpu, cc);
     switch (cc & 0xF)
     {
     case 0: // xO
@@ -2187,6 +3350,43 @@ static inline int EVAL_CC(cpu_state *cpu, const int cc)
     TRAP_NORETURN();
 }
 
+// Evaluate Conditions after CMP/SUB by comparing the operands directly
+static inline int EVAL_CC_SUB(cpu_state *cpu, const int cc)
+{
+    uint32_t dst, src;
+    switch (cpu->lazy_size)
+    {
+    case 0:
+        dst = (uint8_t)cpu->lazy_dst;
+        src = (uint8_t)cpu->lazy_src;
+        break;
+    case 1:
+        dst = (uint16_t)cpu->lazy_dst;
+        src = (uint16_t)cpu->lazy_src;
+        break;
+    default:
+        dst = cpu->lazy_dst;
+        src = cpu->lazy_src;
+        break;
+    }
+    int result;
+    switch ((cc >> 1) & 7)
+    {
+    case 1: // xC
+        result = dst < src;
+        break;
+    case 2: // xZ
+        result = dst == src;
+        break;
+    case 3: // xBE
+        result = dst <= src;
+        break;
+    default: // OF and SF must agree with what LAZY_OF and LAZY_SF report
+        return EVAL_CC_LAZY(cpu, cc);
+    }
+    return result ^ (cc & 1);
+}
+
 static int SHIFT(cpu_state *cpu, operand_set *set, int c)
 {
     uint32_t m;
@@ -2549,7 +3749,7 @@ static void IMUL3(cpu_state *cpu, operand_set *set, int imm)
 static int LDS(cpu_state *cpu, sreg_t *seg_ovr, sreg_t *target)
 {
     operand_set set;
-    if (MODRM_W(cpu, seg_ovr, 1, &set))
+    if (MODRM_W(cpu, seg_ovr, 1, 0, &set))
         return cpu_status_ud; // VEX
     uint16_t new_sel;
     uint32_t offset;
@@ -2636,11 +3836,28 @@ static int MOV_CR(cpu_state *cpu, int cr, uint32_t value)
         uint32_t set_changed = value & changed;
         if (set_changed & ~cpu->cr0_valid)
             return cpu_status_gpf;
+        // PG requires PE
+        if ((value & 0x80000001) == 0x80000000)
+            return cpu_status_gpf;
+        const uint32_t eip = cpu_reflect_rip_to_eip(cpu);
         cpu->CR[cr] = value;
+        if (changed & 0x80010000)
+        {
+            // PG or WP
+            cpu_tlb_flush(cpu);
+            cpu_rebase_code(cpu);
+            cpu_set_eip(cpu, eip);
+            for (int i = 0; i < 6; i++)
+            {
+                sreg_refresh(cpu, &cpu->sregs[i]);
+            }
+        }
         return 0;
     }
     case 3:
         cpu->CR[cr] = value;
+        cpu_tlb_flush(cpu);
+        cpu->code_lo = (cpu_rip_t)UINTPTR_MAX;
         return 0;
     case 4:
     {
@@ -2675,7 +3892,17 @@ static void BitTest(cpu_state *cpu, operand_set *set, const int mod, const uint3
     else
     {
         uint32_t offset = src >> 5;
-        dst = (uint32_t *)(set->opr1b + offset);
+        if (cpu->CR0.PG)
+        {
+            dst = offset ? PAGED_OPERAND(cpu, cpu->opr_copy.linear + offset, 4, op != BitTestOp_BT) : set->opr1;
+        }
+        else
+        {
+            dst = (uint32_t *)(set->opr1b + offset);
+            const uint32_t linear = (uint8_t *)dst - mem;
+            if (op != BitTestOp_BT && linear < max_mem)
+                memory_notify_write(linear);
+        }
     }
     const uint32_t value = READ_LE32(dst);
     cpu->CF = (value & mask) != 0;
@@ -2701,6 +3928,22 @@ static void BitTest(cpu_state *cpu, operand_set *set, const int mod, const uint3
 #define PREFIX_66 0x00000010
 #define PREFIX_67 0x00000020
 
+/**
+ * Forward REP MOVS as a single copy if both ranges are inside the windows of their segments
+ * and the destination does not overlap the source from above
+ */
+static int MOVS_BULK(cpu_state *cpu, sreg_t *seg, const int size, const uint32_t si, const uint32_t di, const uint32_t count, const uint32_t index_mask)
+{
+    const uint32_t src = LINEAR_RANGE(seg, seg->read_span, si, count, size, index_mask);
+    const uint32_t dst = LINEAR_RANGE(&cpu->ES, cpu->ES.write_span, di, count, size, index_mask);
+    const uint32_t bytes = count << size;
+    if (src == UINT32_MAX || dst == UINT32_MAX || (dst > src && dst < src + bytes))
+        return 0;
+    __builtin_memcpy(mem + dst, mem + src, bytes);
+    memory_notify_range(dst, bytes);
+    return 1;
+}
+
 static int MOVS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
 {
     int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
@@ -2723,34 +3966,58 @@ static int MOVS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     if (rep && count == 0)
         return 0;
 
-    switch (size)
+    if (rep && !cpu->DF && count > 1 && !cpu->CR0.PG && MOVS_BULK(cpu, seg, size, si & index_mask, di & index_mask, count, index_mask))
     {
-    case 0:
-        do
+        si += count << size;
+        di += count << size;
+        count = 0;
+    }
+    else
+    {
+        switch (size)
         {
-            WRITE_MEM8(&cpu->ES, di & index_mask, READ_MEM8(seg, si & index_mask));
-            si += increment;
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 0:
+            do
+            {
+                const uint8_t value = READ_MEM8(cpu, seg, si & index_mask);
+                if (cpu->pending_fault)
+                    break;
+                WRITE_MEM8(cpu, &cpu->ES, di & index_mask, value);
+                if (cpu->pending_fault)
+                    break;
+                si += increment;
+                di += increment;
+            } while (rep && --count);
+            break;
 
-    case 1:
-        do
-        {
-            WRITE_MEM16(&cpu->ES, di & index_mask, READ_MEM16(seg, si & index_mask));
-            si += increment;
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 1:
+            do
+            {
+                const uint16_t value = READ_MEM16(cpu, seg, si & index_mask);
+                if (cpu->pending_fault)
+                    break;
+                WRITE_MEM16(cpu, &cpu->ES, di & index_mask, value);
+                if (cpu->pending_fault)
+                    break;
+                si += increment;
+                di += increment;
+            } while (rep && --count);
+            break;
 
-    case 2:
-        do
-        {
-            WRITE_MEM32(&cpu->ES, di & index_mask, READ_MEM32(seg, si & index_mask));
-            si += increment;
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 2:
+            do
+            {
+                const uint32_t value = READ_MEM32(cpu, seg, si & index_mask);
+                if (cpu->pending_fault)
+                    break;
+                WRITE_MEM32(cpu, &cpu->ES, di & index_mask, value);
+                if (cpu->pending_fault)
+                    break;
+                si += increment;
+                di += increment;
+            } while (rep && --count);
+            break;
+        }
     }
 
     if (cpu->cpu_context & CPU_CTX_ADDR32)
@@ -2767,16 +4034,64 @@ static int MOVS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
         if (rep)
             cpu->CX = count;
     }
+    cpu_string_resume(cpu);
 
     return 0;
 }
 
-static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
+/**
+ * Number of bytes from offset, up to count, that stay inside the window given by span (see sreg_refresh)
+ * without wrapping around the segment
+ */
+static inline uint32_t LINEAR_SPAN(const uint32_t span, const uint32_t offset, const uint32_t count, const uint32_t index_mask)
 {
-    int repz = prefix & PREFIX_REPZ;
-    int repnz = prefix & PREFIX_REPNZ;
-    int rep = repz | repnz;
-    uint32_t count, si, di, index_mask;
+    uint32_t n = count;
+    if (n == 0 || offset >= span)
+        return 0;
+    if (n - 1 > index_mask - offset)
+        n = index_mask - offset + 1;
+    // the window holds a dword at each offset below the span, so its last byte is at span + 2
+    if (n - 1 > span + 2 - offset)
+        n = span + 3 - offset;
+    return n;
+}
+
+/**
+ * Count the leading bytes of p that do not end a REPZ (stop_on_equal = 0) or REPNZ (stop_on_equal = 1) loop.
+ * They are compared with the bytes of q, or with value if q is NULL.
+ * Compares 16 bytes at a time if the module is built with SIMD128.
+ */
+static uint32_t SCAN_BYTES(const uint8_t *p, const uint8_t *q, const uint8_t value, const uint32_t n, const int stop_on_equal)
+{
+    uint32_t i = 0;
+#ifdef __wasm_simd128__
+    const v128_t splat = wasm_i8x16_splat(value);
+    for (; i + 16 <= n; i += 16)
+    {
+        const v128_t a = wasm_v128_load(p + i);
+        const v128_t b = q ? wasm_v128_load(q + i) : splat;
+        uint32_t mask = wasm_i8x16_bitmask(wasm_i8x16_eq(a, b));
+        if (!stop_on_equal)
+            mask ^= 0xFFFF;
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < n; i++)
+    {
+        const uint8_t b = q ? q[i] : value;
+        if ((p[i] == b) == !!stop_on_equal)
+            return i;
+    }
+    return n;
+}
+
+static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
+{
+    int repz = prefix & PREFIX_REPZ;
+    int repnz = prefix & PREFIX_REPNZ;
+    int rep = repz | repnz;
+    uint32_t count, si, di, index_mask;
     int increment = (1 << size) * (cpu->DF ? -1 : 1);
     if (cpu->cpu_context & CPU_CTX_ADDR32)
     {
@@ -2795,13 +4110,31 @@ static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     if (rep && count == 0)
         return 0;
 
+    // Skip the bytes that do not end the loop, the scalar loop below runs the last one and sets the flags
+    if (size == 0 && rep && rep != (PREFIX_REPZ | PREFIX_REPNZ) && !cpu->DF && count > 1 && !cpu->CR0.PG)
+    {
+        uint32_t n = LINEAR_SPAN(seg->read_span, si & index_mask, count - 1, index_mask);
+        n = LINEAR_SPAN(cpu->ES.read_span, di & index_mask, n, index_mask);
+        const uint32_t linear_si = LINEAR_RANGE(seg, seg->read_span, si & index_mask, n, 0, index_mask);
+        const uint32_t linear_di = LINEAR_RANGE(&cpu->ES, cpu->ES.read_span, di & index_mask, n, 0, index_mask);
+        if (linear_si != UINT32_MAX && linear_di != UINT32_MAX)
+        {
+            const uint32_t skip = SCAN_BYTES(mem + linear_si, mem + linear_di, 0, n, repnz);
+            si += skip;
+            di += skip;
+            count -= skip;
+        }
+    }
+
     switch (size)
     {
     case 0:
         do
         {
-            int dst = MOVSXB(READ_MEM8(seg, si & index_mask));
-            int src = MOVSXB(READ_MEM8(&cpu->ES, di & index_mask));
+            int dst = MOVSXB(READ_MEM8(cpu, seg, si & index_mask));
+            int src = MOVSXB(READ_MEM8(cpu, &cpu->ES, di & index_mask));
+            if (cpu->pending_fault)
+                break;
             int value = dst - src;
             cpu->AF = (dst & 15) - (src & 15) < 0;
             cpu->CF = dst < src;
@@ -2814,8 +4147,10 @@ static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     case 1:
         do
         {
-            int dst = MOVSXW(READ_MEM16(seg, si & index_mask));
-            int src = MOVSXW(READ_MEM16(&cpu->ES, di & index_mask));
+            int dst = MOVSXW(READ_MEM16(cpu, seg, si & index_mask));
+            int src = MOVSXW(READ_MEM16(cpu, &cpu->ES, di & index_mask));
+            if (cpu->pending_fault)
+                break;
             int value = dst - src;
             cpu->AF = (dst & 15) - (src & 15) < 0;
             cpu->CF = dst < src;
@@ -2828,8 +4163,10 @@ static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     case 2:
         do
         {
-            int64_t dst = (int)READ_MEM32(seg, si & index_mask);
-            int64_t src = (int)READ_MEM32(&cpu->ES, di & index_mask);
+            int64_t dst = (int)READ_MEM32(cpu, seg, si & index_mask);
+            int64_t src = (int)READ_MEM32(cpu, &cpu->ES, di & index_mask);
+            if (cpu->pending_fault)
+                break;
             int64_t value = dst - src;
             cpu->AF = (dst & 15) - (src & 15) < 0;
             cpu->CF = dst < src;
@@ -2854,10 +4191,47 @@ static int CMPS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
         if (rep)
             cpu->CX = count;
     }
+    cpu_string_resume(cpu);
 
     return 0;
 }
 
+/**
+ * Forward REP STOS as a single fill if the range is inside the window of ES
+ */
+static int STOS_BULK(sreg_t *seg, const int size, const uint32_t di, const uint32_t count, const uint32_t index_mask, const uint32_t value)
+{
+    const uint32_t linear = LINEAR_RANGE(seg, seg->write_span, di, count, size, index_mask);
+    if (linear == UINT32_MAX)
+        return 0;
+    switch (size)
+    {
+    case 0:
+        __builtin_memset(mem + linear, value, count);
+        break;
+    case 1:
+    {
+        uint16_t *p = (uint16_t *)(mem + linear);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            p[i] = value;
+        }
+        break;
+    }
+    case 2:
+    {
+        uint32_t *p = (uint32_t *)(mem + linear);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            p[i] = value;
+        }
+        break;
+    }
+    }
+    memory_notify_range(linear, count << size);
+    return 1;
+}
+
 static int STOS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
 {
     // The ES segment cannot be overridden with a segment override prefix.
@@ -2881,31 +4255,45 @@ static int STOS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
     if (rep && count == 0)
         return 0;
 
-    switch (size)
+    if (rep && !cpu->DF && count > 1 && !cpu->CR0.PG && STOS_BULK(seg, size, di & index_mask, count, index_mask, ax))
     {
-    case 0:
-        do
+        di += count << size;
+        count = 0;
+    }
+    else
+    {
+        switch (size)
         {
-            WRITE_MEM8(seg, di & index_mask, ax);
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 0:
+            do
+            {
+                WRITE_MEM8(cpu, seg, di & index_mask, ax);
+                if (cpu->pending_fault)
+                    break;
+                di += increment;
+            } while (rep && --count);
+            break;
 
-    case 1:
-        do
-        {
-            WRITE_MEM16(seg, di & index_mask, ax);
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 1:
+            do
+            {
+                WRITE_MEM16(cpu, seg, di & index_mask, ax);
+                if (cpu->pending_fault)
+                    break;
+                di += increment;
+            } while (rep && --count);
+            break;
 
-    case 2:
-        do
-        {
-            WRITE_MEM32(seg, di & index_mask, ax);
-            di += increment;
-        } while (rep && --count);
-        break;
+        case 2:
+            do
+            {
+                WRITE_MEM32(cpu, seg, di & index_mask, ax);
+                if (cpu->pending_fault)
+                    break;
+                di += increment;
+            } while (rep && --count);
+            break;
+        }
     }
 
     if (cpu->cpu_context & CPU_CTX_ADDR32)
@@ -2920,6 +4308,7 @@ static int STOS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
         if (rep)
             cpu->CX = count;
     }
+    cpu_string_resume(cpu);
 
     return 0;
 }
@@ -2951,7 +4340,7 @@ static int LODS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     case 0:
         do
         {
-            cpu->AL = READ_MEM8(seg, si & index_mask);
+            cpu->AL = READ_MEM8(cpu, seg, si & index_mask);
             si += increment;
         } while (rep && --count);
         break;
@@ -2959,7 +4348,7 @@ static int LODS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     case 1:
         do
         {
-            cpu->AX = READ_MEM16(seg, si & index_mask);
+            cpu->AX = READ_MEM16(cpu, seg, si & index_mask);
             si += increment;
         } while (rep && --count);
         break;
@@ -2967,7 +4356,7 @@ static int LODS(cpu_state *cpu, sreg_t *seg, int size, int prefix)
     case 2:
         do
         {
-            cpu->EAX = READ_MEM32(seg, si & index_mask);
+            cpu->EAX = READ_MEM32(cpu, seg, si & index_mask);
             si += increment;
         } while (rep && --count);
         break;
@@ -3013,6 +4402,19 @@ static int SCAS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
     if (rep && count == 0)
         return 0;
 
+    // Skip the bytes that do not end the loop, the scalar loop below runs the last one and sets the flags
+    if (size == 0 && rep && rep != (PREFIX_REPZ | PREFIX_REPNZ) && !cpu->DF && count > 1 && !cpu->CR0.PG)
+    {
+        const uint32_t n = LINEAR_SPAN(seg->read_span, di & index_mask, count - 1, index_mask);
+        const uint32_t linear = LINEAR_RANGE(seg, seg->read_span, di & index_mask, n, 0, index_mask);
+        if (linear != UINT32_MAX)
+        {
+            const uint32_t skip = SCAN_BYTES(mem + linear, NULL, cpu->AL, n, repnz);
+            di += skip;
+            count -= skip;
+        }
+    }
+
     switch (size)
     {
     case 0:
@@ -3020,7 +4422,9 @@ static int SCAS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
         int al = MOVSXB(cpu->AL);
         do
         {
-            int src = MOVSXB(READ_MEM8(seg, di & index_mask));
+            int src = MOVSXB(READ_MEM8(cpu, seg, di & index_mask));
+            if (cpu->pending_fault)
+                break;
             int value = al - src;
             cpu->AF = (al & 15) - (src & 15) < 0;
             cpu->CF = al < src;
@@ -3035,7 +4439,9 @@ static int SCAS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
         int ax = MOVSXW(cpu->AX);
         do
         {
-            int src = MOVSXW(READ_MEM16(seg, di & index_mask));
+            int src = MOVSXW(READ_MEM16(cpu, seg, di & index_mask));
+            if (cpu->pending_fault)
+                break;
             int value = ax - src;
             cpu->AF = (ax & 15) - (src & 15) < 0;
             cpu->CF = ax < src;
@@ -3050,7 +4456,9 @@ static int SCAS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
         int eax = (cpu->EAX);
         do
         {
-            int src = (READ_MEM32(seg, di & index_mask));
+            int src = (READ_MEM32(cpu, seg, di & index_mask));
+            if (cpu->pending_fault)
+                break;
             int value = eax - src;
             cpu->AF = (eax & 15) - (src & 15) < 0;
             cpu->CF = eax < src;
@@ -3073,6 +4481,7 @@ static int SCAS(cpu_state *cpu, sreg_t *_unused, int size, int prefix)
         if (rep)
             cpu->CX = count;
     }
+    cpu_string_resume(cpu);
 
     return 0;
 }
@@ -3085,41 +4494,43 @@ static inline int RDTSC(cpu_state *cpu)
     return cpu_status_tsc;
 }
 
-static int cpu_step(cpu_state *cpu)
+/**
+ * Decode prefixes and opcode of the instruction at rip
+ */
+static int cpu_decode(cpu_state *cpu, cpu_uop_t *uop)
 {
-    cpu_last_known_eip(cpu);
-    operand_set set;
+    cpu_rip_t rip = cpu->rip;
     uint32_t prefix = 0;
-    sreg_t *seg = NULL;
+    uint32_t seg = 0;
     cpu->cpu_context = cpu->default_context;
     for (;;)
     {
-        const uint32_t inst = FETCH8(cpu);
+        uint32_t inst = FETCH8(cpu);
 
         switch (inst)
         {
         case 0x26: // prefix ES:
-            seg = &cpu->ES;
+            seg = index_ES + 1;
             continue;
 
         case 0x2E: // prefix CS:
-            seg = &cpu->CS;
+            seg = index_CS + 1;
             continue;
 
         case 0x36: // prefix SS:
-            seg = &cpu->SS;
+            seg = index_SS + 1;
             continue;
 
         case 0x3E: // prefix DS:
-            seg = &cpu->DS;
+            seg = index_DS + 1;
             continue;
 
         case 0x64: // prefix FS:
-            seg = &cpu->FS;
+            seg = index_FS + 1;
             continue;
 
         case 0x65: // prefix GS:
-            seg = &cpu->GS;
+            seg = index_GS + 1;
             continue;
 
         case 0x66: // prefix 66
@@ -3148,2324 +4559,3833 @@ static int cpu_step(cpu_state *cpu)
             prefix |= PREFIX_REPZ;
             continue;
 
+        case 0x0F: // 2byte op
+            inst = 0x0F00 | FETCH8(cpu);
         default:
-            switch (inst)
-            {
-            case 0x00: // ADD r/m, reg8
-            case 0x01: // ADD r/m, reg16
-            case 0x02: // ADD reg8, r/m
-            case 0x03: // ADD reg16, r/m
-            case 0x04: // ADD AL, imm8
-            case 0x05: // ADD AX, imm16
-                OPR(cpu, seg, inst, &set);
-                ADD(cpu, &set);
-                return 0;
-
-            case 0x06: // PUSH ES
-                PUSHW(cpu, cpu->ES.sel);
-                return 0;
-
-            case 0x07: // POP ES
-                return POP_SEG(cpu, &cpu->ES, type_bitmap_SEG_READ, 1);
-
-            case 0x08: // OR r/m, reg8
-            case 0x09:
-            case 0x0A:
-            case 0x0B:
-            case 0x0C:
-            case 0x0D:
-                OPR(cpu, seg, inst, &set);
-                OR(cpu, &set);
-                return 0;
+        {
+            const uint32_t length = cpu->rip - rip;
+            uop->handler = cpu->ops[cpu->cpu_context & CPU_CTX_SIZE_MASK][inst & 0x1FF];
+            uop->length = length < UINT8_MAX ? length : UINT8_MAX;
+            uop->seg = seg;
+            uop->opcode = inst;
+            uop->prefix = prefix;
+            uop->context = cpu->cpu_context;
+            return 0;
+        }
+        }
+    }
+}
 
-            case 0x0E: // PUSH CS
-                PUSHW(cpu, cpu->CS.sel);
-                return 0;
+// Programmable Interrupt Controller (8259 master/slave pair)
 
-            case 0x10: // ADC r/m, reg8
-            case 0x11:
-            case 0x12:
-            case 0x13:
-            case 0x14:
-            case 0x15:
-                OPR(cpu, seg, inst, &set);
-                ADC(cpu, &set);
-                return 0;
+#define PIC_PHASE_MAX 4
 
-            case 0x16: // PUSH SS
-                PUSHW(cpu, cpu->SS.sel);
-                return 0;
+// IRQ lines shared with the host: it adds to count[n] for each interrupt request on IRQn and sets bit n of raised
+typedef struct
+{
+    uint32_t raised;
+    uint32_t count[16];
+} irq_lines_t;
 
-            case 0x17: // POP SS
-                return POP_SEG(cpu, &cpu->SS, type_bitmap_SEG_WRITE, 0);
-
-            case 0x18: // SBB r/m, reg8
-            case 0x19:
-            case 0x1A:
-            case 0x1B:
-            case 0x1C:
-            case 0x1D:
-                OPR(cpu, seg, inst, &set);
-                SBC(cpu, &set);
-                return 0;
+typedef struct
+{
+    uint8_t IMR, ISR, phase;
+    uint8_t ICW[PIC_PHASE_MAX];
+} pic_t;
 
-            case 0x1E: // PUSH DS
-                PUSHW(cpu, cpu->DS.sel);
-                return 0;
+typedef struct
+{
+    irq_lines_t lines;
+    pic_t pic[2];
+    // IRQ number + 1 accepted by the PIC and waiting for the CPU, or 0
+    int queued;
+} vpic_t;
 
-            case 0x1F: // POP DS
-                return POP_SEG(cpu, &cpu->DS, type_bitmap_SEG_READ, 1);
-
-            case 0x20: // AND r/m, reg8
-            case 0x21:
-            case 0x22:
-            case 0x23:
-            case 0x24:
-            case 0x25:
-                OPR(cpu, seg, inst, &set);
-                AND(cpu, &set, 0);
-                return 0;
+static vpic_t *vpic = NULL;
 
-            case 0x27: // DAA
-            {
-                int value = (cpu->AF = (cpu->AL & 15) > 9 || cpu->AF) ? 6 : 0;
-                if ((cpu->CF = cpu->AL > 0x99 || cpu->CF))
-                {
-                    value += 0x60;
-                }
-                cpu->AL = SETFA8(cpu, cpu->AL + value);
-                return 0;
-            }
+/**
+ * Accept the highest priority request that is neither masked nor blocked by an in-service one
+ */
+static void pic_enqueue(const int port)
+{
+    pic_t *pic = &vpic->pic[port];
+    if (pic->phase != PIC_PHASE_MAX)
+        return;
+    for (int i = 0; i < 8; i++)
+    {
+        if (vpic->queued)
+            return;
+        const int global_irq = port * 8 + i;
+        const int mask = 1 << i;
+        if (port == 0 && i == vpic->pic[1].ICW[2] && !(pic->IMR & mask))
+        {
+            pic_enqueue(1);
+            break;
+        }
+        if (pic->ISR & mask)
+            break;
+        if (pic->IMR & mask)
+            continue;
+        if (vpic->lines.count[global_irq] > 0)
+        {
+            if (!--vpic->lines.count[global_irq])
+                vpic->lines.raised &= ~(1 << global_irq);
+            pic->ISR |= mask;
+            vpic->queued = global_irq + 1;
+        }
+    }
+}
 
-            case 0x28: // SUB r/g, reg8
-            case 0x29:
-            case 0x2A:
-            case 0x2B:
-            case 0x2C:
-            case 0x2D:
-                OPR(cpu, seg, inst, &set);
-                SUB(cpu, &set);
-                return 0;
+/**
+ * Take the queued request and return its vector
+ */
+static int pic_acknowledge(void)
+{
+    const int global_irq = vpic->queued - 1;
+    vpic->queued = 0;
+    const pic_t *pic = &vpic->pic[global_irq >> 3];
+    return (pic->ICW[1] & 0xF8) | (global_irq & 7);
+}
 
-            case 0x2F: // DAS
+static void pic_write_cmd(const int port, const int data)
+{
+    pic_t *pic = &vpic->pic[port];
+    if (data & 0x10) // ICW1
+    {
+        pic->phase = 1;
+        pic->ICW[0] = data;
+        pic->ISR = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            vpic->lines.count[port * 8 + i] = 0;
+        }
+        vpic->lines.raised &= ~(UINT8_MAX << (port * 8));
+        vpic->queued = 0;
+    }
+    else if ((data & 0xF8) == 0x20) // auto EOI
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            const int mask = 1 << i;
+            if (pic->ISR & mask)
             {
-                int value;
-                value = (cpu->AF = (cpu->AL & 15) > 9 || cpu->AF) ? 6 : 0;
-                if ((cpu->CF = cpu->AL > 0x99 || cpu->CF))
-                {
-                    value += 0x60;
-                }
-                cpu->AL = SETFA8(cpu, cpu->AL - value);
-                return 0;
+                pic->ISR &= ~mask;
+                pic_enqueue(0);
+                break;
             }
+        }
+    }
+    else if ((data & 0xF8) == 0x60) // manual EOI
+    {
+        const int mask = 1 << (data & 7);
+        if (pic->ISR & mask)
+        {
+            pic->ISR &= ~mask;
+            pic_enqueue(0);
+        }
+    }
+}
 
-            case 0x30: // XOR r/g, reg8
-            case 0x31:
-            case 0x32:
-            case 0x33:
-            case 0x34:
-            case 0x35:
-                OPR(cpu, seg, inst, &set);
-                XOR(cpu, &set);
-                return 0;
+static void pic_write_imr(const int port, const int data)
+{
+    pic_t *pic = &vpic->pic[port];
+    const int phase = pic->phase;
+    if (phase > 0 && phase < PIC_PHASE_MAX) // ICW2-4
+    {
+        pic->ICW[phase] = data;
+        pic->phase = 1 + phase;
+    }
+    else
+    {
+        pic->IMR = data;
+    }
+}
 
-            case 0x37: // AAA
-            {
-                if ((cpu->AF = cpu->CF = (cpu->AL & 15) > 9 || cpu->AF))
-                {
-                    cpu->AL += 6;
-                    cpu->AH++;
-                }
-                cpu->AL &= 15;
-                return 0;
-            }
+// Programmable Interval Timer (8254)
 
-            case 0x38: // CMP r/m, reg8
-            case 0x39:
-            case 0x3A:
-            case 0x3B:
-            case 0x3C:
-            case 0x3D:
-                OPR(cpu, seg, inst, &set);
-                CMP(cpu, &set);
-                return 0;
+// Virtual time: the 1.193182MHz PIT clock advances one tick every PIT_INST_PER_TICK instructions (about 30 MIPS)
+#define PIT_INST_PER_TICK 25
+#define PIT_HZ 1193182
 
-            case 0x3F: // AAS
-            {
-                if ((cpu->AF = cpu->CF = (cpu->AL & 15) > 9 || cpu->AF))
-                {
-                    cpu->AL -= 6;
-                    cpu->AH--;
-                }
-                cpu->AL &= 15;
-                return 0;
-            }
+typedef struct
+{
+    uint64_t start; // tick at which the current period began
+    uint32_t reload;
+    uint16_t latch;
+    uint8_t control, status, lsb;
+    uint8_t running, fired, write_lsb, read_msb, latched, status_latched;
+} pit_counter_t;
 
-            case 0x40: // INC reg16
-            case 0x41:
-            case 0x42:
-            case 0x43:
-            case 0x44:
-            case 0x45:
-            case 0x46:
-            case 0x47:
-            {
-                set.size = (cpu->cpu_context & CPU_CTX_DATA32) ? 2 : 1;
-                set.opr1 = &cpu->gpr[inst & 7];
-                INC(cpu, &set);
-                return 0;
-            }
+typedef struct
+{
+    pit_counter_t counter[3];
+    uint64_t ticks;
+    // time_stamp_counter at the last sync and the instructions not converted to ticks yet
+    uint64_t tsc;
+    uint32_t rem;
+    // IN/OUT waiting for cpu_block to bring time_stamp_counter up to date
+    int io_port, io_size, io_write, io_value;
+    // display enable bit of the VGA Input Status #1 outside the retrace, it flips on every read
+    int vga_toggle;
+} vpit_t;
 
-            case 0x48: // DEC reg16
-            case 0x49:
-            case 0x4A:
-            case 0x4B:
-            case 0x4C:
-            case 0x4D:
-            case 0x4E:
-            case 0x4F:
-            {
-                set.size = (cpu->cpu_context & CPU_CTX_DATA32) ? 2 : 1;
-                set.opr1 = &cpu->gpr[inst & 7];
-                DEC(cpu, &set);
-                return 0;
-            }
+static vpit_t *vpit = NULL;
 
-            case 0x50: // PUSH reg16
-            case 0x51:
-            case 0x52:
-            case 0x53:
-            case 0x55:
-            case 0x56:
-            case 0x57:
-                PUSHW(cpu, cpu->gpr[inst & 7]);
-                return 0;
+static int pit_mode(const pit_counter_t *c)
+{
+    const int mode = (c->control >> 1) & 7;
+    return mode > 5 ? mode - 4 : mode;
+}
 
-            case 0x54: // PUSH SP
-                if (cpu->cpu_gen < cpu_gen_80286)
-                {
-                    cpu->SP -= 2;
-                    WRITE_MEM16(&cpu->SS, cpu->SP, cpu->SP);
-                }
-                else
-                {
-                    PUSHW(cpu, cpu->ESP);
-                }
-                return 0;
+static int pit_is_periodic(const pit_counter_t *c)
+{
+    const int mode = pit_mode(c);
+    return mode == 2 || mode == 3;
+}
 
-            case 0x58: // POP reg16
-            case 0x59:
-            case 0x5A:
-            case 0x5B:
-            case 0x5C:
-            case 0x5D:
-            case 0x5E:
-            case 0x5F:
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->gpr[inst & 7] = POPW(cpu);
-                }
-                else
-                {
-                    WRITE_LE16(&cpu->gpr[inst & 7], POPW(cpu));
-                }
-                return 0;
+static void pit_raise_irq0(void)
+{
+    // IRR is a latch, periods that pass while IRQ0 is pending are lost
+    if (vpic->lines.count[0] == 0)
+    {
+        vpic->lines.count[0] = 1;
+        vpic->lines.raised |= 1;
+    }
+}
 
-            case 0x60: // PUSHA
+/**
+ * Advance the PIT clock to time_stamp_counter and raise IRQ0 if counter 0 has expired
+ *
+ * @return nonzero if counter 0 has expired
+ */
+static int pit_sync(cpu_state *cpu)
+{
+    const uint64_t tsc = cpu->time_stamp_counter;
+    int expired = 0;
+    if (tsc < vpit->tsc) // CPU reset
+    {
+        vpit->tsc = tsc;
+        return expired;
+    }
+    const uint32_t elapsed = vpit->rem + (uint32_t)(tsc - vpit->tsc);
+    vpit->tsc = tsc;
+    vpit->ticks += elapsed / PIT_INST_PER_TICK;
+    vpit->rem = elapsed % PIT_INST_PER_TICK;
+    for (int i = 0; i < 3; i++)
+    {
+        pit_counter_t *c = &vpit->counter[i];
+        if (!c->running)
+            continue;
+        const uint32_t e = vpit->ticks - c->start;
+        if (pit_is_periodic(c))
+        {
+            if (e >= c->reload)
             {
-                uint32_t temp = cpu->ESP;
-                if (cpu->cpu_gen < cpu_gen_80286)
-                {
-                    temp -= 10;
-                }
-                PUSHW(cpu, cpu->EAX);
-                PUSHW(cpu, cpu->ECX);
-                PUSHW(cpu, cpu->EDX);
-                PUSHW(cpu, cpu->EBX);
-                PUSHW(cpu, temp);
-                PUSHW(cpu, cpu->EBP);
-                PUSHW(cpu, cpu->ESI);
-                PUSHW(cpu, cpu->EDI);
-                return 0;
+                c->start += e - e % c->reload;
+                expired |= i == 0;
             }
+        }
+        else if (!c->fired && e >= c->reload)
+        {
+            c->fired = 1;
+            expired |= i == 0;
+        }
+    }
+    if (expired)
+        pit_raise_irq0();
+    return expired;
+}
 
-            case 0x61: // POPA
-            {
-                cpu->EDI = POPW(cpu);
-                cpu->ESI = POPW(cpu);
-                cpu->EBP = POPW(cpu);
-                uint32_t temp = POPW(cpu);
-                cpu->EBX = POPW(cpu);
-                cpu->EDX = POPW(cpu);
-                cpu->ECX = POPW(cpu);
-                cpu->EAX = POPW(cpu);
-                return 0;
-            }
+/**
+ * @return instructions until counter 0 raises IRQ0, or limit if that is sooner
+ */
+static uint32_t pit_budget(const uint32_t limit)
+{
+    const pit_counter_t *c = &vpit->counter[0];
+    if (!c->running || (c->fired && !pit_is_periodic(c)))
+        return limit;
+    const uint32_t ticks = c->start + c->reload - vpit->ticks;
+    const uint32_t inst = ticks * PIT_INST_PER_TICK - vpit->rem;
+    return inst < limit ? inst : limit;
+}
 
-                // case 0x62: // BOUND or EVEX
+static int pit_count(const pit_counter_t *c)
+{
+    if (!c->running)
+        return c->reload & UINT16_MAX;
+    const uint32_t e = vpit->ticks - c->start;
+    switch (pit_mode(c))
+    {
+    case 2:
+        return (c->reload - e % c->reload) & UINT16_MAX;
+    case 3: // counts down by two, twice per period
+        return (c->reload - 2 * (e % ((c->reload + 1) / 2))) & UINT16_MAX;
+    default:
+        return (c->reload - e) & UINT16_MAX;
+    }
+}
 
-                // case 0x63: // ARPL or MOVSXD
-                //     return cpu_status_ud;
+static int pit_output(const pit_counter_t *c)
+{
+    if (!c->running)
+        return pit_mode(c) != 0;
+    const uint32_t e = vpit->ticks - c->start;
+    switch (pit_mode(c))
+    {
+    case 0:
+    case 1:
+        return c->fired;
+    case 3:
+        return e % c->reload < (c->reload + 1) / 2;
+    default:
+        return 1;
+    }
+}
 
-            case 0x68: // PUSH imm16
-                PUSHW(cpu, FETCHSW(cpu));
-                return 0;
+static void pit_latch(pit_counter_t *c)
+{
+    if (!c->latched)
+    {
+        c->latch = pit_count(c);
+        c->latched = 1;
+    }
+}
 
-            case 0x69: // IMUL reg, r/m, imm16
-                MODRM_W(cpu, seg, 1, &set);
-                IMUL3(cpu, &set, FETCHW(cpu));
-                return 0;
-
-            case 0x6A: // PUSH imm8
-                PUSHW(cpu, FETCHSB(cpu));
-                return 0;
-
-            case 0x6B: // IMUL reg, r/m, imm8
-                MODRM_W(cpu, seg, 1, &set);
-                IMUL3(cpu, &set, FETCHSB(cpu));
-                return 0;
+static void pit_load(pit_counter_t *c, const int count)
+{
+    c->reload = count ? count : 0x10000;
+    c->start = vpit->ticks;
+    c->running = 1;
+    c->fired = 0;
+}
 
-            case 0x6C: // INSB
+static void pit_write_control(const int data)
+{
+    const int select = data >> 6;
+    if (select == 3) // read-back
+    {
+        for (int i = 0; i < 3; i++)
+        {
+            pit_counter_t *c = &vpit->counter[i];
+            if (!(data & (2 << i)))
+                continue;
+            if (!(data & 0x20))
+                pit_latch(c);
+            if (!(data & 0x10) && !c->status_latched)
             {
-                // TODO: 32bit support
-                if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
-                    return cpu_status_ud;
-                sreg_t *_seg = SEGMENT(&cpu->ES);
-                int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
-                if (rep && cpu->CX == 0)
-                    return 0;
-                do
-                {
-                    WRITE_MEM8(_seg, cpu->DI, vpc_inb(cpu->DX));
-                    if (cpu->DF)
-                    {
-                        cpu->DI--;
-                    }
-                    else
-                    {
-                        cpu->DI++;
-                    }
-                } while (rep && --cpu->CX);
-                return 0;
+                c->status = (pit_output(c) << 7) | (c->running ? 0 : 0x40) | (c->control & 0x3F);
+                c->status_latched = 1;
             }
+        }
+        return;
+    }
+    pit_counter_t *c = &vpit->counter[select];
+    if (!(data & 0x30)) // counter latch
+    {
+        pit_latch(c);
+        return;
+    }
+    c->control = data;
+    c->running = 0;
+    c->write_lsb = 0;
+    c->read_msb = 0;
+    c->latched = 0;
+    c->status_latched = 0;
+    if (select == 0)
+    {
+        vpic->lines.count[0] = 0;
+        vpic->lines.raised &= ~1;
+    }
+}
 
-            case 0x6D: // INSW
-            {
-                // TODO: 32bit support
-                if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
-                    return cpu_status_ud;
-                sreg_t *_seg = SEGMENT(&cpu->ES);
-                int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
-                if (rep && cpu->CX == 0)
-                    return 0;
-                do
-                {
-                    WRITE_MEM16(_seg, cpu->DI, vpc_inw(cpu->DX));
-                    if (cpu->DF)
-                    {
-                        cpu->DI -= 2;
-                    }
-                    else
-                    {
-                        cpu->DI += 2;
-                    }
-                } while (rep && --cpu->CX);
-                return 0;
-            }
+static void pit_write(cpu_state *cpu, const int reg, const int data)
+{
+    pit_sync(cpu);
+    if (reg == 3)
+    {
+        pit_write_control(data);
+        return;
+    }
+    pit_counter_t *c = &vpit->counter[reg];
+    switch ((c->control >> 4) & 3)
+    {
+    case 1:
+        pit_load(c, data);
+        break;
+    case 2:
+        pit_load(c, data << 8);
+        break;
+    default:
+        if (c->write_lsb)
+        {
+            c->write_lsb = 0;
+            pit_load(c, c->lsb | (data << 8));
+        }
+        else
+        {
+            c->write_lsb = 1;
+            c->lsb = data;
+            if (pit_mode(c) == 0)
+                c->running = 0;
+        }
+        break;
+    }
+}
 
-            case 0x6E: // OUTSB
-            {
-                // TODO: 32bit support
-                if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
-                    return cpu_status_ud;
-                sreg_t *_seg = SEGMENT(&cpu->DS);
-                if (prefix & PREFIX_REPNZ)
-                    return cpu_status_ud;
-                int rep = prefix & PREFIX_REPZ;
-                if (rep && cpu->CX == 0)
-                    return 0;
-                do
-                {
-                    vpc_outb(cpu->DX, READ_MEM8(_seg, cpu->SI));
-                    if (cpu->DF)
-                    {
-                        cpu->SI--;
-                    }
-                    else
-                    {
-                        cpu->SI++;
-                    }
-                } while (rep && --cpu->CX);
-                return 0;
-            }
+static int pit_read(cpu_state *cpu, const int reg)
+{
+    if (reg == 3)
+        return UINT8_MAX;
+    pit_sync(cpu);
+    pit_counter_t *c = &vpit->counter[reg];
+    if (c->status_latched)
+    {
+        c->status_latched = 0;
+        return c->status;
+    }
+    const int count = c->latched ? c->latch : pit_count(c);
+    switch ((c->control >> 4) & 3)
+    {
+    case 1:
+        c->latched = 0;
+        return count & UINT8_MAX;
+    case 2:
+        c->latched = 0;
+        return count >> 8;
+    default:
+        if (c->read_msb)
+        {
+            c->read_msb = 0;
+            c->latched = 0;
+            return count >> 8;
+        }
+        c->read_msb = 1;
+        return count & UINT8_MAX;
+    }
+}
 
-            case 0x6F: // OUTSW
-            {
-                // TODO: 32bit support
-                if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
-                    return cpu_status_ud;
-                sreg_t *_seg = SEGMENT(&cpu->DS);
-                int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
-                if (rep && cpu->CX == 0)
-                    return 0;
-                do
-                {
-                    vpc_outw(cpu->DX, READ_MEM16(_seg, cpu->SI));
-                    if (cpu->DF)
-                    {
-                        cpu->SI -= 2;
-                    }
-                    else
-                    {
-                        cpu->SI += 2;
-                    }
-                } while (rep && --cpu->CX);
-                return 0;
-            }
+// VGA Input Status #1: 70Hz frames on the PIT clock, in vertical retrace during the blank lines
 
-            case 0x70: // JO d8
-            case 0x71: // JNO d8
-            case 0x72: // JC d8
-            case 0x73: // JNC d8
-            case 0x74: // JZ d8
-            case 0x75: // JNZ d8
-            case 0x76: // JBE d8
-            case 0x77: // JNBE d8
-            case 0x78: // JS d8
-            case 0x79: // JNS d8
-            case 0x7A: // JP d8
-            case 0x7B: // JNP d8
-            case 0x7C: // JL d8
-            case 0x7D: // JNL d8
-            case 0x7E: // JLE d8
-            case 0x7F: // JG d8
-            {
-                int disp = FETCHSB(cpu);
-                return JUMP_IF(cpu, disp, EVAL_CC(cpu, inst));
-            }
+#define VGA_FRAME_TICKS (PIT_HZ / 70)
+#define VGA_RETRACE_TICKS (VGA_FRAME_TICKS * 49 / 449)
 
-            case 0x80: // alu r/m8, imm8
-            case 0x81: // alu r/m16, imm16
-            case 0x82: // alu r/m8, imm8 (mirror)
-            case 0x83: // alu r/m16, imm8 (sign extended)
-            {
-                MODRM_W(cpu, seg, inst & 1, &set);
-                const int opc = set.opr2;
-                if (inst == 0x81)
-                {
-                    set.opr2 = FETCHW(cpu);
-                }
-                else
-                {
-                    set.opr2 = FETCHSB(cpu);
-                }
-                switch (opc)
-                {
-                case 0: // ADD
-                    ADD(cpu, &set);
-                    break;
-                case 1: // OR
-                    OR(cpu, &set);
-                    break;
-                case 2: // ADC
-                    ADC(cpu, &set);
-                    break;
-                case 3: // SBB
-                    SBC(cpu, &set);
-                    break;
-                case 4: // AND
-                    AND(cpu, &set, 0);
-                    break;
-                case 5: // SUB
-                    SUB(cpu, &set);
-                    break;
-                case 6: // XOR
-                    XOR(cpu, &set);
-                    break;
-                case 7: // CMP
-                    CMP(cpu, &set);
-                    break;
-                }
-                return 0;
-            }
+static int vga_read_status(cpu_state *cpu)
+{
+    pit_sync(cpu);
+    vpit->vga_toggle ^= 1;
+    if ((uint32_t)vpit->ticks % VGA_FRAME_TICKS < VGA_RETRACE_TICKS)
+        return 0x09;
+    return vpit->vga_toggle;
+}
 
-            case 0x84: // test r/m, reg8
-            case 0x85: // test r/m, reg16
-                MODRM_W_D(cpu, seg, inst & 1, 0, &set);
-                AND(cpu, &set, 1);
-                return 0;
+// Port I/O: in-core devices are handled here, only the ports registered by the host cross the boundary
 
-            case 0x86: // xchg r/m, reg8
-            case 0x87: // xchg r/m, reg16
-            {
-                MODRM_W(cpu, seg, inst & 1, &set);
-                switch (set.size)
-                {
-                case 0:
-                {
-                    const uint32_t temp = *set.opr1b;
-                    *set.opr1b = READ_REG8(cpu, set.opr2);
-                    WRITE_REG8(cpu, set.opr2, temp);
-                    return 0;
-                }
-                case 1:
-                {
-                    const uint32_t temp = READ_LE16(set.opr1);
-                    WRITE_LE16(set.opr1, cpu->gpr[set.opr2]);
-                    WRITE_LE16(&cpu->gpr[set.opr2], temp);
-                    return 0;
-                }
-                case 2:
-                {
-                    const uint32_t temp = READ_LE32(set.opr1);
-                    WRITE_LE32(set.opr1, cpu->gpr[set.opr2]);
-                    cpu->gpr[set.opr2] = temp;
-                    return 0;
-                }
-                }
-                return cpu_status_ud;
-            }
+static int io_is_host(const int type)
+{
+    return type == io_type_host || type == io_type_shadow;
+}
 
-            case 0x88: // MOV rm, r8
-                MODRM_W_D(cpu, seg, 0, 0, &set);
-                *set.opr1b = set.opr2;
-                return 0;
+/**
+ * @return cpu_status_inta if an interrupt request became ready
+ */
+static int io_outb(cpu_state *cpu, const int port, const int value)
+{
+    io_map->count[port]++;
+    switch (io_map->type[port])
+    {
+    case io_type_host:
+    case io_type_shadow:
+        vpc_outb(port, value);
+        break;
+    case io_type_pic:
+        if (port & 1)
+            pic_write_imr(port >> 7, value & UINT8_MAX);
+        else
+            pic_write_cmd(port >> 7, value & UINT8_MAX);
+        return vpic->queued ? cpu_status_inta : 0;
+    case io_type_pit:
+        pit_write(cpu, port & 3, value & UINT8_MAX);
+        // the host follows counter 2 for the speaker
+        if (port == 0x42 || (port == 0x43 && (value & 0xC0) == 0x80))
+            vpc_outb(port, value);
+        break;
+    }
+    return 0;
+}
 
-            case 0x89: // MOV rm, r16
-                MODRM_W_D(cpu, seg, 1, 0, &set);
-                if (set.size == 1)
-                {
-                    WRITE_LE16(set.opr1, set.opr2);
-                }
-                else
-                {
-                    WRITE_LE32(set.opr1, set.opr2);
-                }
-                return 0;
+static int io_inb(cpu_state *cpu, const int port)
+{
+    io_map->count[port]++;
+    switch (io_map->type[port])
+    {
+    case io_type_host:
+        return vpc_inb(port);
+    case io_type_shadow:
+        return io_map->shadow[port];
+    case io_type_pic:
+    {
+        const pic_t *pic = &vpic->pic[port >> 7];
+        return port & 1 ? pic->IMR : pic->ISR;
+    }
+    case io_type_pit:
+        return pit_read(cpu, port & 3);
+    case io_type_vga_status:
+        return vga_read_status(cpu);
+    default:
+        return UINT8_MAX;
+    }
+}
 
-            case 0x8A: // MOV r8, rm
-                MODRM_W_D(cpu, seg, 0, 2, &set);
-                *set.opr1b = set.opr2;
-                return 0;
+static int io_outw(cpu_state *cpu, const int port, const int value)
+{
+    const int next = (port + 1) & UINT16_MAX;
+    const int type = io_map->type[port];
+    if (io_is_host(type) && !IO_TYPE_IS_CORE(io_map->type[next]))
+    {
+        io_map->count[port]++;
+        vpc_outw(port, value);
+        return 0;
+    }
+    if (type == io_type_none && io_map->type[next] == io_type_none)
+    {
+        io_map->count[port]++;
+        return 0;
+    }
+    return io_outb(cpu, port, value & UINT8_MAX) | io_outb(cpu, next, (value >> 8) & UINT8_MAX);
+}
 
-            case 0x8B: // MOV r16, rm
-                MODRM_W_D(cpu, seg, 1, 1, &set);
-                if (set.size == 1)
-                {
-                    WRITE_LE16(set.opr1, set.opr2);
-                }
-                else
-                {
-                    WRITE_LE32(set.opr1, set.opr2);
-                }
-                return 0;
+static int io_inw(cpu_state *cpu, const int port)
+{
+    const int next = (port + 1) & UINT16_MAX;
+    const int type = io_map->type[port];
+    if (io_is_host(type) && !IO_TYPE_IS_CORE(io_map->type[next]))
+    {
+        io_map->count[port]++;
+        return vpc_inw(port);
+    }
+    if (type == io_type_none && io_map->type[next] == io_type_none)
+    {
+        io_map->count[port]++;
+        return UINT16_MAX;
+    }
+    return io_inb(cpu, port) | (io_inb(cpu, next) << 8);
+}
 
-            case 0x8C: // MOV r/m, seg
-                MODRM_W(cpu, seg, 1, &set);
-                switch (set.opr2)
-                {
-                case index_DS:
-                case index_ES:
-                case index_FS:
-                case index_GS:
-                case index_SS:
-                case index_CS:
-                    WRITE_LE16(set.opr1, cpu->sregs[set.opr2].sel);
-                    return 0;
-                default:
-                    return cpu_status_ud;
-                }
+static void io_outd(const int port, const uint32_t value)
+{
+    io_map->count[port]++;
+    if (io_is_host(io_map->type[port]))
+        vpc_outd(port, value);
+}
 
-            case 0x8D: // LEA reg, r/m
-            {
-                modrm_t modrm;
-                if (MODRM(cpu, NULL, &modrm))
-                    return cpu_status_ud;
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->gpr[modrm.reg] = modrm.offset;
-                }
-                else
-                {
-                    WRITE_LE16(&cpu->gpr[modrm.reg], modrm.offset);
-                }
-                return 0;
-            }
+static uint32_t io_ind(const int port)
+{
+    io_map->count[port]++;
+    if (io_is_host(io_map->type[port]))
+        return vpc_ind(port);
+    return UINT32_MAX;
+}
 
-            case 0x8E: // MOV seg, r/m
-            {
-                desc_type_bitmap_t type;
-                int allow_null = 1;
-                MODRM_W(cpu, seg, 1, &set);
-                switch (set.opr2)
-                {
-                case index_DS:
-                case index_ES:
-                case index_FS:
-                case index_GS:
-                    type = type_bitmap_SEG_READ;
-                    break;
+static int io_is_timed(const int port)
+{
+    const int type = io_map->type[port & UINT16_MAX];
+    return type == io_type_pit || type == io_type_vga_status;
+}
 
-                case index_SS:
-                    type = type_bitmap_SEG_WRITE;
-                    allow_null = 0;
-                    break;
+/**
+ * Single IN/OUT to the PIT or the VGA status is deferred so that it sees the current time:
+ * cpu_block updates time_stamp_counter only when the status comes back, like RDTSC.
+ * (REP INS/OUTS see the time at the start of the block)
+ *
+ * @return cpu_status_timer if deferred
+ */
+static int io_defer(const int port, const int size, const int is_write, const int value)
+{
+    if (!io_is_timed(port) && !(size == 2 && io_is_timed(port + 1)))
+        return 0;
+    vpit->io_port = port;
+    vpit->io_size = size;
+    vpit->io_write = is_write;
+    vpit->io_value = value;
+    return cpu_status_timer;
+}
 
-                case index_CS:
-                default:
-                    return cpu_status_ud;
-                }
-                return LOAD_DESCRIPTOR(cpu, &cpu->sregs[set.opr2], READ_LE16(set.opr1), type, allow_null, NULL);
-            }
+static void io_complete(cpu_state *cpu)
+{
+    const int port = vpit->io_port;
+    if (vpit->io_write)
+    {
+        if (vpit->io_size == 1)
+            io_outb(cpu, port, vpit->io_value);
+        else
+            io_outw(cpu, port, vpit->io_value);
+    }
+    else
+    {
+        if (vpit->io_size == 1)
+            cpu->AL = io_inb(cpu, port);
+        else
+            cpu->AX = io_inw(cpu, port);
+    }
+}
 
-            case 0x8F: // /0 POP r/m
-                MODRM_W(cpu, seg, 1, &set);
-                switch (set.opr2)
-                {
-                case 0: // POP r/m
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        WRITE_LE32(set.opr1, POPW(cpu));
-                    }
-                    else
-                    {
-                        WRITE_LE16(set.opr1, POPW(cpu));
-                    }
-                    return 0;
-                default: // XOP
-                    return cpu_status_ud;
-                }
+// Opcode handlers: the ones that bypass the lazy flag helpers materialize pending flags on entry
 
-            case 0x90: // NOP
-                if (prefix & PREFIX_REPZ)
-                {
-                    return cpu_status_pause;
-                }
-                else
-                {
-                    return 0;
-                }
+/*
+ * Frequent handlers are written once as name_ctx with the operand/address size context as a parameter
+ * and instantiated three times: name_16 and name_32 for code without size overrides (real mode,
+ * V86 and 16-bit protected mode, or 32-bit protected mode), and name for any other combination.
+ * cpu_decode picks the copy from the context of each instruction, so only prefix 66/67 reaches the generic one.
+ */
+#define CPU_OP_SPECIALIZE(name)                                                                  \
+    static int name(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)     \
+    {                                                                                            \
+        return name##_ctx(cpu, inst, prefix, seg, cpu->cpu_context);                             \
+    }                                                                                            \
+    static int name##_16(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg) \
+    {                                                                                            \
+        return name##_ctx(cpu, inst, prefix, seg, 0);                                            \
+    }                                                                                            \
+    static int name##_32(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg) \
+    {                                                                                            \
+        return name##_ctx(cpu, inst, prefix, seg, CPU_CTX_SIZE_MASK);                            \
+    }
+
+static int cpu_op_ud(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return cpu_status_ud;
+}
 
-            case 0x91: // XCHG AX, reg16
-            case 0x92:
-            case 0x93:
-            case 0x94:
-            case 0x95:
-            case 0x96:
-            case 0x97:
-            {
-                const size_t i7 = inst & 7;
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    const uint32_t temp = cpu->gpr[i7];
-                    cpu->gpr[i7] = cpu->EAX;
-                    cpu->EAX = temp;
-                }
-                else
-                {
-                    const uint32_t temp = cpu->gpr[i7];
-                    WRITE_LE16(&cpu->gpr[i7], cpu->AX);
-                    cpu->AX = temp;
-                }
-                return 0;
-            }
+// 00 ADD r/m, reg8
+// 01 ADD r/m, reg16
+// 02 ADD reg8, r/m
+// 03 ADD reg16, r/m
+// 04 ADD AL, imm8
+// 05 ADD AX, imm16
+static ALWAYS_INLINE int cpu_op_00_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    ADD(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_00)
 
-            case 0x98: // CBW/CWDE
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->EAX = MOVSXW(cpu->AX);
-                }
-                else
-                {
-                    cpu->AX = MOVSXB(cpu->AL);
-                }
-                return 0;
+// 06 PUSH ES
+static int cpu_op_06(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->ES.sel);
+    return 0;
+}
 
-            case 0x99: // CWD/CDQ
-            {
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->EDX = (cpu->EAX & 0x80000000) ? UINT32_MAX : 0;
-                }
-                else
-                {
-                    cpu->EDX = (cpu->AX & 0x8000) ? UINT16_MAX : 0;
-                }
-                return 0;
-            }
+// 07 POP ES
+static int cpu_op_07(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return POP_SEG(cpu, &cpu->ES, type_bitmap_SEG_READ, 1);
+}
 
-            case 0x9A: // CALL far imm32
-            {
-                const uint32_t new_eip = FETCHW(cpu);
-                const uint16_t new_sel = FETCH16(cpu);
-                return FAR_CALL(cpu, new_sel, new_eip);
-            }
+// 08 OR r/m, reg8
+static ALWAYS_INLINE int cpu_op_08_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    OR(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_08)
 
-            case 0x9B: // FWAIT
-                return cpu_status_fpu;
+// 0E PUSH CS
+static int cpu_op_0E(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->CS.sel);
+    return 0;
+}
 
-            case 0x9C: // PUSHF
-                PUSHW(cpu, cpu->eflags);
-                return 0;
+// 10 ADC r/m, reg8
+static ALWAYS_INLINE int cpu_op_10_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    ADC(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_10)
 
-            case 0x9D: // POPF
-            {
-                uint32_t mask = is_kernel(cpu) ? cpu->flags_preserve_popf : cpu->flags_preserve_iret3;
-                if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
-                {
-                    mask |= 0xFFFF0000;
-                }
-                LOAD_FLAGS(cpu, POPW(cpu), mask);
-                if (cpu->IF || cpu->TF)
-                {
-                    return cpu_status_inta;
-                }
-                else
-                {
-                    return 0;
-                }
-            }
+// 16 PUSH SS
+static int cpu_op_16(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->SS.sel);
+    return 0;
+}
 
-            case 0x9E: // SAHF
-                LOAD_FLAGS(cpu, cpu->AH, 0xFFFFFF00);
-                return 0;
+// 17 POP SS
+static int cpu_op_17(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return POP_SEG(cpu, &cpu->SS, type_bitmap_SEG_WRITE, 0);
+}
 
-            case 0x9F: // LAHF
-                cpu->AH = cpu->eflags;
-                return 0;
+// 18 SBB r/m, reg8
+static ALWAYS_INLINE int cpu_op_18_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    SBC(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_18)
 
-            case 0xA0: // MOV AL, off16
-            {
-                uint32_t offset;
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    offset = FETCH32(cpu);
-                }
-                else
-                {
-                    offset = FETCH16(cpu);
-                }
-                cpu->AL = READ_MEM8(SEGMENT(&cpu->DS), offset);
-                return 0;
-            }
+// 1E PUSH DS
+static int cpu_op_1E(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->DS.sel);
+    return 0;
+}
 
-            case 0xA1: // MOV AX, off16
-            {
-                uint32_t offset;
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    offset = FETCH32(cpu);
-                }
-                else
-                {
-                    offset = FETCH16(cpu);
-                }
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->EAX = READ_MEM32(SEGMENT(&cpu->DS), offset);
-                }
-                else
-                {
-                    cpu->AX = READ_MEM16(SEGMENT(&cpu->DS), offset);
-                }
-                return 0;
-            }
+// 1F POP DS
+static int cpu_op_1F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return POP_SEG(cpu, &cpu->DS, type_bitmap_SEG_READ, 1);
+}
 
-            case 0xA2: // MOV off16, AL
-            {
-                uint32_t offset;
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    offset = FETCH32(cpu);
-                }
-                else
-                {
-                    offset = FETCH16(cpu);
-                }
-                WRITE_MEM8(SEGMENT(&cpu->DS), offset, cpu->AL);
-                return 0;
-            }
+// 20 AND r/m, reg8
+static ALWAYS_INLINE int cpu_op_20_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    AND(cpu, &set, 0);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_20)
 
-            case 0xA3: // MOV off16, AX
-            {
-                uint32_t offset;
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    offset = FETCH32(cpu);
-                }
-                else
-                {
-                    offset = FETCH16(cpu);
-                }
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    WRITE_MEM32(SEGMENT(&cpu->DS), offset, cpu->EAX);
-                }
-                else
-                {
-                    WRITE_MEM16(SEGMENT(&cpu->DS), offset, cpu->AX);
-                }
-                return 0;
-            }
+// 27 DAA
+static int cpu_op_27(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    int value = (cpu->AF = (cpu->AL & 15) > 9 || cpu->AF) ? 6 : 0;
+    if ((cpu->CF = cpu->AL > 0x99 || cpu->CF))
+    {
+        value += 0x60;
+    }
+    cpu->AL = SETFA8(cpu, cpu->AL + value);
+    return 0;
+}
 
-            case 0xA4: // MOVSB
-                return MOVS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+// 28 SUB r/g, reg8
+static ALWAYS_INLINE int cpu_op_28_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    SUB(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_28)
 
-            case 0xA5: // MOVSW
-                return MOVS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+// 2F DAS
+static int cpu_op_2F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    int value;
+    value = (cpu->AF = (cpu->AL & 15) > 9 || cpu->AF) ? 6 : 0;
+    if ((cpu->CF = cpu->AL > 0x99 || cpu->CF))
+    {
+        value += 0x60;
+    }
+    cpu->AL = SETFA8(cpu, cpu->AL - value);
+    return 0;
+}
 
-            case 0xA6: // CMPSB
-                return CMPS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+// 30 XOR r/g, reg8
+static ALWAYS_INLINE int cpu_op_30_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    XOR(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_30)
 
-            case 0xA7: // CMPSW
-                return CMPS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+// 37 AAA
+static int cpu_op_37(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if ((cpu->AF = cpu->CF = (cpu->AL & 15) > 9 || cpu->AF))
+    {
+        cpu->AL += 6;
+        cpu->AH++;
+    }
+    cpu->AL &= 15;
+    return 0;
+}
 
-            case 0xA8: // TEST AL, imm8
-            case 0xA9: // TEST AX, imm16
-                if (inst & 1)
-                {
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        set.size = 2;
-                    }
-                    else
-                    {
-                        set.size = 1;
-                    }
-                    set.opr2 = FETCHW(cpu);
-                }
-                else
-                {
-                    set.size = 0;
-                    set.opr2 = FETCH8(cpu);
-                }
-                set.opr1 = &cpu->EAX;
-                AND(cpu, &set, 1);
-                return 0;
+// 38 CMP r/m, reg8
+static ALWAYS_INLINE int cpu_op_38_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    OPR_CTX(cpu, seg, inst, &set, ctx);
+    CMP(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_38)
 
-            case 0xAA: // STOSB
-                return STOS(cpu, NULL, 0, prefix);
+// 3F AAS
+static int cpu_op_3F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if ((cpu->AF = cpu->CF = (cpu->AL & 15) > 9 || cpu->AF))
+    {
+        cpu->AL -= 6;
+        cpu->AH--;
+    }
+    cpu->AL &= 15;
+    return 0;
+}
 
-            case 0xAB: // STOSW
-                return STOS(cpu, NULL, cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+// 40 INC reg16
+static ALWAYS_INLINE int cpu_op_40_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    set.size = (ctx & CPU_CTX_DATA32) ? 2 : 1;
+    set.opr1 = &cpu->gpr[inst & 7];
+    INC(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_40)
 
-            case 0xAC: // LODSB
-                return LODS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+// 48 DEC reg16
+static ALWAYS_INLINE int cpu_op_48_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    set.size = (ctx & CPU_CTX_DATA32) ? 2 : 1;
+    set.opr1 = &cpu->gpr[inst & 7];
+    DEC(cpu, &set);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_48)
 
-            case 0xAD: // LODSW
-                return LODS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+// 50 PUSH reg16
+static ALWAYS_INLINE int cpu_op_50_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    PUSHW_CTX(cpu, cpu->gpr[inst & 7], ctx);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_50)
 
-            case 0xAE: // SCASB
-                return SCAS(cpu, NULL, 0, prefix);
+// 54 PUSH SP
+static int cpu_op_54(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_gen < cpu_gen_80286)
+    {
+        cpu->SP -= 2;
+        WRITE_MEM16(cpu, &cpu->SS, cpu->SP, cpu->SP);
+    }
+    else
+    {
+        PUSHW(cpu, cpu->ESP);
+    }
+    return 0;
+}
 
-            case 0xAF: // SCASW
-                // return SCAS(cpu, NULL, cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
-            {
-                if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
-                    return cpu_status_ud;
-                sreg_t *_seg = SEGMENT(&cpu->ES);
-                int repz = prefix & PREFIX_REPZ;
-                int repnz = prefix & PREFIX_REPNZ;
-                int rep = repz | repnz;
-                if (rep && cpu->CX == 0)
-                    return 0;
-                do
-                {
-                    int dst = MOVSXW(cpu->AX);
-                    int src = MOVSXW(READ_MEM16(_seg, cpu->DI));
-                    int value = dst - src;
-                    cpu->AF = (dst & 15) - (src & 15) < 0;
-                    cpu->CF = dst < src;
-                    SETFA16(cpu, value);
-                    if (cpu->DF)
-                    {
-                        cpu->DI -= 2;
-                    }
-                    else
-                    {
-                        cpu->DI += 2;
-                    }
-                } while (rep && --cpu->CX && ((repnz && !cpu->ZF) || (repz && cpu->ZF)));
-                return 0;
-            }
+// 58 POP reg16
+static ALWAYS_INLINE int cpu_op_58_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->gpr[inst & 7] = POPW_CTX(cpu, ctx);
+    }
+    else
+    {
+        WRITE_LE16(&cpu->gpr[inst & 7], POPW_CTX(cpu, ctx));
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_58)
 
-            case 0xB0: // MOV reg8, imm8
-                cpu->AL = FETCH8(cpu);
-                return 0;
-            case 0xB1:
-                cpu->CL = FETCH8(cpu);
-                return 0;
-            case 0xB2:
-                cpu->DL = FETCH8(cpu);
-                return 0;
-            case 0xB3:
-                cpu->BL = FETCH8(cpu);
-                return 0;
-            case 0xB4:
-                cpu->AH = FETCH8(cpu);
-                return 0;
-            case 0xB5:
-                cpu->CH = FETCH8(cpu);
-                return 0;
-            case 0xB6:
-                cpu->DH = FETCH8(cpu);
-                return 0;
-            case 0xB7:
-                cpu->BH = FETCH8(cpu);
-                return 0;
+// 60 PUSHA
+static int cpu_op_60(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    uint32_t temp = cpu->ESP;
+    if (cpu->cpu_gen < cpu_gen_80286)
+    {
+        temp -= 10;
+    }
+    PUSHW(cpu, cpu->EAX);
+    PUSHW(cpu, cpu->ECX);
+    PUSHW(cpu, cpu->EDX);
+    PUSHW(cpu, cpu->EBX);
+    PUSHW(cpu, temp);
+    PUSHW(cpu, cpu->EBP);
+    PUSHW(cpu, cpu->ESI);
+    PUSHW(cpu, cpu->EDI);
+    return 0;
+}
 
-            case 0xB8: // MOV reg16, imm16
-            case 0xB9:
-            case 0xBA:
-            case 0xBB:
-            case 0xBC:
-            case 0xBD:
-            case 0xBE:
-            case 0xBF:
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->gpr[inst & 7] = FETCH32(cpu);
-                }
-                else
-                {
-                    WRITE_LE16(&cpu->gpr[inst & 7], FETCH16(cpu));
-                }
-                return 0;
+// 61 POPA
+static int cpu_op_61(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->EDI = POPW(cpu);
+    cpu->ESI = POPW(cpu);
+    cpu->EBP = POPW(cpu);
+    uint32_t temp = POPW(cpu);
+    cpu->EBX = POPW(cpu);
+    cpu->EDX = POPW(cpu);
+    cpu->ECX = POPW(cpu);
+    cpu->EAX = POPW(cpu);
+    return 0;
+}
 
-            case 0xC0: // shift r/m, imm5 (186+)
-            case 0xC1: // shift r/m, imm5 (186+)
-                MODRM_W(cpu, seg, inst & 1, &set);
-                return SHIFT(cpu, &set, FETCH8(cpu));
+// case 0x62: // BOUND or EVEX
 
-            case 0xC2: // RET imm16
-            {
-                const uint32_t new_eip = POPW(cpu);
-                const uint32_t imm = FETCH16(cpu);
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->ESP += imm;
-                }
-                else
-                {
-                    cpu->SP += imm;
-                }
-                cpu_set_eip(cpu, new_eip);
-                return 0;
-            }
+// case 0x63: // ARPL or MOVSXD
+//     return cpu_status_ud;
 
-            case 0xC3: // RET
-            {
-                const uint32_t new_eip = POPW(cpu);
-                cpu_set_eip(cpu, new_eip);
-                return 0;
-            }
+// 68 PUSH imm16
+static ALWAYS_INLINE int cpu_op_68_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    PUSHW_CTX(cpu, FETCHSW_CTX(cpu, ctx), ctx);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_68)
 
-            case 0xC4: // LES reg, r/m
-                return LDS(cpu, seg, &cpu->ES);
+// 69 IMUL reg, r/m, imm16
+static int cpu_op_69(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 0, &set);
+    IMUL3(cpu, &set, FETCHW(cpu));
+    return 0;
+}
 
-            case 0xC5: // LDS reg, r/m
-                return LDS(cpu, seg, &cpu->DS);
+// 6A PUSH imm8
+static ALWAYS_INLINE int cpu_op_6A_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    PUSHW_CTX(cpu, FETCHSB(cpu), ctx);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_6A)
 
-            case 0xC6: // /0 MOV r/m, imm8
-            case 0xC7: // /0 MOV r/m, imm16
-                MODRM_W(cpu, seg, inst & 1, &set);
-                switch (set.opr2)
-                {
-                case 0: // MOV r/m, imm
-                    switch (set.size)
-                    {
-                    case 0:
-                        *set.opr1b = FETCH8(cpu);
-                        return 0;
-                    case 1:
-                        WRITE_LE16(set.opr1, FETCH16(cpu));
-                        return 0;
-                    case 2:
-                        WRITE_LE32(set.opr1, FETCH32(cpu));
-                        return 0;
-                    }
-                default:
-                    return cpu_status_ud;
-                }
+// 6B IMUL reg, r/m, imm8
+static int cpu_op_6B(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 0, &set);
+    IMUL3(cpu, &set, FETCHSB(cpu));
+    return 0;
+}
 
-            case 0xC8: // ENTER imm16, imm8
-            {
-                const uint32_t param1 = FETCH16(cpu);
-                const int param2 = FETCH8(cpu);
-                if (param2 != 0)
-                    return cpu_status_ud;
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    PUSHW(cpu, cpu->EBP);
-                    cpu->EBP = cpu->ESP;
-                    cpu->ESP -= param1;
-                }
-                else
-                {
-                    PUSHW(cpu, cpu->BP);
-                    cpu->BP = cpu->SP;
-                    cpu->SP -= param1;
-                }
-                return 0;
-            }
+// 6C INSB
+static int cpu_op_6C(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // TODO: 32bit support
+    if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
+        return cpu_status_ud;
+    sreg_t *_seg = SEGMENT(&cpu->ES);
+    int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
+    if (rep && cpu->CX == 0)
+        return 0;
+    do
+    {
+        WRITE_MEM8(cpu, _seg, cpu->DI, io_inb(cpu, cpu->DX));
+        if (cpu->pending_fault)
+            break;
+        if (cpu->DF)
+        {
+            cpu->DI--;
+        }
+        else
+        {
+            cpu->DI++;
+        }
+    } while (rep && --cpu->CX);
+    cpu_string_resume(cpu);
+    return 0;
+}
 
-            case 0xC9: // LEAVE
-            {
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->ESP = cpu->EBP;
-                }
-                else
-                {
-                    cpu->SP = cpu->BP;
-                }
-                if (cpu->cpu_context & CPU_CTX_DATA32)
-                {
-                    cpu->EBP = POPW(cpu);
-                }
-                else
-                {
-                    cpu->BP = POPW(cpu);
-                }
-                return 0;
-            }
-
-            case 0xCA: // RETF imm16
-                return RETF(cpu, FETCH16(cpu));
+// 6D INSW
+static int cpu_op_6D(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // TODO: 32bit support
+    if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
+        return cpu_status_ud;
+    sreg_t *_seg = SEGMENT(&cpu->ES);
+    int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
+    if (rep && cpu->CX == 0)
+        return 0;
+    do
+    {
+        WRITE_MEM16(cpu, _seg, cpu->DI, io_inw(cpu, cpu->DX));
+        if (cpu->pending_fault)
+            break;
+        if (cpu->DF)
+        {
+            cpu->DI -= 2;
+        }
+        else
+        {
+            cpu->DI += 2;
+        }
+    } while (rep && --cpu->CX);
+    cpu_string_resume(cpu);
+    return 0;
+}
 
-            case 0xCB: // RETF
-                return RETF(cpu, 0);
+// 6E OUTSB
+static int cpu_op_6E(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // TODO: 32bit support
+    if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
+        return cpu_status_ud;
+    sreg_t *_seg = SEGMENT(&cpu->DS);
+    if (prefix & PREFIX_REPNZ)
+        return cpu_status_ud;
+    int rep = prefix & PREFIX_REPZ;
+    if (rep && cpu->CX == 0)
+        return 0;
+    int status = 0;
+    do
+    {
+        const uint8_t value = READ_MEM8(cpu, _seg, cpu->SI);
+        if (cpu->pending_fault)
+            break;
+        status |= io_outb(cpu, cpu->DX, value);
+        if (cpu->DF)
+        {
+            cpu->SI--;
+        }
+        else
+        {
+            cpu->SI++;
+        }
+    } while (rep && --cpu->CX);
+    cpu_string_resume(cpu);
+    return status;
+}
 
-            case 0xCC: // INT 3
-            {
-                const int result = INVOKE_INT(cpu, 3, software);
-                return result ? result : cpu_status_pause;
-            }
+// 6F OUTSW
+static int cpu_op_6F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // TODO: 32bit support
+    if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
+        return cpu_status_ud;
+    sreg_t *_seg = SEGMENT(&cpu->DS);
+    int rep = prefix & (PREFIX_REPZ | PREFIX_REPNZ);
+    if (rep && cpu->CX == 0)
+        return 0;
+    int status = 0;
+    do
+    {
+        const uint16_t value = READ_MEM16(cpu, _seg, cpu->SI);
+        if (cpu->pending_fault)
+            break;
+        status |= io_outw(cpu, cpu->DX, value);
+        if (cpu->DF)
+        {
+            cpu->SI -= 2;
+        }
+        else
+        {
+            cpu->SI += 2;
+        }
+    } while (rep && --cpu->CX);
+    cpu_string_resume(cpu);
+    return status;
+}
 
-            case 0xCD: // INT
-                return INVOKE_INT(cpu, FETCH8(cpu), software);
+// 70 JO d8
+// 71 JNO d8
+// 72 JC d8
+// 73 JNC d8
+// 74 JZ d8
+// 75 JNZ d8
+// 76 JBE d8
+// 77 JNBE d8
+// 78 JS d8
+// 79 JNS d8
+// 7A JP d8
+// 7B JNP d8
+// 7C JL d8
+// 7D JNL d8
+// 7E JLE d8
+// 7F JG d8
+static ALWAYS_INLINE int cpu_op_70_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    int disp = FETCHSB(cpu);
+    return JUMP_IF_CTX(cpu, disp, EVAL_CC(cpu, inst), ctx);
+}
+CPU_OP_SPECIALIZE(cpu_op_70)
 
-            case 0xCE: // INTO
-                if (cpu->OF)
-                {
-                    return INVOKE_INT(cpu, 4, exception);
-                }
-                return 0;
+// 80 alu r/m8, imm8
+// 81 alu r/m16, imm16
+// 82 alu r/m8, imm8 (mirror)
+// 83 alu r/m16, imm8 (sign extended)
+static ALWAYS_INLINE int cpu_op_80_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_CTX(cpu, seg, inst & 1, MODRM_PEEK_REG(cpu) != 7, &set, ctx);
+    const int opc = set.opr2;
+    if (inst == 0x81)
+    {
+        set.opr2 = FETCHW_CTX(cpu, ctx);
+    }
+    else
+    {
+        set.opr2 = FETCHSB(cpu);
+    }
+    switch (opc)
+    {
+    case 0: // ADD
+        ADD(cpu, &set);
+        break;
+    case 1: // OR
+        OR(cpu, &set);
+        break;
+    case 2: // ADC
+        ADC(cpu, &set);
+        break;
+    case 3: // SBB
+        SBC(cpu, &set);
+        break;
+    case 4: // AND
+        AND(cpu, &set, 0);
+        break;
+    case 5: // SUB
+        SUB(cpu, &set);
+        break;
+    case 6: // XOR
+        XOR(cpu, &set);
+        break;
+    case 7: // CMP
+        CMP(cpu, &set);
+        break;
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_80)
 
-            case 0xCF: // IRET
-                return IRET(cpu);
+// 84 test r/m, reg8
+// 85 test r/m, reg16
+static ALWAYS_INLINE int cpu_op_84_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_D_CTX(cpu, seg, inst & 1, 0, 0, &set, ctx);
+    AND(cpu, &set, 1);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_84)
 
-            case 0xD0: // shift r/m, 1
-            case 0xD1: // shift r/m, 1
-                MODRM_W(cpu, seg, inst & 1, &set);
-                return SHIFT(cpu, &set, 1);
+// 86 xchg r/m, reg8
+// 87 xchg r/m, reg16
+static ALWAYS_INLINE int cpu_op_86_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_CTX(cpu, seg, inst & 1, 1, &set, ctx);
+    switch (set.size)
+    {
+    case 0:
+    {
+        const uint32_t temp = *set.opr1b;
+        *set.opr1b = READ_REG8(cpu, set.opr2);
+        WRITE_REG8(cpu, set.opr2, temp);
+        return 0;
+    }
+    case 1:
+    {
+        const uint32_t temp = READ_LE16(set.opr1);
+        WRITE_LE16(set.opr1, cpu->gpr[set.opr2]);
+        WRITE_LE16(&cpu->gpr[set.opr2], temp);
+        return 0;
+    }
+    case 2:
+    {
+        const uint32_t temp = READ_LE32(set.opr1);
+        WRITE_LE32(set.opr1, cpu->gpr[set.opr2]);
+        cpu->gpr[set.opr2] = temp;
+        return 0;
+    }
+    }
+    return cpu_status_ud;
+}
+CPU_OP_SPECIALIZE(cpu_op_86)
 
-            case 0xD2: // shift r/m, cl
-            case 0xD3: // shift r/m, cl
-                MODRM_W(cpu, seg, inst & 1, &set);
-                return SHIFT(cpu, &set, cpu->CL);
+// 88 MOV rm, r8
+static ALWAYS_INLINE int cpu_op_88_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_D_CTX(cpu, seg, 0, 0, 1, &set, ctx);
+    *set.opr1b = set.opr2;
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_88)
 
-            case 0xD4: // AAM
-            {
-                const int param = FETCH8(cpu);
-                const uint8_t al = cpu->AL;
-                cpu->AH = al / param;
-                cpu->AL = SETFA8(cpu, al % param);
-                return 0;
-            }
+// 89 MOV rm, r16
+static ALWAYS_INLINE int cpu_op_89_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_D_CTX(cpu, seg, 1, 0, 1, &set, ctx);
+    if (set.size == 1)
+    {
+        WRITE_LE16(set.opr1, set.opr2);
+    }
+    else
+    {
+        WRITE_LE32(set.opr1, set.opr2);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_89)
 
-            case 0xD5: // AAD
-            {
-                const int param = FETCH8(cpu);
-                cpu->AL = SETFA8(cpu, cpu->AL + cpu->AH * param);
-                cpu->AH = 0;
-                return 0;
-            }
+// 8A MOV r8, rm
+static ALWAYS_INLINE int cpu_op_8A_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_D_CTX(cpu, seg, 0, 2, 0, &set, ctx);
+    *set.opr1b = set.opr2;
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_8A)
 
-                // case 0xD6: // SALC (undocumented)
-                //     cpu->AL = 0 - cpu->CF;
-                //     return 0;
+// 8B MOV r16, rm
+static ALWAYS_INLINE int cpu_op_8B_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_D_CTX(cpu, seg, 1, 1, 0, &set, ctx);
+    if (set.size == 1)
+    {
+        WRITE_LE16(set.opr1, set.opr2);
+    }
+    else
+    {
+        WRITE_LE32(set.opr1, set.opr2);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_8B)
 
-            case 0xD7: // XLAT
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->AL = READ_MEM8(SEGMENT(&cpu->DS), cpu->EBX + cpu->AL);
-                }
-                else
-                {
-                    cpu->AL = READ_MEM8(SEGMENT(&cpu->DS), (cpu->BX + cpu->AL) & 0xFFFF);
-                }
-                return 0;
+// 8C MOV r/m, seg
+static int cpu_op_8C(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    MODRM_W(cpu, seg, 1, 1, &set);
+    switch (set.opr2)
+    {
+    case index_DS:
+    case index_ES:
+    case index_FS:
+    case index_GS:
+    case index_SS:
+    case index_CS:
+        WRITE_LE16(set.opr1, cpu->sregs[set.opr2].sel);
+        return 0;
+    default:
+        return cpu_status_ud;
+    }
+}
 
-            case 0xD8: // ESC (IGNORED)
-            case 0xD9:
-            case 0xDA:
-            case 0xDB:
-            case 0xDC:
-            case 0xDD:
-            case 0xDE:
-            case 0xDF:
-            {
-                modrm_t modrm;
-                MODRM(cpu, seg, &modrm);
-                return cpu_status_fpu;
-            }
+// 8D LEA reg, r/m
+static ALWAYS_INLINE int cpu_op_8D_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    modrm_t modrm;
+    if (MODRM_CTX(cpu, NULL, &modrm, ctx))
+        return cpu_status_ud;
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->gpr[modrm.reg] = modrm.offset;
+    }
+    else
+    {
+        WRITE_LE16(&cpu->gpr[modrm.reg], modrm.offset);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_8D)
 
-            case 0xE0: // LOOPNZ
-            {
-                const int disp = FETCHSB(cpu);
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->ECX--;
-                    return JUMP_IF(cpu, disp, (cpu->ECX != 0 && cpu->ZF == 0));
-                }
-                else
-                {
-                    cpu->CX--;
-                    return JUMP_IF(cpu, disp, (cpu->CX != 0 && cpu->ZF == 0));
-                }
-            }
+// 8E MOV seg, r/m
+static int cpu_op_8E(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    desc_type_bitmap_t type;
+    int allow_null = 1;
+    MODRM_W(cpu, seg, 1, 0, &set);
+    switch (set.opr2)
+    {
+    case index_DS:
+    case index_ES:
+    case index_FS:
+    case index_GS:
+        type = type_bitmap_SEG_READ;
+        break;
 
-            case 0xE1: // LOOPZ
-            {
-                const int disp = FETCHSB(cpu);
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->ECX--;
-                    return JUMP_IF(cpu, disp, (cpu->ECX != 0 && cpu->ZF != 0));
-                }
-                else
-                {
-                    cpu->CX--;
-                    return JUMP_IF(cpu, disp, (cpu->CX != 0 && cpu->ZF != 0));
-                }
-            }
+    case index_SS:
+        type = type_bitmap_SEG_WRITE;
+        allow_null = 0;
+        break;
 
-            case 0xE2: // LOOP
-            {
-                const int disp = FETCHSB(cpu);
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    cpu->ECX--;
-                    return JUMP_IF(cpu, disp, (cpu->ECX != 0));
-                }
-                else
-                {
-                    cpu->CX--;
-                    return JUMP_IF(cpu, disp, (cpu->CX != 0));
-                }
-            }
+    case index_CS:
+    default:
+        return cpu_status_ud;
+    }
+    return LOAD_DESCRIPTOR(cpu, &cpu->sregs[set.opr2], READ_LE16(set.opr1), type, allow_null, NULL);
+}
 
-            case 0xE3: // JCXZ
-            {
-                const int disp = FETCHSB(cpu);
-                if (cpu->cpu_context & CPU_CTX_ADDR32)
-                {
-                    return JUMP_IF(cpu, disp, cpu->ECX == 0);
-                }
-                else
-                {
-                    return JUMP_IF(cpu, disp, cpu->CX == 0);
-                }
-            }
+// 8F /0 POP r/m
+static int cpu_op_8F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    MODRM_W(cpu, seg, 1, 1, &set);
+    switch (set.opr2)
+    {
+    case 0: // POP r/m
+        if (cpu->cpu_context & CPU_CTX_DATA32)
+        {
+            WRITE_LE32(set.opr1, POPW(cpu));
+        }
+        else
+        {
+            WRITE_LE16(set.opr1, POPW(cpu));
+        }
+        return 0;
+    default: // XOP
+        return cpu_status_ud;
+    }
+}
 
-            case 0xE4: // IN AL, imm8
-                cpu->AL = vpc_inb(FETCH8(cpu));
-                return 0;
+// 90 NOP
+static int cpu_op_90(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (prefix & PREFIX_REPZ)
+    {
+        return cpu_status_pause;
+    }
+    else
+    {
+        return 0;
+    }
+}
 
-            case 0xE5: // IN AX, imm8
-                if (cpu->cpu_context & (CPU_CTX_DATA32))
-                {
-                    cpu->EAX = vpc_ind(FETCH8(cpu));
-                }
-                else
-                {
-                    cpu->AX = vpc_inw(FETCH8(cpu));
-                }
-                return 0;
+// 91 XCHG AX, reg16
+static int cpu_op_91(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const size_t i7 = inst & 7;
+    if (cpu->cpu_context & CPU_CTX_DATA32)
+    {
+        const uint32_t temp = cpu->gpr[i7];
+        cpu->gpr[i7] = cpu->EAX;
+        cpu->EAX = temp;
+    }
+    else
+    {
+        const uint32_t temp = cpu->gpr[i7];
+        WRITE_LE16(&cpu->gpr[i7], cpu->AX);
+        cpu->AX = temp;
+    }
+    return 0;
+}
 
-            case 0xE6: // OUT imm8, AL
-                vpc_outb(FETCH8(cpu), cpu->AL);
-                return 0;
+// 98 CBW/CWDE
+static int cpu_op_98(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_context & CPU_CTX_DATA32)
+    {
+        cpu->EAX = MOVSXW(cpu->AX);
+    }
+    else
+    {
+        cpu->AX = MOVSXB(cpu->AL);
+    }
+    return 0;
+}
 
-            case 0xE7: // OUT imm8, AX
-                if (cpu->cpu_context & (CPU_CTX_DATA32))
-                {
-                    vpc_outd(FETCH8(cpu), cpu->EAX);
-                }
-                else
-                {
-                    vpc_outw(FETCH8(cpu), cpu->AX);
-                }
-                return 0;
+// 99 CWD/CDQ
+static int cpu_op_99(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_context & CPU_CTX_DATA32)
+    {
+        cpu->EDX = (cpu->EAX & 0x80000000) ? UINT32_MAX : 0;
+    }
+    else
+    {
+        cpu->EDX = (cpu->AX & 0x8000) ? UINT16_MAX : 0;
+    }
+    return 0;
+}
 
-            case 0xE8: // call imm16
-            {
-                const int disp = FETCHSW(cpu);
-                PUSHW(cpu, cpu_reflect_rip_to_eip(cpu));
-                return JUMP_IF(cpu, disp, 1);
-            }
+// 9A CALL far imm32
+static int cpu_op_9A(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const uint32_t new_eip = FETCHW(cpu);
+    const uint16_t new_sel = FETCH16(cpu);
+    return FAR_CALL(cpu, new_sel, new_eip);
+}
 
-            case 0xE9: // jmp imm16
-            {
-                const int disp = FETCHSW(cpu);
-                return JUMP_IF(cpu, disp, 1);
-            }
+// 9B FWAIT
+static int cpu_op_9B(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return cpu_status_fpu;
+}
 
-            case 0xEA: // jmp far imm32
-            {
-                const uint32_t new_eip = FETCHW(cpu);
-                const uint16_t new_sel = FETCH16(cpu);
-                return FAR_JUMP(cpu, new_sel, new_eip);
-            }
+// 9C PUSHF
+static int cpu_op_9C(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    PUSHW(cpu, cpu->eflags);
+    return 0;
+}
 
-            case 0xEB: // jmp d8
-            {
-                const int disp = FETCHSB(cpu);
-                if (disp == -2)
-                {
-                    // Reduce CPU power of forever loop
-                    cpu->rip += disp;
-                    if (cpu->IF)
-                    {
-                        return cpu_status_pause;
-                    }
-                    else
-                    {
-                        return cpu_status_exit;
-                    }
-                }
-                else
-                {
-                    return JUMP_IF(cpu, disp, 1);
-                }
-            }
+// 9D POPF
+static int cpu_op_9D(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    uint32_t mask = is_kernel(cpu) ? cpu->flags_preserve_popf : cpu->flags_preserve_iret3;
+    if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
+    {
+        mask |= 0xFFFF0000;
+    }
+    LOAD_FLAGS(cpu, POPW(cpu), mask);
+    if (cpu->IF || cpu->TF)
+    {
+        return cpu_status_inta;
+    }
+    else
+    {
+        return 0;
+    }
+}
 
-            case 0xEC: // IN AL, DX
-                cpu->AL = vpc_inb(cpu->DX);
-                return 0;
+// 9E SAHF
+static int cpu_op_9E(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    LOAD_FLAGS(cpu, cpu->AH, 0xFFFFFF00);
+    return 0;
+}
 
-            case 0xED: // IN AX, DX
-                if (cpu->cpu_context & (CPU_CTX_DATA32))
-                {
-                    cpu->EAX = vpc_ind(cpu->DX);
-                }
-                else
-                {
-                    cpu->AX = vpc_inw(cpu->DX);
-                }
-                return 0;
+// 9F LAHF
+static int cpu_op_9F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    cpu->AH = cpu->eflags;
+    return 0;
+}
 
-            case 0xEE: // OUT DX, AL
-                vpc_outb(cpu->DX, cpu->AL);
-                return 0;
+// A0 MOV AL, off16
+static ALWAYS_INLINE int cpu_op_A0_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    uint32_t offset;
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        offset = FETCH32(cpu);
+    }
+    else
+    {
+        offset = FETCH16(cpu);
+    }
+    cpu->AL = READ_MEM8(cpu, SEGMENT(&cpu->DS), offset);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_A0)
 
-            case 0xEF: // OUT DX, AX
-                if (cpu->cpu_context & (CPU_CTX_DATA32))
-                {
-                    vpc_outd(cpu->DX, cpu->EAX);
-                }
-                else
-                {
-                    vpc_outw(cpu->DX, cpu->AX);
-                }
-                return 0;
+// A1 MOV AX, off16
+static ALWAYS_INLINE int cpu_op_A1_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    uint32_t offset;
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        offset = FETCH32(cpu);
+    }
+    else
+    {
+        offset = FETCH16(cpu);
+    }
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->EAX = READ_MEM32(cpu, SEGMENT(&cpu->DS), offset);
+    }
+    else
+    {
+        cpu->AX = READ_MEM16(cpu, SEGMENT(&cpu->DS), offset);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_A1)
 
-            case 0xF1: // ICEBP (undocumented)
-                return cpu_status_icebp;
+// A2 MOV off16, AL
+static ALWAYS_INLINE int cpu_op_A2_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    uint32_t offset;
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        offset = FETCH32(cpu);
+    }
+    else
+    {
+        offset = FETCH16(cpu);
+    }
+    WRITE_MEM8(cpu, SEGMENT(&cpu->DS), offset, cpu->AL);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_A2)
 
-            case 0xF4: // HLT
-                if (is_kernel(cpu))
-                {
-                    if (cpu->IF)
-                    {
-                        return cpu_status_halt;
-                    }
-                    else
-                    {
-                        // println("#### SYSTEM HALTED");
-                        // cpu_show_regs(cpu);
-                        return cpu_status_exit;
-                    }
-                }
-                else
-                {
-                    return RAISE_GPF(0);
-                }
+// A3 MOV off16, AX
+static ALWAYS_INLINE int cpu_op_A3_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    uint32_t offset;
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        offset = FETCH32(cpu);
+    }
+    else
+    {
+        offset = FETCH16(cpu);
+    }
+    if (ctx & CPU_CTX_DATA32)
+    {
+        WRITE_MEM32(cpu, SEGMENT(&cpu->DS), offset, cpu->EAX);
+    }
+    else
+    {
+        WRITE_MEM16(cpu, SEGMENT(&cpu->DS), offset, cpu->AX);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_A3)
 
-            case 0xF5: // CMC
-                cpu->CF ^= 1;
-                return 0;
+// A4 MOVSB
+static int cpu_op_A4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return MOVS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+}
 
-            case 0xF6:
-                MODRM_W(cpu, seg, 0, &set);
-                switch (set.opr2)
-                {
-                case 0: // TEST r/m8, imm8
-                    SETFL8(cpu, *set.opr1b & FETCH8(cpu));
-                    cpu->CF = 0;
-                    cpu->OF = 0;
-                    return 0;
-                case 1: // TEST?
-                    return cpu_status_ud;
-                case 2: // NOT r/m8
-                    *set.opr1b = ~*set.opr1b;
-                    return 0;
-                case 3: // NEG r/m8
-                {
-                    const int src = MOVSXB(*set.opr1b);
-                    cpu->AF = !!(src & 15);
-                    cpu->CF = !!src;
-                    *set.opr1b = SETFA8(cpu, -src);
-                    return 0;
-                }
-                case 4: // MUL al, r/m8
-                    cpu->AX = cpu->AL * *set.opr1b;
-                    cpu->OF = cpu->CF = (cpu->AH != 0);
-                    return 0;
-                case 5: // IMUL al, r/m8
-                    cpu->AX = MOVSXB(cpu->AL) * MOVSXB(*set.opr1b);
-                    cpu->OF = cpu->CF = (MOVSXB(cpu->AL) != MOVSXW(cpu->AX));
-                    return 0;
-                case 6: // DIV ax, r/m8
-                {
-                    const uint32_t dst = cpu->AX;
-                    const uint32_t src = *set.opr1b;
-                    if (src == 0)
-                        return cpu_status_div;
-                    const uint32_t value = dst / src;
-                    if (value > 0x100)
-                        return cpu_status_div;
-                    cpu->AL = value;
-                    cpu->AH = dst % src;
-                    return 0;
-                }
-                case 7: // IDIV ax, r/m8
-                {
-                    const int dst = MOVSXW(cpu->AX);
-                    const int src = MOVSXB(*set.opr1b);
-                    if (src == 0)
-                        return cpu_status_div;
-                    const int value = dst / src;
-                    if (value != MOVSXB(value))
-                        return cpu_status_div;
-                    cpu->AL = value;
-                    cpu->AH = dst % src;
-                    return 0;
-                }
-                }
+// A5 MOVSW
+static int cpu_op_A5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return MOVS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+}
 
-            case 0xF7:
-                MODRM_W(cpu, seg, 1, &set);
-                switch (set.opr2)
-                {
-                case 0: // TEST r/m16, imm16
-                    if (set.size == 1)
-                    {
-                        SETFL16(cpu, READ_LE16(set.opr1) & FETCH16(cpu));
-                    }
-                    else
-                    {
-                        SETFL32(cpu, READ_LE32(set.opr1) & FETCH32(cpu));
-                    }
-                    cpu->CF = 0;
-                    cpu->OF = 0;
-                    return 0;
-                case 1: // TEST?
-                    return cpu_status_ud;
-                case 2: // NOT r/m16
-                    if (set.size == 1)
-                    {
-                        WRITE_LE16(set.opr1, ~READ_LE16(set.opr1));
-                    }
-                    else
-                    {
-                        WRITE_LE32(set.opr1, ~READ_LE32(set.opr1));
-                    }
-                    return 0;
-                case 3: // NEG r/m16
-                {
-                    if (set.size == 1)
-                    {
-                        const int src = MOVSXW(READ_LE16(set.opr1));
-                        cpu->AF = !!(src & 15);
-                        cpu->CF = !!src;
-                        WRITE_LE16(set.opr1, SETFA16(cpu, -src));
-                    }
-                    else
-                    {
-                        const int src = READ_LE32(set.opr1);
-                        if (src == INT32_MIN)
-                        {
-                            cpu->CF = 1;
-                            cpu->PF = 1;
-                            cpu->AF = 0;
-                            cpu->ZF = 0;
-                            cpu->SF = 1;
-                            cpu->OF = 1;
-                        }
-                        else
-                        {
-                            cpu->AF = !!(src & 15);
-                            cpu->CF = !!src;
-                            WRITE_LE32(set.opr1, SETFA32(cpu, -src));
-                        }
-                    }
-                    return 0;
-                }
-                case 4: // MUL ax, r/m16
-                {
-                    if (set.size == 1)
-                    {
-                        const uint32_t value = cpu->AX * READ_LE16(set.opr1);
-                        cpu->AX = value;
-                        cpu->DX = value >> 16;
-                        cpu->OF = cpu->CF = (cpu->DX != 0);
-                    }
-                    else
-                    {
-                        const uint64_t value = (uint64_t)cpu->EAX * (uint64_t)READ_LE32(set.opr1);
-                        cpu->EAX = value;
-                        cpu->EDX = value >> 32;
-                        cpu->OF = cpu->CF = (cpu->EDX != 0);
-                    }
-                    return 0;
-                }
-                case 5: // IMUL al, r/m16
-                {
-                    if (set.size == 1)
-                    {
-                        const int value = MOVSXW(cpu->AX) * MOVSXW(READ_LE16(set.opr1));
-                        cpu->AX = value;
-                        cpu->DX = value >> 16;
-                        cpu->OF = cpu->CF = (value > INT16_MAX || value < INT16_MIN);
-                    }
-                    else
-                    {
-                        const int64_t value = MOVSXD(cpu->EAX) * MOVSXD(READ_LE32(set.opr1));
-                        cpu->EAX = value;
-                        cpu->EDX = value >> 32;
-                        cpu->OF = cpu->CF = (value > INT32_MAX || value < INT32_MIN);
-                    }
-                    return 0;
-                }
-                case 6: // DIV ax, r/m16
-                {
-                    if (set.size == 1)
-                    {
-                        const uint32_t dst = (cpu->DX << 16) | cpu->AX;
-                        const uint32_t src = READ_LE16(set.opr1);
-                        if (src == 0)
-                            return cpu_status_div;
-                        const uint32_t value = dst / src;
-                        if (value > 0x10000)
-                            return cpu_status_div;
-                        cpu->AX = value;
-                        cpu->DX = dst % src;
-                    }
-                    else
-                    {
-                        const uint32_t edx = cpu->EDX;
-                        if (edx)
-                        {
-                            const uint64_t dst = ((uint64_t)edx << 32) | (uint64_t)cpu->EAX;
-                            const uint64_t src = READ_LE32(set.opr1);
-                            if (src == 0)
-                                return cpu_status_div;
-                            const uint64_t value = dst / src;
-                            if (value > 0x100000000ULL)
-                                return cpu_status_div;
-                            cpu->EAX = value;
-                            cpu->EDX = dst % src;
-                        }
-                        else
-                        {
-                            const uint32_t dst = cpu->EAX;
-                            const uint32_t src = READ_LE32(set.opr1);
-                            if (src == 0)
-                                return cpu_status_div;
-                            const uint32_t value = dst / src;
-                            cpu->EAX = value;
-                            cpu->EDX = dst % src;
-                        }
-                    }
-                    return 0;
-                }
-                case 7: // IDIV ax, r/m16
-                {
-                    if (set.size == 1)
-                    {
-                        const int dst = (cpu->DX << 16) | cpu->AX;
-                        const int src = MOVSXW(READ_LE16(set.opr1));
-                        if (src == 0)
-                            return cpu_status_div;
-                        const int value = dst / src;
-                        if (value != MOVSXW(value))
-                            return cpu_status_div;
-                        cpu->AX = value;
-                        cpu->DX = dst % src;
-                    }
-                    else
-                    {
-                        const int64_t dst = ((uint64_t)(cpu->EDX) << 32) | (uint64_t)cpu->EAX;
-                        const int64_t src = MOVSXD(READ_LE32(set.opr1));
-                        if (src == 0)
-                            return cpu_status_div;
-                        const int32_t value = dst / src;
-                        if (value != MOVSXD(value))
-                            return cpu_status_div;
-                        cpu->EAX = value;
-                        cpu->EDX = dst % src;
-                    }
-                    return 0;
-                }
-                }
+// A6 CMPSB
+static int cpu_op_A6(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return CMPS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+}
 
-            case 0xF8: // CLC
-                cpu->CF = 0;
-                return 0;
+// A7 CMPSW
+static int cpu_op_A7(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return CMPS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+}
 
-            case 0xF9: // STC
-                cpu->CF = 1;
-                return 0;
+// A8 TEST AL, imm8
+// A9 TEST AX, imm16
+static ALWAYS_INLINE int cpu_op_A8_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    if (inst & 1)
+    {
+        if (ctx & CPU_CTX_DATA32)
+        {
+            set.size = 2;
+        }
+        else
+        {
+            set.size = 1;
+        }
+        set.opr2 = FETCHW_CTX(cpu, ctx);
+    }
+    else
+    {
+        set.size = 0;
+        set.opr2 = FETCH8(cpu);
+    }
+    set.opr1 = &cpu->EAX;
+    AND(cpu, &set, 1);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_A8)
 
-            case 0xFA: // CLI
-                if (is_kernel(cpu))
-                {
-                    cpu->IF = 0;
-                    return 0;
-                }
-                else
-                {
-                    return RAISE_GPF(0);
-                }
+// AA STOSB
+static int cpu_op_AA(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return STOS(cpu, NULL, 0, prefix);
+}
 
-            case 0xFB: // STI
-                if (!cpu->IF)
-                {
-                    cpu->IF = 1;
-                    return cpu_status_inta;
-                }
-                return 0;
+// AB STOSW
+static int cpu_op_AB(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return STOS(cpu, NULL, cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+}
 
-            case 0xFC: // CLD
-                cpu->DF = 0;
-                return 0;
+// AC LODSB
+static int cpu_op_AC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return LODS(cpu, SEGMENT(&cpu->DS), 0, prefix);
+}
 
-            case 0xFD: // STD
-                cpu->DF = 1;
-                return 0;
+// AD LODSW
+static int cpu_op_AD(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return LODS(cpu, SEGMENT(&cpu->DS), cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+}
 
-            case 0xFE: //
-            {
-                MODRM_W(cpu, seg, 0, &set);
-                switch (set.opr2)
-                {
-                case 0: // INC r/m8
-                    INC(cpu, &set);
-                    return 0;
-                case 1: // DEC r/m8
-                    DEC(cpu, &set);
-                    return 0;
-                default:
-                    return cpu_status_ud;
-                }
-            }
-            case 0xFF: //
-            {
-                const int mod = MODRM_W(cpu, seg, 1, &set);
-                switch (set.opr2)
-                {
-                case 0: // INC r/m16
-                    INC(cpu, &set);
-                    return 0;
-                case 1: // DEC r/m16
-                    DEC(cpu, &set);
-                    return 0;
-                case 2: // CALL r/m16
-                {
-                    PUSHW(cpu, cpu_reflect_rip_to_eip(cpu));
-                    uint32_t new_eip;
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        new_eip = READ_LE32(set.opr1);
-                    }
-                    else
-                    {
-                        new_eip = READ_LE16(set.opr1);
-                    }
-                    cpu_set_eip(cpu, new_eip);
-                    return CS_LIMIT_CHECK(cpu, 0);
-                }
-                case 3: // CALL FAR m16:16
-                {
-                    if (mod)
-                        return cpu_status_ud;
-                    uint32_t new_sel, new_eip;
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        new_eip = READ_LE32(set.opr1b);
-                        new_sel = READ_LE16(set.opr1b + 4);
-                    }
-                    else
-                    {
-                        new_eip = READ_LE16(set.opr1b);
-                        new_sel = READ_LE16(set.opr1b + 2);
-                    }
-                    return FAR_CALL(cpu, new_sel, new_eip);
-                }
-                case 4: // JMP r/m 16
-                {
-                    uint32_t new_eip;
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        new_eip = READ_LE32(set.opr1);
-                    }
-                    else
-                    {
-                        new_eip = READ_LE16(set.opr1);
-                    }
-                    cpu_set_eip(cpu, new_eip);
-                    return CS_LIMIT_CHECK(cpu, 0);
-                }
-                case 5: // JMP FAR m16:16
-                {
-                    if (mod)
-                        return cpu_status_ud;
-                    uint32_t new_sel, new_eip;
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        new_eip = READ_LE32(set.opr1b);
-                        new_sel = READ_LE16(set.opr1b + 4);
-                    }
-                    else
-                    {
-                        new_eip = READ_LE16(set.opr1b);
-                        new_sel = READ_LE16(set.opr1b + 2);
-                    }
-                    return FAR_JUMP(cpu, new_sel, new_eip);
-                }
-                case 6: // PUSH r/m16
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        PUSHW(cpu, READ_LE32(set.opr1));
-                    }
-                    else
-                    {
-                        PUSHW(cpu, READ_LE16(set.opr1));
-                    }
-                    return 0;
-                default: // FF FF (#ud)
-                    return cpu_status_ud;
-                }
+// AE SCASB
+static int cpu_op_AE(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return SCAS(cpu, NULL, 0, prefix);
+}
+
+// AF SCASW
+static int cpu_op_AF(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // return SCAS(cpu, NULL, cpu->cpu_context & CPU_CTX_DATA32 ? 2 : 1, prefix);
+    if (cpu->cpu_context & (CPU_CTX_DATA32 | CPU_CTX_ADDR32))
+        return cpu_status_ud;
+    sreg_t *_seg = SEGMENT(&cpu->ES);
+    int repz = prefix & PREFIX_REPZ;
+    int repnz = prefix & PREFIX_REPNZ;
+    int rep = repz | repnz;
+    if (rep && cpu->CX == 0)
+        return 0;
+    do
+    {
+        int dst = MOVSXW(cpu->AX);
+        int src = MOVSXW(READ_MEM16(cpu, _seg, cpu->DI));
+        if (cpu->pending_fault)
+            break;
+        int value = dst - src;
+        cpu->AF = (dst & 15) - (src & 15) < 0;
+        cpu->CF = dst < src;
+        SETFA16(cpu, value);
+        if (cpu->DF)
+        {
+            cpu->DI -= 2;
+        }
+        else
+        {
+            cpu->DI += 2;
+        }
+    } while (rep && --cpu->CX && ((repnz && !cpu->ZF) || (repz && cpu->ZF)));
+    cpu_string_resume(cpu);
+    return 0;
+}
+
+// B0 MOV reg8, imm8
+static int cpu_op_B0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->AL = FETCH8(cpu);
+    return 0;
+}
+
+// B1 MOV CL, imm8
+static int cpu_op_B1(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->CL = FETCH8(cpu);
+    return 0;
+}
+
+// B2 MOV DL, imm8
+static int cpu_op_B2(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->DL = FETCH8(cpu);
+    return 0;
+}
+
+// B3 MOV BL, imm8
+static int cpu_op_B3(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->BL = FETCH8(cpu);
+    return 0;
+}
+
+// B4 MOV AH, imm8
+static int cpu_op_B4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->AH = FETCH8(cpu);
+    return 0;
+}
+
+// B5 MOV CH, imm8
+static int cpu_op_B5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->CH = FETCH8(cpu);
+    return 0;
+}
+
+// B6 MOV DH, imm8
+static int cpu_op_B6(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->DH = FETCH8(cpu);
+    return 0;
+}
+
+// B7 MOV BH, imm8
+static int cpu_op_B7(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->BH = FETCH8(cpu);
+    return 0;
+}
+
+// B8 MOV reg16, imm16
+static ALWAYS_INLINE int cpu_op_B8_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->gpr[inst & 7] = FETCH32(cpu);
+    }
+    else
+    {
+        WRITE_LE16(&cpu->gpr[inst & 7], FETCH16(cpu));
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_B8)
+
+// C0 shift r/m, imm5 (186+)
+// C1 shift r/m, imm5 (186+)
+static int cpu_op_C0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, inst & 1, 1, &set);
+    return SHIFT(cpu, &set, FETCH8(cpu));
+}
+
+// C2 RET imm16
+static ALWAYS_INLINE int cpu_op_C2_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const uint32_t new_eip = POPW_CTX(cpu, ctx);
+    const uint32_t imm = FETCH16(cpu);
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        cpu->ESP += imm;
+    }
+    else
+    {
+        cpu->SP += imm;
+    }
+    cpu_set_eip(cpu, new_eip);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_C2)
+
+// C3 RET
+static ALWAYS_INLINE int cpu_op_C3_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const uint32_t new_eip = POPW_CTX(cpu, ctx);
+    cpu_set_eip(cpu, new_eip);
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_C3)
+
+// C4 LES reg, r/m
+static int cpu_op_C4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return LDS(cpu, seg, &cpu->ES);
+}
+
+// C5 LDS reg, r/m
+static int cpu_op_C5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return LDS(cpu, seg, &cpu->DS);
+}
+
+// C6 /0 MOV r/m, imm8
+// C7 /0 MOV r/m, imm16
+static ALWAYS_INLINE int cpu_op_C6_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_CTX(cpu, seg, inst & 1, 1, &set, ctx);
+    switch (set.opr2)
+    {
+    case 0: // MOV r/m, imm
+        switch (set.size)
+        {
+        case 0:
+            *set.opr1b = FETCH8(cpu);
+            return 0;
+        case 1:
+            WRITE_LE16(set.opr1, FETCH16(cpu));
+            return 0;
+        case 2:
+            WRITE_LE32(set.opr1, FETCH32(cpu));
+            return 0;
+        }
+    default:
+        return cpu_status_ud;
+    }
+}
+CPU_OP_SPECIALIZE(cpu_op_C6)
+
+// C8 ENTER imm16, imm8
+static int cpu_op_C8(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const uint32_t param1 = FETCH16(cpu);
+    const int param2 = FETCH8(cpu);
+    if (param2 != 0)
+        return cpu_status_ud;
+    if (cpu->cpu_context & CPU_CTX_DATA32)
+    {
+        PUSHW(cpu, cpu->EBP);
+        cpu->EBP = cpu->ESP;
+        cpu->ESP -= param1;
+    }
+    else
+    {
+        PUSHW(cpu, cpu->BP);
+        cpu->BP = cpu->SP;
+        cpu->SP -= param1;
+    }
+    return 0;
+}
+
+// C9 LEAVE
+static int cpu_op_C9(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    {
+        cpu->ESP = cpu->EBP;
+    }
+    else
+    {
+        cpu->SP = cpu->BP;
+    }
+    if (cpu->cpu_context & CPU_CTX_DATA32)
+    {
+        cpu->EBP = POPW(cpu);
+    }
+    else
+    {
+        cpu->BP = POPW(cpu);
+    }
+    return 0;
+}
+
+// CA RETF imm16
+static int cpu_op_CA(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return RETF(cpu, FETCH16(cpu));
+}
+
+// CB RETF
+static int cpu_op_CB(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return RETF(cpu, 0);
+}
+
+// CC INT 3
+static int cpu_op_CC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const int result = INVOKE_INT(cpu, 3, software);
+    return result ? result : cpu_status_pause;
+}
+
+// CD INT
+static int cpu_op_CD(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return INVOKE_INT(cpu, FETCH8(cpu), software);
+}
+
+// CE INTO
+static int cpu_op_CE(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if (cpu->OF)
+    {
+        return INVOKE_INT(cpu, 4, exception);
+    }
+    return 0;
+}
+
+// CF IRET
+static int cpu_op_CF(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return IRET(cpu);
+}
+
+// D0 shift r/m, 1
+// D1 shift r/m, 1
+static int cpu_op_D0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, inst & 1, 1, &set);
+    return SHIFT(cpu, &set, 1);
+}
+
+// D2 shift r/m, cl
+// D3 shift r/m, cl
+static int cpu_op_D2(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, inst & 1, 1, &set);
+    return SHIFT(cpu, &set, cpu->CL);
+}
+
+// D4 AAM
+static int cpu_op_D4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const int param = FETCH8(cpu);
+    const uint8_t al = cpu->AL;
+    cpu->AH = al / param;
+    cpu->AL = SETFA8(cpu, al % param);
+    return 0;
+}
+
+// D5 AAD
+static int cpu_op_D5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const int param = FETCH8(cpu);
+    cpu->AL = SETFA8(cpu, cpu->AL + cpu->AH * param);
+    cpu->AH = 0;
+    return 0;
+}
+
+// case 0xD6: // SALC (undocumented)
+//     cpu->AL = 0 - cpu->CF;
+//     return 0;
+
+// D7 XLAT
+static int cpu_op_D7(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    {
+        cpu->AL = READ_MEM8(cpu, SEGMENT(&cpu->DS), cpu->EBX + cpu->AL);
+    }
+    else
+    {
+        cpu->AL = READ_MEM8(cpu, SEGMENT(&cpu->DS), (cpu->BX + cpu->AL) & 0xFFFF);
+    }
+    return 0;
+}
+
+// D8 ESC (IGNORED)
+static int cpu_op_D8(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    modrm_t modrm;
+    MODRM(cpu, seg, &modrm);
+    return cpu_status_fpu;
+}
+
+// E0 LOOPNZ
+static int cpu_op_E0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const int disp = FETCHSB(cpu);
+    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    {
+        cpu->ECX--;
+        return JUMP_IF(cpu, disp, (cpu->ECX != 0 && cpu->ZF == 0));
+    }
+    else
+    {
+        cpu->CX--;
+        return JUMP_IF(cpu, disp, (cpu->CX != 0 && cpu->ZF == 0));
+    }
+}
+
+// E1 LOOPZ
+static int cpu_op_E1(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const int disp = FETCHSB(cpu);
+    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    {
+        cpu->ECX--;
+        return JUMP_IF(cpu, disp, (cpu->ECX != 0 && cpu->ZF != 0));
+    }
+    else
+    {
+        cpu->CX--;
+        return JUMP_IF(cpu, disp, (cpu->CX != 0 && cpu->ZF != 0));
+    }
+}
+
+// E2 LOOP
+static ALWAYS_INLINE int cpu_op_E2_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const int disp = FETCHSB(cpu);
+    if (ctx & CPU_CTX_ADDR32)
+    {
+        cpu->ECX--;
+        return JUMP_IF_CTX(cpu, disp, (cpu->ECX != 0), ctx);
+    }
+    else
+    {
+        cpu->CX--;
+        return JUMP_IF_CTX(cpu, disp, (cpu->CX != 0), ctx);
+    }
+}
+CPU_OP_SPECIALIZE(cpu_op_E2)
+
+// E3 JCXZ
+static int cpu_op_E3(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const int disp = FETCHSB(cpu);
+    if (cpu->cpu_context & CPU_CTX_ADDR32)
+    {
+        return JUMP_IF(cpu, disp, cpu->ECX == 0);
+    }
+    else
+    {
+        return JUMP_IF(cpu, disp, cpu->CX == 0);
+    }
+}
+
+// E4 IN AL, imm8
+static int cpu_op_E4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const int port = FETCH8(cpu);
+    if (io_defer(port, 1, 0, 0))
+        return cpu_status_timer;
+    cpu->AL = io_inb(cpu, port);
+    return 0;
+}
+
+// E5 IN AX, imm8
+static int cpu_op_E5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const int port = FETCH8(cpu);
+    if (cpu->cpu_context & (CPU_CTX_DATA32))
+    {
+        cpu->EAX = io_ind(port);
+    }
+    else
+    {
+        if (io_defer(port, 2, 0, 0))
+            return cpu_status_timer;
+        cpu->AX = io_inw(cpu, port);
+    }
+    return 0;
+}
+
+// E6 OUT imm8, AL
+static int cpu_op_E6(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const int port = FETCH8(cpu);
+    if (io_defer(port, 1, 1, cpu->AL))
+        return cpu_status_timer;
+    return io_outb(cpu, port, cpu->AL);
+}
+
+// E7 OUT imm8, AX
+static int cpu_op_E7(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    const int port = FETCH8(cpu);
+    if (cpu->cpu_context & (CPU_CTX_DATA32))
+    {
+        io_outd(port, cpu->EAX);
+        return 0;
+    }
+    else
+    {
+        if (io_defer(port, 2, 1, cpu->AX))
+            return cpu_status_timer;
+        return io_outw(cpu, port, cpu->AX);
+    }
+}
+
+// E8 call imm16
+static ALWAYS_INLINE int cpu_op_E8_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const int disp = FETCHSW_CTX(cpu, ctx);
+    PUSHW_CTX(cpu, cpu_reflect_rip_to_eip(cpu), ctx);
+    return JUMP_IF_CTX(cpu, disp, 1, ctx);
+}
+CPU_OP_SPECIALIZE(cpu_op_E8)
+
+// E9 jmp imm16
+static ALWAYS_INLINE int cpu_op_E9_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const int disp = FETCHSW_CTX(cpu, ctx);
+    return JUMP_IF_CTX(cpu, disp, 1, ctx);
+}
+CPU_OP_SPECIALIZE(cpu_op_E9)
+
+// EA jmp far imm32
+static int cpu_op_EA(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    const uint32_t new_eip = FETCHW(cpu);
+    const uint16_t new_sel = FETCH16(cpu);
+    return FAR_JUMP(cpu, new_sel, new_eip);
+}
+
+// EB jmp d8
+static ALWAYS_INLINE int cpu_op_EB_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    const int disp = FETCHSB(cpu);
+    if (disp == -2)
+    {
+        // Reduce CPU power of forever loop
+        cpu->rip += disp;
+        if (cpu->IF)
+        {
+            return cpu_status_pause;
+        }
+        else
+        {
+            return cpu_status_exit;
+        }
+    }
+    else
+    {
+        return JUMP_IF_CTX(cpu, disp, 1, ctx);
+    }
+}
+CPU_OP_SPECIALIZE(cpu_op_EB)
+
+// EC IN AL, DX
+static int cpu_op_EC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (io_defer(cpu->DX, 1, 0, 0))
+        return cpu_status_timer;
+    cpu->AL = io_inb(cpu, cpu->DX);
+    return 0;
+}
+
+// ED IN AX, DX
+static int cpu_op_ED(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_context & (CPU_CTX_DATA32))
+    {
+        cpu->EAX = io_ind(cpu->DX);
+    }
+    else
+    {
+        if (io_defer(cpu->DX, 2, 0, 0))
+            return cpu_status_timer;
+        cpu->AX = io_inw(cpu, cpu->DX);
+    }
+    return 0;
+}
+
+// EE OUT DX, AL
+static int cpu_op_EE(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (io_defer(cpu->DX, 1, 1, cpu->AL))
+        return cpu_status_timer;
+    return io_outb(cpu, cpu->DX, cpu->AL);
+}
+
+// EF OUT DX, AX
+static int cpu_op_EF(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (cpu->cpu_context & (CPU_CTX_DATA32))
+    {
+        io_outd(cpu->DX, cpu->EAX);
+        return 0;
+    }
+    else
+    {
+        if (io_defer(cpu->DX, 2, 1, cpu->AX))
+            return cpu_status_timer;
+        return io_outw(cpu, cpu->DX, cpu->AX);
+    }
+}
+
+// F1 ICEBP (undocumented)
+static int cpu_op_F1(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return cpu_status_icebp;
+}
+
+// F4 HLT
+static int cpu_op_F4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if (is_kernel(cpu))
+    {
+        if (cpu->IF)
+        {
+            return cpu_status_halt;
+        }
+        else
+        {
+            // println("#### SYSTEM HALTED");
+            // cpu_show_regs(cpu);
+            return cpu_status_exit;
+        }
+    }
+    else
+    {
+        return RAISE_GPF(0);
+    }
+}
+
+// F5 CMC
+static int cpu_op_F5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    cpu->CF ^= 1;
+    return 0;
+}
+
+// F6 grp3 r/m8
+static int cpu_op_F6(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 0, (MODRM_PEEK_REG(cpu) & 6) == 2, &set);
+    switch (set.opr2)
+    {
+    case 0: // TEST r/m8, imm8
+        SETFL8(cpu, *set.opr1b & FETCH8(cpu));
+        cpu->CF = 0;
+        cpu->OF = 0;
+        return 0;
+    case 1: // TEST?
+        return cpu_status_ud;
+    case 2: // NOT r/m8
+        *set.opr1b = ~*set.opr1b;
+        return 0;
+    case 3: // NEG r/m8
+    {
+        const int src = MOVSXB(*set.opr1b);
+        cpu->AF = !!(src & 15);
+        cpu->CF = !!src;
+        *set.opr1b = SETFA8(cpu, -src);
+        return 0;
+    }
+    case 4: // MUL al, r/m8
+        cpu->AX = cpu->AL * *set.opr1b;
+        cpu->OF = cpu->CF = (cpu->AH != 0);
+        return 0;
+    case 5: // IMUL al, r/m8
+        cpu->AX = MOVSXB(cpu->AL) * MOVSXB(*set.opr1b);
+        cpu->OF = cpu->CF = (MOVSXB(cpu->AL) != MOVSXW(cpu->AX));
+        return 0;
+    case 6: // DIV ax, r/m8
+    {
+        const uint32_t dst = cpu->AX;
+        const uint32_t src = *set.opr1b;
+        if (src == 0)
+            return cpu_status_div;
+        const uint32_t value = dst / src;
+        if (value > 0x100)
+            return cpu_status_div;
+        cpu->AL = value;
+        cpu->AH = dst % src;
+        return 0;
+    }
+    case 7: // IDIV ax, r/m8
+    {
+        const int dst = MOVSXW(cpu->AX);
+        const int src = MOVSXB(*set.opr1b);
+        if (src == 0)
+            return cpu_status_div;
+        const int value = dst / src;
+        if (value != MOVSXB(value))
+            return cpu_status_div;
+        cpu->AL = value;
+        cpu->AH = dst % src;
+        return 0;
+    }
+    }
+}
+
+// F7 grp3 r/m16
+static int cpu_op_F7(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, (MODRM_PEEK_REG(cpu) & 6) == 2, &set);
+    switch (set.opr2)
+    {
+    case 0: // TEST r/m16, imm16
+        if (set.size == 1)
+        {
+            SETFL16(cpu, READ_LE16(set.opr1) & FETCH16(cpu));
+        }
+        else
+        {
+            SETFL32(cpu, READ_LE32(set.opr1) & FETCH32(cpu));
+        }
+        cpu->CF = 0;
+        cpu->OF = 0;
+        return 0;
+    case 1: // TEST?
+        return cpu_status_ud;
+    case 2: // NOT r/m16
+        if (set.size == 1)
+        {
+            WRITE_LE16(set.opr1, ~READ_LE16(set.opr1));
+        }
+        else
+        {
+            WRITE_LE32(set.opr1, ~READ_LE32(set.opr1));
+        }
+        return 0;
+    case 3: // NEG r/m16
+    {
+        if (set.size == 1)
+        {
+            const int src = MOVSXW(READ_LE16(set.opr1));
+            cpu->AF = !!(src & 15);
+            cpu->CF = !!src;
+            WRITE_LE16(set.opr1, SETFA16(cpu, -src));
+        }
+        else
+        {
+            const int src = READ_LE32(set.opr1);
+            if (src == INT32_MIN)
+            {
+                cpu->CF = 1;
+                cpu->PF = 1;
+                cpu->AF = 0;
+                cpu->ZF = 0;
+                cpu->SF = 1;
+                cpu->OF = 1;
+            }
+            else
+            {
+                cpu->AF = !!(src & 15);
+                cpu->CF = !!src;
+                WRITE_LE32(set.opr1, SETFA32(cpu, -src));
+            }
+        }
+        return 0;
+    }
+    case 4: // MUL ax, r/m16
+    {
+        if (set.size == 1)
+        {
+            const uint32_t value = cpu->AX * READ_LE16(set.opr1);
+            cpu->AX = value;
+            cpu->DX = value >> 16;
+            cpu->OF = cpu->CF = (cpu->DX != 0);
+        }
+        else
+        {
+            const uint64_t value = (uint64_t)cpu->EAX * (uint64_t)READ_LE32(set.opr1);
+            cpu->EAX = value;
+            cpu->EDX = value >> 32;
+            cpu->OF = cpu->CF = (cpu->EDX != 0);
+        }
+        return 0;
+    }
+    case 5: // IMUL al, r/m16
+    {
+        if (set.size == 1)
+        {
+            const int value = MOVSXW(cpu->AX) * MOVSXW(READ_LE16(set.opr1));
+            cpu->AX = value;
+            cpu->DX = value >> 16;
+            cpu->OF = cpu->CF = (value > INT16_MAX || value < INT16_MIN);
+        }
+        else
+        {
+            const int64_t value = MOVSXD(cpu->EAX) * MOVSXD(READ_LE32(set.opr1));
+            cpu->EAX = value;
+            cpu->EDX = value >> 32;
+            cpu->OF = cpu->CF = (value > INT32_MAX || value < INT32_MIN);
+        }
+        return 0;
+    }
+    case 6: // DIV ax, r/m16
+    {
+        if (set.size == 1)
+        {
+            const uint32_t dst = (cpu->DX << 16) | cpu->AX;
+            const uint32_t src = READ_LE16(set.opr1);
+            if (src == 0)
+                return cpu_status_div;
+            const uint32_t value = dst / src;
+            if (value > 0x10000)
+                return cpu_status_div;
+            cpu->AX = value;
+            cpu->DX = dst % src;
+        }
+        else
+        {
+            const uint32_t edx = cpu->EDX;
+            if (edx)
+            {
+                const uint64_t dst = ((uint64_t)edx << 32) | (uint64_t)cpu->EAX;
+                const uint64_t src = READ_LE32(set.opr1);
+                if (src == 0)
+                    return cpu_status_div;
+                const uint64_t value = dst / src;
+                if (value > 0x100000000ULL)
+                    return cpu_status_div;
+                cpu->EAX = value;
+                cpu->EDX = dst % src;
             }
+            else
+            {
+                const uint32_t dst = cpu->EAX;
+                const uint32_t src = READ_LE32(set.opr1);
+                if (src == 0)
+                    return cpu_status_div;
+                const uint32_t value = dst / src;
+                cpu->EAX = value;
+                cpu->EDX = dst % src;
+            }
+        }
+        return 0;
+    }
+    case 7: // IDIV ax, r/m16
+    {
+        if (set.size == 1)
+        {
+            const int dst = (cpu->DX << 16) | cpu->AX;
+            const int src = MOVSXW(READ_LE16(set.opr1));
+            if (src == 0)
+                return cpu_status_div;
+            const int value = dst / src;
+            if (value != MOVSXW(value))
+                return cpu_status_div;
+            cpu->AX = value;
+            cpu->DX = dst % src;
+        }
+        else
+        {
+            const int64_t dst = ((uint64_t)(cpu->EDX) << 32) | (uint64_t)cpu->EAX;
+            const int64_t src = MOVSXD(READ_LE32(set.opr1));
+            if (src == 0)
+                return cpu_status_div;
+            const int32_t value = dst / src;
+            if (value != MOVSXD(value))
+                return cpu_status_div;
+            cpu->EAX = value;
+            cpu->EDX = dst % src;
+        }
+        return 0;
+    }
+    }
+}
+
+// F8 CLC
+static int cpu_op_F8(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    cpu->CF = 0;
+    return 0;
+}
+
+// F9 STC
+static int cpu_op_F9(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    cpu->CF = 1;
+    return 0;
+}
+
+// FA CLI
+static int cpu_op_FA(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (is_kernel(cpu))
+    {
+        cpu->IF = 0;
+        return 0;
+    }
+    else
+    {
+        return RAISE_GPF(0);
+    }
+}
+
+// FB STI
+static int cpu_op_FB(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    if (!cpu->IF)
+    {
+        cpu->IF = 1;
+        return cpu_status_inta;
+    }
+    return 0;
+}
+
+// FC CLD
+static int cpu_op_FC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->DF = 0;
+    return 0;
+}
+
+// FD STD
+static int cpu_op_FD(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu->DF = 1;
+    return 0;
+}
+
+// FE grp4 r/m8
+static ALWAYS_INLINE int cpu_op_FE_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    MODRM_W_CTX(cpu, seg, 0, 1, &set, ctx);
+    switch (set.opr2)
+    {
+    case 0: // INC r/m8
+        INC(cpu, &set);
+        return 0;
+    case 1: // DEC r/m8
+        DEC(cpu, &set);
+        return 0;
+    default:
+        return cpu_status_ud;
+    }
+}
+CPU_OP_SPECIALIZE(cpu_op_FE)
+
+// FF grp5 r/m16
+static ALWAYS_INLINE int cpu_op_FF_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    const int mod = MODRM_W_CTX(cpu, seg, 1, MODRM_PEEK_REG(cpu) < 2, &set, ctx);
+    switch (set.opr2)
+    {
+    case 0: // INC r/m16
+        INC(cpu, &set);
+        return 0;
+    case 1: // DEC r/m16
+        DEC(cpu, &set);
+        return 0;
+    case 2: // CALL r/m16
+    {
+        uint32_t new_eip;
+        if (ctx & CPU_CTX_DATA32)
+        {
+            new_eip = READ_LE32(set.opr1);
+        }
+        else
+        {
+            new_eip = READ_LE16(set.opr1);
+        }
+        const int status = CS_LIMIT_CHECK(cpu, &cpu->CS, new_eip);
+        if (status)
+            return status;
+        PUSHW_CTX(cpu, cpu_reflect_rip_to_eip(cpu), ctx);
+        cpu_set_eip(cpu, new_eip);
+        return 0;
+    }
+    case 3: // CALL FAR m16:16
+    {
+        if (mod)
+            return cpu_status_ud;
+        uint32_t new_sel, new_eip;
+        if (ctx & CPU_CTX_DATA32)
+        {
+            new_eip = READ_LE32(set.opr1b);
+            new_sel = READ_LE16(set.opr1b + 4);
+        }
+        else
+        {
+            new_eip = READ_LE16(set.opr1b);
+            new_sel = READ_LE16(set.opr1b + 2);
+        }
+        return FAR_CALL(cpu, new_sel, new_eip);
+    }
+    case 4: // JMP r/m 16
+    {
+        uint32_t new_eip;
+        if (ctx & CPU_CTX_DATA32)
+        {
+            new_eip = READ_LE32(set.opr1);
+        }
+        else
+        {
+            new_eip = READ_LE16(set.opr1);
+        }
+        const int status = CS_LIMIT_CHECK(cpu, &cpu->CS, new_eip);
+        if (status)
+            return status;
+        cpu_set_eip(cpu, new_eip);
+        return 0;
+    }
+    case 5: // JMP FAR m16:16
+    {
+        if (mod)
+            return cpu_status_ud;
+        uint32_t new_sel, new_eip;
+        if (ctx & CPU_CTX_DATA32)
+        {
+            new_eip = READ_LE32(set.opr1b);
+            new_sel = READ_LE16(set.opr1b + 4);
+        }
+        else
+        {
+            new_eip = READ_LE16(set.opr1b);
+            new_sel = READ_LE16(set.opr1b + 2);
+        }
+        return FAR_JUMP(cpu, new_sel, new_eip);
+    }
+    case 6: // PUSH r/m16
+        if (ctx & CPU_CTX_DATA32)
+        {
+            PUSHW_CTX(cpu, READ_LE32(set.opr1), ctx);
+        }
+        else
+        {
+            PUSHW_CTX(cpu, READ_LE16(set.opr1), ctx);
+        }
+        return 0;
+    default: // FF FF (#ud)
+        return cpu_status_ud;
+    }
+}
+CPU_OP_SPECIALIZE(cpu_op_FF)
+
+// 0F 00 grp6 (SLDT, STR, LLDT, LTR, VERR, VERW)
+static int cpu_op_0F00(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    if (!cpu->CR0.PE || cpu->VM)
+        return cpu_status_ud;
+    int mod = MODRM_W(cpu, seg, 1, MODRM_PEEK_REG(cpu) < 2, &set);
+    switch (set.opr2)
+    {
+    case 0: // SLDT
+        WRITE_LE16(set.opr1, cpu->LDT.sel);
+        return 0;
+    case 1: // STR
+        WRITE_LE16(set.opr1, cpu->TSS.sel);
+        return 0;
+    case 2: // LLDT
+    {
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        uint16_t new_sel = READ_LE16(set.opr1);
+        return LOAD_DESCRIPTOR(cpu, &cpu->LDT, new_sel, type_bitmap_LDT, 1, NULL);
+    }
+    case 3: // LTR
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        uint16_t new_sel = READ_LE16(set.opr1);
+        return LOAD_DESCRIPTOR(cpu, &cpu->TSS, new_sel, type_bitmap_TSS32, 0, NULL);
+    case 4: // VERR
+    {
+        sreg_t temp;
+        uint16_t sel = READ_LE16(set.opr1);
+        cpu->ZF = (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_READ, 0, NULL) == 0);
+        return 0;
+    }
+    case 5: // VERW
+    {
+        sreg_t temp;
+        uint16_t sel = READ_LE16(set.opr1);
+        cpu->ZF = (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_WRITE, 0, NULL) == 0);
+        return 0;
+    }
+    }
+    return cpu_status_ud;
+}
+
+// 0F 01 grp7 (SGDT, SIDT, LGDT, LIDT, SMSW, LMSW, INVLPG)
+static int cpu_op_0F01(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    const int reg = MODRM_PEEK_REG(cpu);
+    if (reg == 7)
+    {
+        // INVLPG only takes the address of its operand
+        modrm_t modrm;
+        if (MODRM(cpu, seg, &modrm))
+            return cpu_status_ud;
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        cpu_tlb_flush_page(cpu, modrm.linear);
+        cpu->code_lo = (cpu_rip_t)UINTPTR_MAX;
+        return 0;
+    }
+    int mod = MODRM_W(cpu, seg, 1, reg < 2 || reg == 4, &set);
+    switch (set.opr2)
+    {
+    case 0: // SGDT
+    {
+        if (mod)
+            return cpu_status_ud;
+        // TODO: 16bit SGDT
+        WRITE_LE16(set.opr1b, cpu->GDT.limit);
+        WRITE_LE32(set.opr1b, cpu->GDT.base);
+        return 0;
+    }
+    case 1: // SIDT
+    {
+        if (mod)
+            return cpu_status_ud;
+        // TODO: 16bit SGDT
+        WRITE_LE16(set.opr1b, cpu->IDT.limit);
+        WRITE_LE32(set.opr1b, cpu->IDT.base);
+        return 0;
+    }
+    case 2: // LGDT
+    {
+        if (mod)
+            return cpu_status_ud;
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        desc_t new_dt;
+        new_dt.limit = READ_LE16(set.opr1b);
+        new_dt.base = READ_LE32(set.opr1b + 2);
+        if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
+        {
+            new_dt.base &= 0xFFFFFF;
+        }
+        cpu->GDT = new_dt;
+        return 0;
+    }
+    case 3: // LIDT
+    {
+        if (mod)
+            return cpu_status_ud;
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        desc_t new_dt;
+        new_dt.limit = READ_LE16(set.opr1b);
+        new_dt.base = READ_LE32(set.opr1b + 2);
+        if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
+        {
+            new_dt.base &= 0xFFFFFF;
+        }
+        cpu->IDT = new_dt;
+        return 0;
+    }
+    case 4: // SMSW
+    {
+        WRITE_LE16(set.opr1, cpu->CR[0]);
+        return 0;
+    }
+    case 6: // LMSW
+    {
+        if (cpu->cpu_gen < cpu_gen_80286)
+            return cpu_status_ud;
+        if (!is_kernel(cpu))
+            return RAISE_GPF(0);
+        // LMSW affects only lower 4bits
+        uint32_t new_value = (*set.opr1b & 0x000F);
+        if (cpu->CR0.PE && ((new_value & 1) == 0))
+            return cpu_status_gpf;
+        // cpu->CR0.value = (cpu->CR0.value & 0xFFFFFFF0) | new_value;
+        cpu->CR0.msw = new_value;
+        return 0;
+    }
+    case 7: // INVLPG (see above)
+        return 0;
+    }
+    return cpu_status_ud;
+}
+
+// 0F 02 LAR reg, r/m
+static int cpu_op_0F02(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    if (!cpu->CR0.PE || cpu->VM)
+        return cpu_status_ud;
+    sreg_t temp;
+    uint16_t sel = READ_LE16(set.opr1);
+    if (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_ALL, 0, NULL) == 0)
+    {
+        cpu->ZF = 1;
+        uint32_t value = temp.attr_u8l << 8;
+        if (cpu->cpu_context & CPU_CTX_DATA32)
+        {
+            value |= temp.attr_u8h << 16;
+            cpu->gpr[set.opr2] = value;
+        }
+        else
+        {
+            WRITE_LE16(&cpu->gpr[set.opr2], value);
+        }
+    }
+    else
+    {
+        cpu->ZF = 0;
+    }
+    return 0;
+}
+
+// 0F 03 LSL reg, r/m
+static int cpu_op_0F03(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    if (!cpu->CR0.PE || cpu->VM)
+        return cpu_status_ud;
+    sreg_t temp;
+    uint16_t sel = READ_LE16(set.opr1);
+    if (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_ALL, 0, NULL) == 0)
+    {
+        cpu->ZF = 1;
+        uint32_t value = temp.limit;
+        if (cpu->cpu_context & CPU_CTX_DATA32)
+        {
+            cpu->gpr[set.opr2] = value;
+        }
+        else
+        {
+            WRITE_LE16(&cpu->gpr[set.opr2], value);
+        }
+    }
+    else
+    {
+        cpu->ZF = 0;
+    }
+    return 0;
+}
+
+// case 0x05: // LOADALL / SYSCALL
+
+// 0F 06 CLTS
+static int cpu_op_0F06(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if (is_kernel(cpu))
+    {
+        cpu->CR0.TS = 0;
+        return 0;
+    }
+    else
+    {
+        return RAISE_GPF(0);
+    }
+}
+
+// case 0x07: // LOADALL / SYSRET
+
+// 0F 08 INVD (NOP)
+// 0F 09 WBINVD (NOP)
+static int cpu_op_0F08(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return 0;
+}
+
+// 0F 0B UD2
+static int cpu_op_0F0B(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return cpu_status_ud;
+}
+
+// 0F 1F LONG NOP
+static int cpu_op_0F1F(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    modrm_t modrm;
+    MODRM(cpu, NULL, &modrm);
+    return 0;
+}
+
+// 0F 20 MOV reg, Cr
+// 0F 22 MOV Cr, reg
+static int cpu_op_0F20(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    if (!is_kernel(cpu))
+        return RAISE_GPF(0);
+    modrm_t modrm;
+    if (!MODRM(cpu, NULL, &modrm))
+        return cpu_status_ud;
+    if ((1 << modrm.reg) & 0xFEE2)
+        return cpu_status_gpf;
+    if (inst & 2)
+    {
+        return MOV_CR(cpu, modrm.reg, cpu->gpr[modrm.rm]);
+    }
+    else
+    {
+        cpu->gpr[modrm.rm] = cpu->CR[modrm.reg];
+    }
+    return 0;
+}
+
+// 0F 21 MOV reg, Dr
+// 0F 23 MOV Dr, reg
+static int cpu_op_0F21(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    // TODO:
+    if (!is_kernel(cpu))
+        return RAISE_GPF(0);
+    modrm_t modrm;
+    if (!MODRM(cpu, NULL, &modrm))
+        return cpu_status_ud;
+    if (inst & 2)
+    {
+        // DO NOTHING
+    }
+    else
+    {
+        cpu->gpr[modrm.rm] = 0;
+    }
+    return 0;
+}
+
+// 0F 30 WRMSR
+// 0F 32 RDMSR
+static int cpu_op_0F30(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+           // case 0x33: // RDPMC
+           // case 0x34: // SYSENTER
+           // case 0x35: // SYSEXIT
+           // case 0x37: // GETSEC
+    if (!is_kernel(cpu))
+        return RAISE_GPF(0);
+    return cpu_status_ud;
+}
+
+// 0F 31 RDTSC
+static int cpu_op_0F31(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return RDTSC(cpu);
+}
 
-            case 0x0F: // 2byte op
-            {
-                const uint32_t inst = FETCH8(cpu);
-                switch (inst)
-                {
-                case 0x00:
-                {
-                    if (cpu->cpu_gen < cpu_gen_80386)
-                        return cpu_status_ud;
-                    if (!cpu->CR0.PE || cpu->VM)
-                        return cpu_status_ud;
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    switch (set.opr2)
-                    {
-                    case 0: // SLDT
-                        WRITE_LE16(set.opr1, cpu->LDT.sel);
-                        return 0;
-                    case 1: // STR
-                        WRITE_LE16(set.opr1, cpu->TSS.sel);
-                        return 0;
-                    case 2: // LLDT
-                    {
-                        if (!is_kernel(cpu))
-                            return RAISE_GPF(0);
-                        uint16_t new_sel = READ_LE16(set.opr1);
-                        return LOAD_DESCRIPTOR(cpu, &cpu->LDT, new_sel, type_bitmap_LDT, 1, NULL);
-                    }
-                    case 3: // LTR
-                        if (!is_kernel(cpu))
-                            return RAISE_GPF(0);
-                        uint16_t new_sel = READ_LE16(set.opr1);
-                        return LOAD_DESCRIPTOR(cpu, &cpu->TSS, new_sel, type_bitmap_TSS32, 0, NULL);
-                    case 4: // VERR
-                    {
-                        sreg_t temp;
-                        uint16_t sel = READ_LE16(set.opr1);
-                        cpu->ZF = (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_READ, 0, NULL) == 0);
-                        return 0;
-                    }
-                    case 5: // VERW
-                    {
-                        sreg_t temp;
-                        uint16_t sel = READ_LE16(set.opr1);
-                        cpu->ZF = (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_WRITE, 0, NULL) == 0);
-                        return 0;
-                    }
-                    }
-                    return cpu_status_ud;
-                }
+// case 0x38: // SSE 3byte op
+// case 0x3A: // SSE 3byte op
 
-                case 0x01:
-                {
-                    if (cpu->cpu_gen < cpu_gen_80386)
-                        return cpu_status_ud;
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    switch (set.opr2)
-                    {
-                    case 0: // SGDT
-                    {
-                        if (mod)
-                            return cpu_status_ud;
-                        // TODO: 16bit SGDT
-                        WRITE_LE16(set.opr1b, cpu->GDT.limit);
-                        WRITE_LE32(set.opr1b, cpu->GDT.base);
-                        return 0;
-                    }
-                    case 1: // SIDT
-                    {
-                        if (mod)
-                            return cpu_status_ud;
-                        // TODO: 16bit SGDT
-                        WRITE_LE16(set.opr1b, cpu->IDT.limit);
-                        WRITE_LE32(set.opr1b, cpu->IDT.base);
-                        return 0;
-                    }
-                    case 2: // LGDT
-                    {
-                        if (mod)
-                            return cpu_status_ud;
-                        if (!is_kernel(cpu))
-                            return RAISE_GPF(0);
-                        desc_t new_dt;
-                        new_dt.limit = READ_LE16(set.opr1b);
-                        new_dt.base = READ_LE32(set.opr1b + 2);
-                        if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
-                        {
-                            new_dt.base &= 0xFFFFFF;
-                        }
-                        cpu->GDT = new_dt;
-                        return 0;
-                    }
-                    case 3: // LIDT
-                    {
-                        if (mod)
-                            return cpu_status_ud;
-                        if (!is_kernel(cpu))
-                            return RAISE_GPF(0);
-                        desc_t new_dt;
-                        new_dt.limit = READ_LE16(set.opr1b);
-                        new_dt.base = READ_LE32(set.opr1b + 2);
-                        if ((cpu->cpu_context & CPU_CTX_DATA32) == 0)
-                        {
-                            new_dt.base &= 0xFFFFFF;
-                        }
-                        cpu->IDT = new_dt;
-                        return 0;
-                    }
-                    case 4: // SMSW
-                    {
-                        WRITE_LE16(set.opr1, cpu->CR[0]);
-                        return 0;
-                    }
-                    case 6: // LMSW
-                    {
-                        if (cpu->cpu_gen < cpu_gen_80286)
-                            return cpu_status_ud;
-                        if (!is_kernel(cpu))
-                            return RAISE_GPF(0);
-                        // LMSW affects only lower 4bits
-                        uint32_t new_value = (*set.opr1b & 0x000F);
-                        if (cpu->CR0.PE && ((new_value & 1) == 0))
-                            return cpu_status_gpf;
-                        // cpu->CR0.value = (cpu->CR0.value & 0xFFFFFFF0) | new_value;
-                        cpu->CR0.msw = new_value;
-                        return 0;
-                    }
-                    case 7: // INVLPG (NOP)
-                        return 0;
-                    }
-                    return cpu_status_ud;
-                }
+// 0F 40 CMOVcc reg, r/m
+static int cpu_op_0F40(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 0, &set);
+    if (EVAL_CC(cpu, inst))
+    {
+        switch (set.size)
+        {
+        case 1:
+            WRITE_LE16(&cpu->gpr[set.opr2], READ_LE16(set.opr1));
+            break;
+        case 2:
+            cpu->gpr[set.opr2] = READ_LE32(set.opr1);
+            break;
+        }
+    }
+    return 0;
+}
 
-                case 0x02: // LAR reg, r/m
-                {
-                    if (!cpu->CR0.PE || cpu->VM)
-                        return cpu_status_ud;
-                    sreg_t temp;
-                    uint16_t sel = READ_LE16(set.opr1);
-                    if (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_ALL, 0, NULL) == 0)
-                    {
-                        cpu->ZF = 1;
-                        uint32_t value = temp.attr_u8l << 8;
-                        if (cpu->cpu_context & CPU_CTX_DATA32)
-                        {
-                            value |= temp.attr_u8h << 16;
-                            cpu->gpr[set.opr2] = value;
-                        }
-                        else
-                        {
-                            WRITE_LE16(&cpu->gpr[set.opr2], value);
-                        }
-                    }
-                    else
-                    {
-                        cpu->ZF = 0;
-                    }
-                    return 0;
-                }
+// 0F 80 Jcc d16
+static ALWAYS_INLINE int cpu_op_0F80_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    int disp = FETCHSW_CTX(cpu, ctx);
+    return JUMP_IF_CTX(cpu, disp, EVAL_CC(cpu, inst), ctx);
+}
+CPU_OP_SPECIALIZE(cpu_op_0F80)
 
-                case 0x03: // LSL reg, r/m
-                {
-                    if (!cpu->CR0.PE || cpu->VM)
-                        return cpu_status_ud;
-                    sreg_t temp;
-                    uint16_t sel = READ_LE16(set.opr1);
-                    if (LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_ALL, 0, NULL) == 0)
-                    {
-                        cpu->ZF = 1;
-                        uint32_t value = temp.limit;
-                        if (cpu->cpu_context & CPU_CTX_DATA32)
-                        {
-                            cpu->gpr[set.opr2] = value;
-                        }
-                        else
-                        {
-                            WRITE_LE16(&cpu->gpr[set.opr2], value);
-                        }
-                    }
-                    else
-                    {
-                        cpu->ZF = 0;
-                    }
-                    return 0;
-                }
+// 0F 90 SETcc r/m8
+static int cpu_op_0F90(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    MODRM_W(cpu, seg, 0, 1, &set);
+    if (set.opr2)
+        return cpu_status_ud;
+    *set.opr1b = EVAL_CC(cpu, inst);
+    return 0;
+}
 
-                    // case 0x05: // LOADALL / SYSCALL
+// 0F A0 PUSH FS
+static int cpu_op_0FA0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->FS.sel);
+    return 0;
+}
 
-                case 0x06: // CLTS
-                    if (is_kernel(cpu))
-                    {
-                        cpu->CR0.TS = 0;
-                        return 0;
-                    }
-                    else
-                    {
-                        return RAISE_GPF(0);
-                    }
+// 0F A1 POP FS
+static int cpu_op_0FA1(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return POP_SEG(cpu, &cpu->FS, type_bitmap_SEG_READ, 1);
+}
 
-                    // case 0x07: // LOADALL / SYSRET
+// 0F A2 CPUID
+static int cpu_op_0FA2(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return CPUID(cpu);
+}
 
-                case 0x08: // INVD (NOP)
-                case 0x09: // WBINVD (NOP)
-                    return 0;
+// 0F A3 BT r/m, reg
+static int cpu_op_0FA3(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int mod = MODRM_W(cpu, seg, 1, 0, &set);
+    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BT);
+    return 0;
+}
 
-                case 0x0B: // UD2
-                    return cpu_status_ud;
+// 0F A4 SHLD r/m, reg, imm8
+static int cpu_op_0FA4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 1, &set);
+    int imm = FETCH8(cpu);
+    SHLD(cpu, &set, imm);
+    return 0;
+}
 
-                case 0x1F: // LONG NOP
-                {
-                    modrm_t modrm;
-                    MODRM(cpu, NULL, &modrm);
-                    return 0;
-                }
+// 0F A5 SHLD r/m, reg, CL
+static int cpu_op_0FA5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 1, &set);
+    SHLD(cpu, &set, cpu->CL);
+    return 0;
+}
 
-                case 0x20: // MOV reg, Cr
-                case 0x22: // MOV Cr, reg
-                {
-                    if (cpu->cpu_gen < cpu_gen_80386)
-                        return cpu_status_ud;
-                    if (!is_kernel(cpu))
-                        return RAISE_GPF(0);
-                    modrm_t modrm;
-                    if (!MODRM(cpu, NULL, &modrm))
-                        return cpu_status_ud;
-                    if ((1 << modrm.reg) & 0xFEE2)
-                        return cpu_status_gpf;
-                    if (inst & 2)
-                    {
-                        return MOV_CR(cpu, modrm.reg, cpu->gpr[modrm.rm]);
-                    }
-                    else
-                    {
-                        cpu->gpr[modrm.rm] = cpu->CR[modrm.reg];
-                    }
-                    return 0;
-                }
+// 0F A8 PUSH GS
+static int cpu_op_0FA8(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    PUSHW(cpu, cpu->GS.sel);
+    return 0;
+}
 
-                case 0x21: // MOV reg, Dr
-                case 0x23: // MOV Dr, reg
-                {
-                    // TODO:
-                    if (cpu->cpu_gen < cpu_gen_80386)
-                        return cpu_status_ud;
-                    if (!is_kernel(cpu))
-                        return RAISE_GPF(0);
-                    modrm_t modrm;
-                    if (!MODRM(cpu, NULL, &modrm))
-                        return cpu_status_ud;
-                    if (inst & 2)
-                    {
-                        // DO NOTHING
-                    }
-                    else
-                    {
-                        cpu->gpr[modrm.rm] = 0;
-                    }
-                    return 0;
-                }
+// 0F A9 POP GS
+static int cpu_op_0FA9(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    return POP_SEG(cpu, &cpu->GS, type_bitmap_SEG_READ, 1);
+}
 
-                case 0x30: // WRMSR
-                case 0x32: // RDMSR
-                           // case 0x33: // RDPMC
-                           // case 0x34: // SYSENTER
-                           // case 0x35: // SYSEXIT
-                           // case 0x37: // GETSEC
-                    if (!is_kernel(cpu))
-                        return RAISE_GPF(0);
-                    return cpu_status_ud;
-
-                case 0x31: // RDTSC
-                    return RDTSC(cpu);
-
-                    // case 0x38: // SSE 3byte op
-                    // case 0x3A: // SSE 3byte op
-
-                case 0x40: // CMOVcc reg, r/m
-                case 0x41:
-                case 0x42:
-                case 0x43:
-                case 0x44:
-                case 0x45:
-                case 0x46:
-                case 0x47:
-                case 0x48:
-                case 0x49:
-                case 0x4A:
-                case 0x4B:
-                case 0x4C:
-                case 0x4D:
-                case 0x4E:
-                case 0x4F:
-                {
-                    MODRM_W(cpu, seg, 1, &set);
-                    if (EVAL_CC(cpu, inst))
-                    {
-                        switch (set.size)
-                        {
-                        case 1:
-                            WRITE_LE16(&cpu->gpr[set.opr2], READ_LE16(set.opr1));
-                            break;
-                        case 2:
-                            cpu->gpr[set.opr2] = READ_LE32(set.opr1);
-                            break;
-                        }
-                    }
-                    return 0;
-                }
+// 0F AB BTS r/m, reg
+static int cpu_op_0FAB(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int mod = MODRM_W(cpu, seg, 1, 1, &set);
+    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTS);
+    return 0;
+}
 
-                case 0x80: // Jcc d16
-                case 0x81:
-                case 0x82:
-                case 0x83:
-                case 0x84:
-                case 0x85:
-                case 0x86:
-                case 0x87:
-                case 0x88:
-                case 0x89:
-                case 0x8A:
-                case 0x8B:
-                case 0x8C:
-                case 0x8D:
-                case 0x8E:
-                case 0x8F:
-                {
-                    int disp = FETCHSW(cpu);
-                    return JUMP_IF(cpu, disp, EVAL_CC(cpu, inst));
-                }
+// 0F AC SHRD r/m, reg, imm8
+static int cpu_op_0FAC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 1, &set);
+    int imm = FETCH8(cpu);
+    SHRD(cpu, &set, imm);
+    return 0;
+}
+
+// 0F AD SHRD r/m, reg, CL
+static int cpu_op_0FAD(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 1, &set);
+    SHRD(cpu, &set, cpu->CL);
+    return 0;
+}
+
+// 0F AF IMUL reg, r/m16
+static int cpu_op_0FAF(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    MODRM_W(cpu, seg, 1, 0, &set);
+    switch (set.size)
+    {
+    case 1:
+    {
+        int src = MOVSXW(cpu->gpr[set.opr2]);
+        int dst = MOVSXW(READ_LE16(set.opr1));
+        src *= dst;
+        WRITE_LE16(&cpu->gpr[set.opr2], src);
+        cpu->OF = cpu->CF = (src != MOVSXW(src));
+        return 0;
+    }
+    case 2:
+    {
+        int src = cpu->gpr[set.opr2];
+        int dst = READ_LE32(set.opr1);
+        int64_t value = MOVSXD(src) * MOVSXD(dst);
+        cpu->gpr[set.opr2] = value;
+        cpu->OF = cpu->CF = (value != (int32_t)value);
+        return 0;
+    }
+    }
+}
+
+// 0F B0 CMPXCHG r/m, AL, r8
+// 0F B1 CMPXCHG r/m, AX, r16
+static int cpu_op_0FB0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int src, dst, value;
+    MODRM_W(cpu, seg, inst & 1, 1, &set);
+    switch (set.size)
+    {
+    case 0:
+    {
+        uint8_t *opr2b = LEA_REG8(cpu, set.opr2);
+        uint8_t temp = *set.opr1b;
+        if (temp == cpu->AL)
+        {
+            cpu->ZF = 1;
+            *set.opr1b = *opr2b;
+        }
+        else
+        {
+            cpu->ZF = 0;
+            cpu->AL = temp;
+        }
+        return 0;
+    }
+    case 1:
+    {
+        uint16_t opr2 = cpu->gpr[set.opr2];
+        uint16_t temp = READ_LE16(set.opr1);
+        if (temp == cpu->AX)
+        {
+            cpu->ZF = 1;
+            WRITE_LE16(set.opr1, opr2);
+        }
+        else
+        {
+            cpu->ZF = 0;
+            cpu->AX = temp;
+        }
+        return 0;
+    }
+    case 2:
+    {
+        uint32_t opr2 = cpu->gpr[set.opr2];
+        uint32_t temp = READ_LE32(set.opr1);
+        if (temp == cpu->EAX)
+        {
+            cpu->ZF = 1;
+            WRITE_LE32(set.opr1, opr2);
+        }
+        else
+        {
+            cpu->ZF = 0;
+            cpu->EAX = temp;
+        }
+        return 0;
+    }
+    }
+}
+
+// 0F B2 LSS reg, r/m
+static int cpu_op_0FB2(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return LDS(cpu, seg, &cpu->SS);
+}
+
+// 0F B3 BTR r/m, reg
+static int cpu_op_0FB3(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int mod = MODRM_W(cpu, seg, 1, 1, &set);
+    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTR);
+    return 0;
+}
+
+// 0F B4 LFS reg, r/m
+static int cpu_op_0FB4(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return LDS(cpu, seg, &cpu->FS);
+}
+
+// 0F B5 LGS reg, r/m
+static int cpu_op_0FB5(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    return LDS(cpu, seg, &cpu->GS);
+}
+
+// 0F B6 MOVZX reg, r/m8
+// 0F B7 MOVZX reg, r/m16
+static ALWAYS_INLINE int cpu_op_0FB6_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    uint32_t value;
+    MODRM_W_CTX(cpu, seg, inst & 1, 0, &set, ctx);
+    if (set.size)
+    {
+        value = READ_LE16(set.opr1);
+    }
+    else
+    {
+        value = *set.opr1b;
+    }
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->gpr[set.opr2] = value;
+    }
+    else
+    {
+        WRITE_LE16(&cpu->gpr[set.opr2], value);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_0FB6)
+
+// case 0xB8: // POPCNT reg, r/m16
+// {
+//     if ((prefix & PREFIX_REPZ) == 0) return cpu_status_ud; // mandatory prefix
+//     MODRM_W(cpu, seg, 1, &set);
+//     switch (set.size) {
+//         case 1:
+//         {
+//             int value = __builtin_popcount(READ_LE16(set.opr1));
+//             WRITE_LE16(&cpu->gpr[set.opr2], SETFA16(cpu, value));
+//             return 0;
+//         }
+//         case 2:
+//         {
+//             int value = __builtin_popcount(READ_LE32(set.opr1));
+//             cpu->gpr[set.opr2] = SETFA32(cpu, value);
+//             return 0;
+//         }
+//     }
+// }
+
+// 0F BA BTx r/m, imm8
+static int cpu_op_0FBA(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int mod = MODRM_W(cpu, seg, 1, MODRM_PEEK_REG(cpu) != 4, &set);
+    int imm = FETCH8(cpu);
+    switch (set.opr2)
+    {
+    case 4: // BT
+    case 5: // BTS
+    case 6: // BTR
+    case 7: // BTC
+        BitTest(cpu, &set, mod, imm, set.opr2 & 3);
+        return 0;
+    }
+    return cpu_status_ud;
+}
+
+// 0F BB BTC r/m, reg
+static int cpu_op_0FBB(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int mod = MODRM_W(cpu, seg, 1, 1, &set);
+    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTC);
+    return 0;
+}
+
+// 0F BE MOVSX reg, r/m8
+// 0F BF MOVSX reg, r/m16
+static ALWAYS_INLINE int cpu_op_0FBE_ctx(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg, const unsigned ctx)
+{
+    operand_set set;
+    int value;
+    MODRM_W_CTX(cpu, seg, inst & 1, 0, &set, ctx);
+    if (set.size)
+    {
+        value = MOVSXW(READ_LE16(set.opr1));
+    }
+    else
+    {
+        value = MOVSXB(*set.opr1b);
+    }
+    if (ctx & CPU_CTX_DATA32)
+    {
+        cpu->gpr[set.opr2] = value;
+    }
+    else
+    {
+        WRITE_LE16(&cpu->gpr[set.opr2], value);
+    }
+    return 0;
+}
+CPU_OP_SPECIALIZE(cpu_op_0FBE)
+
+// 0F BC BSF reg16, r/m16
+static int cpu_op_0FBC(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int value;
+    MODRM_W(cpu, seg, 1, 0, &set);
+    switch (set.size)
+    {
+    case 1:
+        value = __builtin_ctz(READ_LE16(set.opr1));
+        WRITE_LE16(&cpu->gpr[set.opr2], value);
+        cpu->ZF = (value == 0);
+        return 0;
+    case 2:
+        value = __builtin_ctz(READ_LE32(set.opr1));
+        cpu->gpr[set.opr2] = value;
+        cpu->ZF = (value == 0);
+        return 0;
+    }
+}
 
-                case 0x90: // SETcc r/m8
-                case 0x91:
-                case 0x92:
-                case 0x93:
-                case 0x94:
-                case 0x95:
-                case 0x96:
-                case 0x97:
-                case 0x98:
-                case 0x99:
-                case 0x9A:
-                case 0x9B:
-                case 0x9C:
-                case 0x9D:
-                case 0x9E:
-                case 0x9F:
-                {
-                    MODRM_W(cpu, seg, 0, &set);
-                    if (set.opr2)
-                        return cpu_status_ud;
-                    *set.opr1b = EVAL_CC(cpu, inst);
-                    return 0;
-                }
+// 0F BD BSR reg16, r/m16
+static int cpu_op_0FBD(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int value;
+    uint32_t src;
+    MODRM_W(cpu, seg, 1, 0, &set);
+    switch (set.size)
+    {
+    case 1:
+        src = READ_LE16(set.opr1);
+        value = 31 ^ __builtin_clz(src);
+        WRITE_LE16(&cpu->gpr[set.opr2], value);
+        cpu->ZF = (value == src);
+        return 0;
+    case 2:
+        src = READ_LE32(set.opr1);
+        value = 31 ^ __builtin_clz(src);
+        cpu->gpr[set.opr2] = value;
+        cpu->ZF = (value == src);
+        return 0;
+    }
+}
 
-                case 0xA0: // PUSH FS
-                    PUSHW(cpu, cpu->FS.sel);
-                    return 0;
+// 0F C0 XADD r/m, reg8
+// 0F C1 XADD r/m, reg16
+static int cpu_op_0FC0(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    operand_set set;
+    cpu_materialize_flags(cpu);
+    int src, dst, value;
+    MODRM_W(cpu, seg, inst & 1, 1, &set);
+    switch (set.size)
+    {
+    case 0:
+    {
+        uint8_t *opr2b = LEA_REG8(cpu, set.opr2);
+        dst = MOVSXB(*set.opr1b);
+        src = MOVSXB(*opr2b);
+        value = dst + src;
+        cpu->AF = (dst & 15) + (src & 15) > 15;
+        cpu->CF = (uint8_t)dst > (uint8_t)value;
+        *opr2b = SETFA8(cpu, dst);
+        *set.opr1b = value;
+        return 0;
+    }
+    case 1:
+    {
+        void *opr2 = &cpu->gpr[set.opr2];
+        dst = MOVSXW(READ_LE16(set.opr1));
+        src = MOVSXW(READ_LE16(opr2));
+        value = dst + src;
+        cpu->AF = (dst & 15) + (src & 15) > 15;
+        cpu->CF = (uint16_t)dst > (uint16_t)value;
+        WRITE_LE16(opr2, SETFA16(cpu, dst));
+        WRITE_LE16(set.opr1, value);
+        return 0;
+    }
+    case 2:
+    {
+        void *opr2 = &cpu->gpr[set.opr2];
+        dst = READ_LE32(set.opr1);
+        src = cpu->gpr[set.opr2];
+        value = dst + src;
+        cpu->AF = (dst & 15) + (src & 15) > 15;
+        cpu->CF = (uint32_t)dst > (uint32_t)value;
+        cpu->gpr[set.opr2] = SETFA32(cpu, dst);
+        WRITE_LE32(set.opr1, value);
+        return 0;
+    }
+    }
+}
 
-                case 0xA1: // POP FS
-                    return POP_SEG(cpu, &cpu->FS, type_bitmap_SEG_READ, 1);
+// 0F C8 BSWAP reg32
+static int cpu_op_0FC8(cpu_state *cpu, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    cpu_materialize_flags(cpu);
+    cpu->gpr[inst & 7] = __builtin_bswap32(cpu->gpr[inst & 7]);
+    return 0;
+}
 
-                case 0xA2: // CPUID
-                {
-                    if (cpu->cpu_gen < cpu_gen_80386)
-                        return cpu_status_ud;
-                    return CPUID(cpu);
-                }
+// the opcode tables are shared with the disassembler and refer to the handlers above
+#include "disasm.h"
 
-                case 0xA3: // BT r/m, reg
-                {
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BT);
-                    return 0;
-                }
+// Build the dispatch tables for the current CPU generation from opcode1 and opcode2
+static void cpu_init_dispatch(cpu_state *cpu)
+{
+    for (int i = 0; i < 512; i++)
+    {
+        const opmap_t *desc = (i > UINT8_MAX) ? &opcode2[i & UINT8_MAX] : &opcode1[i];
+        for (int ctx = 0; ctx <= CPU_CTX_SIZE_MASK; ctx++)
+        {
+            cpu_op_t handler = desc->handler;
+            if (!handler || cpu->cpu_gen < desc->cpu_gen)
+            {
+                handler = cpu_op_ud;
+            }
+            else if (ctx == 0 && desc->handler16)
+            {
+                handler = desc->handler16;
+            }
+            else if (ctx == CPU_CTX_SIZE_MASK && desc->handler32)
+            {
+                handler = desc->handler32;
+            }
+            cpu->ops[ctx][i] = handler;
+        }
+    }
+}
 
-                case 0xA4: // SHLD r/m, reg, imm8
-                {
-                    MODRM_W(cpu, seg, 1, &set);
-                    int imm = FETCH8(cpu);
-                    SHLD(cpu, &set, imm);
-                    return 0;
-                }
-                case 0xA5: // SHLD r/m, reg, CL
-                    MODRM_W(cpu, seg, 1, &set);
-                    SHLD(cpu, &set, cpu->CL);
-                    return 0;
+/**
+ * Execute a handler in protected mode or with paging enabled.
+ * A #PF, or a #GP/#SS of a segment limit, raised by any memory access of the instruction rolls the registers back
+ * so that it can be restarted,
+ * except for a REP string instruction, which resumes from the element that faulted.
+ * A copied memory operand (see PAGED_OPERAND) is written back when the instruction completes.
+ */
+static int cpu_exec_restartable(cpu_state *cpu, const cpu_op_t handler, const uint32_t inst, const uint32_t prefix, sreg_t *seg)
+{
+    uint32_t gpr[8];
+    memcpy(gpr, cpu->gpr, sizeof(gpr));
+    const uint32_t eflags = cpu->eflags, lazy_op = cpu->lazy_op, lazy_size = cpu->lazy_size;
+    const int lazy_dst = cpu->lazy_dst, lazy_src = cpu->lazy_src, lazy_value = cpu->lazy_value, lazy_aux = cpu->lazy_aux;
 
-                case 0xA8: // PUSH GS
-                    PUSHW(cpu, cpu->GS.sel);
-                    return 0;
+    cpu->fault_resume = 0;
+    int status = handler(cpu, inst, prefix, seg);
+    if (cpu->opr_copy.active)
+    {
+        if (!cpu->pending_fault && status < cpu_status_exception)
+        {
+            // keep a status like cpu_status_inta unless the store faults
+            const int writeback = cpu_operand_writeback(cpu);
+            if (writeback)
+                status = writeback;
+        }
+        cpu->opr_copy.active = 0;
+    }
+    int restart = (status & cpu_status_exception_mask) == cpu_status_page;
+    if (cpu->pending_fault)
+    {
+        status = cpu->pending_fault;
+        cpu->pending_fault = 0;
+        restart = 1;
+    }
+    if (restart)
+    {
+        if (!cpu->fault_resume)
+            memcpy(cpu->gpr, gpr, sizeof(gpr));
+        cpu->eflags = eflags;
+        cpu->lazy_op = lazy_op;
+        cpu->lazy_size = lazy_size;
+        cpu->lazy_dst = lazy_dst;
+        cpu->lazy_src = lazy_src;
+        cpu->lazy_value = lazy_value;
+        cpu->lazy_aux = lazy_aux;
+    }
+    return status;
+}
 
-                case 0xA9: // POP GS
-                    return POP_SEG(cpu, &cpu->GS, type_bitmap_SEG_READ, 1);
+static inline int cpu_exec_uop(cpu_state *cpu, const cpu_uop_t *uop)
+{
+    sreg_t *seg = uop->seg ? &cpu->sregs[uop->seg - 1] : NULL;
+    // memory accesses can only fault in protected mode
+    if (cpu->CR0.PG || (cpu->CR0.PE && !cpu->VM))
+        return cpu_exec_restartable(cpu, uop->handler, uop->opcode & UINT8_MAX, uop->prefix, seg);
+    return uop->handler(cpu, uop->opcode & UINT8_MAX, uop->prefix, seg);
+}
 
-                case 0xAB: // BTS r/m, reg
-                {
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTS);
-                    return 0;
-                }
+/**
+ * Execute a uop of a cached block, its ModRM operand form is recorded by the first run and replayed afterwards
+ */
+static inline int cpu_exec_cached(cpu_state *cpu, cpu_uop_t *uop)
+{
+    cpu->modrm_form = &uop->form;
+    const int status = cpu_exec_uop(cpu, uop);
+    cpu->modrm_form = NULL;
+    return status;
+}
 
-                case 0xAC: // SHRD r/m, reg, imm8
-                {
-                    MODRM_W(cpu, seg, 1, &set);
-                    int imm = FETCH8(cpu);
-                    SHRD(cpu, &set, imm);
-                    return 0;
-                }
-                case 0xAD: // SHRD r/m, reg, CL
-                    MODRM_W(cpu, seg, 1, &set);
-                    SHRD(cpu, &set, cpu->CL);
-                    return 0;
+static inline int bitmap_test(const uint32_t *bitmap, const unsigned bit)
+{
+    return (bitmap[bit >> 5] >> (bit & 31)) & 1;
+}
 
-                case 0xAF: // IMUL reg, r/m16
+/**
+ * Length of the instruction at p, reading no more than avail bytes
+ *
+ * @return length, or more than avail if the instruction continues past them
+ */
+static int cpu_inst_length(const uint8_t *p, const int avail, const unsigned ctx)
+{
+    static const uint32_t modrm1[8] = {0x0F0F0F0F, 0x0F0F0F0F, 0x00000000, 0x00000A0C, 0x0000FFFF, 0x00000000, 0xFF0F00F3, 0xC0C00000};
+    static const uint32_t imm8_1[8] = {0x10101010, 0x10101010, 0x00000000, 0xFFFF0C00, 0x0000000D, 0x00FF0100, 0x00302043, 0x000008FF};
+    static const uint32_t immz_1[8] = {0x20202020, 0x20202020, 0x00000000, 0x00000300, 0x00000002, 0xFF000200, 0x00000080, 0x00000300};
+    static const uint32_t modrm2[8] = {0xFFFFB41F, 0xFF00FFFF, 0xFFFFFFFF, 0xFF7FFFFF, 0xFFFF0000, 0xFFFFF8F8, 0xFFFF00FF, 0xFFFFFFFF};
+    static const uint32_t imm8_2[8] = {0x00000000, 0x00000000, 0x00000000, 0x000F0000, 0x00000000, 0x04001010, 0x00000074, 0x00000000};
+    int data32 = ctx & CPU_CTX_DATA32, addr32 = ctx & CPU_CTX_ADDR32;
+    int len = 0, op;
+    for (;;)
+    {
+        if (len >= avail)
+            return avail + 1;
+        op = p[len++];
+        if (op == 0x66)
+            data32 = !data32;
+        else if (op == 0x67)
+            addr32 = !addr32;
+        else if (op != 0x26 && op != 0x2E && op != 0x36 && op != 0x3E && op != 0x64 && op != 0x65 && op != 0xF0 && op != 0xF2 && op != 0xF3)
+            break;
+    }
+    const int z = data32 ? 4 : 2;
+    int has_modrm, imm = 0;
+    if (op == 0x0F)
+    {
+        if (len >= avail)
+            return avail + 1;
+        op = p[len++];
+        has_modrm = bitmap_test(modrm2, op);
+        if (bitmap_test(imm8_2, op))
+            imm = 1;
+        else if ((op & 0xF0) == 0x80)
+            imm = z;
+    }
+    else
+    {
+        has_modrm = bitmap_test(modrm1, op);
+        if (bitmap_test(imm8_1, op))
+            imm = 1;
+        else if (bitmap_test(immz_1, op))
+            imm = z;
+        else if (op == 0xC2 || op == 0xCA)
+            imm = 2;
+        else if (op == 0xC8)
+            imm = 3;
+        else if (op >= 0xA0 && op <= 0xA3)
+            imm = addr32 ? 4 : 2;
+        else if (op == 0x9A || op == 0xEA)
+            imm = 2 + z;
+    }
+    if (has_modrm)
+    {
+        if (len >= avail)
+            return avail + 1;
+        const int modrm = p[len++];
+        const int mod = modrm >> 6, rm = modrm & 7;
+        if (mod != 3)
+        {
+            if (addr32)
+            {
+                if (rm == 4)
                 {
-                    MODRM_W(cpu, seg, 1, &set);
-                    switch (set.size)
-                    {
-                    case 1:
-                    {
-                        int src = MOVSXW(cpu->gpr[set.opr2]);
-                        int dst = MOVSXW(READ_LE16(set.opr1));
-                        src *= dst;
-                        WRITE_LE16(&cpu->gpr[set.opr2], src);
-                        cpu->OF = cpu->CF = (src != MOVSXW(src));
-                        return 0;
-                    }
-                    case 2:
-                    {
-                        int src = cpu->gpr[set.opr2];
-                        int dst = READ_LE32(set.opr1);
-                        int64_t value = MOVSXD(src) * MOVSXD(dst);
-                        cpu->gpr[set.opr2] = value;
-                        cpu->OF = cpu->CF = (value != (int32_t)value);
-                        return 0;
-                    }
-                    }
+                    if (len >= avail)
+                        return avail + 1;
+                    if (mod == 0 && (p[len] & 7) == 5)
+                        len += 4;
+                    len++;
                 }
-
-                case 0xB0: // CMPXCHG r/m, AL, r8
-                case 0xB1: // CMPXCHG r/m, AX, r16
+                else if (mod == 0 && rm == 5)
                 {
-                    int src, dst, value;
-                    MODRM_W(cpu, seg, inst & 1, &set);
-                    switch (set.size)
-                    {
-                    case 0:
-                    {
-                        uint8_t *opr2b = LEA_REG8(cpu, set.opr2);
-                        uint8_t temp = *set.opr1b;
-                        if (temp == cpu->AL)
-                        {
-                            cpu->ZF = 1;
-                            *set.opr1b = *opr2b;
-                        }
-                        else
-                        {
-                            cpu->ZF = 0;
-                            cpu->AL = temp;
-                        }
-                        return 0;
-                    }
-                    case 1:
-                    {
-                        uint16_t opr2 = cpu->gpr[set.opr2];
-                        uint16_t temp = READ_LE16(set.opr1);
-                        if (temp == cpu->AX)
-                        {
-                            cpu->ZF = 1;
-                            WRITE_LE16(set.opr1, opr2);
-                        }
-                        else
-                        {
-                            cpu->ZF = 0;
-                            cpu->AX = temp;
-                        }
-                        return 0;
-                    }
-                    case 2:
-                    {
-                        uint32_t opr2 = cpu->gpr[set.opr2];
-                        uint32_t temp = READ_LE32(set.opr1);
-                        if (temp == cpu->EAX)
-                        {
-                            cpu->ZF = 1;
-                            WRITE_LE32(set.opr1, opr2);
-                        }
-                        else
-                        {
-                            cpu->ZF = 0;
-                            cpu->EAX = temp;
-                        }
-                        return 0;
-                    }
-                    }
+                    len += 4;
                 }
+            }
+            else if (mod == 0 && rm == 6)
+            {
+                len += 2;
+            }
+            len += mod == 1 ? 1 : mod == 2 ? (addr32 ? 4 : 2) : 0;
+        }
+        // TEST r/m, imm
+        if ((op == 0xF6 || op == 0xF7) && ((modrm >> 3) & 7) < 2)
+            imm = op == 0xF6 ? 1 : z;
+    }
+    return len + imm;
+}
 
-                case 0xB2: // LSS reg, r/m
-                    return LDS(cpu, seg, &cpu->SS);
+/**
+ * Point rip at the physical memory of the instruction at CS:EIP when paging is enabled.
+ * Instructions that may cross into a page that is not physically contiguous are fetched from cpu->fetch_buf.
+ */
+static int cpu_map_code(cpu_state *cpu)
+{
+    const uint32_t eip = (uintptr_t)cpu->rip - cpu->code_base;
+    const uint32_t linear = cpu->CS.base + eip;
+    const unsigned access = cpu_page_access(cpu, 0);
+    paddr_t phys, next;
+    int status = cpu_translate(cpu, linear, access, &phys);
+    if (status)
+    {
+        cpu->last_known_rip = cpu->rip;
+        return cpu_page_fault(cpu, status, linear);
+    }
+    const uint32_t offset = linear & PAGE_MASK;
+    cpu_rip_t host = mem + phys;
+    if (offset <= PAGE_SIZE - MAX_INST_LENGTH)
+    {
+        cpu->code_lo = host - offset;
+        cpu->code_hi = host - offset + PAGE_SIZE - MAX_INST_LENGTH;
+        cpu->code_base = (uintptr_t)host - eip;
+        cpu->rip = host;
+        return 0;
+    }
 
-                case 0xB3: // BTR r/m, reg
-                {
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTR);
-                    return 0;
-                }
+    const int head = PAGE_SIZE - offset;
+    memcpy(cpu->fetch_buf, host, head);
+    status = cpu_translate(cpu, linear + head, access, &next);
+    if (status)
+    {
+        // the next page is needed only if the instruction really continues there
+        if (cpu_inst_length(cpu->fetch_buf, head, cpu->default_context & CPU_CTX_SIZE_MASK) > head)
+        {
+            cpu->last_known_rip = cpu->rip;
+            return cpu_page_fault(cpu, status, linear + head);
+        }
+        memset(cpu->fetch_buf + head, 0, MAX_INST_LENGTH - head);
+    }
+    else if (next == phys + head)
+    {
+        cpu->code_lo = cpu->code_hi = host;
+        cpu->code_base = (uintptr_t)host - eip;
+        cpu->rip = host;
+        return 0;
+    }
+    else
+    {
+        memcpy(cpu->fetch_buf + head, mem + next, MAX_INST_LENGTH - head);
+    }
+    cpu->code_lo = cpu->code_hi = cpu->fetch_buf;
+    cpu->code_base = (uintptr_t)cpu->fetch_buf - eip;
+    cpu->rip = cpu->fetch_buf;
+    return 0;
+}
 
-                case 0xB4: // LFS reg, r/m
-                    return LDS(cpu, seg, &cpu->FS);
+/**
+ * Make sure rip can be fetched from when paging is enabled
+ */
+static inline int cpu_check_code_page(cpu_state *cpu)
+{
+    if (cpu->CR0.PG && (cpu->rip < cpu->code_lo || cpu->rip > cpu->code_hi))
+        return cpu_map_code(cpu);
+    return 0;
+}
 
-                case 0xB5: // LGS reg, r/m
-                    return LDS(cpu, seg, &cpu->GS);
+static int cpu_step(cpu_state *cpu)
+{
+    cpu_uop_t uop;
+    int status = cpu_check_code_page(cpu);
+    if (status)
+        return status;
+    cpu_last_known_eip(cpu);
+    status = cpu_decode(cpu, &uop);
+    if (status)
+        return status;
+    return cpu_exec_uop(cpu, &uop);
+}
 
-                case 0xB6: // MOVZX reg, r/m8
-                case 0xB7: // MOVZX reg, r/m16
-                {
-                    uint32_t value;
-                    MODRM_W(cpu, seg, inst & 1, &set);
-                    if (set.size)
-                    {
-                        value = READ_LE16(set.opr1);
-                    }
-                    else
-                    {
-                        value = *set.opr1b;
-                    }
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        cpu->gpr[set.opr2] = value;
-                    }
-                    else
-                    {
-                        WRITE_LE16(&cpu->gpr[set.opr2], value);
-                    }
-                    return 0;
-                }
+/**
+ * Decode and execute one instruction, appending it to the block being recorded
+ */
+/**
+ * Check if uop sets the flags like CMP, TEST or DEC without touching anything but its operand
+ *
+ * @param modrm the byte following the opcode
+ */
+static int is_fusable_head(const cpu_uop_t *uop, const uint8_t modrm)
+{
+    const int reg = (modrm >> 3) & 7;
+    switch (uop->opcode)
+    {
+    case 0x38: // CMP
+    case 0x39:
+    case 0x3A:
+    case 0x3B:
+    case 0x3C:
+    case 0x3D:
+    case 0x84: // TEST
+    case 0x85:
+    case 0xA8:
+    case 0xA9:
+    case 0x48: // DEC
+    case 0x49:
+    case 0x4A:
+    case 0x4B:
+    case 0x4C:
+    case 0x4D:
+    case 0x4E:
+    case 0x4F:
+        return 1;
+    case 0x80: // CMP r/m, imm
+    case 0x81:
+    case 0x82:
+    case 0x83:
+        return reg == 7;
+    case 0xF6: // TEST r/m, imm
+    case 0xF7:
+        return reg == 0;
+    case 0xFE: // DEC r/m
+    case 0xFF:
+        return reg == 1;
+    default:
+        return 0;
+    }
+}
 
-                    // case 0xB8: // POPCNT reg, r/m16
-                    // {
-                    //     if ((prefix & PREFIX_REPZ) == 0) return cpu_status_ud; // mandatory prefix
-                    //     MODRM_W(cpu, seg, 1, &set);
-                    //     switch (set.size) {
-                    //         case 1:
-                    //         {
-                    //             int value = __builtin_popcount(READ_LE16(set.opr1));
-                    //             WRITE_LE16(&cpu->gpr[set.opr2], SETFA16(cpu, value));
-                    //             return 0;
-                    //         }
-                    //         case 2:
-                    //         {
-                    //             int value = __builtin_popcount(READ_LE32(set.opr1));
-                    //             cpu->gpr[set.opr2] = SETFA32(cpu, value);
-                    //             return 0;
-                    //         }
-                    //     }
-                    // }
-
-                case 0xBA: // BTx r/m, imm8
-                {
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    int imm = FETCH8(cpu);
-                    switch (set.opr2)
-                    {
-                    case 4: // BT
-                    case 5: // BTS
-                    case 6: // BTR
-                    case 7: // BTC
-                        BitTest(cpu, &set, mod, imm, set.opr2 & 3);
-                        return 0;
-                    }
-                    return cpu_status_ud;
-                }
+static inline int is_jcc(const cpu_uop_t *uop)
+{
+    return (uop->opcode & 0xFFF0) == 0x70 || (uop->opcode & 0xFFF0) == 0x0F80;
+}
 
-                case 0xBB: // BTC r/m, reg
-                {
-                    int mod = MODRM_W(cpu, seg, 1, &set);
-                    BitTest(cpu, &set, mod, cpu->gpr[set.opr2], BitTestOp_BTC);
-                    return 0;
-                }
+static int block_cache_record(cpu_state *cpu, cpu_block_t *block)
+{
+    cpu_uop_t *uop = &block->uops[block->n_uops];
+    const cpu_rip_t rip = cpu->rip;
+    const uint32_t offset = rip - (mem + block->linear);
+    const uint32_t linear = block->linear + offset;
 
-                case 0xBE: // MOVSX reg, r/m8
-                case 0xBF: // MOVSX reg, r/m16
-                {
-                    int value;
-                    MODRM_W(cpu, seg, inst & 1, &set);
-                    if (set.size)
-                    {
-                        value = MOVSXW(READ_LE16(set.opr1));
-                    }
-                    else
-                    {
-                        value = MOVSXB(*set.opr1b);
-                    }
-                    if (cpu->cpu_context & CPU_CTX_DATA32)
-                    {
-                        cpu->gpr[set.opr2] = value;
-                    }
-                    else
-                    {
-                        WRITE_LE16(&cpu->gpr[set.opr2], value);
-                    }
-                    return 0;
-                }
+    // mark the code lines first so that self modifying code in this very instruction can be seen
+    block->span = offset + MAX_INST_LENGTH;
+    mark_code_line(linear >= CODE_GUARD ? linear - CODE_GUARD : 0);
+    mark_code_line(linear + MAX_INST_LENGTH - 1);
 
-                case 0xBC: // BSF reg16, r/m16
-                {
-                    int value;
-                    MODRM_W(cpu, seg, 1, &set);
-                    switch (set.size)
-                    {
-                    case 1:
-                        value = __builtin_ctz(READ_LE16(set.opr1));
-                        WRITE_LE16(&cpu->gpr[set.opr2], value);
-                        cpu->ZF = (value == 0);
-                        return 0;
-                    case 2:
-                        value = __builtin_ctz(READ_LE32(set.opr1));
-                        cpu->gpr[set.opr2] = value;
-                        cpu->ZF = (value == 0);
-                        return 0;
-                    }
-                }
+    cpu_last_known_eip(cpu);
+    int status = cpu_decode(cpu, uop);
+    if (status == 0)
+    {
+        uop->offset = offset;
+        uop->form.length = 0;
+        status = cpu_exec_cached(cpu, uop);
+    }
+    if (block_cache->current != block)
+        return status;
+    if (status == 0 && uop->length <= MAX_INST_LENGTH)
+    {
+        if (block->n_uops && is_jcc(uop) && is_fusable_head(uop - 1, mem[block->linear + uop[-1].offset + uop[-1].length]))
+            uop[-1].opcode |= UOP_FUSED;
+        block->n_uops++;
+        if (block->n_uops < BLOCK_MAX_UOPS && cpu->rip > rip && cpu->rip <= rip + MAX_INST_LENGTH)
+        {
+            block_cache->next_rip = cpu->rip;
+            return 0;
+        }
+    }
+    if (block->n_uops == 0)
+    {
+        block->span = 0;
+    }
+    block_cache->current = NULL;
+    block_cache->recording = 0;
+    return status;
+}
 
-                case 0xBD: // BSR reg16, r/m16
-                {
-                    int value;
-                    uint32_t src;
-                    MODRM_W(cpu, seg, 1, &set);
-                    switch (set.size)
-                    {
-                    case 1:
-                        src = READ_LE16(set.opr1);
-                        value = 31 ^ __builtin_clz(src);
-                        WRITE_LE16(&cpu->gpr[set.opr2], value);
-                        cpu->ZF = (value == src);
-                        return 0;
-                    case 2:
-                        src = READ_LE32(set.opr1);
-                        value = 31 ^ __builtin_clz(src);
-                        cpu->gpr[set.opr2] = value;
-                        cpu->ZF = (value == src);
-                        return 0;
-                    }
-                }
+/**
+ * Execute a fused CMP/TEST/DEC and the Jcc that follows it in one step.
+ * The branch condition is taken from the operands; the flags stay pending for later instructions.
+ *
+ * @return cpu_status_fused if the Jcc was executed too
+ */
+static int cpu_exec_fused(cpu_state *cpu, cpu_block_t *block, cpu_uop_t *uop)
+{
+    block_cache_t *cache = block_cache;
+    int status = cpu_exec_cached(cpu, uop);
+    if (status || cache->current != block)
+        return status;
+    const cpu_uop_t *jcc = uop + 1;
+    const cpu_rip_t rip = mem + block->linear + jcc->offset;
+    if (cpu->rip != rip || (cpu->CR0.PG && rip > cpu->code_hi))
+        return status;
 
-                case 0xC0: // XADD r/m, reg8
-                case 0xC1: // XADD r/m, reg16
-                {
-                    int src, dst, value;
-                    MODRM_W(cpu, seg, inst & 1, &set);
-                    switch (set.size)
-                    {
-                    case 0:
-                    {
-                        uint8_t *opr2b = LEA_REG8(cpu, set.opr2);
-                        dst = MOVSXB(*set.opr1b);
-                        src = MOVSXB(*opr2b);
-                        value = dst + src;
-                        cpu->AF = (dst & 15) + (src & 15) > 15;
-                        cpu->CF = (uint8_t)dst > (uint8_t)value;
-                        *opr2b = SETFA8(cpu, dst);
-                        *set.opr1b = value;
-                        return 0;
-                    }
-                    case 1:
-                    {
-                        void *opr2 = &cpu->gpr[set.opr2];
-                        dst = MOVSXW(READ_LE16(set.opr1));
-                        src = MOVSXW(READ_LE16(opr2));
-                        value = dst + src;
-                        cpu->AF = (dst & 15) + (src & 15) > 15;
-                        cpu->CF = (uint16_t)dst > (uint16_t)value;
-                        WRITE_LE16(opr2, SETFA16(cpu, dst));
-                        WRITE_LE16(set.opr1, value);
-                        return 0;
-                    }
-                    case 2:
-                    {
-                        void *opr2 = &cpu->gpr[set.opr2];
-                        dst = READ_LE32(set.opr1);
-                        src = cpu->gpr[set.opr2];
-                        value = dst + src;
-                        cpu->AF = (dst & 15) + (src & 15) > 15;
-                        cpu->CF = (uint32_t)dst > (uint32_t)value;
-                        cpu->gpr[set.opr2] = SETFA32(cpu, dst);
-                        WRITE_LE32(set.opr1, value);
-                        return 0;
-                    }
-                    }
-                }
+    cache->index++;
+    cpu->decodes_saved++;
+    cpu->last_known_rip = rip;
+    cpu->rip = rip + jcc->length;
+    cpu->cpu_context = jcc->context;
+    const unsigned ctx = jcc->context;
+    const int cc = jcc->opcode & 0xF;
+    const int disp = jcc->opcode & 0x0F00 ? FETCHSW_CTX(cpu, ctx) : FETCHSB(cpu);
+    const int taken = cpu->lazy_op == lazy_sub ? EVAL_CC_SUB(cpu, cc) : EVAL_CC(cpu, cc);
+    JUMP_IF_CTX(cpu, disp, taken, ctx);
+    return cpu_status_fused;
+}
 
-                case 0xC8: // BSWAP reg32
-                case 0xC9:
-                case 0xCA:
-                case 0xCB:
-                case 0xCC:
-                case 0xCD:
-                case 0xCE:
-                case 0xCF:
-                    cpu->gpr[inst & 7] = __builtin_bswap32(cpu->gpr[inst & 7]);
-                    return 0;
-                }
-            }
+/**
+ * Execute one instruction, replaying the decoded prefixes, opcode and ModRM operand from the block cache if possible
+ *
+ * @param can_fuse non zero if a fused pair of instructions may be executed (see cpu_exec_fused)
+ */
+static int cpu_step_cached(cpu_state *cpu, const int can_fuse)
+{
+    block_cache_t *cache = block_cache;
+    cpu_block_t *block = cache->current;
+    const int status = cpu_check_code_page(cpu);
+    if (status)
+        return status;
+    if (block)
+    {
+        if (cache->recording)
+        {
+            if (cpu->rip == cache->next_rip)
+                return block_cache_record(cpu, block);
+        }
+        else if (cache->index < block->n_uops && cpu->default_context == block->context)
+        {
+            cpu_uop_t *uop = &block->uops[cache->index];
+            const cpu_rip_t rip = mem + block->linear + uop->offset;
+            if (cpu->rip == rip)
+            {
+                cache->index++;
+                cpu->decodes_saved++;
+                cpu->last_known_rip = rip;
+                cpu->rip = rip + uop->length;
+                cpu->cpu_context = uop->context;
+                if ((uop->opcode & UOP_FUSED) && can_fuse)
+                    return cpu_exec_fused(cpu, block, uop);
+                return cpu_exec_cached(cpu, uop);
             }
-            return cpu_status_ud;
         }
-    }
+        cache->current = NULL;
+        cache->recording = 0;
+    }
+
+    const uint32_t linear = cpu->rip - mem;
+    if (linear >= max_mem || cpu->rip == cpu->fetch_buf)
+        return cpu_step(cpu);
+    block = &cache->blocks[(linear ^ (linear >> 10)) & (BLOCK_CACHE_SIZE - 1)];
+    if (block->n_uops && block->linear == linear && block->cs_base == cpu->CS.base && block->context == cpu->default_context)
+    {
+        cpu_uop_t *uop = &block->uops[0];
+        cache->current = block;
+        cache->index = 1;
+        cpu->decodes_saved++;
+        cpu->last_known_rip = cpu->rip;
+        cpu->rip += uop->length;
+        cpu->cpu_context = uop->context;
+        if ((uop->opcode & UOP_FUSED) && can_fuse)
+            return cpu_exec_fused(cpu, block, uop);
+        return cpu_exec_cached(cpu, uop);
+    }
+
+    block->linear = linear;
+    block->cs_base = cpu->CS.base;
+    block->context = cpu->default_context;
+    block->n_uops = 0;
+    cache->current = block;
+    cache->recording = 1;
+    return block_cache_record(cpu, block);
 }
 
 char *dump_segment(char *p, sreg_t *seg)
@@ -5482,6 +8402,7 @@ char *dump_segment(char *p, sreg_t *seg)
 
 void cpu_show_regs(cpu_state *cpu)
 {
+    machine_enter(cpu);
     static char buff[1024];
     char *p = buff;
 
@@ -5584,6 +8505,7 @@ void cpu_show_regs(cpu_state *cpu)
  */
 WASM_EXPORT void dump_regs(cpu_state *cpu)
 {
+    machine_enter(cpu);
     static char buff[1024];
     char *p = buff;
 
@@ -5644,12 +8566,23 @@ WASM_EXPORT void dump_regs(cpu_state *cpu)
     p = dump_string(p, " CR3 ");
     p = dump32(p, cpu->CR3);
 
+    p = dump_string(p, "\nDECODES SAVED ");
+    p = dump32(p, cpu->decodes_saved >> 32);
+    p = dump32(p, cpu->decodes_saved);
+    p = dump_string(p, "\nTLB HITS ");
+    p = dump32(p, cpu->tlb_hits >> 32);
+    p = dump32(p, cpu->tlb_hits);
+    p = dump_string(p, " MISSES ");
+    p = dump32(p, cpu->tlb_misses >> 32);
+    p = dump32(p, cpu->tlb_misses);
+
     *p = 0;
     println(buff);
 }
 
 void cpu_reset(cpu_state *cpu, int gen)
 {
+    machine_enter(cpu);
     int new_gen;
     if (gen >= 0)
     {
@@ -5665,6 +8598,7 @@ void cpu_reset(cpu_state *cpu, int gen)
     cpu->n_bps = 0;
     cpu->cpu_gen = new_gen;
     cpu->cpuid_model_id = 0x01 | (new_gen << 8);
+    cpu_init_dispatch(cpu);
 
     cpu->flags_mask = 0x003F7FD5;
     cpu->flags_mask1 = 0x00000002;
@@ -5689,7 +8623,7 @@ void cpu_reset(cpu_state *cpu, int gen)
     cpu->flags_preserve_popf = 0;
     LOAD_FLAGS(cpu, 0, 0);
 
-    cpu->cr0_valid = 0xE005003F & INT32_MAX;
+    cpu->cr0_valid = 0xE005003F;
     switch (cpu->cpu_gen)
     {
     case cpu_gen_8086:
@@ -5708,6 +8642,7 @@ void cpu_reset(cpu_state *cpu, int gen)
     cpu->cr4_valid = 0x00000009;
 
     cpu->CR[0] = 0x00000010 & cpu->cr0_valid;
+    cpu_tlb_flush(cpu);
     cpu->RPL = 0;
     cpu->CPL = 0;
     cpu->shadow_eip = 0x0000FFF0;
@@ -5715,6 +8650,8 @@ void cpu_reset(cpu_state *cpu, int gen)
     cpu->CS.base = 0x000F0000;
     cpu->CS.attrs = 0x009B;
     cpu->CS.limit = 0x0000FFFF;
+    sreg_refresh(cpu, &cpu->CS);
+    cpu_rebase_code(cpu);
     LOAD_SEL8086(cpu, &cpu->SS, 0);
     LOAD_SEL8086(cpu, &cpu->DS, 0);
     LOAD_SEL8086(cpu, &cpu->ES, 0);
@@ -5726,6 +8663,7 @@ void cpu_reset(cpu_state *cpu, int gen)
     cpu->TSS.limit = 0xFFFF;
     cpu->EDX = cpu->cpuid_model_id;
     cpu_reflect_rip(cpu);
+    block_cache_flush();
 }
 
 /**
@@ -5733,12 +8671,11 @@ void cpu_reset(cpu_state *cpu, int gen)
  */
 static int check_irq(cpu_state *cpu)
 {
-    if (!cpu->IF)
+    if (vpic->lines.raised && !vpic->queued)
+        pic_enqueue(0);
+    if (!cpu->IF || !vpic->queued)
         return 0;
-    int vector = vpc_irq();
-    if (!vector)
-        return 0;
-    return INVOKE_INT(cpu, vector, external);
+    return INVOKE_INT(cpu, pic_acknowledge(), external);
 }
 
 /**
@@ -5751,6 +8688,7 @@ static int cpu_block(cpu_state *cpu, int speed_status)
     int tsc_adjustment = 0;
 
     cpu_reflect_rip(cpu);
+    cpu->fused_count = 0;
 
     status = check_irq(cpu);
     if (status)
@@ -5801,6 +8739,16 @@ static int cpu_block(cpu_state *cpu, int speed_status)
                 tsc_adjustment = i;
                 RDTSC(cpu);
                 continue;
+            case cpu_status_timer:
+                cpu->time_stamp_counter += (i - tsc_adjustment);
+                tsc_adjustment = i;
+                io_complete(cpu);
+                // counter 0 may have been reprogrammed
+                periodic = i + pit_budget(periodic - i);
+                status = check_irq(cpu);
+                if (status)
+                    goto error_exit;
+                continue;
             case cpu_status_pause:
                 goto exit;
             case cpu_status_div:
@@ -5826,12 +8774,21 @@ static int cpu_block(cpu_state *cpu, int speed_status)
     }
     else
     {
+        block_cache->current = NULL;
+        block_cache->recording = 0;
         for (; i < periodic; i++)
         {
-            status = cpu_step(cpu);
+            status = cpu_step_cached(cpu, i + 1 < periodic);
             if (status == cpu_status_periodic)
                 continue;
 
+            if (status == cpu_status_fused)
+            {
+                cpu->fused_count++;
+                i++;
+                continue;
+            }
+
             if (status == cpu_status_inta)
             {
                 status = check_irq(cpu);
@@ -5857,6 +8814,16 @@ static int cpu_block(cpu_state *cpu, int speed_status)
                 tsc_adjustment = i;
                 RDTSC(cpu);
                 continue;
+            case cpu_status_timer:
+                cpu->time_stamp_counter += (i - tsc_adjustment);
+                tsc_adjustment = i;
+                io_complete(cpu);
+                // counter 0 may have been reprogrammed
+                periodic = i + pit_budget(periodic - i);
+                status = check_irq(cpu);
+                if (status)
+                    goto error_exit;
+                continue;
             case cpu_status_pause:
                 goto exit;
             case cpu_status_div:
@@ -5882,6 +8849,7 @@ static int cpu_block(cpu_state *cpu, int speed_status)
     }
 exit:
     cpu->time_stamp_counter += (i - tsc_adjustment);
+    cpu_materialize_flags(cpu);
 
     // status = check_irq(cpu);
     // if (status) return status;
@@ -5889,24 +8857,203 @@ exit:
     {
         INVOKE_INT(cpu, 1, exception);
     }
-    return cpu_status_periodic;
+    // a pause ends the slice early so that the host can idle
+    return status == cpu_status_pause ? cpu_status_pause : cpu_status_periodic;
 
 error_exit:
     cpu->time_stamp_counter += (i - tsc_adjustment);
+    cpu_materialize_flags(cpu);
     return status;
 }
 
+// Everything one guest machine owns, the CPU context comes first so that it doubles as the machine handle
+typedef struct machine_t
+{
+    cpu_state cpu;
+    uint32_t vram_dirty[VRAM_DIRTY_WORDS];
+    vpic_t vpic;
+    vpit_t vpit;
+    uint8_t *mem;
+    size_t max_mem;
+    block_cache_t *block_cache;
+    uint32_t *code_map;
+    io_map_t *io_map;
+    uint32_t *page_dirty;
+    struct machine_t *next_free;
+} machine_t;
+
+static machine_t *machine = NULL;
+static machine_t *free_machines = NULL;
+
+/**
+ * Point the globals of the interpreter at another machine
+ */
+static void machine_switch(machine_t *m)
+{
+    machine = m;
+    mem = m->mem;
+    max_mem = m->max_mem;
+    null_ptr = 0 - (intptr_t)mem;
+    block_cache = m->block_cache;
+    code_map = m->code_map;
+    io_map = m->io_map;
+    page_dirty = m->page_dirty;
+    vram_dirty = m->vram_dirty;
+    vpic = &m->vpic;
+    vpit = &m->vpit;
+}
+
+/**
+ * Leave no machine selected, the exports without a CPU context do nothing until one is selected
+ */
+static void machine_deselect(void)
+{
+    machine = NULL;
+    mem = NULL;
+    max_mem = 0;
+    null_ptr = 0;
+    block_cache = NULL;
+    code_map = NULL;
+    io_map = NULL;
+    page_dirty = NULL;
+    vram_dirty = NULL;
+    vpic = NULL;
+    vpit = NULL;
+}
+
+static inline void machine_enter(cpu_state *cpu)
+{
+    if ((machine_t *)cpu != machine)
+        machine_switch((machine_t *)cpu);
+}
+
+/**
+ * Create a machine with its own memory, caches and devices, and select it
+ *
+ * WebAssembly can not give memory back, so a destroyed machine of the same memory size is reused.
+ *
+ * @param mb Memory size in MB
+ * @return CPU context of the new machine, call `reset` before running it
+ */
+WASM_EXPORT cpu_state *machine_create(uint32_t mb)
+{
+    const size_t size = mb * 1024 * 1024;
+    machine_t *m = NULL;
+    for (machine_t **p = &free_machines; *p; p = &(*p)->next_free)
+    {
+        if ((*p)->max_mem == size)
+        {
+            m = *p;
+            *p = m->next_free;
+            break;
+        }
+    }
+    if (m)
+    {
+        memset(m->mem, 0, size);
+        memset(m->io_map, 0, sizeof(io_map_t));
+        memset(&m->cpu, 0, sizeof(cpu_state));
+        memset(m->vram_dirty, 0, sizeof(m->vram_dirty));
+        memset(&m->vpic, 0, sizeof(vpic_t));
+        memset(&m->vpit, 0, sizeof(vpit_t));
+    }
+    else
+    {
+        uint8_t *new_mem = alloc_pages(size + WASM_PAGESIZE);
+        m = alloc_pages(sizeof(machine_t));
+        m->mem = new_mem;
+        m->max_mem = size;
+        m->block_cache = alloc_pages(sizeof(block_cache_t));
+        m->code_map = alloc_pages(((size >> CODE_PAGE_SHIFT) + 1) * sizeof(uint32_t));
+        m->io_map = alloc_pages(sizeof(io_map_t));
+        m->page_dirty = alloc_pages(page_dirty_size(size));
+    }
+    m->next_free = NULL;
+    machine_switch(m);
+    block_cache_flush();
+    // nothing has been saved yet
+    memset(page_dirty, UINT8_MAX, page_dirty_size(size));
+    vpic->pic[0].IMR = vpic->pic[1].IMR = 0xFF;
+    io_map->type[0x20] = io_map->type[0x21] = io_type_pic;
+    io_map->type[0xA0] = io_map->type[0xA1] = io_type_pic;
+    for (int i = 0x40; i < 0x44; i++)
+    {
+        io_map->type[i] = io_type_pit;
+    }
+    io_map->type[0x3BA] = io_map->type[0x3DA] = io_type_vga_status;
+    return &m->cpu;
+}
+
+/**
+ * Select the machine that the exports without a CPU context work on
+ *
+ * Exports that take a CPU context select its machine themselves.
+ *
+ * @param cpu CPU context
+ */
+WASM_EXPORT void machine_select(cpu_state *cpu)
+{
+    machine_enter(cpu);
+}
+
+/**
+ * Get the guest memory of a machine
+ *
+ * @param cpu CPU context
+ * @return Base address of the guest memory
+ */
+WASM_EXPORT void *machine_get_memory(cpu_state *cpu)
+{
+    return ((machine_t *)cpu)->mem;
+}
+
+/**
+ * Destroy a machine, its memory is kept for the next machine of the same size
+ *
+ * No machine is selected afterwards if it was the selected one. Destroying a machine twice does nothing.
+ *
+ * @param cpu CPU context
+ */
+WASM_EXPORT void machine_destroy(cpu_state *cpu)
+{
+    machine_t *m = (machine_t *)cpu;
+    for (machine_t *p = free_machines; p; p = p->next_free)
+    {
+        if (p == m)
+            return;
+    }
+    if (m == machine)
+        machine_deselect();
+    m->next_free = free_machines;
+    free_machines = m;
+}
+
+/**
+ * Initialize internal structures and create the first machine.
+ * 
+ * THIS FUNCTION MUST BE CALLED BEFORE ALL OTHER FUNCTIONS.
+ *
+ * @param mb Memory size in MB
+ * @return Base address of the guest memory
+ */
+WASM_EXPORT void *_init(uint32_t mb)
+{
+    return machine_get_memory(machine_create(mb));
+}
+
 /**
- * Allocate internal CPU structure.
+ * Reset the CPU of the selected machine.
  * 
  * @param gen Initial CPU Generation
- * @returns CPU Context
+ * @returns CPU Context, NULL if no machine is selected
  */
 WASM_EXPORT cpu_state *alloc_cpu(int gen)
 {
-    static cpu_state cpu;
-    cpu_reset(&cpu, gen);
-    return &cpu;
+    if (!machine)
+        return NULL;
+    cpu_state *cpu = &machine->cpu;
+    cpu_reset(cpu, gen);
+    return cpu;
 }
 
 /**
@@ -5918,12 +9065,26 @@ WASM_EXPORT cpu_state *alloc_cpu(int gen)
  */
 WASM_EXPORT int run(cpu_state *cpu, int speed_status)
 {
-    int status = cpu_block(cpu, speed_status);
+    machine_enter(cpu);
+    int status;
+    uint32_t remaining = speed_status;
+    pit_sync(cpu);
+    for (;;)
+    {
+        // blocks end at PIT deadlines so that IRQ0 is raised on time
+        const uint64_t tsc = cpu->time_stamp_counter;
+        status = cpu_block(cpu, pit_budget(remaining));
+        const uint32_t done = cpu->time_stamp_counter - tsc;
+        if (!pit_sync(cpu) || status || done >= remaining)
+            break;
+        remaining -= done;
+    }
     cpu_update_eip(cpu);
     switch (status)
     {
     case cpu_status_periodic:
     case cpu_status_significant:
+    case cpu_status_pause:
     case cpu_status_exit:
     case cpu_status_icebp:
     case cpu_status_halt:
@@ -5999,14 +9160,21 @@ WASM_EXPORT int run(cpu_state *cpu, int speed_status)
  * |0xBXXXX|#NP|conditional|Segment Not Present|
  * |0xCXXXX|#SS|conditional|Stack Exception|
  * |0xDXXXX|#GP|conditional|General Protection Exception|
- * |0xEXXXX|#PF|conditional|Page Fault (NOT IMPLEMENTED)|
+ * |0xEXXXX|#PF|conditional|Page Fault|
  * 
  */
 WASM_EXPORT int step(cpu_state *cpu)
 {
+    machine_enter(cpu);
     cpu->time_stamp_counter++;
     cpu_reflect_rip(cpu);
     int status = cpu_step(cpu);
+    if (status == cpu_status_timer)
+    {
+        io_complete(cpu);
+        status = 0;
+    }
+    cpu_materialize_flags(cpu);
     if (status >= cpu_status_exception)
     {
         cpu_recover_eip(cpu);
@@ -6033,6 +9201,7 @@ static inline void cpu_set_bp(cpu_state *cpu, cpu_rip_t bp)
  */
 WASM_EXPORT void set_breakpoint(cpu_state *cpu, uint16_t sel, uint32_t offset)
 {
+    machine_enter(cpu);
     sreg_t temp = {0};
     LOAD_DESCRIPTOR(cpu, &temp, sel, type_bitmap_SEG_ALL, 1, NULL);
     cpu_rip_t bp = make_rip(temp.base, offset);
@@ -6049,6 +9218,7 @@ WASM_EXPORT void set_breakpoint(cpu_state *cpu, uint16_t sel, uint32_t offset)
  */
 WASM_EXPORT int prepare_step_over(cpu_state *cpu)
 {
+    machine_enter(cpu);
     int needs_breakpoint = 0;
     cpu_rip_t rip = make_rip_from_eip(cpu);
     uint32_t len = 0;
@@ -6111,6 +9281,7 @@ WASM_EXPORT int prepare_step_over(cpu_state *cpu)
  */
 WASM_EXPORT void show_regs(cpu_state *cpu)
 {
+    machine_enter(cpu);
     cpu_show_regs(cpu);
 }
 
@@ -6124,6 +9295,7 @@ WASM_EXPORT void show_regs(cpu_state *cpu)
  */
 WASM_EXPORT void reset(cpu_state *cpu, int gen)
 {
+    machine_enter(cpu);
     cpu_reset(cpu, gen);
 }
 
@@ -6137,6 +9309,7 @@ WASM_EXPORT void reset(cpu_state *cpu, int gen)
  */
 WASM_EXPORT int debug_load_selector(cpu_state *cpu, sreg_t *seg, uint16_t selector)
 {
+    machine_enter(cpu);
     return LOAD_DESCRIPTOR(cpu, seg, selector, type_bitmap_SEG_ALL, 1, NULL);
 }
 
@@ -6149,6 +9322,7 @@ WASM_EXPORT int debug_load_selector(cpu_state *cpu, sreg_t *seg, uint16_t select
  */
 WASM_EXPORT uint32_t debug_get_segment_base(cpu_state *cpu, uint16_t selector)
 {
+    machine_enter(cpu);
     sreg_t temp;
     int status = LOAD_DESCRIPTOR(cpu, &temp, selector, type_bitmap_SEG_ALL, 1, NULL);
     if (status)
@@ -6164,6 +9338,7 @@ WASM_EXPORT uint32_t debug_get_segment_base(cpu_state *cpu, uint16_t selector)
  */
 WASM_EXPORT const char *debug_get_register_map(cpu_state *cpu)
 {
+    machine_enter(cpu);
     static char buffer[1024];
     char *p = buffer;
     p = dump_string(p, "{\"AX\":");
@@ -6211,25 +9386,306 @@ WASM_EXPORT const char *debug_get_register_map(cpu_state *cpu)
     return buffer;
 }
 
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_REGIONS 5
+
+typedef struct
+{
+    uint32_t address;
+    uint32_t size;
+} snapshot_region_t;
+
+typedef struct
+{
+    uint32_t version;
+    uint32_t n_regions;
+    snapshot_region_t regions[SNAPSHOT_MAX_REGIONS];
+} snapshot_layout_t;
+
+/**
+ * Get the memory regions that hold the machine state: the CPU, the PIC and the PIT, the port shadow bytes and the guest RAM
+ *
+ * The host saves them as they are between two calls to `run`; to restore, it copies them back and calls `snapshot_restored`.
+ *
+ * @param cpu CPU context
+ * @return snapshot_layout_t
+ */
+WASM_EXPORT snapshot_layout_t *snapshot_get_layout(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    static snapshot_layout_t layout;
+    const snapshot_region_t regions[SNAPSHOT_MAX_REGIONS] = {
+        {(uintptr_t)cpu, sizeof(cpu_state)},
+        {(uintptr_t)vpic, sizeof(vpic_t)},
+        {(uintptr_t)vpit, sizeof(vpit_t)},
+        {(uintptr_t)io_map->shadow, sizeof(io_map->shadow)},
+        {(uintptr_t)mem, max_mem},
+    };
+    layout.version = SNAPSHOT_VERSION;
+    layout.n_regions = SNAPSHOT_MAX_REGIONS;
+    memcpy(layout.regions, regions, sizeof(regions));
+    return &layout;
+}
+
 /**
- * Get VRAM Signature
- * 
- * @param base Base Address
- * @param size VRAM Size in Bytes
- * @return Signature
+ * Get the bitmap of dirty guest pages of the selected machine
+ *
+ * One bit per 4KB page of the guest RAM region, set by every write since the host cleared it at the last checkpoint.
+ *
+ * @return uint32_t[(max_mem >> 17) + 1]
+ */
+WASM_EXPORT uint32_t *snapshot_get_dirty_pages(void)
+{
+    return page_dirty;
+}
+
+/**
+ * Rebuild everything derived from the machine state after the regions of `snapshot_get_layout` were overwritten
+ *
+ * The restored state becomes the last checkpoint, so the dirty page bitmap is cleared.
+ *
+ * @param cpu CPU context
+ */
+WASM_EXPORT void snapshot_restored(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    // host pointers and caches may come from another instance
+    cpu_init_dispatch(cpu);
+    cpu->n_bps = 0;
+    cpu->pending_fault = 0;
+    cpu->opr_copy.active = 0;
+    cpu_tlb_flush(cpu);
+    for (int i = 0; i < 8; i++)
+    {
+        sreg_refresh(cpu, &cpu->sregs[i]);
+    }
+    sreg_refresh(cpu, &cpu->LDT);
+    sreg_refresh(cpu, &cpu->TSS);
+    cpu_rebase_code(cpu);
+    cpu_reflect_rip(cpu);
+    cpu->last_known_rip = cpu->rip;
+    block_cache_flush();
+    memset(vram_dirty, UINT8_MAX, VRAM_DIRTY_WORDS * sizeof(uint32_t));
+    memset(page_dirty, 0, page_dirty_size(max_mem));
+}
+
+/**
+ * Get the VRAM dirty bitmap of the selected machine
+ *
+ * One bit per 256 bytes from A0000h, set by every write and cleared by the host after it has taken the data.
+ *
+ * @return uint32_t[48]
+ */
+WASM_EXPORT uint32_t *get_vram_dirty(void)
+{
+    return vram_dirty;
+}
+
+#define VGA_FRAME_MAX (640 * 480)
+#define VGA_BLACK 0xFF000000
+#define VGA_WHITE 0xFFFFFFFF
+
+typedef enum
+{
+    vga_format_8bpp = 0, // one palette index per byte
+    vga_format_1bpp,     // monochrome, 8 pixels per byte
+    vga_format_cga,      // monochrome with the odd lines 2000h bytes after the even lines
+} vga_format_t;
+
+// RGBA frame for the host canvas, in ImageData byte order
+typedef struct
+{
+    uint32_t palette[256];
+    uint32_t pixels[VGA_FRAME_MAX];
+} vga_frame_t;
+
+vga_frame_t *vga_frame = NULL;
+
+/**
+ * Expand bytes of 1bpp pixels into 8 RGBA pixels each; 8 at a time if the module is built with SIMD128.
+ */
+static void vga_expand_1bpp(uint32_t *dst, const uint8_t *src, const uint32_t bytes)
+{
+#ifdef __wasm_simd128__
+    const v128_t hi = wasm_i32x4_make(0x80, 0x40, 0x20, 0x10);
+    const v128_t lo = wasm_i32x4_make(0x08, 0x04, 0x02, 0x01);
+    const v128_t zero = wasm_i32x4_splat(0);
+    const v128_t black = wasm_i32x4_splat(VGA_BLACK);
+    for (uint32_t i = 0; i < bytes; i++, dst += 8)
+    {
+        const v128_t c = wasm_i32x4_splat(src[i]);
+        // set bits give all ones (white), clear bits leave the opaque black
+        wasm_v128_store(dst, wasm_v128_or(wasm_i32x4_ne(wasm_v128_and(c, hi), zero), black));
+        wasm_v128_store(dst + 4, wasm_v128_or(wasm_i32x4_ne(wasm_v128_and(c, lo), zero), black));
+    }
+#else
+    for (uint32_t i = 0; i < bytes; i++)
+    {
+        const uint8_t c = src[i];
+        for (int k = 0; k < 8; k++)
+        {
+            *dst++ = (c & (0x80 >> k)) ? VGA_WHITE : VGA_BLACK;
+        }
+    }
+#endif
+}
+
+/**
+ * Get the VGA frame buffer, allocated on the first call (the memory may grow)
+ *
+ * @return vga_frame_t: palette at +0, RGBA pixels at +400h
+ */
+WASM_EXPORT vga_frame_t *get_vga_frame(void)
+{
+    if (!vga_frame)
+        vga_frame = alloc_pages(sizeof(vga_frame_t));
+    return vga_frame;
+}
+
+/**
+ * Convert VRAM of the selected machine to RGBA pixels in the VGA frame buffer, through its palette for 8bpp
+ *
+ * @param base VRAM Base Address
+ * @param width Width in pixels
+ * @param height Height in pixels
+ * @param format vga_format_t
+ * @return Number of pixels converted, 0 if the frame does not fit
  */
-WASM_EXPORT uint32_t get_vram_signature(uint32_t base, size_t size)
+WASM_EXPORT uint32_t vga_render(uint32_t base, uint32_t width, uint32_t height, int format)
 {
-    const int shift = 13;
-    uint32_t acc = 0;
-    uint32_t *vram = (uint32_t *)(mem + base);
-    const uint32_t max_vram = size / 4;
-    for (int i = 0; i < max_vram; i++)
+    const uint32_t count = width * height;
+    const uint32_t bytes = format == vga_format_8bpp ? count : count >> 3;
+    const uint32_t span = format == vga_format_cga ? 0x2000 + (bytes >> 1) : bytes;
+    if (count > VGA_FRAME_MAX || base >= max_mem || span > max_mem - base)
+        return 0;
+    vga_frame_t *frame = get_vga_frame();
+    const uint8_t *src = mem + base;
+    uint32_t *dst = frame->pixels;
+    switch (format)
+    {
+    case vga_format_8bpp:
+        // SIMD128 has no gather, the palette lookup stays scalar
+        for (uint32_t i = 0; i < count; i++)
+        {
+            dst[i] = frame->palette[src[i]];
+        }
+        break;
+    case vga_format_1bpp:
+        vga_expand_1bpp(dst, src, bytes);
+        break;
+    case vga_format_cga:
     {
-        uint32_t v = vram[i];
-        acc = ((acc >> (32 - shift)) | (acc << shift)) + v;
+        const uint32_t stride = width >> 3;
+        for (uint32_t y = 0; y < height; y += 2, src += stride)
+        {
+            vga_expand_1bpp(dst, src, stride);
+            dst += width;
+            if (y + 1 < height)
+            {
+                vga_expand_1bpp(dst, src + 0x2000, stride);
+                dst += width;
+            }
+        }
+        break;
+    }
+    default:
+        return 0;
     }
-    return acc;
+    return count;
+}
+
+/**
+ * Skip the idle time after HLT: advance virtual time to the next IRQ0 from the PIT.
+ *
+ * @param cpu CPU context
+ * @return PIT ticks skipped, 0 if counter 0 is not running
+ */
+WASM_EXPORT uint32_t pit_idle(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    pit_sync(cpu);
+    const uint32_t inst = pit_budget(UINT32_MAX);
+    if (inst == UINT32_MAX)
+        return 0;
+    cpu->time_stamp_counter += inst;
+    pit_sync(cpu);
+    return (inst + PIT_INST_PER_TICK - 1) / PIT_INST_PER_TICK;
+}
+
+/**
+ * Get the virtual time kept by the PIT
+ *
+ * @param cpu CPU context
+ * @return milliseconds since power on
+ */
+WASM_EXPORT double pit_get_time(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    pit_sync(cpu);
+    return vpit->ticks * 1000.0 / PIT_HZ;
+}
+
+/**
+ * Get the time stamp counter, which counts executed instructions
+ *
+ * @param cpu CPU context
+ * @return time stamp counter
+ */
+WASM_EXPORT double get_time_stamp_counter(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    return cpu->time_stamp_counter;
+}
+
+/**
+ * Get the port I/O dispatch table of the selected machine
+ *
+ * Layout: uint8 type[65536], uint8 shadow[65536], uint32 count[65536].
+ * The host marks the ports it handles as host (1), or as shadow (2) for status ports
+ * whose byte reads can be served from shadow[] without a call.
+ *
+ * @return address of the table
+ */
+WASM_EXPORT io_map_t *get_io_map()
+{
+    return io_map;
+}
+
+/**
+ * Get the IRQ lines shared with the interrupt controller of the selected machine
+ *
+ * Layout: uint32 raised bitmap followed by uint32 pending counts for IRQ0-15.
+ *
+ * @return address of the IRQ lines
+ */
+WASM_EXPORT irq_lines_t *get_irq_lines()
+{
+    if (!vpic)
+        return NULL;
+    return &vpic->lines;
+}
+
+/**
+ * Get the number of CMP/TEST/DEC + Jcc pairs executed as one step by the last `run`
+ *
+ * @param cpu CPU context
+ * @return number of fused pairs
+ */
+WASM_EXPORT uint32_t debug_get_fused_count(cpu_state *cpu)
+{
+    machine_enter(cpu);
+    return cpu->fused_count;
+}
+
+/**
+ * Notify that memory of the selected machine was modified from outside of the CPU (DMA etc.)
+ * 
+ * @param base Base Address
+ * @param size Size in Bytes
+ */
+WASM_EXPORT void invalidate_code(uint32_t base, size_t size)
+{
+    memory_notify_range(base, size);
 }
 
 static inline int parse_modrm(int use32, uint32_t rip, int *_skip, modrm_t *result)
@@ -6925,6 +10381,7 @@ static inline char *disasm_main(char *p, uint16_t sel, uint32_t eip, uint32_t ri
  */
 WASM_EXPORT int disasm(cpu_state *cpu, uint32_t sel, uint32_t _offset, int count)
 {
+    machine_enter(cpu);
     static char buff[1024];
     int len;
     sreg_t seg = {0};
@@ -0,0 +1,91 @@
+// Batch Runner for Node.js
+//
+// node lib/batch.js [options] image...
+//   --threads n               worker threads (default: one per core)
+//   and the options of headless.js except --save-snapshot, applied to every job
+//
+// vcpu.wasm is compiled once and shared by the threads, each thread runs its jobs one by one
+// on a single instance. With --snapshot every job resumes from the same snapshot instead of booting.
+// A JSON line is printed to stdout for each job as it ends:
+//   {"job":0,"image":"a.img","status":0,"instructions":123456,"screen":"..."}
+// The exit status is 0 when every job exited with 0, and 1 otherwise.
+'use strict';
+
+import * as fs from 'fs';
+import * as os from 'os';
+import * as path from 'path';
+import { Worker, isMainThread, parentPort, workerData } from 'worker_threads';
+import { EXIT_SHUTDOWN, EXIT_USAGE, JobOptions, JobResult, createHost, libDir, parseOptions, runJob, toArrayBuffer } from './runner';
+
+interface BatchJob {
+    job: number;
+    image: string;
+}
+
+const main = async (argv: string[]): Promise<void> => {
+    let threads = os.cpus().length;
+    const args = parseOptions(argv, (arg, value) => {
+        if (arg !== '--threads' || !value) return -1;
+        threads = parseInt(value);
+        return 1;
+    });
+    if (!args || !args.images.length || !(threads > 0)) {
+        process.stderr.write('usage: batch.js [--threads n] [--gen n] [--mem kb] [--keys text] [--keys-file path] [--max-instructions n] [--snapshot path] [--verbose] image...\n');
+        process.exit(EXIT_USAGE);
+        return;
+    }
+
+    const lib = libDir();
+    const module = await WebAssembly.compile(fs.readFileSync(path.join(lib, 'vcpu.wasm')));
+    const bios = new Uint8Array(fs.readFileSync(path.join(lib, 'bios.bin')));
+    const queue: BatchJob[] = args.images.map((image, i) => ({ job: i, image: image }));
+    let failed = false;
+    let running = Math.min(threads, queue.length);
+    for (let i = running; i > 0; i--) {
+        // the module and the snapshot are cloned into the thread, the images are read there
+        const worker = new Worker(fs.realpathSync(process.argv[1]), {
+            workerData: { module: module, bios: bios, options: args.options, verbose: args.verbose },
+        });
+        worker.on('message', (result: BatchJob & JobResult & { error?: string }) => {
+            process.stdout.write(`${JSON.stringify(result)}\n`);
+            failed = failed || result.status != 0;
+            worker.postMessage(queue.shift());
+        });
+        worker.on('error', reason => {
+            process.stderr.write(`${reason}\n`);
+            failed = true;
+        });
+        worker.on('exit', () => {
+            if (--running == 0) {
+                process.exit(failed ? 1 : 0);
+            }
+        });
+        worker.postMessage(queue.shift());
+    }
+}
+
+const thread = async (): Promise<void> => {
+    const { module, bios, options, verbose } = workerData as { module: WebAssembly.Module, bios: Uint8Array, options: JobOptions, verbose: boolean };
+    if (!verbose) {
+        console.log = () => { };
+    }
+    const host = await createHost(module, bios, verbose);
+    parentPort!.on('message', async (job: BatchJob | undefined) => {
+        if (!job) {
+            process.exit(0);
+            return;
+        }
+        let result: JobResult & { error?: string };
+        try {
+            result = await runJob(host, toArrayBuffer(fs.readFileSync(job.image)), options, verbose);
+        } catch (e) {
+            result = { status: EXIT_SHUTDOWN, screen: '', instructions: 0, error: `${e}` };
+        }
+        parentPort!.postMessage({ job: job.job, image: job.image, status: result.status, instructions: result.instructions, screen: result.screen, error: result.error });
+    });
+}
+
+(isMainThread ? main(process.argv.slice(2)) : thread()).catch(reason => {
+    process.stderr.write(`${reason}\n`);
+    process.exit(EXIT_SHUTDOWN);
+});
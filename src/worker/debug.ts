@@ -10,6 +10,8 @@ Step Into       T
 Step Over       P
 Register        R [register [value]]
 Reg Details     RD
+Hot Ports       HP
+Speed           SP
 Edit Memory     E address values
 Dump Memory     D [range]
 Disassemble     U [range]`;
@@ -98,6 +100,14 @@ export class Debugger {
                 this.env.showDesc();
                 break;
 
+            case 'hp':
+                this.env.showHotPorts();
+                break;
+
+            case 'sp':
+                this.env.showSpeed();
+                break;
+
             // Edit
             case 'e':
                 {
@@ -1,127 +1,49 @@
 // Minimal PC's devices
 
-import { RuntimeEnvironment } from './env';
-import { IOManager } from './iomgr';
+import { RuntimeEnvironment, Snapshottable, DeviceState } from './env';
 
-const PIC_PHASE_MAX = 4;
 /**
  * Programmable Interrupt Controller
+ *
+ * The 8259 pair itself lives in vcpu.wasm, this only raises IRQ lines through the table it shares.
  */
 export class VPIC {
-    private irq: number[];
-    private phase: number[];
-    private IMR: Uint8Array;
-    // private IRR: Uint8Array;
-    private ISR: Uint8Array;
-    private ICW: Uint8Array;
-    private intCount: number[];
-
-    constructor(iomgr: IOManager) {
-        this.irq = [];
-        this.phase = [0, 0];
-        this.IMR = new Uint8Array([0xFF, 0xFF]);
-        // this.IRR = new Uint8Array(2);
-        this.ISR = new Uint8Array(2);
-        this.ICW = new Uint8Array(PIC_PHASE_MAX * 2);
-        this.intCount = [];
-        for (let i = 0; i < 16; i++) {
-            this.intCount[i] = 0;
-        }
-
-        iomgr.on(0x20, (_, data) => this.writeCMD(0, data), (_) => this.readCMD(0));
-        iomgr.on(0x21, (_, data) => this.writeIMR(0, data), (_) => this.readIMR(0));
-        iomgr.on(0xA0, (_, data) => this.writeCMD(1, data), (_) => this.readCMD(1));
-        iomgr.on(0xA1, (_, data) => this.writeIMR(1, data), (_) => this.readIMR(1));
-    }
-
-    private writeCMD(port: number, data: number): void {
-        if (data & 0x10) { // ICW1
-            this.phase[port] = 1;
-            this.ICW[port * 4] = data;
-            this.ISR[port] = 0;
-            for (let i = 0; i < 8; i++) {
-                this.intCount[i + port * 8] = 0;
-            }
-            this.irq = [];
-        } else if ((data & 0xF8) == 0x20) { // auto EOI
-            for (let i = 0; i < 8; i++) {
-                const mask = (1 << i);
-                if (this.ISR[port] & mask) {
-                    this.ISR[port] &= ~mask;
-                    this.enqueue(0);
-                    break;
-                }
-            }
-        } else if ((data & 0xF8) == 0x60) { // manual EOI
-            const mask = (1 << (data & 7));
-            if (this.ISR[port] & mask) {
-                this.ISR[port] &= ~mask;
-                this.enqueue(0);
-            }
-        }
-    }
-    private readCMD(port: number): number {
-        return this.ISR[port];
-    }
-    private writeIMR(port: number, data: number): void {
-        const phase = this.phase[port];
-        if (phase > 0 && phase < PIC_PHASE_MAX) { // ICW2-4
-            this.ICW[port * PIC_PHASE_MAX + phase] = data;
-            this.phase[port] = 1 + phase;
-        } else {
-            this.IMR[port] = data;
-        }
-    }
-    private readIMR(port: number): number {
-        return this.IMR[port];
-    }
-    private enqueue(port: number): void {
-        if (this.phase[port] != PIC_PHASE_MAX) return;
-        for (let i = 0; i < 8; i++) {
-            if (this.irq.length) return;
-            const global_irq = port * 8 + i;
-            const mask = (1 << i);
-            if ((port == 0) && (i == this.ICW[6]) && ((this.IMR[0] & mask) == 0)) {
-                this.enqueue(1);
-                break;
-            }
-            if (this.ISR[port] & mask) break;
-            if (this.IMR[port] & mask) continue;
-            if (this.intCount[global_irq] > 0) {
-                this.intCount[global_irq]--;
-                this.ISR[port] |= mask;
-                this.irq.push(global_irq);
-            }
+    private memory?: WebAssembly.Memory;
+    private address = 0;
+    private lines = new Uint32Array(0);
+
+    public attach(memory: WebAssembly.Memory, address: number): void {
+        this.memory = memory;
+        this.address = address;
+        this.lines = new Uint32Array(0);
+    }
+    private getLines(): Uint32Array {
+        // the view is lost whenever the memory grows
+        if (this.memory && this.lines.buffer !== this.memory.buffer) {
+            this.lines = new Uint32Array(this.memory.buffer, this.address, 17);
         }
+        return this.lines;
     }
     public raiseIRQ(n: number, count: number = 1): void {
-        // if (n) console.log('raise', n, this.irq.length);
-        this.intCount[n] += count;
-        this.enqueue(0);
+        const lines = this.getLines();
+        if (!lines.length) return;
+        lines[1 + n] += count;
+        lines[0] |= 1 << n;
     }
     public clearPendingIRQ(n: number): void {
-        this.intCount[n] = 0;
-    }
-    public dequeueIRQ(): number {
-        const global_irq = this.irq.shift();
-        if (global_irq != null) {
-            const port = global_irq >> 3;
-            const local_irq = global_irq & 7;
-            const mask = 1 << local_irq;
-            this.ISR[port] |= mask;
-            const vector = (this.ICW[port * PIC_PHASE_MAX + 1] & 0xF8) | local_irq;
-            // if (global_irq) console.log('dequeue', global_irq, vector, this.irq.length);
-            return vector;
-        } else {
-            return 0;
-        }
+        const lines = this.getLines();
+        if (!lines.length) return;
+        lines[1 + n] = 0;
+        lines[0] &= ~(1 << n);
     }
 }
 
 /**
  * Programmable Interval Timer
+ *
+ * The counters run in vcpu.wasm against virtual time, counter 2 writes are forwarded here for the speaker.
  */
-export class VPIT {
+export class VPIT implements Snapshottable {
     private cntModes: Uint8Array;
     private cntPhases: number[];
     private cntValues: Uint8Array;
@@ -134,10 +56,9 @@ export class VPIT {
         this.cntPhases = [0, 0, 0];
         this.cntValues = new Uint8Array(6);
         this.p0061_data = 0;
+        env.registerDevice('pit', this);
 
-        env.iomgr.on(0x40, (_, data) => this.outCntReg(0, data), _ => this.readCntReg(0));
-        env.iomgr.on(0x41, (_, data) => this.outCntReg(1, data), _ => this.readCntReg(1));
-        env.iomgr.on(0x42, (_, data) => this.outCntReg(2, data), _ => this.readCntReg(2));
+        env.iomgr.on(0x42, (_, data) => this.outCntReg(2, data));
         env.iomgr.on(0x43, (_, data) => {
             const counter = (data >> 6) & 3;
             const format = (data >> 4) & 3;
@@ -148,13 +69,8 @@ export class VPIT {
                 this.cntPhases[counter] = 0;
                 this.cntValues[counter * 2] = 0;
                 this.cntValues[counter * 2 + 1] = 0;
-                switch (counter) {
-                    case 0:
-                        this.clearTimer();
-                        break;
-                    case 2:
-                        this.noteOff();
-                        break;
+                if (counter == 2) {
+                    this.noteOff();
                 }
             }
             return false;
@@ -177,9 +93,6 @@ export class VPIT {
         this.p0061_data ^= 0x30;
         return this.p0061_data;
     }
-    private readCntReg(counter: number): number {
-        return (Math.random() * 255) | 0;
-    }
     private outCntReg(counter: number, data: number): void {
         if (this.cntPhases[counter] != 1) {
             this.cntValues[counter * 2] = data;
@@ -187,18 +100,25 @@ export class VPIT {
         } else {
             this.cntValues[counter * 2 + 1] = data;
             this.cntPhases[counter] = 0;
-            switch (counter) {
-                case 0:
-                    this.setTimer();
-                    break;
-                case 2:
-                    if (this.p0061_data & 0x02) {
-                        this.noteOn();
-                    }
-                    break;
+            if (counter == 2 && (this.p0061_data & 0x02)) {
+                this.noteOn();
             }
         }
     }
+    public saveState(): DeviceState {
+        return { modes: Array.from(this.cntModes), phases: this.cntPhases.slice(), values: Array.from(this.cntValues), p61: this.p0061_data };
+    }
+    public loadState(state: DeviceState): void {
+        this.cntModes.set(state.modes);
+        this.cntPhases = state.phases.slice();
+        this.cntValues.set(state.values);
+        this.p0061_data = state.p61;
+        if (this.p0061_data & 0x02) {
+            this.noteOn();
+        } else {
+            this.noteOff();
+        }
+    }
     public noteOn(): void {
         const freq = 1193181 / this.getCounter(2);
         this.env.setSound(freq);
@@ -211,13 +131,6 @@ export class VPIT {
         if (!count_value) count_value = 0x10000;
         return count_value;
     }
-    public clearTimer(): void {
-        this.env.pic.clearPendingIRQ(0);
-        this.env.setTimer(0);
-    }
-    public setTimer(): void {
-        this.env.setTimer(this.getCounter(0) / 1193.181);
-    }
 }
 
 
@@ -258,16 +171,24 @@ export class UART {
 /**
  * Real Time Clock
  */
-export class RTC {
+export class RTC implements Snapshottable {
     public index: number = 0;
     private ram: Uint8Array;
 
     constructor(env: RuntimeEnvironment) {
         this.ram = new Uint8Array(128);
         this.ram[0x0B] = 0x02;
+        env.registerDevice('rtc', this);
         env.iomgr.on(0x70, (_, data) => this.index = data, (_) => this.index);
         env.iomgr.on(0x71, (_, data) => this.writeRTC(data), (_) => this.readRTC());
     }
+    saveState(): DeviceState {
+        return { index: this.index, ram: Array.from(this.ram) };
+    }
+    loadState(state: DeviceState): void {
+        this.index = state.index;
+        this.ram.set(state.ram);
+    }
     writeRTC(data: number): void {
         this.ram[this.index & 0x7F] = data;
     }
@@ -305,12 +226,19 @@ export class RTC {
 /**
  * Peripheral Component Interconnect
  */
-export class PCI {
+export class PCI implements Snapshottable {
     private lastAddress = 0;
 
     constructor(env: RuntimeEnvironment) {
         // TODO: everything
+        env.registerDevice('pci', this);
         env.iomgr.ond(0xCF8, (_, data) => this.lastAddress = data, (_) => this.lastAddress);
         env.iomgr.ond(0xCFC, (_, _data) => { }, (_) => 0xFFFFFFFF);
     }
+    saveState(): DeviceState {
+        return { lastAddress: this.lastAddress };
+    }
+    loadState(state: DeviceState): void {
+        this.lastAddress = state.lastAddress;
+    }
 }
@@ -12,6 +12,16 @@ export interface WorkerInterface {
     bind(command: string, handler: WorkerMessageHandler): void;
 }
 
+export type DeviceState = { [key: string]: any };
+
+/**
+ * A device whose registers are carried in a machine snapshot
+ */
+export interface Snapshottable {
+    saveState(): DeviceState;
+    loadState(state: DeviceState): void;
+}
+
 interface RuntimeEnvironmentInterface {
     memoryBase: number;
     memory: WebAssembly.Memory;
@@ -24,14 +34,29 @@ interface RuntimeEnvironmentInterface {
     vpc_inw(port: number): number;
     vpc_outd(port: number, data: number): void;
     vpc_ind(port: number): number;
-    vpc_irq(): number;
     vpc_grow(n: number): number;
 }
 
+const STATUS_PAUSE = 2;
 const STATUS_ICEBP = 4;
 const STATUS_HALT = 0x1000;
 const STATUS_EXCEPTION = 0x10000;
 
+// 'VPCS', followed by the version, the chain id, the checkpoint index, the region count,
+// the device JSON size, the dirty page count and the size of each region
+const SNAPSHOT_MAGIC = 0x53435056;
+const SNAPSHOT_VERSION = 2;
+const SNAPSHOT_HEADER_SIZE = 28;
+const SNAPSHOT_MAX_REGIONS = 5;
+// the guest RAM is the last region, a checkpoint only carries its dirty pages
+const SNAPSHOT_PAGE_SHIFT = 12;
+const SNAPSHOT_PAGE_SIZE = 1 << SNAPSHOT_PAGE_SHIFT;
+
+// wall time of a run() slice in ms, the instruction budget follows it
+const SLICE_TARGET = 8;
+const SLICE_MIN = 0x10000;
+const SLICE_MAX = 0x1000000;
+
 export class RuntimeEnvironment {
 
     public worker: WorkerInterface;
@@ -42,11 +67,23 @@ export class RuntimeEnvironment {
     public rtc: RTC;
     public pci: PCI;
 
-    private period = 0;
-    private lastTick: number;
+    // no wall clock pacing, idle HLT skips straight to the next timer interrupt
+    public headless = false;
+    // called after every run() slice with its status
+    public onSlice?: (status: number) => void;
+    // the slices stop exactly at this instruction count (see getInstructionCount)
+    public instructionLimit = Infinity;
+    // set when the memory is shared with the UI: [0] odd while run() is writing, [1] frame generation
+    public sharedFrame?: Int32Array;
+    // wall clock at virtual time 0
+    private timeOrigin: number;
     private env: RuntimeEnvironmentInterface;
-    private _memory: Uint8Array;
+    private memoryView = new Uint8Array(0);
     private instance?: WebAssembly.Instance;
+    // the environment that instantiated vcpu.wasm, the machine that calls it now and the machine selected in it
+    private owner: RuntimeEnvironment = this;
+    private active: RuntimeEnvironment = this;
+    private selected = 0;
     private vmem: number = 0;
     private cpu: number = 0;
     private regmap: { [key: string]: number } = {};
@@ -54,11 +91,26 @@ export class RuntimeEnvironment {
     private memoryConfig: Uint16Array = new Uint16Array(2);
     private isDebugging: boolean = false;
     private isRunning: boolean = false;
-    private speed_status = 0x200000;
+    // instruction budget of run()
+    private slice = 0x200000;
+    // reschedules a busy guest without the timer clamping of setTimeout
+    private channel?: MessageChannel;
+    // the UI sets and notifies it after posting an input event, an idle guest waits on it
+    private wake?: Int32Array;
+    private perfStart = 0;
+    private instructionBase = 0;
+    private perfInstructions = 0;
+    // instructions per wall clock microsecond over the last second
+    public mips = 0;
+    private vramDirty = new Uint32Array(0);
+    private devices: { [name: string]: Snapshottable } = {};
+    // the full snapshot the checkpoints are based on and the number of checkpoints taken since
+    private chainId = 0;
+    private chainIndex = 0;
 
     constructor(worker: WorkerInterface) {
         this.worker = worker;
-        this.lastTick = new Date().valueOf();
+        this.timeOrigin = new Date().valueOf();
         this.env = {
             memoryBase: 0,
             memory: new WebAssembly.Memory({ initial: 1, maximum: 1030 }),
@@ -69,26 +121,20 @@ export class RuntimeEnvironment {
             },
             println: (at: number): void => {
                 const str = this.getCString(at);
-                worker.print(str);
+                this.active.worker.print(str);
                 // console.log(str);
             },
-            vpc_outb: (port: number, data: number): void => this.iomgr.outb(port, data),
-            vpc_inb: (port: number): number => this.iomgr.inb(port),
-            vpc_outw: (port: number, data: number): void => this.iomgr.outw(port, data),
-            vpc_inw: (port: number): number => this.iomgr.inw(port),
-            vpc_outd: (port: number, data: number): void => this.iomgr.outd(port, data),
-            vpc_ind: (port: number): number => this.iomgr.ind(port),
-            vpc_irq: (): number => this.pic.dequeueIRQ(),
-            vpc_grow: (n: number): number => {
-                const result = this.env.memory.grow(n);
-                this._memory = new Uint8Array(this.env.memory.buffer);
-                return result;
-            },
+            vpc_outb: (port: number, data: number): void => this.active.iomgr.outb(port, data),
+            vpc_inb: (port: number): number => this.active.iomgr.inb(port),
+            vpc_outw: (port: number, data: number): void => this.active.iomgr.outw(port, data),
+            vpc_inw: (port: number): number => this.active.iomgr.inw(port),
+            vpc_outd: (port: number, data: number): void => this.active.iomgr.outd(port, data),
+            vpc_ind: (port: number): number => this.active.iomgr.ind(port),
+            vpc_grow: (n: number): number => this.env.memory.grow(n),
         }
-        this._memory = new Uint8Array(this.env.memory.buffer);
 
         this.iomgr = new IOManager(worker);
-        this.pic = new VPIC(this.iomgr);
+        this.pic = new VPIC();
         this.pit = new VPIT(this);
         this.rtc = new RTC(this);
         this.pci = new PCI(this);
@@ -100,10 +146,102 @@ export class RuntimeEnvironment {
         this.iomgr.onw(0xFC02, undefined, (_) => this.memoryConfig[1]);
 
         worker.bind('reset', (args) => this.reset(args.gen, args.br_mbr));
+        worker.bind('save_snapshot', (_) => {
+            try {
+                worker.postCommand('snapshot', this.saveSnapshot());
+            } catch (e) {
+                worker.postCommand('alert', e.toString());
+            }
+        });
+        worker.bind('save_checkpoint', (_) => {
+            try {
+                worker.postCommand('checkpoint', this.saveCheckpoint());
+            } catch (e) {
+                worker.postCommand('alert', e.toString());
+            }
+        });
+        worker.bind('load_snapshot', (args) => {
+            try {
+                this.loadSnapshot(args.blob, args.checkpoints);
+            } catch (e) {
+                worker.postCommand('alert', e.toString());
+            }
+        });
+
+        if (worker.hasClass('MessageChannel')) {
+            this.channel = new MessageChannel();
+            this.channel.port1.onmessage = () => this.cont();
+        }
+        if (worker.hasClass('SharedArrayBuffer')) {
+            this.wake = new Int32Array(new SharedArrayBuffer(4));
+            worker.postCommand('idle_wake', this.wake);
+        }
+    }
+    /**
+     * Instantiate vcpu.wasm
+     * @param source the binary, or a module compiled once and instantiated by several threads
+     */
+    public async instantiate(source: ArrayBuffer | WebAssembly.Module): Promise<WebAssembly.Instance> {
+        if (this.shareMemory()) {
+            try {
+                return await this.instantiateWith(source);
+            } catch (e) {
+                // vcpu.wasm was built without SHARED=1
+                this.unshareMemory();
+            }
+        }
+        return this.instantiateWith(source);
+    }
+    private async instantiateWith(source: ArrayBuffer | WebAssembly.Module): Promise<WebAssembly.Instance> {
+        if (source instanceof WebAssembly.Module) {
+            return WebAssembly.instantiate(source, this as any);
+        }
+        return (await WebAssembly.instantiate(source, this as any)).instance;
+    }
+    private shareMemory(): boolean {
+        // SharedArrayBuffer is only exposed to cross-origin isolated pages
+        if (!this.worker.hasClass('SharedArrayBuffer')) return false;
+        this.env.memory = new WebAssembly.Memory({ initial: 1, maximum: 1030, shared: true } as WebAssembly.MemoryDescriptor);
+        this.sharedFrame = new Int32Array(new SharedArrayBuffer(8));
+        return true;
+    }
+    private unshareMemory(): void {
+        this.env.memory = new WebAssembly.Memory({ initial: 1, maximum: 1030 });
+        this.sharedFrame = undefined;
+    }
+    public getSharedVram(base: number, size: number): { buffer: ArrayBufferLike, offset: number, size: number, frame: Int32Array } | undefined {
+        if (!this.sharedFrame) return undefined;
+        return { buffer: this.env.memory.buffer, offset: this.vmem + base, size: size, frame: this.sharedFrame };
     }
     public loadCPU(wasm: WebAssembly.Instance): void {
         this.instance = wasm;
     }
+    /**
+     * Run another machine on the vcpu.wasm instance of an environment, instead of loading one
+     *
+     * Each machine has its own memory and devices, the instance calls back into the machine that invoked it.
+     * @param owner the environment that instantiated vcpu.wasm
+     */
+    public shareInstance(owner: RuntimeEnvironment): void {
+        if (!owner.instance) throw new Error('Instance not initialized');
+        this.owner = owner.owner;
+        this.env = owner.env;
+        this.instance = owner.instance;
+        this.bios = owner.bios;
+    }
+    /**
+     * Stop the machine and give its memory back for the next machine of the same size
+     */
+    public dispose(): void {
+        // an open port would keep a Node.js thread alive
+        this.channel?.port1.close();
+        this.channel = undefined;
+        if (!this.instance || !this.cpu) return;
+        this.invokeWasm('machine_destroy')(this.cpu);
+        this.isRunning = false;
+        this.instance = undefined;
+        this.cpu = 0;
+    }
     public loadBIOS(bios: Uint8Array): void {
         this.bios = bios;
     }
@@ -115,10 +253,11 @@ export class RuntimeEnvironment {
         } else {
             this.memoryConfig = new Uint16Array([640, size - 1024]);
         }
-        this.vmem = this.invokeWasm('_init')((size + 1023) / 1024);
-    }
-    public setTimer(period: number): void {
-        this.period = period;
+        this.cpu = this.invokeWasm('machine_create')((size + 1023) / 1024);
+        this.owner.selected = this.cpu;
+        this.vmem = this.invokeWasm('machine_get_memory')(this.cpu);
+        this.iomgr.attach(this.env.memory, this.invokeWasm('get_io_map')());
+        this.pic.attach(this.env.memory, this.invokeWasm('get_irq_lines')());
     }
     public setSound(freq: number): void {
         this.worker.postCommand('beep', freq);
@@ -140,10 +279,12 @@ export class RuntimeEnvironment {
                 throw `Unexpected type ${typeof (v)}`;
             }
         }
+        this.invokeWasm('invalidate_code')(to, p - this.vmem - to);
     }
     public dmaWrite(base: number, data: ArrayBuffer): void {
         const a = new Uint8Array(data);
         this._memory.set(a, this.vmem + base);
+        this.invokeWasm('invalidate_code')(base, a.length);
     }
     public dmaRead(base: number, size: number): Uint8Array {
         const offset = this.vmem + base;
@@ -165,9 +306,13 @@ export class RuntimeEnvironment {
             return String.fromCharCode.apply(String, bytes);
         }
     }
-    private afterReset(br_mbr: boolean): void {
+    private afterReset(br_mbr: boolean, snapshot?: ArrayBuffer, checkpoints?: ArrayBuffer[]): void {
         const bios_base = 0x100000 - this.bios.length;
         this.dmaWrite(bios_base, this.bios);
+        this.instructionBase = 0;
+        if (snapshot) {
+            this.loadSnapshot(snapshot, checkpoints);
+        }
         if (br_mbr) {
             this.setBreakpoint(0, 0x7C00);
         }
@@ -183,25 +328,27 @@ export class RuntimeEnvironment {
         console.log(`CPU restarted (${gen})`);
         this.afterReset(br_mbr);
     }
-    public start(gen: number, br_mbr: boolean = false): void {
+    /**
+     * Reset the CPU and run
+     * @param snapshot resume from a snapshot and its checkpoints instead of booting
+     */
+    public start(gen: number, br_mbr: boolean = false, snapshot?: ArrayBuffer, checkpoints?: ArrayBuffer[]): void {
         if (!this.instance) throw new Error('Instance not initialized');
-        this.cpu = this.invokeWasm('alloc_cpu')(gen);
+        this.invokeWasm('reset')(this.cpu, gen);
         this.regmap = JSON.parse(this.getCString(this.invokeWasm('debug_get_register_map')(this.cpu)));
         console.log(`CPU started (${gen})`);
-        this.afterReset(br_mbr);
+        this.afterReset(br_mbr, snapshot, checkpoints);
     }
     private cont(): void {
         if (!this.instance) return;
-        if (this.period > 0) {
-            const now = new Date().valueOf();
-            for (let expected = this.lastTick + this.period; now >= expected; expected += this.period) {
-                this.pic.raiseIRQ(0);
-                this.lastTick = expected;
-            }
-        }
         let status: number;
+        const frame = this.sharedFrame;
+        const start = performance.now();
+        const tsc = this.invokeWasm('get_time_stamp_counter')(this.cpu);
+        const budget = Math.max(1, Math.min(this.slice, this.instructionLimit - this.getInstructionCount()));
+        if (frame) Atomics.add(frame, 0, 1);
         try {
-            status = this.invokeWasm('run')(this.cpu, this.speed_status);
+            status = this.invokeWasm('run')(this.cpu, budget);
         } catch (e) {
             this.isRunning = false;
             console.error(e);
@@ -210,6 +357,8 @@ export class RuntimeEnvironment {
             this.invokeWasm('show_regs')(this.cpu);
             this.worker.postCommand('debugReaction', {});
         }
+        if (frame) Atomics.add(frame, 0, 1);
+        this.updateSlice(status, budget, this.invokeWasm('get_time_stamp_counter')(this.cpu) - tsc, start);
         this.dequeueUART();
         if (status >= STATUS_EXCEPTION) {
             this.isRunning = false;
@@ -221,20 +370,67 @@ export class RuntimeEnvironment {
             this.invokeWasm('show_regs')(this.cpu);
             this.worker.postCommand('debugReaction', {});
         } else {
-            let timer = 1;
-            switch (status) {
-                case STATUS_HALT:
-                    const now = new Date().valueOf();
-                    const expected = this.lastTick + this.period;
-                    timer = expected - now;
-                    if (timer < 0) timer = 0;
-                    break;
-                default:
-                // timer = 1;
+            let timer = 0;
+            const idle = status == STATUS_HALT || status == STATUS_PAUSE;
+            if (idle) {
+                // nothing to do until the next timer interrupt
+                this.invokeWasm('pit_idle')(this.cpu);
             }
-            setTimeout(() => this.cont(), timer);
+            if (!this.headless) {
+                // keep virtual time from running ahead of the wall clock
+                const now = new Date().valueOf();
+                const ahead = this.timeOrigin + this.invokeWasm('pit_get_time')(this.cpu) - now;
+                if (ahead > 1000 || ahead < -250) {
+                    this.timeOrigin -= ahead;
+                } else if (ahead >= 1) {
+                    timer = ahead;
+                }
+            }
+            if (idle && timer > 0 && this.wake) {
+                // block until the next timer interrupt is due or the UI posts an input event,
+                // the event is queued ahead of the channel message below
+                Atomics.wait(this.wake, 0, 0, timer);
+                Atomics.store(this.wake, 0, 0);
+                timer = 0;
+            }
+            if (timer > 0 || !this.channel) {
+                setTimeout(() => this.cont(), timer);
+            } else {
+                this.channel.port2.postMessage(null);
+            }
+        }
+        if (this.onSlice) {
+            this.onSlice(status);
         }
     }
+    public get running(): boolean {
+        return this.isRunning;
+    }
+    /**
+     * Instructions executed since the start, or since the snapshot was loaded
+     */
+    public getInstructionCount(): number {
+        if (!this.instance) return 0;
+        return this.invokeWasm('get_time_stamp_counter')(this.cpu) - this.instructionBase;
+    }
+    private updateSlice(status: number, budget: number, executed: number, start: number): void {
+        const now = performance.now();
+        const elapsed = now - start;
+        // only a slice that used up its budget tells how fast the guest runs
+        if (status == 0 && elapsed > 0) {
+            const next = budget * SLICE_TARGET / elapsed;
+            this.slice = Math.max(SLICE_MIN, Math.min(SLICE_MAX, (this.slice + next) / 2)) | 0;
+        }
+        this.perfInstructions += executed;
+        if (now - this.perfStart >= 1000) {
+            this.mips = this.perfInstructions / ((now - this.perfStart) * 1000);
+            this.perfStart = now;
+            this.perfInstructions = 0;
+        }
+    }
+    public showSpeed(): void {
+        this.worker.print(`${this.mips.toFixed(2)} MIPS, ${this.slice} instructions per slice`);
+    }
     public dequeueUART(): void {
         // if (this.uart) {
         //     const cout = this.uart.dequeueTX();
@@ -374,13 +570,208 @@ export class RuntimeEnvironment {
         if (!this.instance) return;
         return this.invokeWasm('disasm')(this.cpu, seg, off, count);
     }
-    public getVramSignature(base: number, size: number): number {
-        if (!this.instance) return 0;
-        return this.invokeWasm('get_vram_signature')(base, size);
+    public showHotPorts(): void {
+        const ports = this.iomgr.getHotPorts(16);
+        if (!ports.length) {
+            this.worker.print('no port I/O');
+            return;
+        }
+        const lines = ports.map(item => `${item.port.toString(16).padStart(4, '0')} ${item.count}`);
+        this.worker.print(lines.join('\n'));
+    }
+    public getVramDirty(): Uint32Array {
+        if (!this.instance) return this.vramDirty;
+        // the view is lost whenever the memory grows
+        if (this.vramDirty.buffer !== this.env.memory.buffer) {
+            this.vramDirty = new Uint32Array(this.env.memory.buffer, this.invokeWasm('get_vram_dirty')(), 48);
+        }
+        return this.vramDirty;
+    }
+    public setVgaPalette(palette: Uint32Array): void {
+        if (!this.instance) return;
+        const frame = this.invokeWasm('get_vga_frame')();
+        new Uint32Array(this.env.memory.buffer, frame, 256).set(palette);
+    }
+    public renderVGA(base: number, width: number, height: number, format: number): Uint8ClampedArray {
+        if (!this.instance) return new Uint8ClampedArray(0);
+        const frame = this.invokeWasm('get_vga_frame')();
+        const count = this.invokeWasm('vga_render')(base, width, height, format);
+        const pixels = new Uint8ClampedArray(this.env.memory.buffer, frame + 0x400, count * 4);
+        // ImageData can not be backed by a shared memory
+        return this.sharedFrame ? pixels.slice() : pixels;
+    }
+    public registerDevice(name: string, device: Snapshottable): void {
+        this.devices[name] = device;
+    }
+    private getSnapshotRegions(): [number, number][] {
+        const layout = new Uint32Array(this.env.memory.buffer, this.invokeWasm('snapshot_get_layout')(this.cpu), 2 + SNAPSHOT_MAX_REGIONS * 2);
+        const result: [number, number][] = [];
+        for (let i = 0; i < layout[1]; i++) {
+            result.push([layout[2 + i * 2], layout[3 + i * 2]]);
+        }
+        return result;
+    }
+    private getDirtyPages(ramSize: number): Uint32Array {
+        return new Uint32Array(this.env.memory.buffer, this.invokeWasm('snapshot_get_dirty_pages')(), (ramSize >> SNAPSHOT_PAGE_SHIFT >> 5) + 1);
+    }
+    private packSnapshot(delta: boolean): ArrayBuffer {
+        if (!this.instance || !this.cpu) throw new Error('CPU not started');
+        const regions = this.getSnapshotRegions();
+        const ram = regions.length - 1;
+        const ramSize = regions[ram][1];
+        const dirty = this.getDirtyPages(ramSize);
+        const pages: number[] = [];
+        if (delta) {
+            for (let i = 0; i < dirty.length; i++) {
+                for (let bits = dirty[i]; bits; bits &= bits - 1) {
+                    const page = (i << 5) + 31 - Math.clz32(bits & -bits);
+                    if ((page << SNAPSHOT_PAGE_SHIFT) < ramSize) {
+                        pages.push(page);
+                    }
+                }
+            }
+        }
+        const states: { [name: string]: DeviceState } = {};
+        for (const name in this.devices) {
+            states[name] = this.devices[name].saveState();
+        }
+        const json = new TextEncoder().encode(JSON.stringify(states));
+        const header = SNAPSHOT_HEADER_SIZE + regions.length * 4;
+        const total = regions.reduce((a, [_, size], i) => a + (delta && i == ram ? pages.length * (4 + SNAPSHOT_PAGE_SIZE) : size), header + json.length);
+        const blob = new ArrayBuffer(total);
+        const view = new DataView(blob);
+        view.setUint32(0, SNAPSHOT_MAGIC, true);
+        view.setUint32(4, SNAPSHOT_VERSION, true);
+        view.setUint32(8, this.chainId, true);
+        view.setUint32(12, this.chainIndex, true);
+        view.setUint32(16, regions.length, true);
+        view.setUint32(20, json.length, true);
+        view.setUint32(24, pages.length, true);
+        let p = header;
+        regions.forEach(([address, size], i) => {
+            view.setUint32(SNAPSHOT_HEADER_SIZE + i * 4, size, true);
+            if (delta && i == ram) {
+                pages.forEach(page => {
+                    view.setUint32(p, page, true);
+                    p += 4;
+                });
+                pages.forEach(page => {
+                    const offset = address + (page << SNAPSHOT_PAGE_SHIFT);
+                    new Uint8Array(blob, p, SNAPSHOT_PAGE_SIZE).set(this._memory.subarray(offset, offset + SNAPSHOT_PAGE_SIZE));
+                    p += SNAPSHOT_PAGE_SIZE;
+                });
+            } else {
+                new Uint8Array(blob, p, size).set(this._memory.subarray(address, address + size));
+                p += size;
+            }
+        });
+        new Uint8Array(blob, p).set(json);
+        // the next checkpoint is taken against this one
+        dirty.fill(0);
+        return blob;
+    }
+    private checkSnapshot(blob: ArrayBuffer, regions: [number, number][], chainId: number, index: number): number {
+        const view = new DataView(blob);
+        if (blob.byteLength < SNAPSHOT_HEADER_SIZE || view.getUint32(0, true) != SNAPSHOT_MAGIC || view.getUint32(4, true) != SNAPSHOT_VERSION) {
+            throw new Error('Unsupported snapshot');
+        }
+        if (view.getUint32(12, true) != index || (index && view.getUint32(8, true) != chainId)) {
+            throw new Error(index ? `Checkpoint ${index} does not follow the snapshot` : 'Not a full snapshot');
+        }
+        if (view.getUint32(16, true) != regions.length
+            || regions.some(([_, size], i) => view.getUint32(SNAPSHOT_HEADER_SIZE + i * 4, true) != size)) {
+            throw new Error('Snapshot does not match the memory size or the CPU');
+        }
+        return view.getUint32(8, true);
+    }
+    private unpackSnapshot(blob: ArrayBuffer, regions: [number, number][], index: number): { [name: string]: DeviceState } {
+        const view = new DataView(blob);
+        const ram = regions.length - 1;
+        const n_pages = view.getUint32(24, true);
+        let p = SNAPSHOT_HEADER_SIZE + regions.length * 4;
+        regions.forEach(([address, size], i) => {
+            if (index && i == ram) {
+                const pages = new Uint32Array(blob.slice(p, p + n_pages * 4));
+                p += n_pages * 4;
+                pages.forEach(page => {
+                    this._memory.set(new Uint8Array(blob, p, SNAPSHOT_PAGE_SIZE), address + (page << SNAPSHOT_PAGE_SHIFT));
+                    p += SNAPSHOT_PAGE_SIZE;
+                });
+            } else {
+                this._memory.set(new Uint8Array(blob, p, size), address);
+                p += size;
+            }
+        });
+        this.chainId = view.getUint32(8, true);
+        this.chainIndex = index;
+        const json = new Uint8Array(blob, p, view.getUint32(20, true));
+        return JSON.parse(new TextDecoder('utf-8').decode(json));
+    }
+    /**
+     * Serialize the CPU, the guest memory and the device registers
+     *
+     * The floppy image is not included, it has to be attached again before the restore.
+     * The snapshot starts a new chain of checkpoints.
+     * @return the snapshot blob
+     */
+    public saveSnapshot(): ArrayBuffer {
+        this.chainId = ((Math.random() * 0xFFFFFFFF) >>> 0) + 1;
+        this.chainIndex = 0;
+        return this.packSnapshot(false);
+    }
+    /**
+     * Serialize the state that has changed since the last snapshot or checkpoint
+     *
+     * Only the 4KB guest pages written since then are stored.
+     * @return the checkpoint blob
+     */
+    public saveCheckpoint(): ArrayBuffer {
+        if (!this.chainId) throw new Error('No snapshot to take a checkpoint from');
+        this.chainIndex++;
+        return this.packSnapshot(true);
+    }
+    /**
+     * Restore a snapshot taken by saveSnapshot on a machine of the same configuration
+     *
+     * Later checkpoints continue the chain from the last one restored.
+     * @param blob the snapshot blob
+     * @param checkpoints the checkpoints of the snapshot to apply in order
+     */
+    public loadSnapshot(blob: ArrayBuffer, checkpoints: ArrayBuffer[] = []): void {
+        if (!this.instance || !this.cpu) throw new Error('CPU not started');
+        const regions = this.getSnapshotRegions();
+        // nothing is overwritten unless the whole chain fits this machine
+        const chainId = this.checkSnapshot(blob, regions, 0, 0);
+        checkpoints.forEach((checkpoint, i) => this.checkSnapshot(checkpoint, regions, chainId, i + 1));
+        let states = this.unpackSnapshot(blob, regions, 0);
+        checkpoints.forEach((checkpoint, i) => {
+            states = this.unpackSnapshot(checkpoint, regions, i + 1);
+        });
+        this.invokeWasm('snapshot_restored')(this.cpu);
+        for (const name in states) {
+            this.devices[name]?.loadState(states[name]);
+        }
+        this.timeOrigin = new Date().valueOf() - this.invokeWasm('pit_get_time')(this.cpu);
+        this.instructionBase = this.invokeWasm('get_time_stamp_counter')(this.cpu);
+        console.log(`Snapshot restored (${checkpoints.length} checkpoints)`);
+    }
+    private get _memory(): Uint8Array {
+        // the view is lost whenever the memory grows, possibly by another machine on the same instance
+        if (this.memoryView.buffer !== this.env.memory.buffer) {
+            this.memoryView = new Uint8Array(this.env.memory.buffer);
+        }
+        return this.memoryView;
     }
     private invokeWasm(name: string): Function {
         const result = this.instance?.exports[name];
         if (typeof result === 'function') {
+            // calls back from the instance go to this machine, and the exports without a CPU context work on it
+            const owner = this.owner;
+            owner.active = this;
+            if (this.cpu && owner.selected != this.cpu) {
+                owner.selected = this.cpu;
+                (this.instance?.exports.machine_select as Function)(this.cpu);
+            }
             return result;
         } else {
             throw new Error(`${name} is not function`);
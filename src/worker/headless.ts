@@ -0,0 +1,54 @@
+// Headless Runner for Node.js
+//
+// node lib/headless.js [options] image
+//   --gen n                   CPU generation (0: 8086 - 4: 486SX, default 4)
+//   --mem kb                  memory size in KB (default 640)
+//   --keys text               type text whenever the guest waits for a key (\n Enter, \t Tab, \b BS, \e ESC)
+//   --keys-file path          same as --keys with the contents of a file
+//   --max-instructions n      give up after n instructions
+//   --snapshot path           resume from a snapshot instead of booting
+//   --save-snapshot path      save a snapshot when the runner exits
+//   --verbose                 print the diagnostics to stderr
+//
+// The text screen is printed to stdout when the runner exits.
+// The exit status is the byte the guest writes to port FC08h, 124 when the instruction limit is reached,
+// or 125 when the CPU shuts down.
+'use strict';
+
+import * as fs from 'fs';
+import * as path from 'path';
+import { EXIT_SHUTDOWN, EXIT_USAGE, createHost, libDir, parseOptions, runJob, toArrayBuffer } from './runner';
+
+const main = async (argv: string[]): Promise<void> => {
+    let saveSnapshot: string | undefined;
+    const args = parseOptions(argv, (arg, value) => {
+        if (arg !== '--save-snapshot' || !value) return -1;
+        saveSnapshot = value;
+        return 1;
+    });
+    if (!args || args.images.length != 1) {
+        process.stderr.write('usage: headless.js [--gen n] [--mem kb] [--keys text] [--keys-file path] [--max-instructions n] [--snapshot path] [--save-snapshot path] [--verbose] image\n');
+        process.exit(EXIT_USAGE);
+        return;
+    }
+    if (!args.verbose) {
+        // the screen is the only output on stdout
+        console.log = () => { };
+    }
+    args.options.saveSnapshot = !!saveSnapshot;
+
+    const lib = libDir();
+    const host = await createHost(toArrayBuffer(fs.readFileSync(path.join(lib, 'vcpu.wasm'))),
+        new Uint8Array(fs.readFileSync(path.join(lib, 'bios.bin'))), args.verbose);
+    const result = await runJob(host, toArrayBuffer(fs.readFileSync(args.images[0])), args.options, args.verbose);
+    process.stdout.write(`${result.screen}\n`);
+    if (saveSnapshot && result.snapshot) {
+        fs.writeFileSync(saveSnapshot, new Uint8Array(result.snapshot));
+    }
+    process.exit(result.status);
+}
+
+main(process.argv.slice(2)).catch(reason => {
+    process.stderr.write(`${reason}\n`);
+    process.exit(EXIT_SHUTDOWN);
+});
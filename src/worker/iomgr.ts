@@ -5,6 +5,12 @@ import { WorkerInterface } from './env';
 type outputHandler = (port: number, data: number) => void;
 type inputHandler = (port: number) => number;
 
+// port types in the dispatch table of vcpu.wasm
+const IO_TYPE_NONE = 0;
+const IO_TYPE_HOST = 1;
+const IO_TYPE_SHADOW = 2;
+const IO_PORTS = 0x10000;
+
 /**
 * I/O Manager
 */
@@ -15,12 +21,79 @@ export class IOManager {
     private iwHandlers: inputHandler[] = [];
     private odHandlers: outputHandler[] = [];
     private idHandlers: inputHandler[] = [];
-    ioRedirectMap: Uint32Array;
+    private _ioRedirectMap: Uint32Array;
     private worker: WorkerInterface;
+    private memory?: WebAssembly.Memory;
+    private mapAddress = 0;
+    private ioTypes = new Uint8Array(0);
+    private ioShadow = new Uint8Array(0);
+    private ioCount = new Uint32Array(0);
+    private shadows: { [port: number]: number } = {};
 
     constructor (worker: WorkerInterface) {
         this.worker = worker;
-        this.ioRedirectMap = new Uint32Array(2048);
+        this._ioRedirectMap = new Uint32Array(2048);
+    }
+    get ioRedirectMap(): Uint32Array {
+        return this._ioRedirectMap;
+    }
+    set ioRedirectMap(map: Uint32Array) {
+        this._ioRedirectMap = map;
+        for (let port = 0; port < IO_PORTS; port++) {
+            if (this.isRedirectRequired(port)) {
+                this.markHost(port);
+            }
+        }
+    }
+    /**
+     * Attach to the dispatch table in vcpu.wasm, only the ports marked there are forwarded to the handlers.
+     */
+    public attach(memory: WebAssembly.Memory, address: number): void {
+        this.memory = memory;
+        this.mapAddress = address;
+        this.ioTypes = new Uint8Array(0);
+        [this.obHandlers, this.ibHandlers, this.owHandlers, this.iwHandlers, this.odHandlers, this.idHandlers].forEach(
+            handlers => handlers.forEach((_, port) => this.markHost(port)));
+        this.ioRedirectMap = this._ioRedirectMap;
+        Object.keys(this.shadows).forEach(port => this.setShadow(+port, this.shadows[+port]));
+    }
+    private getTypes(): Uint8Array {
+        // the views are lost whenever the memory grows
+        if (this.memory && this.ioTypes.buffer !== this.memory.buffer) {
+            const buffer = this.memory.buffer;
+            this.ioTypes = new Uint8Array(buffer, this.mapAddress, IO_PORTS);
+            this.ioShadow = new Uint8Array(buffer, this.mapAddress + IO_PORTS, IO_PORTS);
+            this.ioCount = new Uint32Array(buffer, this.mapAddress + IO_PORTS * 2, IO_PORTS);
+        }
+        return this.ioTypes;
+    }
+    private markHost(port: number): void {
+        const types = this.getTypes();
+        if (types.length && types[port & 0xFFFF] == IO_TYPE_NONE) {
+            types[port & 0xFFFF] = IO_TYPE_HOST;
+        }
+    }
+    /**
+     * Publish the value of a status port so that byte reads are served without calling the handler.
+     */
+    public setShadow(port: number, value: number): void {
+        this.shadows[port] = value;
+        const types = this.getTypes();
+        if (types.length && types[port] <= IO_TYPE_SHADOW) {
+            types[port] = IO_TYPE_SHADOW;
+            this.ioShadow[port] = value;
+        }
+    }
+    /**
+     * Get the most accessed ports.
+     */
+    public getHotPorts(max: number): { port: number, count: number }[] {
+        this.getTypes();
+        const result: { port: number, count: number }[] = [];
+        this.ioCount.forEach((count, port) => {
+            if (count) result.push({ port: port, count: count });
+        });
+        return result.sort((a, b) => b.count - a.count).slice(0, max);
     }
     private setHandler(array: any|undefined[], index: number, value?: any) {
         if (value) {
@@ -28,6 +101,7 @@ export class IOManager {
                 throw new Error(`iomgr: The I/O handler at port 0x${index.toString(16)} is already set`);
             } else {
                 array[index & 0xFFFF] = value;
+                this.markHost(index);
             }
         }
     }
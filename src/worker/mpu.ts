@@ -1,8 +1,8 @@
 // Virtual MPU-401 Midi UART Device
 
-import { RuntimeEnvironment } from './env';
+import { RuntimeEnvironment, Snapshottable, DeviceState } from './env';
 
-export class MPU401 {
+export class MPU401 implements Snapshottable {
     private lastStatus: number | null;
     private outputBuffer: number[] = [];
     private inputBuffer: number[] = [];
@@ -10,6 +10,7 @@ export class MPU401 {
 
     constructor (env: RuntimeEnvironment, base: number) {
         this.env = env;
+        env.registerDevice('mpu', this);
 
         env.iomgr.on(base, (_, data) => this.uartOut(data), (_) => this.inputBuffer.shift() || 0);
         env.iomgr.on(base + 1, (_, data) => {
@@ -26,6 +27,14 @@ export class MPU401 {
             }
         }, (_) => (this.inputBuffer.length > 0) ? 0 : 0x80);
     }
+    saveState(): DeviceState {
+        return { lastStatus: this.lastStatus, outputBuffer: this.outputBuffer.slice(), inputBuffer: this.inputBuffer.slice() };
+    }
+    loadState(state: DeviceState): void {
+        this.lastStatus = state.lastStatus;
+        this.outputBuffer = state.outputBuffer.slice();
+        this.inputBuffer = state.inputBuffer.slice();
+    }
     uartOut (data: number): void {
         const isStatus = ((data & 0x80) != 0);
         if (isStatus) {
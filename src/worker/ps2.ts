@@ -1,6 +1,6 @@
 // Virtual PS/2
 
-import { WorkerInterface, RuntimeEnvironment } from './env';
+import { WorkerInterface, RuntimeEnvironment, Snapshottable, DeviceState } from './env';
 // import { IOManager } from './iomgr';
 
 const IRQ_KEY = 1;
@@ -126,7 +126,7 @@ class Buttons {
     }
 }
 
-export class PS2 {
+export class PS2 implements Snapshottable {
     private env: RuntimeEnvironment;
     private lastCmd: number = 0;
     private iram: Uint8Array;
@@ -143,22 +143,48 @@ export class PS2 {
 
         env.iomgr.on(0x0060, (_, data) => this.data(data), (_): number => {
             if (this.k_fifo.length) {
-                return this.k_fifo.shift() || 0;
+                const data = this.k_fifo.shift() || 0;
+                this.updateStatus();
+                return data;
             } else if (this.m_fifo.length) {
                 return this.m_fifo.shift() || 0;
             } else {
                 return 0;
             }
         });
-        env.iomgr.on(0x0064, (_, data) => this.command(data), (_) => {
-            return ((this.k_fifo.length > 0) ? 1 : 0)
+        // the status byte is served by vcpu.wasm
+        env.iomgr.on(0x0064, (_, data) => this.command(data));
+        env.iomgr.onw(0x64, undefined, (_) => {
+            const data = this.k_fifo.shift() || 0;
+            this.updateStatus();
+            return data;
         });
-        env.iomgr.onw(0x64, undefined, (_) => this.k_fifo.shift() || 0);
+        this.updateStatus();
+        env.registerDevice('ps2', this);
 
         env.worker.bind('key', (args) => this.onKey(args.data));
         env.worker.bind('pointer', (args) => this.onPointer(args.move, args.button, args.pressed));
 
     }
+    public saveState(): DeviceState {
+        return {
+            lastCmd: this.lastCmd, iram: Array.from(this.iram),
+            k_fifo: this.k_fifo.slice(), m_fifo: this.m_fifo.slice(), i_fifo: this.i_fifo.slice(),
+            buttons: [this.buttons.L, this.buttons.R, this.buttons.M],
+            keyboard: this.isKeyboardEnabled, mouse: this.isMouseEnabled,
+        };
+    }
+    public loadState(state: DeviceState): void {
+        this.lastCmd = state.lastCmd;
+        this.iram.set(state.iram);
+        this.k_fifo = state.k_fifo.slice();
+        this.m_fifo = state.m_fifo.slice();
+        this.i_fifo = state.i_fifo.slice();
+        [this.buttons.L, this.buttons.R, this.buttons.M] = state.buttons;
+        this.isKeyboardEnabled = state.keyboard;
+        this.isMouseEnabled = state.mouse;
+        this.updateStatus();
+    }
     private command(data: number): void {
         // console.log(`ps2: command ${data.toString(16)}`);
         if (data >= 0x20 && data <= 0x3F) {
@@ -229,6 +255,7 @@ export class PS2 {
                         case 0xFF:
                             this.env.pic.clearPendingIRQ(IRQ_KEY);
                             this.k_fifo = [];
+                            this.updateStatus();
                             this.isKeyboardEnabled = false;
                             this.postKeyData(0xAA);
                             break;
@@ -237,8 +264,12 @@ export class PS2 {
         }
         this.lastCmd = 0;
     }
+    private updateStatus(): void {
+        this.env.iomgr.setShadow(0x64, (this.k_fifo.length > 0) ? 1 : 0);
+    }
     private postKeyData(data: number): void {
         this.k_fifo.push(data);
+        this.updateStatus();
         this.env.pic.raiseIRQ(IRQ_KEY);
     }
     private setMouseEnabled(enabled: boolean): void {
@@ -0,0 +1,276 @@
+// Headless Machine for Node.js
+'use strict';
+
+import * as fs from 'fs';
+import * as path from 'path';
+import { RuntimeEnvironment, WorkerInterface, WorkerMessageHandler } from './env';
+import { PS2 } from './ps2';
+import { VFD } from './vfd';
+
+const VPC_EXIT_PORT = 0xFC08;
+const STATUS_PAUSE = 2;
+const STATUS_HALT = 0x1000;
+export const EXIT_USAGE = 2;
+export const EXIT_TIMEOUT = 124;
+export const EXIT_SHUTDOWN = 125;
+
+// BIOS data area
+const BDA_VIDEO_COLS = 0x44A;
+const BDA_VIDEO_PAGE_OFFSET = 0x44E;
+const BDA_KBD_BUFF_HEAD = 0x41A;
+const BDA_VIDEO_ROWS = 0x484;
+const TEXT_VRAM = 0xB8000;
+
+const punctuation: { [key: string]: string } = {
+    '-': 'Minus', '_': 'Minus', '=': 'Equal', '+': 'Equal',
+    '[': 'BracketLeft', '{': 'BracketLeft', ']': 'BracketRight', '}': 'BracketRight',
+    ';': 'Semicolon', ':': 'Semicolon', '\'': 'Quote', '"': 'Quote', '`': 'Backquote', '~': 'Backquote',
+    '\\': 'Backslash', '|': 'Backslash', ',': 'Comma', '<': 'Comma', '.': 'Period', '>': 'Period',
+    '/': 'Slash', '?': 'Slash', ' ': 'Space',
+    '!': 'Digit1', '@': 'Digit2', '#': 'Digit3', '$': 'Digit4', '%': 'Digit5',
+    '^': 'Digit6', '&': 'Digit7', '*': 'Digit8', '(': 'Digit9', ')': 'Digit0',
+};
+
+const controls: { [key: string]: [string, number] } = {
+    '\n': ['Enter', 0x0D], '\t': ['Tab', 0x09], '\b': ['Backspace', 0x08], '\x1b': ['Escape', 0x1B],
+};
+
+export interface JobOptions {
+    gen: number;
+    mem: number;
+    // typed whenever the guest waits for a key
+    keys: string;
+    maxInstructions: number;
+    // resume from it instead of booting
+    snapshot?: ArrayBuffer;
+    saveSnapshot?: boolean;
+}
+
+export interface JobResult {
+    status: number;
+    screen: string;
+    instructions: number;
+    snapshot?: ArrayBuffer;
+}
+
+export class HeadlessWorker implements WorkerInterface {
+    public verbose = false;
+    private dispatchTable: { [key: string]: WorkerMessageHandler } = {};
+
+    print(s: string): void {
+        if (this.verbose) {
+            process.stderr.write(`${s}\n`);
+        }
+    }
+    postCommand(cmd: string, data: any): void {
+        if (cmd === 'alert') {
+            process.stderr.write(`${data}\n`);
+        }
+    }
+    hasClass(className: string): boolean {
+        return (typeof (globalThis as any)[className] === 'function');
+    }
+    bind(command: string, handler: WorkerMessageHandler): void {
+        if (this.dispatchTable[command]) {
+            throw new Error(`bind: Conflict dispatch table for ${command}`);
+        } else {
+            this.dispatchTable[command] = handler;
+        }
+    }
+    dispatch(command: string, args: { [key: string]: any }): void {
+        const handler = this.dispatchTable[command];
+        if (handler) {
+            handler(args);
+        }
+    }
+}
+
+/**
+ * A keyboard event as the UI would post it for a character
+ */
+const keyEvents = (ch: string): { [key: string]: any }[] => {
+    let key = ch, code = '', keyCode = 0;
+    const control = controls[ch];
+    if (control) {
+        [code, keyCode] = control;
+        key = code;
+    } else if (ch.match(/^[A-Za-z]$/)) {
+        code = `Key${ch.toUpperCase()}`;
+        keyCode = ch.toUpperCase().charCodeAt(0);
+    } else if (ch.match(/^[0-9]$/)) {
+        code = `Digit${ch}`;
+        keyCode = ch.charCodeAt(0);
+    } else {
+        code = punctuation[ch] || '';
+    }
+    return ['keydown', 'keyup'].map(type => ({ type: type, key: key, code: code, keyCode: keyCode, ctrlKey: false, altKey: false }));
+}
+
+const unescape = (s: string): string => s.replace(/\\(.)/g, (_, c: string) => {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'b': return '\b';
+        case 'e': return '\x1b';
+        default: return c;
+    }
+});
+
+export const toArrayBuffer = (buffer: Buffer): ArrayBuffer => buffer.buffer.slice(buffer.byteOffset, buffer.byteOffset + buffer.length) as ArrayBuffer;
+
+/**
+ * Directory of vcpu.wasm and bios.bin, next to the bundled runner
+ */
+export const libDir = (): string => path.dirname(fs.realpathSync(process.argv[1]));
+
+/**
+ * Parse the options shared by the runners
+ * @param argv command line without node and the script
+ * @param extra handler of the options of a runner, returns the number of values it took or -1 if unknown
+ * @return job options, verbose flag and image paths, undefined on a usage error
+ */
+export const parseOptions = (argv: string[], extra: (arg: string, value: string | undefined) => number = () => -1): { options: JobOptions, verbose: boolean, images: string[] } | undefined => {
+    const options: JobOptions = { gen: 4, mem: 640, keys: '', maxInstructions: Infinity };
+    let verbose = false;
+    const images: string[] = [];
+    for (let i = 0; i < argv.length; i++) {
+        const arg = argv[i];
+        switch (arg) {
+            case '--gen':
+                options.gen = parseInt(argv[++i]);
+                break;
+            case '--mem':
+                options.mem = parseInt(argv[++i]);
+                break;
+            case '--keys':
+                options.keys += unescape(argv[++i] || '');
+                break;
+            case '--keys-file':
+                options.keys += fs.readFileSync(argv[++i], 'utf-8');
+                break;
+            case '--max-instructions':
+                options.maxInstructions = parseFloat(argv[++i]);
+                break;
+            case '--snapshot':
+                options.snapshot = toArrayBuffer(fs.readFileSync(argv[++i]));
+                break;
+            case '--verbose':
+                verbose = true;
+                break;
+            default:
+                if (arg.startsWith('--')) {
+                    const taken = extra(arg, argv[i + 1]);
+                    if (taken < 0) {
+                        process.stderr.write(`unexpected argument: ${arg}\n`);
+                        return undefined;
+                    }
+                    i += taken;
+                } else {
+                    images.push(arg);
+                }
+        }
+    }
+    if (!(options.gen >= 0 && options.gen <= 4) || !(options.mem > 0)) return undefined;
+    return { options: options, verbose: verbose, images: images };
+}
+
+/**
+ * Text mode screen of the active page
+ */
+export const readScreen = (env: RuntimeEnvironment): string => {
+    const bda = env.dmaRead(0x400, 0x100);
+    const cols = (bda[BDA_VIDEO_COLS & 0xFF] | (bda[(BDA_VIDEO_COLS & 0xFF) + 1] << 8)) || 80;
+    const rows = (bda[BDA_VIDEO_ROWS & 0xFF] + 1) || 25;
+    const offset = bda[BDA_VIDEO_PAGE_OFFSET & 0xFF] | (bda[(BDA_VIDEO_PAGE_OFFSET & 0xFF) + 1] << 8);
+    const vram = env.dmaRead(TEXT_VRAM + offset, cols * rows * 2);
+    const lines: string[] = [];
+    for (let y = 0; y < rows; y++) {
+        let line = '';
+        for (let x = 0; x < cols; x++) {
+            const c = vram[(y * cols + x) * 2];
+            line += (c >= 0x20 && c < 0x7F) ? String.fromCharCode(c) : (c == 0 || c == 0xFF) ? ' ' : '.';
+        }
+        lines.push(line.replace(/\s+$/, ''));
+    }
+    while (lines.length && !lines[lines.length - 1]) {
+        lines.pop();
+    }
+    return lines.join('\n');
+}
+
+/**
+ * Load vcpu.wasm and the BIOS for the machines of a thread
+ * @param source the binary, or a module compiled by another thread
+ */
+export const createHost = async (source: ArrayBuffer | WebAssembly.Module, bios: Uint8Array, verbose: boolean = false): Promise<RuntimeEnvironment> => {
+    const worker = new HeadlessWorker();
+    worker.verbose = verbose;
+    const host = new RuntimeEnvironment(worker);
+    host.headless = true;
+    host.loadCPU(await host.instantiate(source));
+    host.loadBIOS(bios);
+    // the host only owns the instance, the jobs bring their own schedulers
+    host.dispose();
+    return host;
+}
+
+/**
+ * Run a floppy image on a machine of its own until the guest exits, the CPU shuts down or the limit is reached
+ *
+ * The machine is destroyed afterwards, so that the next job of the same size reuses its memory.
+ * @param host environment from createHost
+ * @param image floppy image
+ * @return exit status, text screen and instruction count of the job
+ */
+export const runJob = (host: RuntimeEnvironment, image: ArrayBuffer, options: JobOptions, verbose: boolean = false): Promise<JobResult> => new Promise(resolve => {
+    const worker = new HeadlessWorker();
+    worker.verbose = verbose;
+    const env = new RuntimeEnvironment(worker);
+    env.headless = true;
+    env.shareInstance(host);
+    new PS2(env);
+    const floppy = new VFD(env);
+
+    // the slice of the OUT runs to its end before the machine goes away
+    let exitStatus: number | undefined;
+    env.iomgr.on(VPC_EXIT_PORT, (_, data) => {
+        if (exitStatus === undefined) {
+            exitStatus = data;
+        }
+    });
+    const finish = (status: number): void => {
+        const result: JobResult = { status: status, screen: readScreen(env), instructions: env.getInstructionCount() };
+        if (options.saveSnapshot) {
+            result.snapshot = env.saveSnapshot();
+        }
+        env.dispose();
+        resolve(result);
+    };
+
+    floppy.attachImage(image);
+    env.initMemory(options.mem);
+    env.instructionLimit = options.maxInstructions;
+    let typed = 0;
+    env.onSlice = (status) => {
+        if (exitStatus !== undefined) {
+            finish(exitStatus);
+        } else if (!env.running) {
+            finish(EXIT_SHUTDOWN);
+        } else if (env.getInstructionCount() >= options.maxInstructions) {
+            finish(EXIT_TIMEOUT);
+        } else if (typed < options.keys.length && (status == STATUS_HALT || status == STATUS_PAUSE)) {
+            // the guest is idle, type the next key once the BIOS has handed out the previous ones
+            const head = env.dmaRead(BDA_KBD_BUFF_HEAD, 4);
+            if (head[0] == head[2] && head[1] == head[3]) {
+                keyEvents(options.keys[typed++]).forEach(e => worker.dispatch('key', { data: e }));
+            }
+        }
+    };
+    try {
+        env.start(options.gen, false, options.snapshot);
+    } catch (e) {
+        // the snapshot does not fit this machine
+        env.dispose();
+        throw e;
+    }
+});
@@ -1,6 +1,6 @@
 // Virtual Floppy
 
-import { RuntimeEnvironment } from './env';
+import { RuntimeEnvironment, Snapshottable, DeviceState } from './env';
 // import { IOManager } from './iomgr';
 
 const STATUS_NOT_READY      = 0x80;
@@ -21,7 +21,7 @@ const STATUS_DISK_CHANGED   = 6;
  * base + 8 BYTE sector
  * base + 9 BYTE cylinder
  */
-export class VFD {
+export class VFD implements Snapshottable {
     private image: Uint8Array;
     private env: RuntimeEnvironment;
     private status: number;
@@ -69,6 +69,8 @@ export class VFD {
         env.iomgr.on(base + 8, (_, data) => this.SEC = data, (_) => this.SEC);
         env.iomgr.on(base + 9, (_, data) => this.CYL = data, (_) => this.CYL);
 
+        env.registerDevice('vfd', this);
+
         env.worker.bind('attach', (args) => {
             try {
                 this.attachImage(args.blob);
@@ -78,6 +80,17 @@ export class VFD {
         });
 
     }
+    public saveState(): DeviceState {
+        return { status: this.status, CNT: this.CNT, CYL: this.CYL, SEC: this.SEC, HEAD: this.HEAD, PTR: Array.from(this.PTR) };
+    }
+    public loadState(state: DeviceState): void {
+        this.status = state.status;
+        this.CNT = state.CNT;
+        this.CYL = state.CYL;
+        this.SEC = state.SEC;
+        this.HEAD = state.HEAD;
+        this.PTR.set(state.PTR);
+    }
     private readSectors(): number {
         if (this.maxLBA == 0) return STATUS_NOT_READY;
         if (this.status == STATUS_DISK_CHANGED) return STATUS_DISK_CHANGED;
@@ -1,6 +1,6 @@
 // Virtual Graphics Adaptor
 
-import { WorkerInterface, RuntimeEnvironment } from './env';
+import { WorkerInterface, RuntimeEnvironment, Snapshottable, DeviceState } from './env';
 // import { IOManager } from './iomgr';
 
 const actualFPS = 10;
@@ -10,10 +10,17 @@ const GRAPHICS_MODE = 0x01;
 const CGA_MODE = 0x02;
 const SEGMENT_A000 = 0xA0000;
 const SEGMENT_B800 = 0xB8000;
+// vcpu.wasm tracks writes from A0000h in 256 byte spans
+const VRAM_SPAN_SHIFT = 8;
+// vga_format_t of vga_render
+const VGA_FORMAT_8BPP = 0;
+const VGA_FORMAT_1BPP = 1;
+const VGA_FORMAT_CGA = 2;
 
 type Size = [number, number];
+type VramSpan = [number, Uint8Array];
 
-export class VGA {
+export class VGA implements Snapshottable {
 
     private timer: NodeJS.Timeout | undefined;
     private pal_u32: Uint32Array;
@@ -28,10 +35,19 @@ export class VGA {
 
     private vram_base: number = 0;
     private vram_size: number = 0;
-    private vram_sign: number = 0;
-    private vtrace_time = 0;
-    private vtrace = false;
-    private vtrace_toggle = 0;
+    private vram_full: boolean = true;
+    private pal_dirty: boolean = true;
+    // range of palette entries changed since the last frame
+    private pal_first: number = 256;
+    private pal_last: number = -1;
+
+    // graphics modes are painted here when the UI hands over an OffscreenCanvas
+    private canvas?: OffscreenCanvas;
+    private canvasContext?: OffscreenCanvasRenderingContext2D;
+    private dim: Size = [0, 0];
+    private format: number = -1;
+    // arguments of the last setMode, replayed on restore
+    private mode?: [Size, number, number, Size | undefined];
 
     constructor (env: RuntimeEnvironment) {
         this.env = env;
@@ -51,9 +67,7 @@ export class VGA {
         env.iomgr.on(0x3D5, (_, data) => this.crtcDataWrite(this.crtcIndex, data),
             (_) => this.crtcData[this.crtcIndex]);
 
-        // Vtrace
-        env.iomgr.on(0x3BA, undefined, (_) => this.readVtrace());
-        env.iomgr.on(0x3DA, undefined, (_) => this.readVtrace());
+        // Vtrace (3BAh/3DAh) is timed by vcpu.wasm
 
         // Attribute Controller Registers
         env.iomgr.on(0x3C0, (_, data) => this.attrIndex = data, (_) => this.attrIndex);
@@ -76,7 +90,10 @@ export class VGA {
             pal_index++;
             if ((pal_index & 3) == 3) {
                 const color_index = pal_index >> 2;
-                this.env.worker.postCommand('pal', [color_index, this.pal_u32[color_index]]);
+                // sent to the UI with the next frame
+                this.pal_first = Math.min(this.pal_first, color_index);
+                this.pal_last = Math.max(this.pal_last, color_index);
+                this.pal_dirty = true;
                 pal_index++;
             }
             this.pal_index = pal_index & 0x3FF;
@@ -93,16 +110,34 @@ export class VGA {
 
         env.iomgr.onw(0xFC04, (_, data) => this.setVGAMode(data));
 
+        env.worker.bind('vga_canvas', (args) => this.attachCanvas(args.canvas));
+        env.registerDevice('vga', this);
+
     }
-    readVtrace(): number {
-        this.vtrace_toggle ^= 0x01;
-        if (this.vtrace) {
-            if (new Date().valueOf() - this.vtrace_time > 0) {
-                this.vtrace = false;
-            }
-            return 0x08 | this.vtrace_toggle;
-        } else {
-            return this.vtrace_toggle;
+    saveState(): DeviceState {
+        return {
+            crtcIndex: this.crtcIndex, crtcData: Array.from(this.crtcData),
+            attrIndex: this.attrIndex, attrData: Array.from(this.attrData),
+            pal: Array.from(this.pal_u32), pal_index: this.pal_index, pal_read_index: this.pal_read_index,
+            vram_base: this.vram_base, vram_size: this.vram_size, mode: this.mode,
+        };
+    }
+    loadState(state: DeviceState): void {
+        this.crtcIndex = state.crtcIndex;
+        this.crtcData.set(state.crtcData);
+        this.attrIndex = state.attrIndex;
+        this.attrData.set(state.attrData);
+        this.pal_u32.set(state.pal);
+        this.pal_index = state.pal_index;
+        this.pal_read_index = state.pal_read_index;
+        this.vram_base = state.vram_base;
+        this.vram_size = state.vram_size;
+        this.pal_first = 0;
+        this.pal_last = 255;
+        this.pal_dirty = true;
+        if (state.mode) {
+            const [dim, bpp, mode, vdim] = state.mode;
+            this.setMode(dim, bpp, mode, vdim);
         }
     }
     crtcDataWrite(index: number, data: number): void {
@@ -170,9 +205,39 @@ export class VGA {
         // console.log('cursor', cursor_sl, cursor_sh, (cursor % 160) / 2, (cursor / 160) | 0);
         this.env.worker.postCommand('vga_cursor', cursor);
     }
+    attachCanvas(canvas: OffscreenCanvas): void {
+        const context = canvas.getContext('2d');
+        if (!context) return;
+        this.canvas = canvas;
+        this.canvasContext = context;
+        this.resizeCanvas();
+    }
+    isOffscreen(): boolean {
+        return this.canvasContext !== undefined && this.format >= 0;
+    }
+    resizeCanvas(): void {
+        if (this.canvas && this.isOffscreen()) {
+            this.canvas.width = this.dim[0];
+            this.canvas.height = this.dim[1];
+            this.vram_full = true;
+        }
+    }
     setMode(dim: Size, bpp: number, mode: number, vdim?: Size): void {
         this.clearTimer();
-        this.env.worker.postCommand('vga_mode', { dim: dim, vdim: vdim ? vdim : dim, bpp: bpp, mode: mode});
+        this.mode = [dim, bpp, mode, vdim];
+        this.vram_full = true;
+        this.dim = dim;
+        if (!mode) {
+            this.format = -1;
+        } else if (bpp == 8) {
+            this.format = VGA_FORMAT_8BPP;
+        } else {
+            this.format = (mode & CGA_MODE) ? VGA_FORMAT_CGA : VGA_FORMAT_1BPP;
+        }
+        this.resizeCanvas();
+        const offscreen = this.isOffscreen();
+        this.env.worker.postCommand('vga_mode', { dim: dim, vdim: vdim ? vdim : dim, bpp: bpp, mode: mode, offscreen: offscreen,
+            shared: offscreen ? undefined : this.env.getSharedVram(this.vram_base, this.vram_size) });
         this.timer = setInterval(() => this.transferVGA(), vtInterval);
     }
     clearTimer(): void {
@@ -182,14 +247,72 @@ export class VGA {
         }
     }
     transferVGA(): void {
-        this.vtrace_time = new Date().valueOf();
-        this.vtrace = true;
         this.updateCursor();
-        const sign: number = this.env.getVramSignature(this.vram_base, this.vram_size);
-        if (this.vram_sign != sign) {
-            this.vram_sign = sign;
-            const vram = this.env.dmaRead(this.vram_base, this.vram_size);
-            this.env.worker.postCommand('vga', vram);
+        const dirty = this.env.getVramDirty();
+        const base = this.vram_base - SEGMENT_A000;
+        const first = base >> VRAM_SPAN_SHIFT;
+        const last = (base + this.vram_size - 1) >> VRAM_SPAN_SHIFT;
+        const frame = this.env.sharedFrame;
+        const offscreen = this.isOffscreen();
+        const spans: VramSpan[] = [];
+        let start = -1;
+        for (let i = first; i <= last + 1; i++) {
+            const isDirty = i <= last && (this.vram_full || (dirty[i >> 5] & (1 << (i & 31))) != 0);
+            if (isDirty && start < 0) {
+                start = i;
+                if (frame || offscreen) break;
+            } else if (!isDirty && start >= 0) {
+                // adjacent dirty spans are sent as one run
+                const offset = (start << VRAM_SPAN_SHIFT) - base;
+                const end = Math.min((i << VRAM_SPAN_SHIFT) - base, this.vram_size);
+                spans.push([offset, this.env.dmaRead(this.vram_base + offset, end - offset)]);
+                start = -1;
+            }
+        }
+        dirty.fill(0);
+        this.vram_full = false;
+        if (offscreen) {
+            if (start >= 0 || (this.pal_dirty && this.format == VGA_FORMAT_8BPP)) {
+                this.renderOffscreen();
+            }
+            this.takePalette();
+        } else if (frame) {
+            // the UI reads VRAM from the shared memory and only needs to know that it has changed
+            const pal = this.takePalette();
+            if (pal) {
+                this.env.worker.postCommand('pal', pal);
+            }
+            if (start >= 0) {
+                Atomics.add(frame, 1, 1);
+            }
+        } else {
+            const pal = this.takePalette();
+            if (spans.length) {
+                this.env.worker.postCommand('vga', { size: this.vram_size, spans: spans, pal: pal });
+            } else if (pal) {
+                // the UI recolors the VRAM it already has
+                this.env.worker.postCommand('pal', pal);
+            }
+        }
+    }
+    takePalette(): { index: number, colors: Uint32Array } | undefined {
+        if (this.pal_last < this.pal_first) return undefined;
+        const result = { index: this.pal_first, colors: this.pal_u32.slice(this.pal_first, this.pal_last + 1) };
+        this.pal_first = 256;
+        this.pal_last = -1;
+        return result;
+    }
+    renderOffscreen(): void {
+        const context = this.canvasContext;
+        if (!context) return;
+        const [width, height] = this.dim;
+        if (this.pal_dirty) {
+            this.env.setVgaPalette(this.pal_u32);
+            this.pal_dirty = false;
+        }
+        const pixels = this.env.renderVGA(this.vram_base, width, height, this.format);
+        if (pixels.length == width * height * 4) {
+            context.putImageData(new ImageData(pixels, width, height), 0, 0);
         }
     }
 }
@@ -21,7 +21,10 @@ class WI implements WorkerInterface {
             if (args.midi) {
                 (self as any).midi = new MPU401(env, 0x330);
             }
-            setTimeout(() => env.start(args.gen, args.br_mbr), 100);
+            setTimeout(() => {
+                // a snapshot skips the POST and the boot
+                env.start(args.gen, args.br_mbr, args.snapshot, args.checkpoints);
+            }, 100);
         });
 
         (async function() {
@@ -31,8 +34,8 @@ class WI implements WorkerInterface {
                     if (!res.ok) { throw Error(res.statusText); }
                     return res.arrayBuffer()
                 })
-                .then(buffer => WebAssembly.instantiate(buffer, env as any))
-                .then(wasm => env.loadCPU(wasm.instance))
+                .then(buffer => env.instantiate(buffer))
+                .then(instance => env.loadCPU(instance))
             
             console.log('Loading BIOS...');
             await fetch('./bios.bin')
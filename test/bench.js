@@ -0,0 +1,78 @@
+'use strict';
+
+// Interpreter throughput: node test/bench.js [seconds per generation] [vcpu.wasm...]
+//
+// With several builds the first one is compared against the others,
+// make bench compares lib/vcpu.wasm against the last build that dispatched opcodes through a switch.
+
+const fs = require('fs');
+const MinimalRuntimeEnvironment = require('./mre');
+
+const SLICE = 0x100000;
+const seconds = parseFloat(process.argv[2]) || 1;
+const paths = process.argv.length > 3 ? process.argv.slice(3) : ['./lib/vcpu.wasm'];
+
+const bench = (env, gen) => {
+    env.reset(gen);
+    env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+    env.emit(0x1000, [
+        0xB9, 0x00, 0x00, // MOV CX, 0
+        0x8B, 0x07, // MOV AX, [BX]
+        0x01, 0xC8, // ADD AX, CX
+        0x31, 0xC2, // XOR DX, AX
+        0x43, // INC BX
+        0x81, 0xE3, 0xFF, 0x0F, // AND BX, 0FFFh
+        0x83, 0xFA, 0x05, // CMP DX, 5
+        0x74, 0x01, // JZ $+3
+        0x90, // NOP
+        0xE2, 0xED, // LOOP 1003
+        0xEB, 0xE8, // JMP 1000
+    ]);
+    const run = env.wasm.exports.run;
+    const tsc = env.wasm.exports.get_time_stamp_counter;
+    const fusedCount = env.wasm.exports.debug_get_fused_count;
+    let fused = 0;
+    const base = tsc(env.vcpu);
+    const start = process.hrtime.bigint();
+    const limit = start + BigInt(Math.round(seconds * 1e9));
+    let now = start;
+    while (now < limit) {
+        const status = run(env.vcpu, SLICE);
+        if (status) {
+            throw new Error(`Unexpected status ${status.toString(16)}`);
+        }
+        if (fusedCount) {
+            fused += fusedCount(env.vcpu);
+        }
+        now = process.hrtime.bigint();
+    }
+    // a slice may end before SLICE instructions
+    const count = tsc(env.vcpu) - base;
+    const elapsed = Number(now - start) / 1e9;
+    return [count / elapsed, fusedCount ? `${(fused / count * 100).toFixed(1).padStart(5)}% fused` : ''];
+}
+
+const load = async (path) => {
+    const env = new MinimalRuntimeEnvironment();
+    // imported by the builds before the PIC moved into vcpu.wasm
+    env.env.vpc_irq = () => 0;
+    await env.instantiate(fs.readFileSync(path), 1, 0);
+    return env;
+}
+
+Promise.all(paths.map(load))
+    .then(envs => {
+        if (envs.length > 1) {
+            console.log(paths.join(' vs '));
+        }
+        ['8086', '80186', '80286', '80386', '80486'].forEach((name, gen) => {
+            const results = envs.map(env => bench(env, gen));
+            const columns = results.map(([ips, fused]) => `${(ips / 1e6).toFixed(2).padStart(8)} MIPS ${fused.padEnd(11)}`);
+            const ratios = results.slice(1).map(([ips]) => `x${(results[0][0] / ips).toFixed(2)}`);
+            console.log(`${name.padEnd(6)} ${columns.join(' ')} ${ratios.join(' ')}`.trimEnd());
+        });
+    })
+    .catch(reason => {
+        console.error(reason);
+        process.exit(1);
+    });
@@ -921,6 +921,24 @@ describe('CPU', () => {
 
         });
 
+        it('MOV segment edge', () => {
+            env.emitTest([0x66, 0xA1, 0xFC, 0xFF, 0xA1, 0xFE, 0xFF]);
+            env.emit(0xFFFC, [0x78, 0x56, 0x34, 0x12]);
+
+            env.setReg('AX', 0);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF4);
+            expect(env.getReg('AX')).toBe(0x12345678);
+            expect(env.changed()).toStrictEqual(['AX', 'IP']);
+
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF7);
+            expect(env.getReg('AX')).toBe(0x12341234);
+            expect(env.changed()).toStrictEqual(['AX', 'IP']);
+        });
+
         it('MOVZX/MOVSX', () => {
             env.emitTest([0x66, 0x0F, 0xB7, 0xC3, 0x66, 0x0F, 0xBF, 0xC3]);
 
@@ -941,6 +959,82 @@ describe('CPU', () => {
             expect(env.changed()).toStrictEqual(['AX', 'IP']);
         });
 
+        it('REP MOVS/STOS', () => {
+            env.emitTest([0xF3, 0xAB, 0xF3, 0xA4, 0xF3, 0xA5]);
+            const mem = new Uint8Array(env.env.memory.buffer, env.vmem, 0x3000);
+
+            env.setReg('AX', 0x12340720);
+            env.setReg('CX', 0x12340010);
+            env.setReg('DI', 0x12341000);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF2);
+            expect(env.getReg('CX')).toBe(0x12340000);
+            expect(env.getReg('DI')).toBe(0x12341020);
+            expect(Array.from(mem.slice(0x1000, 0x1004))).toStrictEqual([0x20, 0x07, 0x20, 0x07]);
+            expect(Array.from(mem.slice(0x101C, 0x1020))).toStrictEqual([0x20, 0x07, 0x20, 0x07]);
+            expect(env.changed()).toStrictEqual(['CX', 'DI', 'IP']);
+
+            // overlapping from above repeats the first byte
+            env.setReg('CX', 4);
+            env.setReg('SI', 0x1000);
+            env.setReg('DI', 0x1001);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF4);
+            expect(env.getReg('SI')).toBe(0x1004);
+            expect(env.getReg('DI')).toBe(0x1005);
+            expect(Array.from(mem.slice(0x1000, 0x1006))).toStrictEqual([0x20, 0x20, 0x20, 0x20, 0x20, 0x07]);
+            expect(env.changed()).toStrictEqual(['CX', 'DI', 'IP', 'SI']);
+
+            env.setReg('CX', 8);
+            env.setReg('SI', 0x1000);
+            env.setReg('DI', 0x2000);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF6);
+            expect(env.getReg('SI')).toBe(0x1010);
+            expect(env.getReg('DI')).toBe(0x2010);
+            expect(Array.from(mem.slice(0x2000, 0x2010))).toStrictEqual(Array.from(mem.slice(0x1000, 0x1010)));
+            expect(env.changed()).toStrictEqual(['CX', 'DI', 'IP', 'SI']);
+        });
+
+        it('REP CMPS/SCAS', () => {
+            env.emitTest([0xF3, 0xA6, 0xF2, 0xAE]);
+            const mem = new Uint8Array(env.env.memory.buffer, env.vmem, 0x3000);
+            for (let i = 0; i < 0x40; i++) {
+                mem[0x1000 + i] = 0x41 + i;
+                mem[0x2000 + i] = 0x41 + i;
+            }
+            mem[0x2000 + 37] = 0;
+            mem[0x1000 + 45] = 0;
+
+            // REPE CMPSB stops after the first mismatch
+            env.setReg('CX', 0x40);
+            env.setReg('SI', 0x1000);
+            env.setReg('DI', 0x2000);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF2);
+            expect(env.getReg('CX')).toBe(0x40 - 38);
+            expect(env.getReg('SI')).toBe(0x1000 + 38);
+            expect(env.getReg('DI')).toBe(0x2000 + 38);
+            expect(env.getReg('flags') & 0x08C1).toBe(0x0000);
+            expect(env.changed()).toStrictEqual(['CX', 'DI', 'IP', 'SI', 'flags']);
+
+            // REPNE SCASB stops after the first match
+            env.setReg('AX', 0);
+            env.setReg('CX', 0xFFFF);
+            env.setReg('DI', 0x1000);
+            env.saveState();
+            expect(env.step()).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF4);
+            expect(env.getReg('CX')).toBe(0xFFFF - 46);
+            expect(env.getReg('DI')).toBe(0x1000 + 46);
+            expect(env.getReg('flags') & 0x0040).toBe(0x0040);
+            expect(env.changed()).toStrictEqual(['CX', 'DI', 'IP', 'flags']);
+        });
+
         it('NOT', () => {
             env.emitTest([0xF6, 0xD1, 0xF6, 0xD1, 0xF6, 0xD6, 0xF7, 0xD5, 0x66, 0xF7, 0xD6]);
             env.setReg('CX', 0x123456FF);
@@ -1196,6 +1290,375 @@ describe('CPU', () => {
 
         });
 
+        it('DEC/CMP + Jcc fusion', () => {
+            const run = n => env.wasm.exports.run(env.vcpu, n);
+            const fused = () => env.wasm.exports.debug_get_fused_count(env.vcpu);
+
+            // MOV CX, 5; DEC CX; JNZ $-1; HLT
+            env.emitTest([0xB9, 0x05, 0x00, 0x49, 0x75, 0xFD, 0xF4]);
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('CX')).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF6);
+            expect(fused()).toBe(3);
+
+            // MOV AX, 5; CMP AX, 2; DEC AX; JA $-4; HLT
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xB8, 0x05, 0x00, 0x3D, 0x02, 0x00, 0x48, 0x77, 0xFA, 0xF4]);
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('AX')).toBe(0);
+            expect(env.getReg('IP')).toBe(0xFFF9);
+            expect(fused()).toBe(3);
+        });
+
+        it('Lazy flags', () => {
+            const run = n => env.wasm.exports.run(env.vcpu, n);
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('SP', 0x8000);
+            env.setReg('BX', 0);
+            env.setReg('CX', 0);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xB0, 0xFF, // MOV AL, FFh
+                0x04, 0x01, // ADD AL, 1 (CF ZF)
+                0xFE, 0xC3, // INC BL (CF is kept)
+                0x76, 0x02, // JBE $+4
+                0xB1, 0x01, // MOV CL, 1
+                0x9C, // PUSHF
+                0x5A, // POP DX
+                0x80, 0xD5, 0x00, // ADC CH, 0
+                0xF4,
+            ]);
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('BX')).toBe(1);
+            expect(env.getReg('CX')).toBe(0x0100);
+            expect(env.getReg('DX') & 0x08D5).toBe(0x0001);
+            expect(env.getReg('flags') & 0x08D5).toBe(0);
+        });
+
+        it('Self modifying code', () => {
+            const run = n => env.wasm.exports.run(env.vcpu, n);
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('SP', 0x8000);
+            env.setReg('DX', 0);
+            env.setReg('SI', 0x2000);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x2010, [0x01, 0x00, 0x00, 0x01]);
+            env.emit(0x1000, [
+                0xB9, 0x04, 0x00, // MOV CX, 4
+                0x03, 0x54, 0x10, // ADD DX, [SI+10h]
+                0x83, 0xF9, 0x02, // CMP CX, 2
+                0x75, 0x05, // JNE $+7
+                0xC6, 0x06, 0x05, 0x10, 0x12, // MOV BYTE [1005h], 12h (ADD DX, [SI+12h])
+                0xE2, 0xF1, // LOOP 1003h
+                0xF4,
+            ]);
+            // the third pass runs the cached ADD, a stale displacement would add 1 once more
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('CX')).toBe(0);
+            expect(env.getReg('DX')).toBe(0x0103);
+        });
+
+        it('Table reads beside cached code', () => {
+            const run = n => env.wasm.exports.run(env.vcpu, n);
+            const fused = () => env.wasm.exports.debug_get_fused_count(env.vcpu);
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('SP', 0x8000);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1020, [0x00]);
+            env.emit(0x1000, [
+                0xB9, 0x05, 0x00, // MOV CX, 5
+                0x80, 0x3E, 0x20, 0x10, 0x00, // CMP BYTE [1020h], 0
+                0x75, 0x03, // JNZ $+5
+                0xE2, 0xF7, // LOOP 1003h
+                0xF4,
+            ]);
+            // a read of the same code line must not invalidate the cached loop
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('CX')).toBe(0);
+            expect(fused()).toBe(3);
+        });
+
+        it('PIC', () => {
+            const run = n => env.wasm.exports.run(env.vcpu, n);
+            const lines = new Uint32Array(env.env.memory.buffer, env.wasm.exports.get_irq_lines(), 17);
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('SP', 0x8000);
+            env.setReg('BX', 0);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xB0, 0x11, 0xE6, 0x20, // ICW1
+                0xB0, 0x08, 0xE6, 0x21, // ICW2: vector 08h
+                0xB0, 0x04, 0xE6, 0x21, // ICW3
+                0xB0, 0x01, 0xE6, 0x21, // ICW4
+                0xB0, 0x11, 0xE6, 0xA0, // slave ICW1
+                0xB0, 0x70, 0xE6, 0xA1, // slave ICW2: vector 70h
+                0xB0, 0x02, 0xE6, 0xA1, // slave ICW3: cascaded on IRQ2
+                0xB0, 0x01, 0xE6, 0xA1, // slave ICW4
+                0xB0, 0xFE, 0xE6, 0x21, // unmask IRQ0
+                0xFB, 0xF4, // STI; HLT
+                0xFA, 0xF4, // CLI; HLT
+            ]);
+            env.emit(0x2000, [
+                0x43, // INC BX
+                0xB0, 0x20, 0xE6, 0x20, // EOI
+                0xCF, // IRET
+            ]);
+            env.emit(0x0020, [0x00, 0x20, 0x00, 0x00]); // INT 08h -> 0000:2000
+
+            expect(run(100)).toBe(0x1000);
+            expect(env.getReg('IP')).toBe(0x1026);
+            expect(env.getReg('BX')).toBe(0);
+
+            lines[1] += 2;
+            lines[0] |= 1;
+            expect(run(100)).toBe(0x10001);
+            expect(env.getReg('IP')).toBe(0x1027);
+            expect(env.getReg('BX')).toBe(2);
+            expect(lines[0]).toBe(0);
+            expect(lines[1]).toBe(0);
+        });
+
+        it('PIT', () => {
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xB0, 0x34, 0xE6, 0x43, // counter 0: mode 2
+                0xB0, 0xE8, 0xE6, 0x40, 0xB0, 0x03, 0xE6, 0x40, // 1000
+                0xB0, 0x00, 0xE6, 0x43, // latch
+                0xE4, 0x40, 0x88, 0xC3, 0xE4, 0x40, 0x88, 0xC7, // BX
+                0xB9, 0xF3, 0x00, 0xE2, 0xFE, // 250 instructions after the first latch
+                0xB0, 0x00, 0xE6, 0x43, // latch
+                0xE4, 0x40, 0x88, 0xC2, 0xE4, 0x40, 0x88, 0xC6, // DX
+                0xB0, 0xE2, 0xE6, 0x43, // read-back status
+                0xE4, 0x40, 0x88, 0xC1, // CL
+                0xB0, 0x30, 0xE6, 0x43, // stop counter 0
+                0xB0, 0xFF, 0xE6, 0x21, // mask all IRQs
+                0xF4,
+            ]);
+
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0x10001);
+            expect(env.getReg('BX') & 0xFFFF).toBe(1000);
+            expect(env.getReg('DX') & 0xFFFF).toBe(990);
+            expect(env.getReg('CX') & 0xFF).toBe(0xB4);
+        });
+
+        it('PAUSE', () => {
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xF3, 0x90, 0xF4]); // PAUSE; HLT
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(2);
+            expect(env.getReg('IP')).toBe(0xFFF2);
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0x10001);
+        });
+
+        it('Port I/O', () => {
+            const base = env.wasm.exports.get_io_map();
+            const types = new Uint8Array(env.env.memory.buffer, base, 0x10000);
+            const shadow = new Uint8Array(env.env.memory.buffer, base + 0x10000, 0x10000);
+            const count = new Uint32Array(env.env.memory.buffer, base + 0x20000, 0x10000);
+
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xB0, 0x12, 0xE6, 0x80, // OUT 80h, AL
+                0xE4, 0x80, 0x88, 0xC3, // IN AL, 80h / MOV BL, AL
+                0xE5, 0x80, 0x89, 0xC2, // IN AX, 80h / MOV DX, AX
+                0xE4, 0x64, 0x88, 0xC1, // IN AL, 64h / MOV CL, AL
+                0xF4,
+            ]);
+            types[0x64] = 2;
+            shadow[0x64] = 0x5A;
+            const before = count[0x80];
+
+            const status = env.wasm.exports.run(env.vcpu, 1000);
+            types[0x64] = 0;
+
+            expect(status).toBe(0x10001);
+            expect(env.getReg('BX') & 0xFF).toBe(0xFF);
+            expect(env.getReg('DX') & 0xFFFF).toBe(0xFFFF);
+            expect(env.getReg('CX') & 0xFF).toBe(0x5A);
+            expect(count[0x80] - before).toBe(3);
+        });
+
+        it('VRAM dirty bitmap', () => {
+            const dirty = new Uint32Array(env.env.memory.buffer, env.wasm.exports.get_vram_dirty(), 48);
+
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xB8, 0x00, 0xB8, 0x8E, 0xC0, // MOV ES, B800h
+                0x26, 0xA3, 0xFF, 0x0F, // MOV ES:[0FFFh], AX
+                0xB8, 0x00, 0xA0, 0x8E, 0xC0, // MOV ES, A000h
+                0x31, 0xFF, 0xB9, 0x00, 0x02, // XOR DI, DI / MOV CX, 200h
+                0xF3, 0xAA, // REP STOSB
+                0xF4,
+            ]);
+            dirty.fill(0);
+
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0x10001);
+            const expected = new Uint32Array(48);
+            expected[0] = 0x00000003; // A0000h-A01FFh
+            expected[12] = 0x00018000; // B8F00h-B90FFh
+            expect(Array.from(dirty)).toStrictEqual(Array.from(expected));
+        });
+
+        it('VGA render', () => {
+            const frame = env.wasm.exports.get_vga_frame();
+            const palette = new Uint32Array(env.env.memory.buffer, frame, 256);
+            const pixels = new Uint32Array(env.env.memory.buffer, frame + 0x400, 16);
+            palette[1] = 0xFF0000FF;
+            palette[2] = 0xFF00FF00;
+
+            env.emit(0xA0000, [0x01, 0x02, 0x00, 0x01]);
+            expect(env.wasm.exports.vga_render(0xA0000, 4, 1, 0)).toBe(4);
+            expect(Array.from(pixels.subarray(0, 4))).toStrictEqual([0xFF0000FF, 0xFF00FF00, palette[0], 0xFF0000FF]);
+
+            env.emit(0xA0000, [0xA5, 0x0F]);
+            expect(env.wasm.exports.vga_render(0xA0000, 16, 1, 1)).toBe(16);
+            const mono = Array.from(pixels).map(v => v == 0xFFFFFFFF ? 1 : v == 0xFF000000 ? 0 : -1);
+            expect(mono).toStrictEqual([1, 0, 1, 0, 0, 1, 0, 1, 0, 0, 0, 0, 1, 1, 1, 1]);
+        });
+
+        it('Snapshot', () => {
+            const save = () => {
+                const layout = new Uint32Array(env.env.memory.buffer, env.wasm.exports.snapshot_get_layout(env.vcpu), 12);
+                const regions = [];
+                for (let i = 0; i < layout[1]; i++) {
+                    const address = layout[2 + i * 2];
+                    regions.push([address, new Uint8Array(env.env.memory.buffer, address, layout[3 + i * 2]).slice()]);
+                }
+                return regions;
+            };
+            const restore = (regions) => {
+                regions.forEach(([address, bytes]) => new Uint8Array(env.env.memory.buffer).set(bytes, address));
+                env.wasm.exports.snapshot_restored(env.vcpu);
+            };
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('BX', 0);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x43, // INC BX
+                0x88, 0x1E, 0x00, 0x20, // MOV [2000h], BL
+                0xEB, 0xF9, // JMP 1000
+            ]);
+
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0);
+            const snapshot = save();
+            const bx = env.getReg('BX');
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0);
+            const next = env.getReg('BX');
+            expect(next).not.toBe(bx);
+
+            restore(snapshot);
+            expect(env.getReg('BX')).toBe(bx);
+            expect(new Uint8Array(env.env.memory.buffer, env.vmem + 0x2000, 1)[0]).toBe(bx & 0xFF);
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0);
+            expect(env.getReg('BX')).toBe(next);
+        });
+
+        it('Dirty pages', () => {
+            env.reset(MAIN_CPU_GEN);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0xA3, 0x00, 0x20, // MOV [2000h], AX
+                0xA3, 0xFF, 0x5F, // MOV [5FFFh], AX
+                0xF4,
+            ]);
+            const dirty = new Uint32Array(env.env.memory.buffer, env.wasm.exports.snapshot_get_dirty_pages(), 8);
+            dirty.fill(0);
+
+            expect(env.wasm.exports.run(env.vcpu, 1000)).toBe(0x10001);
+            expect(Array.from(dirty)).toStrictEqual([0x00000064, 0, 0, 0, 0, 0, 0, 0]);
+        });
+
+        it('Checkpoints', async () => {
+            // the snapshot chain lives in the worker runtime, built into tmp/ by make
+            const { RuntimeEnvironment } = require('../tmp/env');
+            const { HeadlessWorker, createHost } = require('../tmp/runner');
+            const host = await createHost(fs.readFileSync(WASM_PATH), new Uint8Array(0x10000).fill(0xF4)); // HLT
+            const rt = new RuntimeEnvironment(new HeadlessWorker());
+            rt.headless = true;
+            rt.shareInstance(host);
+            rt.initMemory(640);
+            rt.start(MAIN_CPU_GEN);
+            const peek = () => [0x2000, 0x3000, 0x4000, 0x5000].map(address => rt.dmaRead(address, 1)[0]);
+
+            rt.dmaWrite(0x2000, [1]);
+            const snapshot = rt.saveSnapshot();
+            rt.dmaWrite(0x3000, [2]);
+            const checkpoint1 = rt.saveCheckpoint();
+            rt.dmaWrite(0x4000, [3]);
+            const checkpoint2 = rt.saveCheckpoint();
+            // a checkpoint carries only the page written since the last one
+            expect(new DataView(checkpoint1).getUint32(24, true)).toBe(1);
+            expect(checkpoint1.byteLength).toBeLessThan(snapshot.byteLength / 10);
+
+            [0x2000, 0x3000, 0x4000, 0x5000].forEach(address => rt.dmaWrite(address, [9]));
+            rt.loadSnapshot(snapshot, [checkpoint1]);
+            expect(peek()).toStrictEqual([1, 2, 0, 0]);
+            rt.loadSnapshot(snapshot, [checkpoint1, checkpoint2]);
+            expect(peek()).toStrictEqual([1, 2, 3, 0]);
+
+            // a broken chain is rejected before anything is overwritten
+            rt.dmaWrite(0x5000, [7]);
+            expect(() => rt.loadSnapshot(snapshot, [checkpoint2])).toThrow();
+            expect(() => rt.loadSnapshot(checkpoint1)).toThrow();
+            const other = rt.saveSnapshot();
+            expect(() => rt.loadSnapshot(other, [checkpoint1])).toThrow();
+            expect(peek()).toStrictEqual([1, 2, 3, 7]);
+            rt.dispose();
+        });
+
+        it('Multiple machines', () => {
+            const exports = env.wasm.exports;
+            const cpu2 = exports.machine_create(1);
+            const mem2 = new Uint8Array(env.env.memory.buffer, exports.machine_get_memory(cpu2), 0x100000);
+            const bx2 = new Uint32Array(env.env.memory.buffer, env.regmap['BX'] - env.vcpu + cpu2, 1);
+            exports.reset(cpu2, MAIN_CPU_GEN);
+            mem2.set([0xEA, 0x00, 0x10, 0x00, 0x00], 0xFFFF0); // JMP 0000:1000
+            mem2.set([
+                0x4B, // DEC BX
+                0x88, 0x1E, 0x00, 0x20, // MOV [2000h], BL
+                0xF4,
+            ], 0x1000);
+
+            env.reset(MAIN_CPU_GEN);
+            env.setReg('BX', 0);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x43, // INC BX
+                0x88, 0x1E, 0x00, 0x20, // MOV [2000h], BL
+                0xF4,
+            ]);
+
+            expect(exports.run(cpu2, 1000)).toBe(0x10001);
+            expect(exports.run(env.vcpu, 1000)).toBe(0x10001);
+            expect(env.getReg('BX')).toBe(1);
+            expect(new Uint8Array(env.env.memory.buffer, env.vmem + 0x2000, 1)[0]).toBe(1);
+            expect(bx2[0]).toBe(0xFFFF);
+            expect(mem2[0x2000]).toBe(0xFF);
+
+            // a destroyed machine is reused with its memory cleared
+            exports.machine_destroy(cpu2);
+            expect(exports.machine_create(1)).toBe(cpu2);
+            expect(mem2[0x2000]).toBe(0);
+
+            // nothing is selected after the selected machine is destroyed, and a second destroy does nothing
+            exports.machine_destroy(cpu2);
+            expect(exports.get_io_map()).toBe(0);
+            exports.machine_destroy(cpu2);
+            expect(exports.machine_create(1)).toBe(cpu2);
+            const cpu3 = exports.machine_create(1);
+            expect(cpu3).not.toBe(cpu2);
+            exports.machine_destroy(cpu3);
+            exports.machine_destroy(cpu2);
+            exports.machine_select(env.vcpu);
+        });
+
     });
 
     describe('Stack Operations', () => {
@@ -1245,6 +1708,301 @@ describe('CPU', () => {
             env.saveState();
 
         });
+
+        it('Paging', () => {
+            const dword = v => [v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >>> 24];
+            // GDT: 08 code16 4G, 10 data32 4G
+            env.emit(0x0800, [
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0x8F, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x92, 0xCF, 0x00,
+            ]);
+            env.emit(0x0900, [0x17, 0x00, ...dword(0x0800)]);
+            // identity map except 00020000 -> 00030000 and 00021000 (not present)
+            env.emit(0x10000, dword(0x11007));
+            for (let i = 0; i < 0x20; i++) {
+                env.emit(0x11000 + i * 4, dword((i << 12) | 7));
+            }
+            env.emit(0x11080, [...dword(0x30007), ...dword(0)]);
+            env.emit(0x30000, dword(0x12345678));
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x0F, 0x01, 0x16, 0x00, 0x09, // LGDT [0900]
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x0C, 0x01, // OR AL, 1
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0xEA, 0x12, 0x10, 0x08, 0x00, // JMP 0008:1012
+                0xB8, 0x10, 0x00, // MOV AX, 0010
+                0x8E, 0xD8, // MOV DS, AX
+                0x66, 0xB8, ...dword(0x10000), // MOV EAX, 00010000
+                0x0F, 0x22, 0xD8, // MOV CR3, EAX
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x66, 0x0D, ...dword(0x80000000), // OR EAX, 80000000
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0x67, 0x66, 0x8B, 0x1D, ...dword(0x20000), // MOV EBX, [00020000]
+                0x67, 0x66, 0xC7, 0x05, ...dword(0x20004), ...dword(0xDEADBEEF), // MOV DWORD [00020004], DEADBEEF
+                0x67, 0x66, 0x8B, 0x15, ...dword(0x20FFE), // MOV EDX, [00020FFE]
+            ]);
+            env.setReg('DX', 0);
+            for (let i = 0; i < 13; i++) {
+                expect(env.step()).toBe(0);
+            }
+            expect(env.getReg('CR0')).toBe(0x80000011);
+            expect(env.getReg('IP')).toBe(0x102C);
+
+            expect(env.step()).toBe(0);
+            expect(env.getReg('BX')).toBe(0x12345678);
+            expect(env.step()).toBe(0);
+            const mem = new Uint32Array(env.env.memory.buffer, env.vmem + 0x30004, 1);
+            expect(mem[0]).toBe(0xDEADBEEF);
+
+            env.saveState();
+            expect(env.step()).toBe(0xE0000);
+            expect(env.getReg('IP')).toBe(0x1040);
+            expect(env.changed()).toStrictEqual([]);
+        });
+
+        it('Segment limits', () => {
+            const dword = v => [v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >>> 24];
+            // GDT: 08 code16 64K, 10 data 00020000-00020FFF, 18 expand-down stack 00031000-0003FFFF, 20 code16 8K
+            env.emit(0x0800, [
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0x00, 0x00,
+                0xFF, 0x0F, 0x00, 0x00, 0x02, 0x92, 0x00, 0x00,
+                0xFF, 0x0F, 0x00, 0x00, 0x03, 0x96, 0x00, 0x00,
+                0xFF, 0x1F, 0x00, 0x00, 0x00, 0x9A, 0x00, 0x00,
+            ]);
+            env.emit(0x0900, [0x27, 0x00, ...dword(0x0800)]);
+            env.emit(0x20FFF, [0x5A]);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x0F, 0x01, 0x16, 0x00, 0x09, // LGDT [0900]
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x0C, 0x01, // OR AL, 1
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0xEA, 0x12, 0x10, 0x08, 0x00, // JMP 0008:1012
+                0xB8, 0x10, 0x00, // MOV AX, 0010
+                0x8E, 0xD8, // MOV DS, AX
+                0xB8, 0x18, 0x00, // MOV AX, 0018
+                0x8E, 0xD0, // MOV SS, AX
+                0xBC, 0x02, 0x10, // MOV SP, 1002
+                0xA0, 0xFF, 0x0F, // MOV AL, [0FFF]
+                0xA1, 0xFF, 0x0F, // MOV AX, [0FFF]
+                0x50, // PUSH AX
+                0x50, // PUSH AX
+                0xEA, 0x00, 0x30, 0x20, 0x00, // JMP 0020:3000
+            ]);
+            for (let i = 0; i < 11; i++) {
+                expect(env.step()).toBeLessThan(0x10000);
+            }
+            expect(env.getReg('IP')).toBe(0x101F);
+            expect(env.getReg('SS')).toBe(0x0018);
+
+            // the last byte of DS can be read, a word across the limit faults before AX changes
+            expect(env.step()).toBe(0);
+            expect(env.getReg('AX')).toBe(0x005A);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.getReg('IP')).toBe(0x1022);
+            expect(env.changed()).toStrictEqual([]);
+
+            // the expand-down stack ends at 1000
+            env.setReg('IP', 0x1025);
+            expect(env.step()).toBe(0);
+            expect(env.getReg('SP')).toBe(0x1000);
+            env.saveState();
+            expect(env.step()).toBe(0xC0000);
+            expect(env.changed()).toStrictEqual([]);
+
+            // a far jump past the limit of the new CS faults at the jump
+            env.setReg('IP', 0x1027);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.changed()).toStrictEqual([]);
+        });
+
+        it('Segment limits of ModRM operands', () => {
+            const dword = v => [v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >>> 24];
+            const mem = new Uint8Array(env.env.memory.buffer, env.vmem, 0x30000);
+            // GDT: 08 code16 64K, 10 data 00020000-00020FFF, 18 read-only data 00020000-00020FFF
+            env.emit(0x0800, [
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0x00, 0x00,
+                0xFF, 0x0F, 0x00, 0x00, 0x02, 0x92, 0x00, 0x00,
+                0xFF, 0x0F, 0x00, 0x00, 0x02, 0x90, 0x00, 0x00,
+            ]);
+            env.emit(0x0900, [0x1F, 0x00, ...dword(0x0800)]);
+            env.emit(0x0FFF, [0x00]);
+            env.emit(0x20FFF, [0x5A, 0x00]);
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x0F, 0x01, 0x16, 0x00, 0x09, // LGDT [0900]
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x0C, 0x01, // OR AL, 1
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0xEA, 0x12, 0x10, 0x08, 0x00, // JMP 0008:1012
+                0xB8, 0x10, 0x00, // MOV AX, 0010
+                0x8E, 0xD8, // MOV DS, AX
+                0xB8, 0x18, 0x00, // MOV AX, 0018
+                0x8E, 0xC0, // MOV ES, AX
+                0xBB, 0xFF, 0x0F, // MOV BX, 0FFF
+                0x8A, 0x07, // MOV AL, [BX]
+                0x8B, 0x07, // MOV AX, [BX]
+                0x00, 0x07, // ADD [BX], AL
+                0x00, 0x47, 0x01, // ADD [BX+1], AL
+                0x2E, 0x88, 0x07, // MOV CS:[BX], AL
+                0x26, 0x00, 0x07, // ADD ES:[BX], AL
+            ]);
+            for (let i = 0; i < 11; i++) {
+                expect(env.step()).toBeLessThan(0x10000);
+            }
+            expect(env.getReg('IP')).toBe(0x101F);
+
+            // the last byte of DS can be read, a word across the limit faults before AX changes
+            expect(env.step()).toBe(0);
+            expect(env.getReg('AX')).toBe(0x005A);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.getReg('IP')).toBe(0x1021);
+            expect(env.changed()).toStrictEqual([]);
+
+            // a byte is stored at the limit, nothing past it
+            env.setReg('IP', 0x1023);
+            expect(env.step()).toBe(0);
+            expect(mem[0x20FFF]).toBe(0xB4);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.changed()).toStrictEqual([]);
+            expect(mem[0x21000]).toBe(0x00);
+
+            // code segments and read-only data segments cannot be written
+            env.setReg('IP', 0x1028);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.changed()).toStrictEqual([]);
+            expect(mem[0x0FFF]).toBe(0x00);
+            env.setReg('IP', 0x102B);
+            env.saveState();
+            expect(env.step()).toBe(0xD0000);
+            expect(env.changed()).toStrictEqual([]);
+            expect(mem[0x20FFF]).toBe(0xB4);
+        });
+
+        it('Segment limits of string scans', () => {
+            const dword = v => [v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >>> 24];
+            // GDT: 08 code16 64K, 10 data 00020000-00020FFF
+            env.emit(0x0800, [
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0x00, 0x00,
+                0xFF, 0x0F, 0x00, 0x00, 0x02, 0x92, 0x00, 0x00,
+            ]);
+            env.emit(0x0900, [0x17, 0x00, ...dword(0x0800)]);
+            // the bytes past the limit would not end the loops either
+            env.emit(0x20FE0, new Array(0x60).fill(0));
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x0F, 0x01, 0x16, 0x00, 0x09, // LGDT [0900]
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x0C, 0x01, // OR AL, 1
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0xEA, 0x12, 0x10, 0x08, 0x00, // JMP 0008:1012
+                0xB8, 0x10, 0x00, // MOV AX, 0010
+                0x8E, 0xD8, // MOV DS, AX
+                0x8E, 0xC0, // MOV ES, AX
+                0xB0, 0xFF, // MOV AL, FF
+                0xF2, 0xAE, // REPNE SCASB
+                0xF3, 0xA6, // REPE CMPSB
+            ]);
+            for (let i = 0; i < 10; i++) {
+                expect(env.step()).toBeLessThan(0x10000);
+            }
+            expect(env.getReg('IP')).toBe(0x101B);
+
+            // the scan stops at the element past the limit
+            env.setReg('DI', 0x0FF0);
+            env.setReg('CX', 0x40);
+            expect(env.step()).toBe(0xD0000);
+            expect(env.getReg('IP')).toBe(0x101B);
+            expect(env.getReg('DI')).toBe(0x1000);
+            expect(env.getReg('CX')).toBe(0x30);
+
+            env.setReg('IP', 0x101D);
+            env.setReg('SI', 0x0FE0);
+            env.setReg('DI', 0x0FF0);
+            env.setReg('CX', 0x40);
+            expect(env.step()).toBe(0xD0000);
+            expect(env.getReg('IP')).toBe(0x101D);
+            expect(env.getReg('SI')).toBe(0x0FF0);
+            expect(env.getReg('DI')).toBe(0x1000);
+            expect(env.getReg('CX')).toBe(0x30);
+        });
+
+        it('Read-only pages in user mode', () => {
+            const dword = v => [v & 0xFF, (v >> 8) & 0xFF, (v >> 16) & 0xFF, v >>> 24];
+            // GDT: 08 code16 4G, 10 data32 4G, 18 user code16 4G, 20 user data32 4G
+            env.emit(0x0800, [
+                0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x9A, 0x8F, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0x92, 0xCF, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0xFA, 0x8F, 0x00,
+                0xFF, 0xFF, 0x00, 0x00, 0x00, 0xF2, 0xCF, 0x00,
+            ]);
+            env.emit(0x0900, [0x27, 0x00, ...dword(0x0800)]);
+            // identity map, 00020000 is read-only
+            env.emit(0x10000, dword(0x11007));
+            for (let i = 0; i < 0x20; i++) {
+                env.emit(0x11000 + i * 4, dword((i << 12) | 7));
+            }
+            env.emit(0x11080, dword(0x20005));
+            env.emit(0x20000, dword(0x12345678));
+            env.emitTest([0xEA, 0x00, 0x10, 0x00, 0x00]); // JMP 0000:1000
+            env.emit(0x1000, [
+                0x0F, 0x01, 0x16, 0x00, 0x09, // LGDT [0900]
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x0C, 0x01, // OR AL, 1
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0xEA, 0x12, 0x10, 0x08, 0x00, // JMP 0008:1012
+                0xB8, 0x10, 0x00, // MOV AX, 0010
+                0x8E, 0xD8, // MOV DS, AX
+                0x66, 0xB8, ...dword(0x10000), // MOV EAX, 00010000
+                0x0F, 0x22, 0xD8, // MOV CR3, EAX
+                0x0F, 0x20, 0xC0, // MOV EAX, CR0
+                0x66, 0x0D, ...dword(0x80000000), // OR EAX, 80000000
+                0x0F, 0x22, 0xC0, // MOV CR0, EAX
+                0x6A, 0x23, // PUSH 0023
+                0x68, 0x00, 0x80, // PUSH 8000
+                0x6A, 0x1B, // PUSH 001B
+                0x68, 0x37, 0x10, // PUSH 1037
+                0xCB, // RETF
+                0xB8, 0x23, 0x00, // MOV AX, 0023
+                0x8E, 0xD8, // MOV DS, AX
+                0x67, 0x66, 0x83, 0x3D, ...dword(0x20000), 0x00, // CMP DWORD [00020000], 0
+                0x67, 0x66, 0x0F, 0xB6, 0x05, ...dword(0x20000), // MOVZX EAX, BYTE [00020000]
+                0x67, 0x66, 0xFF, 0x35, ...dword(0x20000), // PUSH DWORD [00020000]
+                0x67, 0x66, 0xC7, 0x05, ...dword(0x20000), ...dword(1), // MOV DWORD [00020000], 1
+            ]);
+            for (let i = 0; i < 20; i++) {
+                expect(env.step()).toBe(0);
+            }
+            expect(env.getReg('CS')).toBe(0x001B);
+            expect(env.getReg('DS')).toBe(0x0023);
+
+            // reads of the page do not check a write access
+            expect(env.step()).toBe(0);
+            expect(env.step()).toBe(0);
+            expect(env.getReg('AX')).toBe(0x0078);
+            expect(env.step()).toBe(0);
+            expect(env.getReg('SP')).toBe(0x7FFC);
+            const stack = new Uint32Array(env.env.memory.buffer, env.vmem + 0x7FFC, 1);
+            expect(stack[0]).toBe(0x12345678);
+            const pte = new Uint32Array(env.env.memory.buffer, env.vmem + 0x11080, 1);
+            expect(pte[0] & 0x60).toBe(0x20);
+
+            env.saveState();
+            expect(env.step()).toBe(0xE0007);
+            expect(env.getReg('IP')).toBe(0x1056);
+            expect(env.changed()).toStrictEqual([]);
+        });
     });
 
 });